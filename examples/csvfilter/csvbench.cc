@@ -0,0 +1,362 @@
+// $Id$
+
+/*
+ * STX Expression Parser C++ Framework v0.7
+ * Copyright (C) 2007 Timo Bingmann
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/** \file csvbench.cc
+ * Benchmark program for the csvfilter workload: it loads a CSV file into
+ * memory and measures the time per row of evaluating a filter expression
+ * using the ParseTree, the compiled ParseProgram, the ParseProgram bound to
+ * the column slots and the ParseTree filtering blocks of rows column-wise.
+ */
+
+// CSV Filter Evaluation Benchmark
+
+#include "ExpressionParser.h"
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include <boost/scoped_array.hpp>
+
+// use this as the delimiter. this can be changed to ';' or ',' if needed
+const char delimiter = '\t';
+
+// number of data rows filtered together as one batch, the same as csvfilter
+const unsigned int batchsize = 1024;
+
+// read one line from instream and split it into tab (or otherwise) delimited
+// columns. returns the number of columns read, 0 if eof.
+unsigned int read_csvline(std::istream &instream,
+			  std::vector<std::string> &columns)
+{
+    columns.clear();
+
+    // read one line from the input stream
+    std::string line;
+    if (!std::getline(instream, line, '\n').good()) {
+	return 0;
+    }
+
+    // parse line into tab separated columns, start with inital column
+    columns.push_back("");
+
+    for (std::string::const_iterator si = line.begin();
+	 si != line.end(); ++si)
+    {
+	if (*si == delimiter)
+	    columns.push_back("");
+	else // add non-delimiter to last column
+	    columns.back() += *si;
+    }
+
+    return columns.size();
+}
+
+// subclass stx::BasicSymbolTable and return variable values from the current
+// csv row. the same as in csvfilter.cc, except that the row is exchanged via a
+// pointer.
+class CSVRowSymbolTable : public stx::BasicSymbolTable
+{
+public:
+    // maps the column variable name to the vector index
+    const std::map<std::string, unsigned int> &headersmap;
+
+    // pointer to the current data row vector.
+    const std::vector<std::string> *datacolumns;
+
+    CSVRowSymbolTable(const std::map<std::string, unsigned int> &_headersmap)
+	: stx::BasicSymbolTable(),
+	  headersmap(_headersmap),
+	  datacolumns(NULL)
+    {
+    }
+
+    virtual stx::AnyScalar lookupVariable(const std::string &varname) const
+    {
+	std::map<std::string, unsigned int>::const_iterator
+	    varfind = headersmap.find(varname);
+
+	if (varfind == headersmap.end()) {
+	    return stx::BasicSymbolTable::lookupVariable(varname);
+	}
+
+	if(varfind->second < datacolumns->size())
+	{
+	    return stx::AnyScalar().setAutoString( (*datacolumns)[varfind->second] );
+	}
+	else
+	{
+	    return "";
+	}
+    }
+};
+
+// return the current time in seconds
+static inline double timestamp()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// evaluate the expression over all rows repeatedly and return the number of
+// rows for which it evaluated to true.
+template <typename Evaluator>
+unsigned int run_rows(const Evaluator &eval, CSVRowSymbolTable &st,
+		      const std::vector< std::vector<std::string> > &rows,
+		      unsigned int repeats)
+{
+    unsigned int matches = 0;
+
+    for(unsigned int r = 0; r < repeats; ++r)
+    {
+	for(unsigned int i = 0; i < rows.size(); ++i)
+	{
+	    st.datacolumns = &rows[i];
+
+	    try {
+		stx::AnyScalar val = eval.evaluate(st);
+
+		if (val.isBooleanType() && val.getBoolean())
+		    matches++;
+	    }
+	    catch (stx::ExpressionParserException &e) {
+	    }
+	}
+    }
+
+    return matches;
+}
+
+// same as run_rows() but evaluate the program bound to the column indexes:
+// convert only the referenced columns into a slot array.
+unsigned int run_rows_bound(const stx::ParseProgram &pp, CSVRowSymbolTable &st,
+			    const std::vector< std::vector<std::string> > &rows,
+			    unsigned int repeats)
+{
+    const std::vector<unsigned int> &boundslots = pp.getBoundSlots();
+    std::vector<stx::AnyScalar> slots(boundslots.empty() ? 1 : boundslots.back() + 1);
+
+    unsigned int matches = 0;
+
+    for(unsigned int r = 0; r < repeats; ++r)
+    {
+	for(unsigned int i = 0; i < rows.size(); ++i)
+	{
+	    const std::vector<std::string> &row = rows[i];
+	    st.datacolumns = &row;
+
+	    for(unsigned int j = 0; j < boundslots.size(); ++j)
+	    {
+		unsigned int col = boundslots[j];
+
+		if (col < row.size())
+		    slots[col].setAutoString(row[col]);
+		else
+		    slots[col] = "";
+	    }
+
+	    try {
+		stx::AnyScalar val = pp.evaluate(&slots[0], st);
+
+		if (val.isBooleanType() && val.getBoolean())
+		    matches++;
+	    }
+	    catch (stx::ExpressionParserException &e) {
+	    }
+	}
+    }
+
+    return matches;
+}
+
+// same as run_rows_bound() but load the referenced columns of blocks of rows
+// into a stx::ColumnBatch and evaluate the parse tree as a filter. Blocks
+// which throw an exception are evaluated row by row.
+unsigned int run_batch(const stx::ParseTree &pt, const std::vector<unsigned int> &boundslots,
+		       const std::vector<std::string> &headers, CSVRowSymbolTable &st,
+		       const std::vector< std::vector<std::string> > &rows,
+		       unsigned int repeats)
+{
+    boost::scoped_array<stx::BatchColumn> batchcolumns(new stx::BatchColumn[boundslots.size()]);
+    std::vector<stx::AnyScalar> values;
+    std::vector<unsigned int> selection;
+
+    unsigned int matches = 0;
+
+    for(unsigned int r = 0; r < repeats; ++r)
+    {
+	for(unsigned int begin = 0; begin < rows.size(); begin += batchsize)
+	{
+	    unsigned int blockrows = std::min<unsigned int>(batchsize, rows.size() - begin);
+
+	    stx::ColumnBatch batch(blockrows);
+
+	    for(unsigned int j = 0; j < boundslots.size(); ++j)
+	    {
+		unsigned int col = boundslots[j];
+		values.resize(blockrows);
+
+		for(unsigned int i = 0; i < blockrows; ++i)
+		{
+		    const std::vector<std::string> &row = rows[begin + i];
+
+		    if (col < row.size())
+			values[i].setAutoString(row[col]);
+		    else
+			values[i] = "";
+		}
+
+		batchcolumns[j].setValues(values);
+		batch.addColumn(headers[col], batchcolumns[j]);
+	    }
+
+	    try {
+		pt.evaluateBatch(batch, selection, st);
+		matches += selection.size();
+		continue;
+	    }
+	    catch (stx::ExpressionParserException &e) {
+	    }
+
+	    for(unsigned int i = 0; i < blockrows; ++i)
+	    {
+		st.datacolumns = &rows[begin + i];
+
+		try {
+		    stx::AnyScalar val = pt.evaluate(st);
+
+		    if (val.isBooleanType() && val.getBoolean())
+			matches++;
+		}
+		catch (stx::ExpressionParserException &e) {
+		}
+	    }
+	}
+    }
+
+    return matches;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3) {
+	std::cerr << "Usage: " << argv[0] << " <csv-filename> <filter expression> [repeats]" << "\n";
+	return 0;
+    }
+
+    unsigned int repeats = (argc >= 4) ? atoi(argv[3]) : 10;
+    if (repeats == 0) repeats = 1;
+
+    stx::ParseTree pt;
+    try
+    {
+	pt = stx::parseExpression(argv[2]);
+	std::cerr << "Parsed expression: " << pt.toString() << "\n";
+    }
+    catch (stx::ExpressionParserException &e)
+    {
+	std::cerr << "ExpressionParserException: " << e.what() << "\n";
+	return 0;
+    }
+
+    stx::ParseProgram pp = pt.compile();
+    std::cerr << "Compiled program:\n" << pp.toString();
+
+    // load the CSV file into memory
+    std::ifstream csvfile(argv[1]);
+    if (!csvfile) {
+	std::cerr << "Error opening CSV file " << argv[1] << "\n";
+	return 0;
+    }
+
+    std::vector<std::string> headers;
+    if (read_csvline(csvfile, headers) == 0) {
+	std::cerr << "Error read column headers: no input\n";
+	return 0;
+    }
+
+    std::map<std::string, unsigned int> headersmap;
+    for(unsigned int headnum = 0; headnum < headers.size(); ++headnum)
+    {
+	headersmap[ headers[headnum] ] = headnum;
+    }
+
+    std::vector< std::vector<std::string> > rows;
+    std::vector<std::string> datacolumns;
+
+    while( read_csvline(csvfile, datacolumns) > 0 )
+    {
+	rows.push_back(datacolumns);
+    }
+
+    if (rows.empty()) {
+	std::cerr << "No data rows in CSV file\n";
+	return 0;
+    }
+
+    CSVRowSymbolTable csvsymboltable(headersmap);
+
+    stx::ParseProgram ppbound = pp;
+    try
+    {
+	ppbound.bindVariables(headersmap);
+	ppbound.bindFunctions(csvsymboltable);
+    }
+    catch (stx::ExpressionParserException &e)
+    {
+	std::cerr << "ExpressionParserException: " << e.what() << "\n";
+	return 0;
+    }
+
+    double ts1 = timestamp();
+    unsigned int mtree = run_rows(pt, csvsymboltable, rows, repeats);
+    double ts2 = timestamp();
+    unsigned int mprog = run_rows(pp, csvsymboltable, rows, repeats);
+    double ts3 = timestamp();
+    unsigned int mbound = run_rows_bound(ppbound, csvsymboltable, rows, repeats);
+    double ts4 = timestamp();
+    unsigned int mbatch = run_batch(pt, ppbound.getBoundSlots(), headers, csvsymboltable, rows, repeats);
+    double ts5 = timestamp();
+
+    double nrows = static_cast<double>(rows.size()) * repeats;
+    double nstree = (ts2 - ts1) / nrows * 1e9;
+    double nsprog = (ts3 - ts2) / nrows * 1e9;
+    double nsbound = (ts4 - ts3) / nrows * 1e9;
+    double nsbatch = (ts5 - ts4) / nrows * 1e9;
+
+    std::cout << "rows: " << rows.size() << " x " << repeats << " repeats\n"
+	      << "ParseTree:    " << nstree << " ns/row, " << mtree << " matches\n"
+	      << "ParseProgram: " << nsprog << " ns/row, " << mprog << " matches\n"
+	      << "bound:        " << nsbound << " ns/row, " << mbound << " matches\n"
+	      << "batch:        " << nsbatch << " ns/row, " << mbatch << " matches\n"
+	      << "speedup:      " << (nstree / nsprog) << " compiled, "
+	      << (nstree / nsbound) << " bound, "
+	      << (nstree / nsbatch) << " batch\n";
+
+    return (mtree == mprog && mtree == mbound && mtree == mbatch) ? 0 : 1;
+}
@@ -28,94 +28,357 @@
 // CSV Parser and Filter using the Expression Parser
  
 #include "ExpressionParser.h"
+#include "../csvreader.h"
 
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <vector>
 #include <map>
 
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <boost/scoped_array.hpp>
+
 // use this as the delimiter. this can be changed to ';' or ',' if needed
 const char delimiter = '\t';
 
-// read one line from instream and split it into tab (or otherwise) delimited
-// columns. returns the number of columns read, 0 if eof.
-unsigned int read_csvline(std::istream &instream,
-			  std::vector<std::string> &columns)
+// number of data rows which are read and filtered together as one batch
+const unsigned int batchsize = 1024;
+
+// size in bytes of the chunks of an input file filtered in parallel
+const size_t chunksize = 4 * 1024 * 1024;
+
+// number of chunks per thread which may be filtered ahead of the chunk
+// currently written, bounding the memory of the reorder buffer.
+const unsigned int chunkwindow = 4;
+
+// the filter state of one thread: a copy of the compiled program, the symbol
+// table over the current data row and the rows of one block.
+class RowFilter
 {
-    columns.clear();
+public:
+    // the parse tree used to filter blocks column-wise
+    const stx::ParseTree &pt;
 
-    // read one line from the input stream
-    std::string line;
-    if (!std::getline(instream, line, '\n').good()) {
-	return 0;
+    // column headers, the names of the batch columns
+    const std::vector<std::string> &headers;
+
+    // the thread's copy of the bound program
+    stx::ParseProgram pp;
+
+    CSVRowSymbolTable csvsymboltable;
+
+    // number of leading fields of a row referenced by the expression
+    unsigned int maxfields;
+
+    // the columns of a block referenced by the expression
+    boost::scoped_array<stx::BatchColumn> batchcolumns;
+    std::vector<stx::AnyScalar> batchvalues;
+    std::vector<unsigned int> selection;
+
+    // the data rows of the current block, referencing the reader's input
+    std::vector<CSVRow> block;
+
+    // false once the expression returned a non-boolean value, or if the
+    // program is adaptive and collects statistics of its operands
+    bool usebatch;
+
+    RowFilter(const stx::ParseTree &_pt, const stx::ParseProgram &_pp,
+	      const std::vector<std::string> &_headers,
+	      const std::map<std::string, unsigned int> &headersmap)
+	: pt(_pt), headers(_headers), pp(_pp),
+	  csvsymboltable(headersmap),
+	  maxfields(csvsymboltable.getNeededFields(_pt.getVariables())),
+	  batchcolumns(new stx::BatchColumn[_pp.getBoundSlots().size()]),
+	  block(batchsize), usebatch(!_pp.isAdaptive())
+    {
     }
 
-    // parse line into tab separated columns, start with inital column
-    columns.push_back("");
+    // read the next block of data rows from the reader, returns the number of
+    // rows read. Only the fields referenced by the expression are split, the
+    // selected rows are written as the original lines.
+    unsigned int readBlock(CSVReader &reader)
+    {
+	reader.setMaxFields(maxfields);
+	return reader.readRows(block, batchsize);
+    }
 
-    for (std::string::const_iterator si = line.begin();
-	 si != line.end(); ++si)
+    // write the original line of a data row to outstream
+    static void writeRow(std::ostream &outstream, const CSVRow &row)
     {
-	if (*si == delimiter)
-	    columns.push_back("");
-	else // add non-delimiter to last column
-	    columns.back() += *si;
+	outstream.write(row.line, row.linesize);
+	outstream.put('\n');
     }
 
-    return columns.size();
-}
+    // filter the first blockrows rows of the block: the selected rows are
+    // written to outstream and the evaluation messages to errstream. returns
+    // the number of rows skipped.
+    unsigned int filterBlock(unsigned int blockrows,
+			     std::ostream &outstream, std::ostream &errstream)
+    {
+	// the data rows are read in blocks and the columns referenced by the
+	// expression are loaded into a stx::ColumnBatch. A boolean expression
+	// is evaluated as a filter for the whole block, which yields the
+	// selected rows. Only if this fails, because the expression is not
+	// boolean or a row throws an exception, the block is evaluated row by
+	// row. An adaptive program always evaluates row by row, since only it
+	// reorders the operands by their statistics.
+	const std::vector<unsigned int> &boundslots = pp.getBoundSlots();
+
+	if (usebatch)
+	{
+	    stx::ColumnBatch batch(blockrows);
+
+	    for(unsigned int j = 0; j < boundslots.size(); ++j)
+	    {
+		unsigned int col = boundslots[j];
+
+		batchvalues.resize(blockrows);
+
+		for(unsigned int r = 0; r < blockrows; ++r)
+		{
+		    const std::vector<CSVField> &fields = block[r].fields;
+
+		    if (col < fields.size())
+			batchvalues[r].setAutoStringRef( fields[col].data, fields[col].size );
+		    else
+			batchvalues[r] = "";
+		}
+
+		// values of the same type are packed into a typed column.
+		batchcolumns[j].setValues(batchvalues);
+		batch.addColumn(headers[col], batchcolumns[j]);
+	    }
+
+	    try
+	    {
+		pt.evaluateBatch(batch, selection, csvsymboltable);
+
+		// output the selected data rows
+		for(unsigned int i = 0; i < selection.size(); ++i)
+		    writeRow(outstream, block[ selection[i] ]);
+
+		return blockrows - selection.size();
+	    }
+	    catch (stx::ExpressionParserException &)
+	    {
+	    }
+	}
+
+	unsigned int linesskipped = 0;
+
+	for(unsigned int r = 0; r < blockrows; ++r)
+	{
+	    csvsymboltable.setRow(block[r].fields);
+
+	    // evaluate the expression for each row using the
+	    // headers/data fields as variables
+	    try
+	    {
+		stx::AnyScalar val = pp.evaluate( csvsymboltable.fillSlots(boundslots),
+						  csvsymboltable );
+
+		if (val.isBooleanType())
+		{
+		    if (!val.getBoolean()) {
+			linesskipped++;
+			continue;
+		    }
+		}
+		else {
+		    errstream << "evaluated: " << val << "\n";
+
+		    // expressions which are not boolean are not filtered
+		    // column-wise.
+		    usebatch = false;
+		}
+
+		// output this data row
+		writeRow(outstream, block[r]);
+	    }
+	    catch (stx::UnknownSymbolException &e)
+	    {
+		errstream << "evaluated: UnknownSymbolException: " << e.what() << "\n";
+	    }
+	    catch (stx::ExpressionParserException &e)
+	    {
+		errstream << "evaluated: ExpressionParserException: " << e.what() << "\n";
+	    }
+	}
+
+	return linesskipped;
+    }
+};
 
-// subclass stx::BasicSymbolTable and return variable values from the current
-// csv row. the variable names are defined by the map containing the column
-// header.
-class CSVRowSymbolTable : public stx::BasicSymbolTable
+// the filtered output of one chunk of the input file, kept in the reorder
+// buffer until all previous chunks are written.
+struct ChunkResult
 {
-public:
-    // maps the column variable name to the vector index
-    const std::map<std::string, unsigned int> &headersmap;
+    std::string		output;
+    std::string		messages;
+    unsigned int	linesprocessed;
+    unsigned int	linesskipped;
+};
+
+// the state shared by the threads filtering the chunks of an input file. The
+// chunks are handed out in order, but a thread may only start a chunk if it
+// is within the window of chunks following the next one to be written.
+struct ChunkQueue
+{
+    // chunk i contains the complete lines in [bounds[i], bounds[i+1]) of the
+    // memory-mapped input file
+    std::vector<const char*> bounds;
+
+    // the filter whose program and headers are used by each thread
+    const RowFilter	*prototype;
+
+    // maximum number of chunks filtered ahead of the written chunk
+    unsigned int	window;
+
+    pthread_mutex_t	mutex;
+    pthread_cond_t	cond;
 
-    // refernce to the reused data row vector.
-    const std::vector<std::string> &datacolumns;
+    // the next chunk to filter and the number of chunks written, protected
+    // by the mutex.
+    unsigned int	nextchunk;
+    unsigned int	written;
 
-    CSVRowSymbolTable(const std::map<std::string, unsigned int> &_headersmap,
-		      const std::vector<std::string> &_datacolumns)
-	: stx::BasicSymbolTable(),
-	  headersmap(_headersmap),
-	  datacolumns(_datacolumns)
+    // the reorder buffer of finished chunks, protected by the mutex.
+    std::map<unsigned int, ChunkResult> finished;
+
+    // the threads' programs, for the adaptive statistics
+    std::vector<stx::ParseProgram> programs;
+
+    inline unsigned int chunks() const
     {
+	return bounds.size() - 1;
     }
+};
+
+// thread function filtering chunks of the input file until all are done.
+void* filter_chunks(void *arg)
+{
+    ChunkQueue &queue = *static_cast<ChunkQueue*>(arg);
 
-    virtual stx::AnyScalar lookupVariable(const std::string &varname) const
+    const RowFilter &prototype = *queue.prototype;
+    RowFilter filter(prototype.pt, prototype.pp, prototype.headers,
+		     prototype.csvsymboltable.headersmap);
+    CSVReader reader(delimiter);
+
+    while(1)
     {
-	// look if the variable name is defined by the CSV file
-	std::map<std::string, unsigned int>::const_iterator
-	    varfind = headersmap.find(varname);
+	pthread_mutex_lock(&queue.mutex);
 
-	if (varfind == headersmap.end()) {
-	    // if not, let BasicSymbolTable check if it knows it
-	    return stx::BasicSymbolTable::lookupVariable(varname);
-	}
+	while (queue.nextchunk < queue.chunks() &&
+	       queue.nextchunk >= queue.written + queue.window)
+	    pthread_cond_wait(&queue.cond, &queue.mutex);
 
-	// return the variable value from the current vector. convert it to a
-	// stx::AnyScalar but use the automatic type recognition for input
-	// strings.
-	if(varfind->second < datacolumns.size())
-	{
-	    return stx::AnyScalar().setAutoString( datacolumns[varfind->second] );
+	if (queue.nextchunk >= queue.chunks()) {
+	    pthread_mutex_unlock(&queue.mutex);
+	    break;
 	}
-	else
+
+	unsigned int chunk = queue.nextchunk++;
+	pthread_mutex_unlock(&queue.mutex);
+
+	// read the lines of the chunk and filter them block by block
+	reader.openRange(queue.bounds[chunk], queue.bounds[chunk+1]);
+
+	std::ostringstream outstream, errstream;
+
+	ChunkResult result;
+	result.linesprocessed = result.linesskipped = 0;
+
+	while(1)
 	{
-	    return "";	// happens when a data row has too few delimited
-			// fields.
+	    unsigned int blockrows = filter.readBlock(reader);
+	    if (blockrows == 0) break;
+
+	    result.linesprocessed += blockrows;
+	    result.linesskipped += filter.filterBlock(blockrows, outstream, errstream);
 	}
+
+	result.output = outstream.str();
+	result.messages = errstream.str();
+
+	pthread_mutex_lock(&queue.mutex);
+	ChunkResult &slot = queue.finished[chunk];
+	slot.output.swap(result.output);
+	slot.messages.swap(result.messages);
+	slot.linesprocessed = result.linesprocessed;
+	slot.linesskipped = result.linesskipped;
+	pthread_cond_broadcast(&queue.cond);
+	pthread_mutex_unlock(&queue.mutex);
     }
-};
+
+    pthread_mutex_lock(&queue.mutex);
+    queue.programs.push_back(filter.pp);
+    pthread_mutex_unlock(&queue.mutex);
+
+    return NULL;
+}
+
+// write the statistics of the adaptively evaluated operands to stderr
+void write_chainstats(const std::vector<stx::ParseProgram::OperandStats> &stats)
+{
+    for(unsigned int i = 0; i < stats.size(); ++i)
+    {
+	std::cerr << "Operand " << stats[i].expression << ": "
+		  << "position " << stats[i].position << ", "
+		  << "evaluated " << stats[i].evaluations << ", "
+		  << "decided " << stats[i].decisions << ", "
+		  << "cost " << stats[i].cost << " ns" << "\n";
+    }
+}
 
 int main(int argc, char *argv[])
 {
+    // parse options: [-f file] [-j threads]. a file input can be split into
+    // chunks which are filtered by multiple threads. [-a] evaluates a chain
+    // of AND/OR operands in an adaptive order.
+    const char *filename = NULL;
+    unsigned int threads = 1;
+    bool adaptive = false;
+
+    int argi = 1;
+    while (argi + 1 < argc)
+    {
+	if (std::string(argv[argi]) == "-a") {
+	    adaptive = true;
+	    argi += 1;
+	    continue;
+	}
+	else if (std::string(argv[argi]) == "-f")
+	    filename = argv[argi + 1];
+	else if (std::string(argv[argi]) == "-j")
+	{
+	    char *endptr;
+	    long num = strtol(argv[argi + 1], &endptr, 10);
+
+	    if (*argv[argi + 1] == 0 || *endptr != 0 || num < 0) {
+		std::cerr << "Usage: " << argv[0] << " [-a] [-f file] [-j threads] <filter expression>" << "\n";
+		return 0;
+	    }
+
+	    threads = static_cast<unsigned int>(num);
+	}
+	else
+	    break;
+
+	argi += 2;
+    }
+
+    if (threads == 0) {
+	long nprocs = sysconf(_SC_NPROCESSORS_ONLN);
+	threads = (nprocs > 0) ? static_cast<unsigned int>(nprocs) : 1;
+    }
+
     // collect expression by joining all remaining input arguments
     std::string args;
-    for(int i = 1; i < argc; i++) {
+    for(int i = argi; i < argc; i++) {
 	if (!args.empty()) args += " ";
 	args += argv[i];
     }
@@ -135,15 +398,36 @@ int main(int argc, char *argv[])
 	return 0;
     }
 
+    // compile the parse tree into a flat program for faster evaluation
+    stx::ParseProgram pp = pt.compile();
+
+    // map the input file into memory or read stdin
+    CSVReader reader(delimiter);
+    if (filename)
+    {
+	if (!reader.openFile(filename)) {
+	    std::cerr << "Error opening input file " << filename << "\n";
+	    return 0;
+	}
+    }
+    else
+    {
+	reader.openStream(0);
+    }
+
     // read first line of CSV input as column headers
     std::cerr << "Reading CSV column headers from input\n";
     std::vector<std::string> headers;
 
-    if (read_csvline(std::cin, headers) == 0) {
+    CSVRow headerrow;
+    if (!reader.readRow(headerrow)) {
 	std::cerr << "Error read column headers: no input\n";
 	return 0;
     }
 
+    for(unsigned int i = 0; i < headerrow.fields.size(); ++i)
+	headers.push_back( headerrow.fields[i].str() );
+
     std::cerr << "Read " << headers.size() << " column headers.\n";
 
     // create a header column lookup map for CSVRowSymbolTable and output the
@@ -158,51 +442,171 @@ int main(int argc, char *argv[])
     }
     std::cout << "\n";
 
-    // iterate over the data lines of the CSV input
+    // counters of the data lines of the CSV input
     unsigned int linesprocessed = 0, linesskipped = 0;
-    std::vector<std::string> datacolumns;
-    CSVRowSymbolTable csvsymboltable(headersmap, datacolumns);
 
-    while( read_csvline(std::cin, datacolumns) > 0 )
+    // the symbol table used to resolve the function calls
+    CSVRowSymbolTable csvsymboltable(headersmap);
+
+    // bind the column variables of the program to their column index and
+    // resolve the function calls.
+    try
     {
-        // evaluate the expression for each row using the headers/datacolumns
-        // as variables
-	try
-	{
-	    linesprocessed++;
-	    stx::AnyScalar val = pt.evaluate( csvsymboltable );
+	pp.bindVariables(headersmap);
+	pp.bindFunctions(csvsymboltable);
+    }
+    catch (stx::ExpressionParserException &e)
+    {
+	std::cerr << "ExpressionParserException: " << e.what() << "\n";
+	return 0;
+    }
 
-	    if (val.isBooleanType())
-	    {
-		if (!val.getBoolean()) {
-		    linesskipped++;
-		    continue;
-		}
-	    }
-	    else {
-		std::cerr << "evaluated: " << val << "\n";
-	    }
+    // with -a evaluate a chain of AND/OR operands row by row in an adaptive
+    // order instead of column-wise: the operands which filter most rows
+    // cheaply are moved to the front. This
+    // changes which rows throw exceptions, so by default the operands are
+    // evaluated from left to right as written.
+    if (adaptive)
+	pp.setAdaptive();
 
-	    // output this data row to std::cout
-	    for(std::vector<std::string>::const_iterator
-		    coliter = datacolumns.begin();
-		coliter != datacolumns.end(); ++coliter)
-	    {
-		if (coliter != datacolumns.begin()) std::cout << delimiter;
-		std::cout << *coliter;
-	    }
-	    std::cout << "\n";
-	}
-	catch (stx::UnknownSymbolException &e)
+    RowFilter filter(pt, pp, headers, headersmap);
+
+    if (!reader.isMapped() || threads <= 1)
+    {
+	// filter the input block by block on this thread
+	while(1)
 	{
-	    std::cerr << "evaluated: UnknownSymbolException: " << e.what() << "\n";
+	    unsigned int blockrows = filter.readBlock(reader);
+	    if (blockrows == 0) break;
+
+	    linesprocessed += blockrows;
+	    linesskipped += filter.filterBlock(blockrows, std::cout, std::cerr);
 	}
-	catch (stx::ExpressionParserException &e)
-	{
-	    std::cerr << "evaluated: ExpressionParserException: " << e.what() << "\n";
+
+	std::cerr << "Processed " << linesprocessed << " lines, "
+		  << "copied " << (linesprocessed - linesskipped) << " and "
+		  << "skipped " << linesskipped << " lines" << "\n";
+
+	// write statistics of the adaptively evaluated operands to stderr
+	if (filter.pp.isAdaptive())
+	    write_chainstats(filter.pp.getChainStats());
+
+	return 0;
+    }
+
+    // split the data rows of the file into chunks, each ending after the
+    // first newline following its nominal size.
+    ChunkQueue queue;
+    queue.prototype = &filter;
+    queue.window = chunkwindow * threads;
+    queue.nextchunk = queue.written = 0;
+
+    const char *fileend = reader.getEnd();
+
+    queue.bounds.push_back(reader.getPos());
+
+    while (static_cast<size_t>(fileend - queue.bounds.back()) > chunksize)
+    {
+	const char *newline = static_cast<const char*>(memchr(queue.bounds.back() + chunksize, '\n',
+							       fileend - queue.bounds.back() - chunksize));
+
+	if (!newline || newline + 1 >= fileend) break;
+
+	queue.bounds.push_back(newline + 1);
+    }
+
+    queue.bounds.push_back(fileend);
+
+    pthread_mutex_init(&queue.mutex, NULL);
+    pthread_cond_init(&queue.cond, NULL);
+
+    // if not all threads can be created, fewer threads filter the chunks.
+    std::vector<pthread_t> threadids;
+    for(unsigned int t = 0; t < threads; ++t)
+    {
+	pthread_t thread;
+
+	if (pthread_create(&thread, NULL, filter_chunks, &queue) != 0) {
+	    std::cerr << "Error creating filter thread " << t << ".\n";
+	    break;
 	}
+
+	threadids.push_back(thread);
+    }
+
+    if (threadids.empty()) {
+	pthread_cond_destroy(&queue.cond);
+	pthread_mutex_destroy(&queue.mutex);
+	return 0;
     }
+
+    // write the chunks' output in the original order as they are finished
+    pthread_mutex_lock(&queue.mutex);
+
+    while (queue.written < queue.chunks())
+    {
+	std::map<unsigned int, ChunkResult>::iterator fi = queue.finished.find(queue.written);
+
+	if (fi == queue.finished.end()) {
+	    pthread_cond_wait(&queue.cond, &queue.mutex);
+	    continue;
+	}
+
+	ChunkResult result;
+	result.output.swap(fi->second.output);
+	result.messages.swap(fi->second.messages);
+	result.linesprocessed = fi->second.linesprocessed;
+	result.linesskipped = fi->second.linesskipped;
+	queue.finished.erase(fi);
+
+	pthread_mutex_unlock(&queue.mutex);
+
+	std::cout.write(result.output.data(), result.output.size());
+	std::cerr.write(result.messages.data(), result.messages.size());
+
+	linesprocessed += result.linesprocessed;
+	linesskipped += result.linesskipped;
+
+	pthread_mutex_lock(&queue.mutex);
+	queue.written++;
+	pthread_cond_broadcast(&queue.cond);
+    }
+
+    pthread_mutex_unlock(&queue.mutex);
+
+    for(unsigned int t = 0; t < threadids.size(); ++t)
+	pthread_join(threadids[t], NULL);
+
+    pthread_cond_destroy(&queue.cond);
+    pthread_mutex_destroy(&queue.mutex);
+
     std::cerr << "Processed " << linesprocessed << " lines, "
 	      << "copied " << (linesprocessed - linesskipped) << " and "
 	      << "skipped " << linesskipped << " lines" << "\n";
+
+    // write the statistics of the adaptively evaluated operands summed over
+    // all threads to stderr
+    if (filter.pp.isAdaptive() && !queue.programs.empty())
+    {
+	std::vector<stx::ParseProgram::OperandStats> stats = queue.programs[0].getChainStats();
+
+	for(unsigned int t = 1; t < queue.programs.size(); ++t)
+	{
+	    std::vector<stx::ParseProgram::OperandStats> tstats = queue.programs[t].getChainStats();
+
+	    for(unsigned int i = 0; i < stats.size(); ++i)
+	    {
+		unsigned long long evaluations = stats[i].evaluations + tstats[i].evaluations;
+
+		if (evaluations != 0)
+		    stats[i].cost = (stats[i].cost * stats[i].evaluations
+				     + tstats[i].cost * tstats[i].evaluations) / evaluations;
+
+		stats[i].evaluations = evaluations;
+		stats[i].decisions += tstats[i].decisions;
+	    }
+	}
+
+	write_chainstats(stats);
+    }
 }
@@ -0,0 +1,506 @@
+// $Id$
+
+/*
+ * STX Expression Parser C++ Framework v0.7
+ * Copyright (C) 2007 Timo Bingmann
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/** \file csvreader.h
+ * Zero-copy reader of tab (or otherwise) delimited CSV input and the symbol
+ * table over its rows shared by the csvfilter and csvtool example
+ * applications.
+ */
+
+#ifndef _STX_CSVREADER_H_
+#define _STX_CSVREADER_H_
+
+#include "ExpressionParser.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// one field of a row: a view of the characters in the reader's memory.
+struct CSVField
+{
+    const char		*data;
+    unsigned int	size;
+
+    // copy the field's characters
+    inline std::string str() const
+    {
+	return std::string(data, size);
+    }
+};
+
+// one row: the complete line without the newline and its fields.
+struct CSVRow
+{
+    const char		*line;
+    unsigned int	linesize;
+
+    std::vector<CSVField> fields;
+};
+
+// reads rows of tab (or otherwise) delimited CSV input without copying
+// them. A regular file is mapped into memory and the rows are views of the
+// mapping, which stay valid until the reader is destroyed. Other input, like
+// stdin, is read into a large buffer: the rows returned by readRows() stay
+// valid until the next call. Newlines and delimiters are found using memchr(),
+// which scans word- or vector-wise. Rows can be split only up to the last
+// field needed by the application. Like the former getline()-based reader, a
+// last line not terminated by a newline is ignored.
+class CSVReader
+{
+private:
+    // the delimiter of the fields
+    char		delimiter;
+
+    // maximum number of fields split from each row
+    unsigned int	maxfields;
+
+    // the mapped file, if any
+    void		*mapping;
+    size_t		mapsize;
+
+    // file descriptor read into the buffer, or -1 if mapped or a range
+    int			fd;
+
+    // read buffer and the end of the data read into it
+    std::vector<char>	buffer;
+    size_t		bufferfill;
+
+    // the unread data
+    const char		*pos, *end;
+
+    // the offsets of the lines to read from the mapped file, if selected, and
+    // the next one of them
+    const std::vector<size_t> *selection;
+    size_t		selectpos;
+
+    // size of the read buffer
+    static const size_t	buffersize = 4 * 1024 * 1024;
+
+    // disabled copy constructor
+    CSVReader(const CSVReader &r);
+
+    // disabled assignment operator
+    CSVReader& operator=(const CSVReader &r);
+
+    // move the unread data to the front of the buffer and read more. the
+    // buffer is enlarged if it is full with a single line. returns false if
+    // nothing more could be read.
+    bool fillBuffer()
+    {
+	if (fd < 0) return false;
+
+	size_t unread = end - pos;
+	memmove(&buffer[0], pos, unread);
+
+	if (unread == buffer.size())
+	    buffer.resize(buffer.size() * 2);
+
+	bufferfill = unread;
+
+	ssize_t rb;
+	do {
+	    rb = read(fd, &buffer[bufferfill], buffer.size() - bufferfill);
+	} while (rb < 0 && errno == EINTR);
+
+	if (rb > 0) bufferfill += rb;
+
+	pos = &buffer[0];
+	end = pos + bufferfill;
+
+	return (rb > 0);
+    }
+
+public:
+    explicit CSVReader(char _delimiter)
+	: delimiter(_delimiter), maxfields(UINT_MAX), mapping(NULL), mapsize(0),
+	  fd(-1), bufferfill(0), pos(NULL), end(NULL), selection(NULL), selectpos(0)
+    {
+    }
+
+    ~CSVReader()
+    {
+	close();
+    }
+
+    // release the mapping or buffer.
+    void close()
+    {
+	if (mapping) munmap(mapping, mapsize);
+	mapping = NULL;
+	mapsize = 0;
+
+	if (fd > 0) ::close(fd);
+	fd = -1;
+
+	std::vector<char>().swap(buffer);
+	pos = end = NULL;
+
+	selection = NULL;
+	selectpos = 0;
+    }
+
+    // open the file and map it into memory. Files which cannot be mapped are
+    // read using the buffer. returns false if the file cannot be opened.
+    bool openFile(const char *filename)
+    {
+	close();
+
+	int filefd = open(filename, O_RDONLY);
+	if (filefd < 0) return false;
+
+	struct stat st;
+	if (fstat(filefd, &st) == 0 && S_ISREG(st.st_mode))
+	{
+	    if (st.st_size == 0) {
+		::close(filefd);
+		return true;
+	    }
+
+	    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, filefd, 0);
+
+	    if (map != MAP_FAILED)
+	    {
+		::close(filefd);
+
+		madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+		mapping = map;
+		mapsize = st.st_size;
+		pos = static_cast<const char*>(map);
+		end = pos + mapsize;
+		return true;
+	    }
+	}
+
+	openStream(filefd);
+	return true;
+    }
+
+    // read the already opened file descriptor, e.g. stdin, using the buffer.
+    // the descriptor is closed by the reader unless it is stdin.
+    void openStream(int _fd)
+    {
+	close();
+
+	fd = _fd;
+	buffer.resize(buffersize);
+	bufferfill = 0;
+	pos = end = &buffer[0];
+    }
+
+    // read the rows of a memory range, e.g. a chunk of another reader's
+    // mapping. the memory must stay valid while reading.
+    void openRange(const char *begin, const char *_end)
+    {
+	close();
+
+	pos = begin;
+	end = _end;
+    }
+
+    // read only the lines of the mapped file starting at the given offsets,
+    // which must be increasing, instead of all following lines. The vector
+    // must stay valid while reading.
+    void selectLines(const std::vector<size_t> &offsets)
+    {
+	selection = &offsets;
+	selectpos = 0;
+    }
+
+    // returns true if only selected lines are read.
+    inline bool isSelecting() const
+    {
+	return (selection != NULL);
+    }
+
+    // split only the first _maxfields fields of the following rows. the rest of
+    // each line is not scanned for delimiters.
+    inline void setMaxFields(unsigned int _maxfields)
+    {
+	maxfields = _maxfields;
+    }
+
+    // return the maximum number of fields split from each row.
+    inline unsigned int getMaxFields() const
+    {
+	return maxfields;
+    }
+
+    // split the characters in [line,lineend) into at most _maxfields fields.
+    void splitFields(const char *line, const char *lineend,
+		     std::vector<CSVField> &fields, unsigned int _maxfields = UINT_MAX) const
+    {
+	fields.clear();
+
+	while (fields.size() < _maxfields)
+	{
+	    const char *delim = static_cast<const char*>(memchr(line, delimiter, lineend - line));
+
+	    CSVField field;
+	    field.data = line;
+	    field.size = (delim ? delim : lineend) - line;
+	    fields.push_back(field);
+
+	    if (!delim) break;
+	    line = delim + 1;
+	}
+    }
+
+    // returns true if the whole input is mapped into memory.
+    inline bool isMapped() const
+    {
+	return (mapping != NULL);
+    }
+
+    // return the start of a mapped file.
+    inline const char* getBegin() const
+    {
+	return static_cast<const char*>(mapping);
+    }
+
+    // return the unread data of a mapped file.
+    inline const char* getPos() const
+    {
+	return pos;
+    }
+
+    // return the end of the data of a mapped file.
+    inline const char* getEnd() const
+    {
+	return end;
+    }
+
+    // read up to maxrows rows into the front of the rows vector, which is
+    // enlarged to hold maxrows rows. The rows' field vectors are reused.
+    // returns the number of rows read, 0 at the end of the input. fewer than
+    // maxrows rows are returned only at the end of the input or of the
+    // buffer.
+    unsigned int readRows(std::vector<CSVRow> &rows, unsigned int maxrows)
+    {
+	if (rows.size() < maxrows) rows.resize(maxrows);
+
+	if (selection) return readSelectedRows(rows, maxrows);
+
+	const char *lineend = NULL;
+
+	// refill the buffer while it holds no complete line
+	if (pos != end)
+	    lineend = static_cast<const char*>(memchr(pos, '\n', end - pos));
+
+	while (!lineend && fillBuffer())
+	    lineend = static_cast<const char*>(memchr(pos, '\n', end - pos));
+
+	unsigned int rownum = 0;
+
+	while (lineend)
+	{
+	    CSVRow &row = rows[rownum++];
+	    row.line = pos;
+	    row.linesize = lineend - pos;
+	    splitFields(pos, lineend, row.fields, maxfields);
+
+	    pos = lineend + 1;
+
+	    if (rownum >= maxrows || pos == end) break;
+
+	    lineend = static_cast<const char*>(memchr(pos, '\n', end - pos));
+	}
+
+	return rownum;
+    }
+
+    // read up to maxrows of the selected lines of the mapped file.
+    unsigned int readSelectedRows(std::vector<CSVRow> &rows, unsigned int maxrows)
+    {
+	const char *base = static_cast<const char*>(mapping);
+	unsigned int rownum = 0;
+
+	while (rownum < maxrows && selectpos < selection->size())
+	{
+	    size_t offset = (*selection)[selectpos];
+	    if (!base || offset >= mapsize) break;
+
+	    const char *line = base + offset;
+	    const char *lineend = static_cast<const char*>(memchr(line, '\n', end - line));
+	    if (!lineend) break;
+
+	    CSVRow &row = rows[rownum++];
+	    row.line = line;
+	    row.linesize = lineend - line;
+	    splitFields(line, lineend, row.fields, maxfields);
+
+	    pos = lineend + 1;
+	    selectpos++;
+	}
+
+	return rownum;
+    }
+
+    // read the next row. the row is only valid until the next call in
+    // buffered mode. returns false at the end of the input.
+    bool readRow(CSVRow &row)
+    {
+	std::vector<CSVRow> rows(1);
+	if (readRows(rows, 1) == 0) return false;
+
+	std::swap(row, rows[0]);
+	return true;
+    }
+};
+
+// subclass stx::BasicSymbolTable and return variable values from the current
+// csv row. the variable names are defined by the map containing the column
+// header. The fields of a row are converted lazily: only when a column is
+// first referenced, which then costs nothing for further references.
+class CSVRowSymbolTable : public stx::BasicSymbolTable
+{
+public:
+    // maps the column variable name to the vector index
+    const std::map<std::string, unsigned int> &headersmap;
+
+private:
+    // the fields of the current data row
+    const std::vector<CSVField> *datafields;
+
+    // number of the current row, incremented by setRow()
+    unsigned int	rownum;
+
+    // converted values of the current row indexed by column, which also
+    // serve as the slot array of a bound stx::ParseProgram.
+    mutable std::vector<stx::AnyScalar> slots;
+
+    // the row number for which each slot was converted
+    mutable std::vector<unsigned int> slotrow;
+
+public:
+    CSVRowSymbolTable(const std::map<std::string, unsigned int> &_headersmap)
+	: stx::BasicSymbolTable(),
+	  headersmap(_headersmap),
+	  datafields(NULL), rownum(1)
+    {
+	unsigned int columns = 0;
+
+	for(std::map<std::string, unsigned int>::const_iterator hi = headersmap.begin();
+	    hi != headersmap.end(); ++hi)
+	{
+	    columns = std::max(columns, hi->second + 1);
+	}
+
+	slots.resize(columns);
+	slotrow.resize(columns, 0);
+    }
+
+    // set the fields of the current data row. the converted values of the
+    // previous row are invalidated.
+    inline void setRow(const std::vector<CSVField> &fields)
+    {
+	datafields = &fields;
+
+	if (++rownum == 0) {
+	    // reset the row numbers of the slots on wrap-around
+	    std::fill(slotrow.begin(), slotrow.end(), 0);
+	    rownum = 1;
+	}
+    }
+
+    // return the number of leading fields of a row needed to look up all
+    // variables in varset, e.g. those referenced by an expression.
+    unsigned int getNeededFields(const std::set<std::string> &varset) const
+    {
+	unsigned int needed = 0;
+
+	for(std::set<std::string>::const_iterator vi = varset.begin();
+	    vi != varset.end(); ++vi)
+	{
+	    std::map<std::string, unsigned int>::const_iterator
+		varfind = headersmap.find(*vi);
+
+	    if (varfind != headersmap.end())
+		needed = std::max(needed, varfind->second + 1);
+	}
+
+	return needed;
+    }
+
+    // return the value of a column of the current row. convert it to a
+    // stx::AnyScalar using the automatic type recognition for input strings
+    // when first referenced. string values reference the input without
+    // copying it.
+    const stx::AnyScalar& getColumn(unsigned int col) const
+    {
+	if (slotrow[col] != rownum)
+	{
+	    if (datafields && col < datafields->size())
+		slots[col].setAutoStringRef( (*datafields)[col].data, (*datafields)[col].size );
+	    else
+		slots[col] = "";	// happens when a data row has too few
+					// delimited fields.
+
+	    slotrow[col] = rownum;
+	}
+
+	return slots[col];
+    }
+
+    virtual stx::AnyScalar lookupVariable(const std::string &varname) const
+    {
+	// look if the variable name is defined by the CSV file
+	std::map<std::string, unsigned int>::const_iterator
+	    varfind = headersmap.find(varname);
+
+	if (varfind == headersmap.end()) {
+	    // if not, let BasicSymbolTable check if it knows it
+	    return stx::BasicSymbolTable::lookupVariable(varname);
+	}
+
+	// return the variable value from the current row.
+	return getColumn(varfind->second);
+    }
+
+    // convert the columns used by a bound stx::ParseProgram and return the
+    // slot array for evaluation. only the columns actually referenced by the
+    // expression are converted.
+    const stx::AnyScalar* fillSlots(const std::vector<unsigned int> &boundslots)
+    {
+	if (boundslots.empty()) return NULL;
+
+	for(std::vector<unsigned int>::const_iterator si = boundslots.begin();
+	    si != boundslots.end(); ++si)
+	{
+	    getColumn(*si);
+	}
+
+	return &slots[0];
+    }
+};
+
+#endif // _STX_CSVREADER_H_
@@ -0,0 +1,129 @@
+// $Id$
+
+/*
+ * STX Expression Parser C++ Framework v0.7
+ * Copyright (C) 2007 Timo Bingmann
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/** \file bloomfilter.h
+ * Bloom filter over strings used by the hash join and the index files of the
+ * csvtool example.
+ */
+
+#ifndef _STX_CSVTOOL_BLOOMFILTER_H_
+#define _STX_CSVTOOL_BLOOMFILTER_H_
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+// a bloom filter over strings: a bit array in which a few bits determined by
+// the string's hash value are set for each inserted string. A string whose
+// bits are not all set was certainly not inserted, so most lookups of
+// strings not inserted are answered by testing a few bits of an array much
+// smaller than a hash table. With ten bits per string and four bits set, one
+// in about eighty of those lookups passes falsely.
+class BloomFilter
+{
+private:
+    // the bit array
+    std::vector<unsigned int> bits;
+
+    // number of bits in the array
+    unsigned long long	bitcount;
+
+    // number of bits set per string
+    static const unsigned int hashes = 4;
+
+    // the 64-bit FNV-1a hash value of the string
+    static inline unsigned long long hash(const std::string &str)
+    {
+	unsigned long long h = 14695981039346656037ULL;
+
+	for(std::string::size_type i = 0; i < str.size(); ++i)
+	{
+	    h ^= static_cast<unsigned char>(str[i]);
+	    h *= 1099511628211ULL;
+	}
+
+	return h;
+    }
+
+public:
+    BloomFilter()
+	: bitcount(0)
+    {
+    }
+
+    // clear the filter and size it for the given number of strings.
+    void init(size_t strings)
+    {
+	bitcount = std::max<unsigned long long>(64, strings * 10ULL);
+	bits.assign((bitcount + 31) / 32, 0);
+    }
+
+    // insert a string. the bits are derived from the two halves of the hash
+    // value by double hashing.
+    void insert(const std::string &str)
+    {
+	unsigned long long h = hash(str);
+	unsigned long long h1 = h & 0xFFFFFFFF, h2 = (h >> 32) | 1;
+
+	for(unsigned int i = 0; i < hashes; ++i)
+	{
+	    unsigned long long bit = (h1 + i * h2) % bitcount;
+	    bits[bit / 32] |= (1u << (bit % 32));
+	}
+    }
+
+    // returns false if the string was certainly not inserted.
+    bool contains(const std::string &str) const
+    {
+	return contains(bits.empty() ? NULL : &bits[0], bitcount, str);
+    }
+
+    // the same test on a bit array stored elsewhere, e.g. in a mapped file.
+    static bool contains(const unsigned int *words, unsigned long long wordbits,
+			 const std::string &str)
+    {
+	if (wordbits == 0) return false;
+
+	unsigned long long h = hash(str);
+	unsigned long long h1 = h & 0xFFFFFFFF, h2 = (h >> 32) | 1;
+
+	for(unsigned int i = 0; i < hashes; ++i)
+	{
+	    unsigned long long bit = (h1 + i * h2) % wordbits;
+	    if (!(words[bit / 32] & (1u << (bit % 32)))) return false;
+	}
+
+	return true;
+    }
+
+    // return the bit array and its number of bits for storing the filter.
+    inline const std::vector<unsigned int>& getWords() const
+    {
+	return bits;
+    }
+
+    inline unsigned long long getBitCount() const
+    {
+	return bitcount;
+    }
+};
+
+#endif // _STX_CSVTOOL_BLOOMFILTER_H_
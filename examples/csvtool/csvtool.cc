@@ -28,123 +28,1313 @@
 // Enhanced CSV Parser and Filter using the Expression Parser
  
 #include "ExpressionParser.h"
-#include "strnatcmp.h"
+#include "../csvreader.h"
+#include "sortkey.h"
+#include "hashjoin.h"
+#include "fileindex.h"
 
 #include <iostream>
-#include <fstream>
 #include <string>
 #include <vector>
 #include <map>
+#include <memory>
+#include <set>
+#include <algorithm>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include <boost/lexical_cast.hpp>
+#include <boost/unordered_map.hpp>
+
+// use this as the delimiter. this can be changed to ';' or ',' if needed
+const char delimiter = '\t';
+
+// std::sort order relation functional object: compares the sort keys
+// encoded by SortKey, which are stored as the last column of the data records
+// while sorting. Comparing the keys bytewise yields the "natural" sort order,
+// which means numbers and text are ordered correctly.
+struct DataRecordSortRelation
+{
+    inline bool operator()(const std::vector<std::string> &recordA,
+			   const std::vector<std::string> &recordB) const
+    {
+	return recordA.back() < recordB.back();
+    }
+};
+
+// keeps the first k data records in the sort order of the relation using a
+// bounded max-heap, whose top is the last of the retained records. Records
+// with equal sort keys are ordered by their input position, like a stable
+// sort. The memory used is proportional to k, not to the number of records
+// inserted.
+class TopRecords
+{
+private:
+    // the sort order of the records
+    DataRecordSortRelation relation;
+
+    // the number of records retained
+    unsigned int	k;
+
+    // the retained records and their input position
+    std::vector< std::vector<std::string> > records;
+    std::vector<unsigned int> position;
+
+    // the indexes of the records ordered as max-heap
+    std::vector<unsigned int> heap;
+
+    // the input position of the next record
+    unsigned int	nextposition;
+
+    // heap order of the record indexes: true if record a comes first.
+    struct IndexOrder
+    {
+	const TopRecords &top;
+
+	inline IndexOrder(const TopRecords &_top)
+	    : top(_top)
+	{
+	}
+
+	inline bool operator()(unsigned int a, unsigned int b) const
+	{
+	    if (top.relation(top.records[a], top.records[b])) return true;
+	    if (top.relation(top.records[b], top.records[a])) return false;
+	    return top.position[a] < top.position[b];
+	}
+    };
+
+public:
+    explicit TopRecords(unsigned int _k)
+	: k(_k), nextposition(0)
+    {
+    }
+
+    // returns true if a record with the given sort key would be retained.
+    // each record must be tested before it is inserted, because its input
+    // position is counted here.
+    bool accepts(const std::string &key)
+    {
+	nextposition++;
+
+	if (heap.size() < k) return true;
+	if (k == 0) return false;
+
+	// a later record with an equal key does not replace the top.
+	return key < records[heap.front()].back();
+    }
+
+    // insert the accepted record, whose columns are swapped into the heap. the
+    // last column is its sort key.
+    void insert(std::vector<std::string> &record)
+    {
+	unsigned int index;
+
+	if (heap.size() < k)
+	{
+	    index = records.size();
+	    records.push_back( std::vector<std::string>() );
+	    position.push_back(0);
+	    heap.push_back(index);
+	}
+	else
+	{
+	    // replace the last retained record
+	    std::pop_heap(heap.begin(), heap.end(), IndexOrder(*this));
+	    index = heap.back();
+	}
+
+	records[index].swap(record);
+	position[index] = nextposition - 1;
+
+	std::push_heap(heap.begin(), heap.end(), IndexOrder(*this));
+    }
+
+    // move the retained records in sort order into the output vector.
+    void getSorted(std::vector< std::vector<std::string> > &output)
+    {
+	std::sort_heap(heap.begin(), heap.end(), IndexOrder(*this));
+
+	output.clear();
+	output.resize(heap.size());
+
+	for(unsigned int i = 0; i < heap.size(); ++i)
+	    output[i].swap(records[heap[i]]);
+
+	heap.clear();
+    }
+};
+
+// sort the data records by the sort keys in their last column using the
+// given number of threads. Records with equal keys keep their input order.
+// Only the keys' addresses are sorted, then the records are moved into place.
+static void sort_records(std::vector< std::vector<std::string> > &records,
+			 unsigned int threads)
+{
+    std::vector<SortEntry> entries(records.size());
+
+    for(unsigned int i = 0; i < records.size(); ++i)
+    {
+	entries[i].key = &records[i].back();
+	entries[i].index = i;
+    }
+
+    parallel_sort(entries, threads);
+
+    std::vector< std::vector<std::string> > sorted(records.size());
+
+    for(unsigned int i = 0; i < entries.size(); ++i)
+	sorted[i].swap(records[entries[i].index]);
+
+    records.swap(sorted);
+}
+
+// approximate memory used by a copied data record
+static inline size_t record_memory(const std::vector<std::string> &record)
+{
+    size_t size = sizeof(record) + record.capacity() * sizeof(std::string);
+
+    for(unsigned int i = 0; i < record.size(); ++i)
+	size += record[i].size();
+
+    return size;
+}
+
+// write an unsigned integer in 7 bit groups, the high bit of each byte marks
+// a following byte. returns the number of bytes written.
+static inline size_t write_varint(FILE *file, size_t value)
+{
+    size_t bytes = 1;
+
+    while (value >= 0x80) {
+	putc(static_cast<int>(value & 0x7F) | 0x80, file);
+	value >>= 7;
+	++bytes;
+    }
+    putc(static_cast<int>(value), file);
+
+    return bytes;
+}
+
+// read an unsigned integer written by write_varint(). returns false at eof.
+static inline bool read_varint(FILE *file, size_t &value)
+{
+    value = 0;
+
+    for(unsigned int shift = 0; ; shift += 7)
+    {
+	int c = getc(file);
+	if (c == EOF) return false;
+
+	value |= static_cast<size_t>(c & 0x7F) << shift;
+	if (!(c & 0x80)) return true;
+    }
+}
+
+// spills runs of data records to temporary files in a compact binary
+// encoding: the number of columns followed by the length and characters of
+// each column. The files are deleted when the spiller is destroyed.
+class RecordSpiller
+{
+private:
+    // the temporary files of the runs and the number of records of each
+    std::vector<FILE*>	runs;
+    std::vector<size_t>	runrecords;
+
+    // total number of bytes written
+    unsigned long long	bytes;
+
+public:
+    RecordSpiller()
+	: bytes(0)
+    {
+    }
+
+    ~RecordSpiller()
+    {
+	for(unsigned int i = 0; i < runs.size(); ++i)
+	    fclose(runs[i]);
+    }
+
+    // number of runs spilled
+    inline unsigned int size() const
+    {
+	return runs.size();
+    }
+
+    // number of bytes spilled
+    inline unsigned long long getBytes() const
+    {
+	return bytes;
+    }
+
+    // return the file of a run, rewound for reading
+    inline FILE* getRun(unsigned int i) const
+    {
+	rewind(runs[i]);
+	return runs[i];
+    }
+
+    // number of records written to a run
+    inline size_t getRunRecords(unsigned int i) const
+    {
+	return runrecords[i];
+    }
+
+    // write the records as a new run and clear them. returns false if no
+    // temporary file could be written.
+    bool spill(std::vector< std::vector<std::string> > &records)
+    {
+	FILE *file = tmpfile();
+	if (!file) return false;
+
+	runs.push_back(file);
+	runrecords.push_back(records.size());
+
+	for(unsigned int r = 0; r < records.size(); ++r)
+	{
+	    const std::vector<std::string> &record = records[r];
+
+	    bytes += write_varint(file, record.size());
+
+	    for(unsigned int i = 0; i < record.size(); ++i)
+	    {
+		bytes += write_varint(file, record[i].size());
+		bytes += fwrite(record[i].data(), 1, record[i].size(), file);
+	    }
+	}
+
+	records.clear();
+
+	return (fflush(file) == 0 && !ferror(file));
+    }
+
+    // read the next record of a run. returns false at the end of the file or
+    // if it cannot be read.
+    static bool read(FILE *file, std::vector<std::string> &record)
+    {
+	size_t columns;
+	if (!read_varint(file, columns)) return false;
+
+	record.resize(columns);
+
+	for(unsigned int i = 0; i < columns; ++i)
+	{
+	    size_t length;
+	    if (!read_varint(file, length)) return false;
+
+	    record[i].resize(length);
+	    if (length && fread(&record[i][0], 1, length, file) != length) return false;
+	}
+
+	return true;
+    }
+};
+
+// merges the sorted runs of a RecordSpiller and a final run kept in memory
+// using a loser tree: each inner node holds the source which lost the
+// comparison there and node 0 the overall winner, so replacing the winner's
+// record takes one comparison per tree level. Records with equal sort keys
+// are taken from the sources in their order, so runs of consecutive input
+// rows sorted stably are merged stably. Without a relation the sources are
+// concatenated.
+class RunMerger
+{
+private:
+    // the sort order, or NULL to concatenate the runs
+    const DataRecordSortRelation *relation;
+
+    // the spilled runs and the final run in memory
+    const RecordSpiller &spiller;
+    std::vector< std::vector<std::string> > &memrun;
+
+    // next record of the memory run
+    unsigned int	mempos;
+
+    // number of sources: the spilled runs and the memory run
+    unsigned int	k;
+
+    // the files of the runs and the number of their records not yet read
+    std::vector<FILE*>	files;
+    std::vector<size_t>	remaining;
+
+    // set if a run could not be read completely
+    bool		failed;
+
+    // the current record of each source and whether it is exhausted
+    std::vector< std::vector<std::string> > current;
+    std::vector<char>	exhausted;
+
+    // the loser tree: node 0 is the winner, the leaves k..2k-1 are implicit.
+    std::vector<unsigned int> tree;
+
+    // read the next record of a source
+    void fetch(unsigned int src)
+    {
+	if (src < files.size())
+	{
+	    // a run ending before all its records were read is an error
+	    if (remaining[src] == 0) {
+		exhausted[src] = true;
+	    }
+	    else if (!RecordSpiller::read(files[src], current[src])) {
+		exhausted[src] = true;
+		failed = true;
+	    }
+	    else {
+		remaining[src]--;
+	    }
+	}
+	else if (mempos < memrun.size())
+	{
+	    current[src].swap(memrun[mempos++]);
+	}
+	else
+	{
+	    exhausted[src] = true;
+	}
+    }
+
+    // true if the current record of source a comes before that of b.
+    bool before(unsigned int a, unsigned int b) const
+    {
+	if (exhausted[a]) return false;
+	if (exhausted[b]) return true;
+
+	if (relation)
+	{
+	    if ((*relation)(current[a], current[b])) return true;
+	    if ((*relation)(current[b], current[a])) return false;
+	}
+
+	return a < b;
+    }
+
+    // play the matches of the subtree below node and return its winner
+    unsigned int build(unsigned int node)
+    {
+	if (node >= k) return node - k;
+
+	unsigned int left = build(2 * node), right = build(2 * node + 1);
+
+	if (before(right, left)) std::swap(left, right);
+
+	tree[node] = right;
+	return left;
+    }
+
+public:
+    RunMerger(const DataRecordSortRelation *_relation, const RecordSpiller &_spiller,
+	      std::vector< std::vector<std::string> > &_memrun)
+	: relation(_relation), spiller(_spiller), memrun(_memrun), mempos(0),
+	  k(_spiller.size() + 1), failed(false),
+	  current(k), exhausted(k, false), tree(k)
+    {
+	for(unsigned int i = 0; i < spiller.size(); ++i)
+	{
+	    files.push_back(spiller.getRun(i));
+	    remaining.push_back(spiller.getRunRecords(i));
+	}
+
+	for(unsigned int i = 0; i < k; ++i)
+	    fetch(i);
+
+	tree[0] = build(1);
+    }
+
+    // move the next record in sort order into record. returns false when all
+    // sources are exhausted or a run could not be read.
+    bool next(std::vector<std::string> &record)
+    {
+	unsigned int winner = tree[0];
+	if (failed || exhausted[winner]) return false;
+
+	record.swap(current[winner]);
+	fetch(winner);
+
+	// replay the matches on the path from the winner's leaf to the root
+	for(unsigned int node = (winner + k) / 2; node > 0; node /= 2)
+	{
+	    if (before(tree[node], winner)) std::swap(tree[node], winner);
+	}
+
+	tree[0] = winner;
+	return true;
+    }
+
+    // returns true if a run could not be read, which ended the merge.
+    inline bool isFailed() const
+    {
+	return failed;
+    }
+};
+
+// write the columns of a data record as one line. if haskey is set, the last
+// column is the sort key and not written.
+static void write_datarecord(std::ostream &outstream, const std::vector<std::string> &record,
+			     bool haskey = false)
+{
+    std::vector<std::string>::const_iterator colend = record.end();
+    if (haskey) --colend;
+
+    for(std::vector<std::string>::const_iterator coliter = record.begin();
+	coliter != colend; ++coliter)
+    {
+	if (coliter != record.begin()) outstream << delimiter;
+	outstream << *coliter;
+    }
+    outstream << "\n";
+}
+
+// the aggregate functions of the group mode
+enum aggregate_type
+{
+    AGGREGATE_COUNT, AGGREGATE_SUM, AGGREGATE_MIN, AGGREGATE_MAX, AGGREGATE_AVG
+};
+
+// write a string as its length and characters. returns the number of bytes
+// written.
+static inline size_t write_string(FILE *file, const std::string &str)
+{
+    size_t bytes = write_varint(file, str.size());
+    return bytes + fwrite(str.data(), 1, str.size(), file);
+}
+
+// read a string written by write_string(). returns false at eof.
+static inline bool read_string(FILE *file, std::string &str)
+{
+    size_t length;
+    if (!read_varint(file, length)) return false;
+
+    str.resize(length);
+    return (length == 0 || fread(&str[0], 1, length, file) == length);
+}
+
+// the partial result of one aggregate function over rows of a group. The
+// partial results of different rows, e.g. counted by different threads, are
+// merged into the result of the whole group.
+struct AggregateState
+{
+    // number of values aggregated
+    unsigned long long	count;
+
+    // sum of the values, which is also kept exactly while all are integers
+    double		sum;
+    long long		intsum;
+    bool		integral;
+
+    // sort key and text of the minimum or maximum value
+    std::string		extremekey, extremetext;
+
+    AggregateState()
+	: count(0), sum(0), intsum(0), integral(true)
+    {
+    }
+
+    // returns true if the sort key of a min() or max() is better than the
+    // current one.
+    inline bool better(aggregate_type func, const std::string &key) const
+    {
+	if (count == 0) return true;
+	return (func == AGGREGATE_MIN) ? (key < extremekey) : (extremekey < key);
+    }
+
+    // add the value of a row. throws if a non-numeric value is summed.
+    void add(aggregate_type func, const stx::AnyScalar &val)
+    {
+	if (func == AGGREGATE_SUM || func == AGGREGATE_AVG)
+	{
+	    double d = val.getDouble();
+
+	    if (val.isIntegerType())
+		intsum += val.getLong();
+	    else
+		integral = false;
+
+	    sum += d;
+	}
+	else if (func == AGGREGATE_MIN || func == AGGREGATE_MAX)
+	{
+	    // values are compared like sort keys: numbers before strings in
+	    // natural order.
+	    std::string key;
+	    append_value_key(key, val);
+
+	    if (better(func, key)) {
+		extremekey.swap(key);
+		extremetext = val.getString();
+	    }
+	}
+
+	count++;
+    }
+
+    // merge the partial result of other rows of the group
+    void merge(aggregate_type func, const AggregateState &other)
+    {
+	if (other.count == 0) return;
+
+	if ((func == AGGREGATE_MIN || func == AGGREGATE_MAX) && better(func, other.extremekey)) {
+	    extremekey = other.extremekey;
+	    extremetext = other.extremetext;
+	}
+
+	count += other.count;
+	sum += other.sum;
+	intsum += other.intsum;
+	integral = integral && other.integral;
+    }
+
+    // return the text of the aggregate's result. sum(), avg(), min() and
+    // max() of no values are empty.
+    std::string result(aggregate_type func) const
+    {
+	switch(func)
+	{
+	case AGGREGATE_COUNT:
+	    return boost::lexical_cast<std::string>(count);
+
+	case AGGREGATE_SUM:
+	    if (count == 0) return "";
+	    if (integral) return boost::lexical_cast<std::string>(intsum);
+	    return stx::AnyScalar(sum).getString();
+
+	case AGGREGATE_AVG:
+	    if (count == 0) return "";
+	    return stx::AnyScalar(sum / count).getString();
+
+	default:
+	    return extremetext;
+	}
+    }
+
+    // write the state to a partition file. returns the number of bytes
+    // written.
+    size_t write(FILE *file) const
+    {
+	size_t bytes = write_varint(file, count);
+	bytes += fwrite(&sum, 1, sizeof(sum), file);
+	bytes += fwrite(&intsum, 1, sizeof(intsum), file);
+	putc(integral, file);
+	bytes += 1;
+	bytes += write_string(file, extremekey);
+	bytes += write_string(file, extremetext);
+	return bytes;
+    }
+
+    // read a state written by write(). returns false at eof.
+    bool read(FILE *file)
+    {
+	size_t value;
+	if (!read_varint(file, value)) return false;
+	count = value;
+
+	if (fread(&sum, 1, sizeof(sum), file) != sizeof(sum)) return false;
+	if (fread(&intsum, 1, sizeof(intsum), file) != sizeof(intsum)) return false;
+
+	int c = getc(file);
+	if (c == EOF) return false;
+	integral = (c != 0);
+
+	return read_string(file, extremekey) && read_string(file, extremetext);
+    }
+};
+
+// the group keys and aggregate functions of the group mode, each given as an
+// expression list. The output columns are the group keys followed by the
+// aggregates, named by their expressions.
+struct GroupBySpec
+{
+    // names of the output columns
+    std::vector<std::string> headers;
+
+    // the compiled and bound programs of the group keys
+    std::vector<stx::ParseProgram> keyprograms;
+
+    // the aggregate functions and the programs of their parameters, which
+    // are empty for count().
+    std::vector<aggregate_type> functions;
+    std::vector<stx::ParseProgram> aggprograms;
+
+    // the leading fields of a row needed to evaluate the programs
+    unsigned int	neededfields;
+
+    GroupBySpec()
+	: neededfields(0)
+    {
+    }
+
+    // parse the expression lists of group keys and aggregates. The aggregates
+    // must be calls of count(), count(x), sum(x), min(x), max(x) or avg(x).
+    // returns false and the message in error if they cannot be resolved.
+    bool parse(const std::string &groupstring, const std::string &aggregatestring,
+	       CSVRowSymbolTable &symboltable, std::string &error)
+    {
+	const std::map<std::string, unsigned int> &headersmap = symboltable.headersmap;
+	std::set<std::string> varset;
+
+	try
+	{
+	    stx::ParseTreeList keylist, aggregatelist;
+
+	    if (groupstring.size()) keylist = stx::parseExpressionList(groupstring);
+	    if (aggregatestring.size()) aggregatelist = stx::parseExpressionList(aggregatestring);
+
+	    for(unsigned int i = 0; i < keylist.size(); ++i)
+	    {
+		std::set<std::string> keyvars = keylist[i].getVariables();
+		varset.insert(keyvars.begin(), keyvars.end());
+
+		headers.push_back(keylist[i].toString());
+		keyprograms.push_back(keylist[i].compile());
+	    }
+
+	    for(unsigned int i = 0; i < aggregatelist.size(); ++i)
+	    {
+		std::string funcname;
+		std::vector<stx::ParseTree> params;
+
+		if (!aggregatelist[i].getFunctionCall(funcname, params)) {
+		    error = "Bad aggregate: " + aggregatelist[i].toString() + " is no call of count(), sum(), min(), max() or avg().";
+		    return false;
+		}
+
+		std::transform(funcname.begin(), funcname.end(), funcname.begin(), toupper);
+
+		aggregate_type func;
+
+		if (funcname == "COUNT") func = AGGREGATE_COUNT;
+		else if (funcname == "SUM") func = AGGREGATE_SUM;
+		else if (funcname == "MIN") func = AGGREGATE_MIN;
+		else if (funcname == "MAX") func = AGGREGATE_MAX;
+		else if (funcname == "AVG") func = AGGREGATE_AVG;
+		else {
+		    error = "Bad aggregate: " + aggregatelist[i].toString() + " is no call of count(), sum(), min(), max() or avg().";
+		    return false;
+		}
+
+		if (params.size() > 1 || (params.empty() && func != AGGREGATE_COUNT)) {
+		    error = "Bad aggregate: " + aggregatelist[i].toString() + " takes exactly one parameter.";
+		    return false;
+		}
+
+		headers.push_back(aggregatelist[i].toString());
+		functions.push_back(func);
+
+		if (params.empty()) {
+		    aggprograms.push_back(stx::ParseProgram());
+		}
+		else {
+		    std::set<std::string> paramvars = params[0].getVariables();
+		    varset.insert(paramvars.begin(), paramvars.end());
+
+		    aggprograms.push_back(params[0].compile());
+		}
+	    }
+
+	    for(std::set<std::string>::const_iterator vi = varset.begin();
+		vi != varset.end(); ++vi)
+	    {
+		if (headersmap.find(*vi) == headersmap.end()) {
+		    error = "Bad group column: " + *vi + " could not be found.";
+		    return false;
+		}
+	    }
+
+	    for(unsigned int i = 0; i < keyprograms.size(); ++i)
+	    {
+		keyprograms[i].bindVariables(headersmap);
+		keyprograms[i].bindFunctions(symboltable);
+	    }
+
+	    for(unsigned int i = 0; i < aggprograms.size(); ++i)
+	    {
+		if (aggprograms[i].isEmpty()) continue;
+
+		aggprograms[i].bindVariables(headersmap);
+		aggprograms[i].bindFunctions(symboltable);
+	    }
+	}
+	catch (stx::ExpressionParserException &e)
+	{
+	    error = std::string("ExpressionParserException: ") + e.what();
+	    return false;
+	}
+
+	neededfields = symboltable.getNeededFields(varset);
+	return true;
+    }
+};
+
+// the aggregates of the groups seen by one thread, hashed by the texts of
+// their key values, each prefixed by its length. Beyond its memory budget
+// the table is spilled into partition files by the hash of the group keys,
+// so that the groups of each partition can be merged separately at the end.
+class GroupTable
+{
+public:
+    // the aggregate states of each group key
+    typedef boost::unordered_map<std::string, std::vector<AggregateState> > map_type;
+
+    // number of partitions of the groups spilled
+    static const unsigned int partitions = 16;
+
+private:
+    // the group keys and aggregates
+    const GroupBySpec	&spec;
+
+    // copies of the programs for this thread
+    std::vector<stx::ParseProgram> keyprograms, aggprograms;
+
+    // the groups in memory
+    map_type		groups;
+
+    // approximate memory used by the groups and the budget
+    size_t		memoryused, memorybudget;
+
+    // the partition files, created on the first spill, and the number of
+    // groups written to each
+    std::vector<FILE*>	partfiles;
+    std::vector<size_t>	partgroups;
+
+    // total number of bytes spilled
+    unsigned long long	spilledbytes;
+
+    // the key of the current row
+    std::string		key;
+
+    // disabled copy constructor
+    GroupTable(const GroupTable &t);
+
+    // disabled assignment operator
+    GroupTable& operator=(const GroupTable &t);
+
+    // the partition of a group key
+    static inline unsigned int partition(const std::string &groupkey)
+    {
+	return boost::hash<std::string>()(groupkey) % partitions;
+    }
+
+    // merge the aggregate states of a group into the result table
+    void mergeGroup(map_type &result, const std::string &groupkey,
+		    const std::vector<AggregateState> &states) const
+    {
+	map_type::iterator gi = result.find(groupkey);
+
+	if (gi == result.end()) {
+	    result.insert(map_type::value_type(groupkey, states));
+	    return;
+	}
+
+	for(unsigned int a = 0; a < states.size(); ++a)
+	    gi->second[a].merge(spec.functions[a], states[a]);
+    }
+
+public:
+    GroupTable(const GroupBySpec &_spec, size_t _memorybudget)
+	: spec(_spec), keyprograms(_spec.keyprograms), aggprograms(_spec.aggprograms),
+	  memoryused(0), memorybudget(_memorybudget), spilledbytes(0)
+    {
+    }
+
+    ~GroupTable()
+    {
+	for(unsigned int p = 0; p < partfiles.size(); ++p)
+	    fclose(partfiles[p]);
+    }
+
+    // return the groups in memory
+    inline map_type& getGroups()
+    {
+	return groups;
+    }
+
+    // returns true if groups were spilled to the partition files
+    inline bool isSpilled() const
+    {
+	return !partfiles.empty();
+    }
+
+    // number of bytes spilled
+    inline unsigned long long getSpilledBytes() const
+    {
+	return spilledbytes;
+    }
+
+    // evaluate the group key and the aggregates' parameters for the current
+    // row of the symbol table and add it to its group. An exception of a
+    // group key is taken as its text, a value of an aggregate throwing an
+    // exception is skipped. returns false if the groups could not be spilled.
+    bool addRow(CSVRowSymbolTable &symboltable)
+    {
+	key.clear();
+
+	for(unsigned int k = 0; k < keyprograms.size(); ++k)
+	{
+	    std::string text;
+
+	    try
+	    {
+		text = keyprograms[k].evaluate( symboltable.fillSlots(keyprograms[k].getBoundSlots()),
+						symboltable ).getString();
+	    }
+	    catch (stx::ExpressionParserException &e)
+	    {
+		text = std::string("Exception: ") + e.what();
+	    }
+
+	    unsigned int length = text.size();
+	    key += static_cast<char>(length >> 24);
+	    key += static_cast<char>(length >> 16);
+	    key += static_cast<char>(length >> 8);
+	    key += static_cast<char>(length);
+	    key += text;
+	}
+
+	map_type::iterator gi = groups.find(key);
+
+	if (gi == groups.end())
+	{
+	    gi = groups.insert(map_type::value_type(key, std::vector<AggregateState>(aggprograms.size()))).first;
+
+	    memoryused += sizeof(map_type::value_type) + 4 * sizeof(void*) + key.size()
+		+ aggprograms.size() * sizeof(AggregateState);
+	}
+
+	for(unsigned int a = 0; a < aggprograms.size(); ++a)
+	{
+	    AggregateState &state = gi->second[a];
+
+	    try
+	    {
+		if (aggprograms[a].isEmpty())
+		    state.add(spec.functions[a], stx::AnyScalar());
+		else
+		    state.add(spec.functions[a],
+			      aggprograms[a].evaluate( symboltable.fillSlots(aggprograms[a].getBoundSlots()),
+						       symboltable ));
+	    }
+	    catch (stx::ExpressionParserException &e)
+	    {
+		// skip the value
+	    }
+	}
+
+	if (memorybudget && memoryused > memorybudget)
+	    return spill();
+
+	return true;
+    }
+
+    // write all groups in memory to the partition files and clear them.
+    // returns false if a file could not be written.
+    bool spill()
+    {
+	while (partfiles.size() < partitions)
+	{
+	    FILE *file = tmpfile();
+	    if (!file) return false;
+
+	    partfiles.push_back(file);
+	    partgroups.push_back(0);
+	}
+
+	for(map_type::const_iterator gi = groups.begin(); gi != groups.end(); ++gi)
+	{
+	    unsigned int part = partition(gi->first);
+	    FILE *file = partfiles[part];
+	    partgroups[part]++;
+
+	    spilledbytes += write_string(file, gi->first);
+
+	    for(unsigned int a = 0; a < gi->second.size(); ++a)
+		spilledbytes += gi->second[a].write(file);
+	}
+
+	groups.clear();
+	memoryused = 0;
+
+	for(unsigned int p = 0; p < partfiles.size(); ++p)
+	{
+	    if (fflush(partfiles[p]) != 0 || ferror(partfiles[p])) return false;
+	}
+
+	return true;
+    }
+
+    // merge the groups of a partition, in memory and spilled, into the result
+    // table. if part equals partitions, the groups in memory of all
+    // partitions are merged. returns false if the partition file could not
+    // be read completely.
+    bool mergeInto(map_type &result, unsigned int part) const
+    {
+	for(map_type::const_iterator gi = groups.begin(); gi != groups.end(); ++gi)
+	{
+	    if (part == partitions || partition(gi->first) == part)
+		mergeGroup(result, gi->first, gi->second);
+	}
+
+	if (part >= partfiles.size()) return true;
+
+	FILE *file = partfiles[part];
+	rewind(file);
+
+	std::string groupkey;
+	std::vector<AggregateState> states(aggprograms.size());
+
+	for(size_t g = 0; g < partgroups[part]; ++g)
+	{
+	    if (!read_string(file, groupkey)) return false;
+
+	    for(unsigned int a = 0; a < states.size(); ++a)
+	    {
+		states[a] = AggregateState();
+		if (!states[a].read(file)) return false;
+	    }
+
+	    mergeGroup(result, groupkey, states);
+	}
+
+	return !ferror(file);
+    }
+};
+
+// the work of one thread in group mode: filter the rows of a reader and
+// aggregate the matching ones into its own group table.
+struct GroupWorker
+{
+    // the reader of a chunk of the input and the reader used
+    CSVReader		chunkreader;
+    CSVReader		*reader;
+
+    // copy of the filter program for this thread
+    stx::ParseProgram	program;
+
+    CSVRowSymbolTable	symboltable;
+    GroupTable		table;
+
+    unsigned int	linesprocessed, linescopied;
+
+    // set if the groups could not be spilled
+    bool		failed;
+
+    GroupWorker(const stx::ParseProgram &_program,
+		const std::map<std::string, unsigned int> &headersmap,
+		const GroupBySpec &spec, size_t memorybudget)
+	: chunkreader(delimiter), reader(&chunkreader), program(_program),
+	  symboltable(headersmap), table(spec, memorybudget),
+	  linesprocessed(0), linescopied(0), failed(false)
+    {
+    }
+};
+
+// thread function filtering and aggregating the rows of a GroupWorker. Like
+// in the sort mode, only rows for which the filter is false are skipped.
+static void* aggregate_rows(void *arg)
+{
+    GroupWorker &worker = *static_cast<GroupWorker*>(arg);
+
+    std::vector<CSVRow> block;
+    unsigned int blockrows;
+
+    while ( !worker.failed && (blockrows = worker.reader->readRows(block, 1024)) > 0 )
+    {
+	for(unsigned int r = 0; r < blockrows; ++r)
+	{
+	    worker.symboltable.setRow(block[r].fields);
+	    worker.linesprocessed++;
+
+	    try
+	    {
+		if (!worker.program.isEmpty())
+		{
+		    stx::AnyScalar val = worker.program.evaluate( worker.symboltable.fillSlots(worker.program.getBoundSlots()),
+								  worker.symboltable );
+
+		    if (val.isBooleanType() && !val.getBoolean()) continue;
+		}
+	    }
+	    catch (stx::ExpressionParserException &e)
+	    {
+		// rows with an exception text as "EvalResult" are kept.
+	    }
+
+	    worker.linescopied++;
+
+	    if (!worker.table.addRow(worker.symboltable)) {
+		worker.failed = true;
+		break;
+	    }
+	}
+    }
+
+    return NULL;
+}
+
+// create the output rows of the groups: the texts of the key values followed
+// by the aggregates' results and the sort key, if one is given.
+static void make_group_rows(const GroupTable::map_type &groups, const GroupBySpec &spec,
+			    const SortKey &sortkey, CSVRowSymbolTable &outsymboltable,
+			    std::vector< std::vector<std::string> > &rows)
+{
+    std::vector<CSVField> fields;
+    std::string sortkeytext;
+
+    for(GroupTable::map_type::const_iterator gi = groups.begin(); gi != groups.end(); ++gi)
+    {
+	const std::string &groupkey = gi->first;
+
+	rows.push_back( std::vector<std::string>() );
+	std::vector<std::string> &row = rows.back();
+
+	for(std::string::size_type pos = 0; pos + 4 <= groupkey.size(); )
+	{
+	    const unsigned char *len = reinterpret_cast<const unsigned char*>(groupkey.data() + pos);
+	    unsigned int length = (len[0] << 24) | (len[1] << 16) | (len[2] << 8) | len[3];
+
+	    row.push_back( groupkey.substr(pos + 4, length) );
+	    pos += 4 + length;
+	}
+
+	for(unsigned int a = 0; a < gi->second.size(); ++a)
+	    row.push_back( gi->second[a].result(spec.functions[a]) );
+
+	if (!sortkey.empty())
+	{
+	    fields.resize(row.size());
+	    for(unsigned int i = 0; i < row.size(); ++i)
+	    {
+		fields[i].data = row[i].data();
+		fields[i].size = row[i].size();
+	    }
+
+	    outsymboltable.setRow(fields);
+
+	    sortkeytext.clear();
+	    sortkey.encode(sortkeytext, outsymboltable, fields, NULL);
+	    row.push_back(sortkeytext);
+	}
+    }
+}
+
+// group mode of csvtool: aggregate the rows matching the filter program by
+// the group keys and output one row per group, ordered by the group keys or
+// the sort key over the output columns. A mapped input file is split into
+// chunks aggregated by multiple threads, whose tables are merged at the end.
+static int aggregate_groups(CSVReader &csvfile, const stx::ParseProgram &pp,
+			    CSVRowSymbolTable &csvsymboltable,
+			    const std::string &groupstring, const std::string &aggregatestring,
+			    const std::string &sortcolumn, unsigned int offset, unsigned int limit,
+			    size_t memorybudget, unsigned int threads)
+{
+    GroupBySpec spec;
+    std::string error;
+
+    if (!spec.parse(groupstring, aggregatestring, csvsymboltable, error)) {
+	std::cerr << error << "\n";
+	return 0;
+    }
+
+    // the sort key is given over the output columns
+    std::map<std::string, unsigned int> outheadersmap;
+    for(unsigned int i = 0; i < spec.headers.size(); ++i)
+	outheadersmap[ spec.headers[i] ] = i;
+
+    CSVRowSymbolTable outsymboltable(outheadersmap);
+    SortKey sortkey;
+
+    if (sortcolumn.size())
+    {
+	if (!sortkey.parse(sortcolumn, outsymboltable, error)) {
+	    std::cerr << error << "\n";
+	    return 0;
+	}
+
+	if (sortkey.usesEvalResult()) {
+	    std::cerr << "Bad sort column: EvalResult could not be found.\n";
+	    return 0;
+	}
+    }
+    else
+    {
+	for(unsigned int i = 0; i < spec.keyprograms.size(); ++i)
+	    sortkey.addColumn(i);
+    }
+
+    unsigned int neededfields = spec.neededfields;
+    if (!pp.isEmpty())
+	neededfields = std::max(neededfields, csvfile.getMaxFields());
+
+    // split a mapped file into chunks at line boundaries, one per thread. The
+    // lines selected by an index are read by one thread.
+    if (!csvfile.isMapped() || csvfile.isSelecting()) threads = 1;
+
+    std::vector<GroupWorker*> workers;
+    const char *filebegin = csvfile.getPos(), *fileend = csvfile.getEnd();
+    const char *chunkbegin = filebegin;
+
+    for(unsigned int t = 0; t < threads; ++t)
+    {
+	GroupWorker *worker = new GroupWorker(pp, csvsymboltable.headersmap, spec,
+					      memorybudget / threads);
+	workers.push_back(worker);
+
+	if (threads == 1) {
+	    worker->reader = &csvfile;
+	}
+	else
+	{
+	    // the chunk ends with the line crossing its share of the file
+	    const char *chunkend = fileend;
+
+	    if (t + 1 < threads)
+	    {
+		chunkend = std::max(chunkbegin, filebegin + (fileend - filebegin) / threads * (t + 1));
+
+		const char *newline = static_cast<const char*>(memchr(chunkend, '\n', fileend - chunkend));
+		chunkend = newline ? newline + 1 : fileend;
+	    }
+
+	    worker->chunkreader.openRange(chunkbegin, chunkend);
+	    chunkbegin = chunkend;
+	}
+
+	worker->reader->setMaxFields(neededfields);
+    }
 
-// use this as the delimiter. this can be changed to ';' or ',' if needed
-const char delimiter = '\t';
+    std::vector<pthread_t> threadids(threads);
+    for(unsigned int t = 1; t < threads; ++t)
+	pthread_create(&threadids[t], NULL, aggregate_rows, workers[t]);
 
-// read one line from instream and split it into tab (or otherwise) delimited
-// columns. returns the number of columns read, 0 if eof.
-unsigned int read_csvline(std::istream &instream,
-			  std::vector<std::string> &columns)
-{
-    columns.clear();
+    aggregate_rows(workers[0]);
+
+    for(unsigned int t = 1; t < threads; ++t)
+	pthread_join(threadids[t], NULL);
+
+    unsigned int linesprocessed = 0, linescopied = 0;
+    unsigned long long spilledbytes = 0;
+    bool spilled = false, failed = false;
+
+    for(unsigned int t = 0; t < threads; ++t)
+    {
+	linesprocessed += workers[t]->linesprocessed;
+	linescopied += workers[t]->linescopied;
+	spilledbytes += workers[t]->table.getSpilledBytes();
+	spilled = spilled || workers[t]->table.isSpilled();
+	failed = failed || workers[t]->failed;
+    }
 
-    // read one line from the input stream
-    std::string line;
-    if (!std::getline(instream, line, '\n').good()) {
+    if (failed) {
+	std::cerr << "Error writing temporary file of spilled groups.\n";
+	for(unsigned int t = 0; t < threads; ++t) delete workers[t];
 	return 0;
     }
 
-    // parse line into tab separated columns, start with inital column
-    columns.push_back("");
+    // merge the threads' tables and create the output rows. without spilled
+    // groups all are merged into the first table, otherwise each partition
+    // is merged, sorted and spilled as run for the final merge.
+    std::vector< std::vector<std::string> > grouprecords;
+    RecordSpiller spiller;
+    unsigned int groupcount = 0;
 
-    for (std::string::const_iterator si = line.begin();
-	 si != line.end(); ++si)
+    if (!spilled)
     {
-	if (*si == delimiter)
-	    columns.push_back("");
-	else // add non-delimiter to last column
-	    columns.back() += *si;
-    }
+	GroupTable::map_type &groups = workers[0]->table.getGroups();
 
-    return columns.size();
-}
+	for(unsigned int t = 1; t < threads; ++t)
+	    workers[t]->table.mergeInto(groups, GroupTable::partitions);
 
-// subclass stx::BasicSymbolTable and return variable values from the current
-// csv row. the variable names are defined by the map containing the column
-// header.
-class CSVRowSymbolTable : public stx::BasicSymbolTable
-{
-public:
-    // maps the column variable name to the vector index
-    const std::map<std::string, unsigned int> &headersmap;
+	// aggregates without group keys always yield one row
+	if (spec.keyprograms.empty() && groups.empty())
+	    groups[""].resize(spec.functions.size());
 
-    // refernce to the reused data row vector.
-    const std::vector<std::string> &datacolumns;
+	make_group_rows(groups, spec, sortkey, outsymboltable, grouprecords);
+	groupcount = grouprecords.size();
 
-    CSVRowSymbolTable(const std::map<std::string, unsigned int> &_headersmap,
-		      const std::vector<std::string> &_datacolumns)
-	: stx::BasicSymbolTable(),
-	  headersmap(_headersmap),
-	  datacolumns(_datacolumns)
-    {
+	if (!sortkey.empty())
+	    sort_records(grouprecords, threads);
     }
-
-    virtual stx::AnyScalar lookupVariable(const std::string &varname) const
+    else
     {
-	// look if the variable name is defined by the CSV file
-	std::map<std::string, unsigned int>::const_iterator
-	    varfind = headersmap.find(varname);
+	for(unsigned int p = 0; p < GroupTable::partitions; ++p)
+	{
+	    GroupTable::map_type groups;
 
-	if (varfind == headersmap.end()) {
-	    // if not, let BasicSymbolTable check if it knows it
-	    return stx::BasicSymbolTable::lookupVariable(varname);
-	}
+	    for(unsigned int t = 0; t < threads; ++t)
+		failed = !workers[t]->table.mergeInto(groups, p) || failed;
 
-	// return the variable value from the current vector. convert it to a
-	// stx::AnyScalar but use the automatic type recognition for input
-	// strings.
-	if(varfind->second < datacolumns.size())
-	{
-	    return stx::AnyScalar().setAutoString( datacolumns[varfind->second] );
-	}
-	else
-	{
-	    return "";	// happens when a data row has too few delimited
-			// fields.
+	    if (failed) {
+		std::cerr << "Error reading temporary file of spilled groups.\n";
+		for(unsigned int t = 0; t < threads; ++t) delete workers[t];
+		return 0;
+	    }
+
+	    make_group_rows(groups, spec, sortkey, outsymboltable, grouprecords);
+	    groupcount += grouprecords.size();
+
+	    if (!sortkey.empty())
+		sort_records(grouprecords, threads);
+
+	    if (!spiller.spill(grouprecords)) {
+		std::cerr << "Error writing temporary file of sorted run.\n";
+		for(unsigned int t = 0; t < threads; ++t) delete workers[t];
+		return 0;
+	    }
 	}
     }
-};
 
-// std::sort order relation functional object
-struct DataRecordSortRelation
-{
-    // the column index to sort by
-    unsigned int sortcol;
+    for(unsigned int t = 0; t < threads; ++t)
+	delete workers[t];
+
+    // write a processing summary to stderr
+    std::cerr << "Processed " << linesprocessed << " lines, "
+	      << "copied " << linescopied << " and "
+	      << "skipped " << (linesprocessed - linescopied) << " lines" << "\n";
 
-    // sort ascending or descending
-    bool	descending;
+    std::cerr << "Aggregated " << groupcount << " groups" << "\n";
 
-    inline DataRecordSortRelation(unsigned int _sortcol, bool _descending = 0)
-	: sortcol(_sortcol), descending(_descending)
+    if (spilled)
     {
+	std::cerr << "Spilled " << spilledbytes << " bytes of groups to "
+		  << GroupTable::partitions << " partitions" << "\n";
     }
 
-    // calls the strnatcasecmp on the given column's text or "" if the column
-    // does not exist. sorts in "natural" sort order means numbers and text are
-    // ordered correctly.
-    inline bool operator()(const std::vector<std::string> &recordA,
-			   const std::vector<std::string> &recordB) const
+    write_datarecord(std::cout, spec.headers);
+
+    // output the groups from "offset" to "offset+limit"
+
+    if (spiller.size())
     {
-	if (!descending) {
-	    return strnatcasecmp(sortcol < recordA.size() ? recordA[sortcol].c_str() : "",
-				 sortcol < recordB.size() ? recordB[sortcol].c_str() : "") < 0;
-	}
-	else {
-	    return strnatcasecmp(sortcol < recordA.size() ? recordA[sortcol].c_str() : "",
-				 sortcol < recordB.size() ? recordB[sortcol].c_str() : "") > 0;
+	DataRecordSortRelation relation;
+	RunMerger merger(sortkey.empty() ? NULL : &relation, spiller, grouprecords);
+	std::vector<std::string> record;
+
+	for(unsigned int current = 0; merger.next(record); ++current)
+	{
+	    if (current < offset) continue;
+	    if (current - offset >= limit) break;
+
+	    write_datarecord(std::cout, record, !sortkey.empty());
 	}
+
+	if (merger.isFailed())
+	    std::cerr << "Error reading temporary file of sorted run.\n";
+
+	return 0;
     }
-};
+
+    for(unsigned int current = offset;
+	current - offset < limit && current < grouprecords.size();
+	++current)
+    {
+	write_datarecord(std::cout, grouprecords[current], !sortkey.empty());
+    }
+
+    return 0;
+}
 
 // trim function from my weblog.
 static inline std::string string_trim(const std::string& str)
@@ -161,9 +1351,57 @@ static inline std::string string_trim(const std::string& str)
 
 int main(int argc, char *argv[])
 {
+    // parse options: [-m megabytes] sets the memory budget for the collected
+    // rows. Beyond it sorted runs of rows are spilled to temporary files and
+    // merged for output. 0 disables spilling. [-j threads] sorts the rows
+    // using multiple threads, 0 uses all processors. [-g group-keys] and
+    // [-a aggregates] aggregate the rows by groups instead, see
+    // aggregate_groups(). [-J join-file] [-k join-keys] joins each row with
+    // the rows of the join file with an equal key, see HashJoin. [-I
+    // index-columns] builds the index files of the columns instead of
+    // filtering, which later select the rows read, see ColumnIndex.
+    size_t memorybudget = 512;
+    unsigned int threads = 1;
+    std::string groupstring, aggregatestring;
+    std::string joinfilename, joinkeystring;
+    std::string indexstring;
+
+    int argi = 1;
+    while (argi + 1 < argc)
+    {
+	if (std::string(argv[argi]) == "-m")
+	    memorybudget = atoi(argv[argi + 1]);
+	else if (std::string(argv[argi]) == "-j")
+	    threads = atoi(argv[argi + 1]);
+	else if (std::string(argv[argi]) == "-g")
+	    groupstring = string_trim(argv[argi + 1]);
+	else if (std::string(argv[argi]) == "-a")
+	    aggregatestring = string_trim(argv[argi + 1]);
+	else if (std::string(argv[argi]) == "-J")
+	    joinfilename = argv[argi + 1];
+	else if (std::string(argv[argi]) == "-k")
+	    joinkeystring = string_trim(argv[argi + 1]);
+	else if (std::string(argv[argi]) == "-I")
+	    indexstring = string_trim(argv[argi + 1]);
+	else
+	    break;
+
+	argi += 2;
+    }
+
+    memorybudget *= 1024 * 1024;
+
+    if (threads == 0) {
+	long nprocs = sysconf(_SC_NPROCESSORS_ONLN);
+	threads = (nprocs > 0) ? static_cast<unsigned int>(nprocs) : 1;
+    }
+
+    argc -= argi - 1;
+    argv += argi - 1;
+
     // get progarm argment or reasonable defaults
     if (argc < 2) {
-	std::cerr << "Usage: " << argv[0] << " <csv-filename> [filter expression] [sort-column] [offset] [limit]" << "\n";
+	std::cerr << "Usage: " << argv[0] << " [-m megabytes] [-j threads] [-g group-keys] [-a aggregates] [-J join-file -k join-keys] [-I index-columns] <csv-filename> [filter expression] [sort-columns] [offset] [limit]" << "\n";
 	return 0;
     }
 
@@ -173,12 +1411,34 @@ int main(int argc, char *argv[])
     std::string offsetstring = (argc >= 5) ? string_trim(argv[4]) : "";
     std::string limitstring = (argc >= 6) ? string_trim(argv[5]) : "";
 
-    // parse expression into a parse tree
+    // parse expression into a parse tree and compile it. the join keys are
+    // given as "probe-key, build-key" or as one key for both files.
     stx::ParseTree pt;
+    stx::ParseProgram pp;
+    stx::ParseTreeList joinkeys;
     try
     {
 	if (exprstring.size()) {
 	    pt = stx::parseExpression(exprstring);
+	    pp = pt.compile();
+	}
+
+	if (joinfilename.size())
+	{
+	    joinkeys = stx::parseExpressionList(joinkeystring);
+
+	    if (joinkeys.size() == 1)
+		joinkeys.push_back(joinkeys[0]);
+
+	    if (joinkeys.size() != 2) {
+		std::cerr << "Bad join keys: give one key or \"probe-key, build-key\".\n";
+		return 0;
+	    }
+
+	    if (groupstring.size() || aggregatestring.size()) {
+		std::cerr << "Joins cannot be aggregated by groups.\n";
+		return 0;
+	    }
 	}
     }
     catch (stx::ExpressionParserException &e)
@@ -187,27 +1447,51 @@ int main(int argc, char *argv[])
 	return 0;
     }
 
-    // open the CSV file stream, either stdin or the given filename
-    std::ifstream csvfilestream;
+    // map the given CSV file into memory or read stdin
+    CSVReader csvfile(delimiter);
     if (csvfilename != "-")
     {
-	csvfilestream.open(csvfilename.c_str());
-	if (!csvfilestream) {
+	if (!csvfile.openFile(csvfilename.c_str())) {
 	    std::cerr << "Error opening CSV file " << csvfilename << "\n";
 	    return 0;
 	}
     }
-
-    std::istream& csvfile = (csvfilename == "-") ? std::cin : csvfilestream;
+    else
+    {
+	csvfile.openStream(0);
+    }
 
     // read first line of CSV input as column headers
     std::vector<std::string> headers;
 
-    if (read_csvline(csvfile, headers) == 0) {
+    CSVRow headerrow;
+    if (!csvfile.readRow(headerrow)) {
 	std::cerr << "Error read column headers: no input\n";
 	return 0;
     }
 
+    for(unsigned int i = 0; i < headerrow.fields.size(); ++i)
+	headers.push_back( headerrow.fields[i].str() );
+
+    // load the join file into a hash table. its columns follow the input
+    // columns prefixed by "join_".
+    std::auto_ptr<HashJoin> joiner;
+    unsigned int probecolumns = headers.size();
+
+    if (joinfilename.size())
+    {
+	std::string error;
+
+	joiner.reset(new HashJoin(delimiter));
+	if (!joiner->load(joinfilename, joinkeys[1], error)) {
+	    std::cerr << error << "\n";
+	    return 0;
+	}
+
+	for(unsigned int i = 0; i < joiner->getHeaders().size(); ++i)
+	    headers.push_back("join_" + joiner->getHeaders()[i]);
+    }
+
     // create a header column lookup map for CSVRowSymbolTable 
     std::map<std::string, unsigned int> headersmap;
     for(unsigned int headnum = 0; headnum < headers.size(); ++headnum)
@@ -215,112 +1499,117 @@ int main(int argc, char *argv[])
 	headersmap[ headers[headnum] ] = headnum;
     }
 
+    // build the index files of the comma separated columns and stop.
+    if (indexstring.size())
+    {
+	std::vector<std::string> indexcolumns;
+	std::vector<unsigned int> indexcolnums;
+
+	std::string::size_type begin = 0;
+	while (begin <= indexstring.size())
+	{
+	    std::string::size_type comma = indexstring.find(',', begin);
+	    if (comma == std::string::npos) comma = indexstring.size();
+
+	    std::string column = string_trim(indexstring.substr(begin, comma - begin));
+
+	    std::map<std::string, unsigned int>::const_iterator
+		colfind = headersmap.find(column);
+
+	    if (colfind == headersmap.end() || colfind->second >= probecolumns) {
+		std::cerr << "Bad index column: " << column << " could not be found.\n";
+		return 0;
+	    }
+
+	    indexcolumns.push_back(column);
+	    indexcolnums.push_back(colfind->second);
+
+	    begin = comma + 1;
+	}
+
+	std::string error;
+	unsigned int lines = 0;
+
+	if (!build_column_indexes(csvfile, csvfilename, indexcolumns, indexcolnums,
+				  threads, lines, error)) {
+	    std::cerr << error << "\n";
+	    return 0;
+	}
+
+	for(unsigned int i = 0; i < indexcolumns.size(); ++i)
+	{
+	    std::cerr << "Indexed " << lines << " lines by column " << indexcolumns[i]
+		      << " into " << ColumnIndex::filename(csvfilename, indexcolumns[i]) << "\n";
+	}
+	return 0;
+    }
+
     // iterate over the data lines of the CSV input and save matching data rows
     // into "datarecords"
     unsigned int linesprocessed = 0;
     bool addedEvalResult = false;
 
-    std::vector<std::string> datacolumns;	// current row
-    CSVRowSymbolTable csvsymboltable(headersmap, datacolumns);
-
-    // huge table containing copied rows.
-    std::vector< std::vector<std::string> > datarecords;
+    CSVRowSymbolTable csvsymboltable(headersmap);
 
-    while( read_csvline(csvfile, datacolumns) > 0 )
+    // bind the column variables of the program to their column index and
+    // resolve the function calls.
+    if (!pp.isEmpty())
     {
-        // evaluate the expression for each row using the headers/datacolumns
-        // as variables
 	try
 	{
-	    linesprocessed++;
-	    if (!pt.isEmpty())
-	    {
-		stx::AnyScalar val = pt.evaluate( csvsymboltable );
-
-		if (val.isBooleanType())
-		{
-		    if (!val.getBoolean()) continue;
-		}
-		else
-		{
-		    // if calculation results in non-boolean value, then save
-		    // that value into a column "EvalResult"
-		    if (!addedEvalResult) {
-			headers.push_back("EvalResult");
-			addedEvalResult = true;
-		    }
-
-		    while( datacolumns.size() + 1 < headers.size() )
-			datacolumns.push_back("");
-		    datacolumns.push_back(val.getString());
-		}
-	    }
+	    pp.bindVariables(headersmap);
+	    pp.bindFunctions(csvsymboltable);
 	}
 	catch (stx::ExpressionParserException &e)
 	{
-	    // save exception text into column "EvalResult"
-	    if (!addedEvalResult) {
-		headers.push_back("EvalResult");
-		addedEvalResult = true;
-	    }
-	    // add calculation result as last column
-	    while( datacolumns.size() + 1 < headers.size() )
-		datacolumns.push_back("");
-
-	    datacolumns.push_back(std::string("Exception: ") + e.what());
+	    std::cerr << "ExpressionParserException: " << e.what() << "\n";
+	    return 0;
 	}
 
-	datarecords.push_back( datacolumns );
+	// split only the fields referenced by the expression for evaluation
+	csvfile.setMaxFields( csvsymboltable.getNeededFields(pt.getVariables()) );
     }
 
-    // add "EvalResult" to headers map to allow sorting by it.
-    if (addedEvalResult) {
-	headersmap[ headers[headers.size() - 1] ] = headers.size() - 1;
-    }
+    // parse the sort key: a comma separated list of columns or expressions,
+    // which is encoded once for each matching row.
+    SortKey sortkey;
+    bool grouped = (groupstring.size() || aggregatestring.size());
 
-    // sort the result table if required.
-    if (sortcolumn.size())
+    if (sortcolumn.size() && !grouped)
     {
-	std::map<std::string, unsigned int>::const_iterator
-	    colfind = headersmap.find(sortcolumn);
-
-	if (colfind != headersmap.end())
-	{
-	    // sort ascending
-	    std::sort(datarecords.begin(), datarecords.end(),
-		      DataRecordSortRelation(colfind->second));
+	std::string error;
+	if (!sortkey.parse(sortcolumn, csvsymboltable, error)) {
+	    std::cerr << error << "\n";
+	    return 0;
 	}
-	else 
-	{
-	    // the the sort column is !header it is sorted descending.
-	    if (sortcolumn[0] == '!')
-	    {
-		sortcolumn.erase(0, 1);
-		
-		colfind = headersmap.find(sortcolumn);
-		if (colfind != headersmap.end())
-		{
-		    std::sort(datarecords.begin(), datarecords.end(),
-			      DataRecordSortRelation(colfind->second, 1));
-		}
-		else
-		{
-		    std::cerr << "Bad sort column: " << sortcolumn << " could not be found.\n";
-		    return 0;
-		}
-	    }
-	    else
-	    {
-		std::cerr << "Bad sort column: " << sortcolumn << " could not be found.\n";
-		return 0;
-	    }
+
+	if (csvfile.getMaxFields() < sortkey.getNeededFields())
+	    csvfile.setMaxFields(sortkey.getNeededFields());
+    }
+
+    // bind the key of the input rows. with a join only the input columns are
+    // split from the rows, the join columns are taken from the build rows.
+    if (joiner.get())
+    {
+	std::string error;
+	if (!joiner->bindProbeKey(joinkeys[0], probecolumns, csvsymboltable, error)) {
+	    std::cerr << error << "\n";
+	    return 0;
 	}
+
+	unsigned int keyfields = csvsymboltable.getNeededFields(joinkeys[0].getVariables());
+
+	if (csvfile.getMaxFields() < keyfields)
+	    csvfile.setMaxFields(keyfields);
+
+	if (csvfile.getMaxFields() > probecolumns)
+	    csvfile.setMaxFields(probecolumns);
     }
 
     // determine offset and limit of the outputted data rows.
 
     unsigned int offset = 0;
-    unsigned int limit = datarecords.size();
+    unsigned int limit = UINT_MAX;
 
     if (offsetstring.size())
     {
@@ -344,36 +1633,299 @@ int main(int argc, char *argv[])
 	}
     }
 
+    // read only the lines selected by the index files of the columns
+    // compared with constants in the filter, if any exist.
+    std::vector<size_t> indexedlines;
+
+    if (!pt.isEmpty() && csvfile.isMapped())
+    {
+	std::vector<std::string> indexused, indexignored;
+
+	bool selected = select_indexed_lines(pt, csvfilename, headersmap, probecolumns,
+					     indexedlines, indexused, indexignored);
+
+	for(unsigned int i = 0; i < indexignored.size(); ++i)
+	    std::cerr << indexignored[i] << "\n";
+
+	if (selected)
+	{
+	    csvfile.selectLines(indexedlines);
+
+	    std::cerr << "Selected " << indexedlines.size() << " lines by the index of "
+		      << (indexused.size() == 1 ? "column" : "columns");
+	    for(unsigned int i = 0; i < indexused.size(); ++i)
+		std::cerr << (i == 0 ? " " : ", ") << indexused[i];
+	    std::cerr << "\n";
+	}
+    }
+
+    // aggregate the matching rows by groups, the sort key refers to the
+    // output columns then.
+    if (grouped)
+    {
+	return aggregate_groups(csvfile, pp, csvsymboltable, groupstring, aggregatestring,
+				sortcolumn, offset, limit, memorybudget, threads);
+    }
+
+    // with a limit only the first offset+limit rows in the output order are
+    // needed: without a sort key reading stops once they have matched, with
+    // a sort key they are kept in a bounded heap.
+    bool limited = (limitstring.size() && limit <= UINT_MAX - offset);
+    unsigned int needed = limited ? offset + limit : UINT_MAX;
+
+    std::auto_ptr<TopRecords> toprecords;
+
+    if (limited && !sortkey.empty())
+	toprecords.reset(new TopRecords(needed));
+
+    // table containing copied rows. while sorting the last column of each
+    // row holds its sort key.
+    std::vector< std::vector<std::string> > datarecords;
+
+    // the runs spilled when the table exceeds the memory budget, sorted by
+    // the sort key if one is given.
+    RecordSpiller spiller;
+    size_t memoryused = 0;
+
+    // number of rows matching the filter
+    unsigned int linescopied = 0;
+
+    // the rows are read in blocks referencing the input. only the fields of
+    // matching rows are completely split and copied into the table.
+    std::vector<CSVRow> block;
+    std::vector<CSVField> allfields, joinfields;
+    std::string sortkeytext;
+    unsigned int blockrows;
+
+    while( (!sortkey.empty() || linescopied < needed) &&
+	   (blockrows = csvfile.readRows(block, 1024)) > 0 )
+    {
+	for(unsigned int r = 0; r < blockrows; ++r)
+	{
+	    // with a join the row is combined with each matching row of the join
+	    // file, otherwise it is processed alone.
+	    unsigned int matches = 1;
+
+	    if (joiner.get())
+	    {
+		csvsymboltable.setRow(block[r].fields);
+		matches = joiner->probe(csvsymboltable);
+	    }
+
+	    for(unsigned int m = 0; m < matches; ++m)
+	    {
+		// the fields of the row, with a join combined with the match
+		const std::vector<CSVField> *rowfields = &block[r].fields;
+
+		if (joiner.get()) {
+		    joiner->combine(block[r].fields, m, joinfields);
+		    rowfields = &joinfields;
+		}
+
+		csvsymboltable.setRow(*rowfields);
+
+		// the result of a non-boolean expression or an exception text
+		std::string evalresult;
+		bool hasEvalResult = false;
+
+		// evaluate the expression for each row using the headers/data
+		// fields as variables
+		try
+		{
+		    linesprocessed++;
+		    if (!pp.isEmpty())
+		    {
+			stx::AnyScalar val = pp.evaluate( csvsymboltable.fillSlots(pp.getBoundSlots()),
+							  csvsymboltable );
+
+			if (val.isBooleanType())
+			{
+			    if (!val.getBoolean()) continue;
+			}
+			else
+			{
+			    // if calculation results in non-boolean value, then
+			    // save that value into a column "EvalResult"
+			    evalresult = val.getString();
+			    hasEvalResult = true;
+			}
+		    }
+		}
+		catch (stx::ExpressionParserException &e)
+		{
+		    // save exception text into column "EvalResult"
+		    evalresult = std::string("Exception: ") + e.what();
+		    hasEvalResult = true;
+		}
+
+		if (hasEvalResult && !addedEvalResult) {
+		    headers.push_back("EvalResult");
+		    addedEvalResult = true;
+		}
+
+		linescopied++;
+
+		// encode the sort key of the row from its fields
+		if (!sortkey.empty())
+		{
+		    sortkeytext.clear();
+		    sortkey.encode(sortkeytext, csvsymboltable, *rowfields,
+				   hasEvalResult ? &evalresult : NULL);
+		}
+
+		// skip rows before the offset or outside the heap's top rows
+		// without copying them.
+		if (toprecords.get())
+		{
+		    if (!toprecords->accepts(sortkeytext)) continue;
+		}
+		else if (sortkey.empty() && linescopied <= offset)
+		{
+		    continue;
+		}
+
+		// copy the fields of the matching row
+		const std::vector<CSVField> *datafields = rowfields;
+
+		if (csvfile.getMaxFields() != UINT_MAX)
+		{
+		    csvfile.splitFields(block[r].line, block[r].line + block[r].linesize, allfields);
+		    datafields = &allfields;
+
+		    if (joiner.get()) {
+			joiner->combine(allfields, m, joinfields);
+			datafields = &joinfields;
+		    }
+		}
+
+		std::vector<std::string> datacolumns;
+
+		datacolumns.reserve(datafields->size() + 2);
+		for(unsigned int i = 0; i < datafields->size(); ++i)
+		    datacolumns.push_back( (*datafields)[i].str() );
+
+		if (hasEvalResult)
+		{
+		    // add calculation result as last column
+		    while( datacolumns.size() + 1 < headers.size() )
+			datacolumns.push_back("");
+
+		    datacolumns.push_back(evalresult);
+		}
+
+		// the sort key is kept as last column
+		if (!sortkey.empty())
+		    datacolumns.push_back(sortkeytext);
+
+		if (toprecords.get())
+		{
+		    toprecords->insert(datacolumns);
+		}
+		else
+		{
+		    datarecords.push_back( std::vector<std::string>() );
+		    datarecords.back().swap(datacolumns);
+
+		    memoryused += record_memory(datarecords.back());
+
+		    if (memorybudget && memoryused > memorybudget)
+		    {
+			// the index breaks ties of the sort keys, so merging
+			// the runs yields the rows with equal keys in input
+			// order.
+			if (!sortkey.empty())
+			    sort_records(datarecords, threads);
+
+			if (!spiller.spill(datarecords)) {
+			    std::cerr << "Error writing temporary file of sorted run.\n";
+			    return 0;
+			}
+
+			memoryused = 0;
+		    }
+
+		    // stop combining once the limit is reached without sorting
+		    if (sortkey.empty() && linescopied >= needed) break;
+		}
+	    }
+
+	    // stop reading once the limit is reached without sorting
+	    if (sortkey.empty() && linescopied >= needed) break;
+	}
+    }
+
+    // sorting by "EvalResult" requires the column
+    if (sortkey.usesEvalResult() && !addedEvalResult) {
+	std::cerr << "Bad sort column: EvalResult could not be found.\n";
+	return 0;
+    }
+
+    if (toprecords.get())
+    {
+	// the heap holds the first rows in sort order
+	toprecords->getSorted(datarecords);
+    }
+    else if (!sortkey.empty())
+    {
+	// sort the result table, or the last run which is merged with the
+	// spilled ones
+	sort_records(datarecords, threads);
+    }
+    else
+    {
+	// the rows before the offset were not copied
+	offset = 0;
+    }
+
     // write a processing summary to stderr
     std::cerr << "Processed " << linesprocessed << " lines, "
-	      << "copied " << datarecords.size() << " and "
-	      << "skipped " << (linesprocessed - datarecords.size()) << " lines" << "\n";
+	      << "copied " << linescopied << " and "
+	      << "skipped " << (linesprocessed - linescopied) << " lines" << "\n";
 
+    if (joiner.get())
+    {
+	std::cerr << "Joined " << joiner->getProbed() << " lines with "
+		  << joiner->getRows() << " lines of " << joiner->getKeys() << " keys, "
+		  << "rejected " << joiner->getBloomRejected() << " by bloom filter and "
+		  << joiner->getHashRejected() << " by hash table" << "\n";
+    }
 
-    // write column headers to stdout
-    for(std::vector<std::string>::const_iterator coliter = headers.begin();
-	coliter != headers.end(); ++coliter)
+    if (spiller.size())
     {
-	if (coliter != headers.begin()) std::cout << delimiter;
-	std::cout << *coliter;
+	std::cerr << "Spilled " << spiller.size() << " runs of "
+		  << spiller.getBytes() << " bytes to temporary files" << "\n";
     }
-    std::cout << "\n";
+
+    // write column headers to stdout
+    write_datarecord(std::cout, headers);
 
     // output data rows from "offset" to "offset+limit"
 
-    for(unsigned int current = offset;
-	current < offset + limit && current < datarecords.size();
-	++current)
+    if (spiller.size())
     {
-	std::vector<std::string> &currrecord = datarecords[current];
+	// merge the spilled runs and the last one in memory
+	DataRecordSortRelation relation;
+	RunMerger merger(sortkey.empty() ? NULL : &relation, spiller, datarecords);
+	std::vector<std::string> record;
 
-	// output this data row to std::cout
-	for(std::vector<std::string>::const_iterator coliter = currrecord.begin();
-	    coliter != currrecord.end(); ++coliter)
+	for(unsigned int current = 0; merger.next(record); ++current)
 	{
-	    if (coliter != currrecord.begin()) std::cout << delimiter;
-	    std::cout << *coliter;
+	    if (current < offset) continue;
+	    if (current - offset >= limit) break;
+
+	    write_datarecord(std::cout, record, !sortkey.empty());
 	}
-	std::cout << "\n";
+
+	if (merger.isFailed())
+	    std::cerr << "Error reading temporary file of sorted run.\n";
+
+	return 0;
+    }
+
+    for(unsigned int current = offset;
+	current - offset < limit && current < datarecords.size();
+	++current)
+    {
+	write_datarecord(std::cout, datarecords[current], !sortkey.empty());
     }
 }
@@ -0,0 +1,576 @@
+// $Id$
+
+/*
+ * STX Expression Parser C++ Framework v0.7
+ * Copyright (C) 2007 Timo Bingmann
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/** \file fileindex.h
+ * Persistent column indexes of the csvtool example: sidecar files next to a
+ * CSV file holding the lines' offsets sorted by the values of a column and a
+ * bloom filter of the values. They select the lines which may match a filter
+ * comparing the columns with constants, which are then read by their offsets
+ * instead of scanning the whole file.
+ */
+
+#ifndef _STX_CSVTOOL_FILEINDEX_H_
+#define _STX_CSVTOOL_FILEINDEX_H_
+
+#include "ExpressionParser.h"
+#include "../csvreader.h"
+#include "sortkey.h"
+#include "bloomfilter.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <iterator>
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// the header of an index file. It is followed by the column name, the words
+// of the bloom filter, the entries and the keys, each padded to eight bytes.
+// The size and modification time of the CSV file when the index was built
+// invalidate the index once the file changes.
+struct IndexFileHeader
+{
+    char		magic[8];
+    unsigned long long	filesize;
+    long long		filemtime;
+    unsigned long long	column;
+    unsigned long long	namesize;
+    unsigned long long	bloombits;
+    unsigned long long	entries;
+    unsigned long long	keybytes;
+};
+
+// one entry of an index file: the position of its key in the keys, which
+// ends at the next entry's key, and the offset of the line in the CSV file.
+// The entries are sorted by key, and equal keys by offset.
+struct IndexFileEntry
+{
+    unsigned long long	keypos;
+    unsigned long long	offset;
+};
+
+// the persistent index of one column of a CSV file, which is mapped into
+// memory. The keys of the values are those of the sort key: numbers come
+// first in numeric order, then strings in natural order. Numbers are the
+// columns' values recognized as numbers like the CSVRowSymbolTable does.
+class ColumnIndex
+{
+private:
+    // the mapped index file
+    void		*mapping;
+    size_t		mapsize;
+
+    // the parts of the mapped file
+    const IndexFileHeader *header;
+    const unsigned int	*bloomwords;
+    const IndexFileEntry *entries;
+    const char		*keys;
+
+    // disabled copy constructor
+    ColumnIndex(const ColumnIndex &i);
+
+    // disabled assignment operator
+    ColumnIndex& operator=(const ColumnIndex &i);
+
+    // the magic of the index files, which includes their version
+    static const char* magic()
+    {
+	return "STXCIDX1";
+    }
+
+    // the number of bytes padding n to a multiple of eight
+    static inline size_t padding(size_t n)
+    {
+	return (8 - n % 8) % 8;
+    }
+
+    // compare the key of entry i with the given key bytewise.
+    inline int compareEntry(size_t i, const std::string &key) const
+    {
+	size_t size = ((i + 1 < header->entries) ? entries[i + 1].keypos : header->keybytes) - entries[i].keypos;
+
+	int cmp = memcmp(keys + entries[i].keypos, key.data(), std::min(size, key.size()));
+	if (cmp != 0) return cmp;
+
+	return (size < key.size()) ? -1 : (size > key.size()) ? 1 : 0;
+    }
+
+    // return the first entry whose key is not less than the given key, or
+    // with upper set the first one whose key is greater.
+    size_t findEntry(const std::string &key, bool upper) const
+    {
+	size_t lo = 0, hi = header->entries;
+
+	while (lo < hi)
+	{
+	    size_t mid = lo + (hi - lo) / 2;
+	    int cmp = compareEntry(mid, key);
+
+	    if (cmp < 0 || (upper && cmp == 0))
+		lo = mid + 1;
+	    else
+		hi = mid;
+	}
+
+	return lo;
+    }
+
+    // append the offsets of the entries [first,last) to the vector.
+    void appendOffsets(size_t first, size_t last, std::vector<size_t> &offsets) const
+    {
+	for(size_t i = first; i < last; ++i)
+	    offsets.push_back(entries[i].offset);
+    }
+
+public:
+    ColumnIndex()
+	: mapping(NULL), mapsize(0), header(NULL), bloomwords(NULL),
+	  entries(NULL), keys(NULL)
+    {
+    }
+
+    ~ColumnIndex()
+    {
+	if (mapping) munmap(mapping, mapsize);
+    }
+
+    // the name of the index file of a column: the CSV file's name followed by
+    // the column name, in which all but letters, digits, '-' and '_' are
+    // replaced by '_'.
+    static std::string filename(const std::string &csvfilename, const std::string &column)
+    {
+	std::string name = csvfilename + ".";
+
+	for(std::string::size_type i = 0; i < column.size(); ++i)
+	{
+	    char c = column[i];
+	    bool plain = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+		(c >= '0' && c <= '9') || c == '-' || c == '_';
+
+	    name += plain ? c : '_';
+	}
+
+	return name + ".idx";
+    }
+
+    // append the key of the value of a column in the fields of a row to key.
+    // a missing field is an empty string like in CSVRowSymbolTable.
+    static inline void appendFieldKey(std::string &key, const std::vector<CSVField> &fields,
+				      unsigned int column)
+    {
+	stx::AnyScalar val("");
+
+	if (column < fields.size())
+	    val.setAutoStringRef(fields[column].data, fields[column].size);
+
+	append_value_key(key, val);
+    }
+
+    // map the index file of the column of the CSV file, which has the given
+    // number. returns false if there is no such file. returns false and the
+    // message in error if the file is not a valid index of the column or
+    // the CSV file changed since it was built.
+    bool open(const std::string &csvfilename, const std::string &column,
+	      unsigned int colnum, std::string &error)
+    {
+	std::string idxfilename = filename(csvfilename, column);
+
+	struct stat csvst, st;
+	if (stat(csvfilename.c_str(), &csvst) != 0) return false;
+
+	int fd = ::open(idxfilename.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+
+	if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(IndexFileHeader))) {
+	    ::close(fd);
+	    error = "Index file " + idxfilename + " is invalid, ignored.";
+	    return false;
+	}
+
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+
+	if (map == MAP_FAILED) {
+	    error = "Index file " + idxfilename + " could not be mapped, ignored.";
+	    return false;
+	}
+
+	mapping = map;
+	mapsize = st.st_size;
+
+	const char *p = static_cast<const char*>(map);
+	header = reinterpret_cast<const IndexFileHeader*>(p);
+	p += sizeof(IndexFileHeader);
+
+	// check the size of the parts before referencing them, the counts
+	// are bounded first so that the sizes cannot overflow.
+	if (header->namesize > mapsize || header->bloombits / 8 > mapsize ||
+	    header->entries > mapsize / sizeof(IndexFileEntry) || header->keybytes > mapsize)
+	{
+	    error = "Index file " + idxfilename + " is invalid, ignored.";
+	    return false;
+	}
+
+	unsigned long long namebytes = header->namesize + padding(header->namesize);
+	unsigned long long bloombytes = (header->bloombits + 31) / 32 * 4;
+	bloombytes += padding(bloombytes);
+
+	if (memcmp(header->magic, magic(), 8) != 0 ||
+	    mapsize != sizeof(IndexFileHeader) + namebytes + bloombytes
+	    + header->entries * sizeof(IndexFileEntry) + header->keybytes)
+	{
+	    error = "Index file " + idxfilename + " is invalid, ignored.";
+	    return false;
+	}
+
+	if (header->namesize != column.size() || memcmp(p, column.data(), column.size()) != 0 ||
+	    header->column != colnum)
+	{
+	    error = "Index file " + idxfilename + " indexes another column, ignored.";
+	    return false;
+	}
+
+	if (header->filesize != static_cast<unsigned long long>(csvst.st_size) ||
+	    header->filemtime != static_cast<long long>(csvst.st_mtime))
+	{
+	    error = "Index file " + idxfilename + " is out of date, ignored.";
+	    return false;
+	}
+
+	p += namebytes;
+	bloomwords = reinterpret_cast<const unsigned int*>(p);
+	p += bloombytes;
+	entries = reinterpret_cast<const IndexFileEntry*>(p);
+	p += header->entries * sizeof(IndexFileEntry);
+	keys = p;
+
+	// each key ends where the next one starts
+	for(size_t i = 0; i < header->entries; ++i)
+	{
+	    if (entries[i].keypos > ((i + 1 < header->entries) ? entries[i + 1].keypos : header->keybytes))
+	    {
+		error = "Index file " + idxfilename + " is invalid, ignored.";
+		return false;
+	    }
+	}
+
+	return true;
+    }
+
+    // look up the lines for the predicate "column op value". matching gets
+    // the offsets of the lines for which it may be true, throwing those for
+    // which its evaluation may throw an exception, both in increasing order.
+    // The sets may contain more lines, those not contained are certain.
+    // Comparing a string with a number converts the string, which usually
+    // throws, so the lines of values of the other type are throwing. Numbers
+    // are looked up for all comparisons but inequality, strings only for
+    // equality because their order differs from the natural order of the
+    // keys. returns false if the predicate cannot be looked up.
+    bool lookup(int op, const stx::AnyScalar &value,
+		std::vector<size_t> &matching, std::vector<size_t> &throwing) const
+    {
+	matching.clear();
+	throwing.clear();
+
+	// only signed types convert the values in order
+	stx::AnyScalar::attrtype_t type = value.getType();
+
+	bool number = (type == stx::AnyScalar::ATTRTYPE_CHAR || type == stx::AnyScalar::ATTRTYPE_SHORT ||
+		       type == stx::AnyScalar::ATTRTYPE_INTEGER || type == stx::AnyScalar::ATTRTYPE_LONG ||
+		       type == stx::AnyScalar::ATTRTYPE_DOUBLE);
+
+	if (op == stx::ParseProgram::OP_NOTEQUAL) return false;
+	if (!number && (type != stx::AnyScalar::ATTRTYPE_STRING || op != stx::ParseProgram::OP_EQUAL))
+	    return false;
+
+	std::string key;
+	append_value_key(key, value);
+
+	// the numbers end where the strings start
+	size_t strings = findEntry(std::string(1, static_cast<char>(3)), false);
+
+	// the conversions are monotonic, but may round different values to
+	// the same, so the bounds are inclusive.
+	size_t first = 0, last = 0;
+
+	if (op == stx::ParseProgram::OP_EQUAL)
+	{
+	    if (BloomFilter::contains(bloomwords, header->bloombits, key)) {
+		first = findEntry(key, false);
+		last = findEntry(key, true);
+	    }
+	}
+	else if (op == stx::ParseProgram::OP_LESS || op == stx::ParseProgram::OP_LESSEQUAL)
+	{
+	    first = 0;
+	    last = findEntry(key, true);
+	}
+	else
+	{
+	    first = findEntry(key, false);
+	    last = strings;
+	}
+
+	appendOffsets(first, last, matching);
+	std::sort(matching.begin(), matching.end());
+
+	if (number)
+	    appendOffsets(strings, header->entries, throwing);
+	else
+	    appendOffsets(0, strings, throwing);
+
+	std::sort(throwing.begin(), throwing.end());
+
+	return true;
+    }
+
+    // write the index file of a column from the keys of its values and the
+    // offsets of their lines. The entries are sorted using the given number
+    // of threads. returns false and the message in error if the file cannot
+    // be written.
+    static bool write(const std::string &csvfilename, const struct stat &csvst,
+		      const std::string &column, unsigned int colnum,
+		      const std::vector<std::string> &linekeys, const std::vector<size_t> &offsets,
+		      unsigned int threads, std::string &error)
+    {
+	std::vector<SortEntry> sorted(linekeys.size());
+
+	for(unsigned int i = 0; i < linekeys.size(); ++i)
+	{
+	    sorted[i].key = &linekeys[i];
+	    sorted[i].index = i;
+	}
+
+	parallel_sort(sorted, threads);
+
+	// the bloom filter holds the distinct keys
+	size_t distinct = 0;
+
+	for(size_t i = 0; i < sorted.size(); ++i)
+	{
+	    if (i == 0 || *sorted[i].key != *sorted[i-1].key) distinct++;
+	}
+
+	BloomFilter bloom;
+	bloom.init(distinct);
+
+	for(size_t i = 0; i < sorted.size(); ++i)
+	{
+	    if (i == 0 || *sorted[i].key != *sorted[i-1].key) bloom.insert(*sorted[i].key);
+	}
+
+	IndexFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, magic(), 8);
+	header.filesize = csvst.st_size;
+	header.filemtime = csvst.st_mtime;
+	header.column = colnum;
+	header.namesize = column.size();
+	header.bloombits = bloom.getBitCount();
+	header.entries = sorted.size();
+
+	std::vector<IndexFileEntry> fileentries(sorted.size());
+
+	for(size_t i = 0; i < sorted.size(); ++i)
+	{
+	    fileentries[i].keypos = header.keybytes;
+	    fileentries[i].offset = offsets[ sorted[i].index ];
+	    header.keybytes += sorted[i].key->size();
+	}
+
+	// write a temporary file, which replaces the index when complete
+	std::string idxfilename = filename(csvfilename, column);
+	std::string tmpfilename = idxfilename + ".tmp";
+
+	FILE *file = fopen(tmpfilename.c_str(), "wb");
+	if (!file) {
+	    error = "Error writing index file " + idxfilename + ".";
+	    return false;
+	}
+
+	static const char zeros[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+	const std::vector<unsigned int> &words = bloom.getWords();
+	size_t bloombytes = words.size() * sizeof(unsigned int);
+
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(column.data(), 1, column.size(), file);
+	fwrite(zeros, 1, padding(column.size()), file);
+	fwrite(&words[0], 1, bloombytes, file);
+	fwrite(zeros, 1, padding(bloombytes), file);
+
+	if (!fileentries.empty())
+	    fwrite(&fileentries[0], sizeof(IndexFileEntry), fileentries.size(), file);
+
+	for(size_t i = 0; i < sorted.size(); ++i)
+	    fwrite(sorted[i].key->data(), 1, sorted[i].key->size(), file);
+
+	bool ok = (fflush(file) == 0 && !ferror(file));
+	ok = (fclose(file) == 0) && ok;
+
+	if (!ok || rename(tmpfilename.c_str(), idxfilename.c_str()) != 0) {
+	    unlink(tmpfilename.c_str());
+	    error = "Error writing index file " + idxfilename + ".";
+	    return false;
+	}
+
+	return true;
+    }
+};
+
+// build the index files of the columns of a mapped CSV file, whose header
+// row was read: all rows are scanned once collecting the keys of the
+// columns' values, which are then sorted and written for each column.
+// returns false and the message in error if the file is not mapped or an
+// index file cannot be written. lines is set to the number of lines indexed.
+static bool build_column_indexes(CSVReader &csvfile, const std::string &csvfilename,
+				 const std::vector<std::string> &columns,
+				 const std::vector<unsigned int> &colnums,
+				 unsigned int threads, unsigned int &lines, std::string &error)
+{
+    struct stat csvst;
+
+    if (!csvfile.isMapped() || stat(csvfilename.c_str(), &csvst) != 0) {
+	error = "Indexes can only be built for regular files.";
+	return false;
+    }
+
+    unsigned int maxfields = 0;
+    for(unsigned int c = 0; c < colnums.size(); ++c)
+	maxfields = std::max(maxfields, colnums[c] + 1);
+
+    csvfile.setMaxFields(maxfields);
+
+    std::vector< std::vector<std::string> > linekeys(columns.size());
+    std::vector<size_t> offsets;
+
+    std::vector<CSVRow> block;
+    unsigned int blockrows;
+
+    while( (blockrows = csvfile.readRows(block, 1024)) > 0 )
+    {
+	for(unsigned int r = 0; r < blockrows; ++r)
+	{
+	    offsets.push_back(block[r].line - csvfile.getBegin());
+
+	    for(unsigned int c = 0; c < colnums.size(); ++c)
+	    {
+		linekeys[c].push_back(std::string());
+		ColumnIndex::appendFieldKey(linekeys[c].back(), block[r].fields, colnums[c]);
+	    }
+	}
+    }
+
+    lines = offsets.size();
+
+    for(unsigned int c = 0; c < columns.size(); ++c)
+    {
+	if (!ColumnIndex::write(csvfilename, csvst, columns[c], colnums[c],
+				linekeys[c], offsets, threads, error))
+	    return false;
+
+	std::vector<std::string>().swap(linekeys[c]);
+    }
+
+    return true;
+}
+
+// select the lines of the CSV file which may match the filter using the index
+// files of its columns. The filter's and-chain is evaluated short-circuit
+// from left to right, and a row whose evaluation throws an exception is
+// output. Therefore only the leading operands comparing a column with a
+// constant, for which an index exists, can exclude lines: a line is excluded
+// by the first of them which is certainly false for it, unless a preceding
+// one may throw. Only the first columns are looked up, the others of a joined
+// row have no index. The offsets of the lines are put into lines in
+// increasing order and the names of the columns used into used. returns
+// false if no index applies. Invalid index files are reported in ignored.
+static bool select_indexed_lines(const stx::ParseTree &pt, const std::string &csvfilename,
+				 const std::map<std::string, unsigned int> &headersmap,
+				 unsigned int columns, std::vector<size_t> &lines,
+				 std::vector<std::string> &used, std::vector<std::string> &ignored)
+{
+    std::vector<stx::ParseTree> operands;
+    pt.getConjuncts(operands);
+
+    std::vector<size_t> throwing, matching, throwhere, passing, merged;
+
+    for(unsigned int i = 0; i < operands.size(); ++i)
+    {
+	std::string varname;
+	int op;
+	stx::AnyScalar value;
+
+	if (!operands[i].getPredicate(varname, op, value)) break;
+
+	std::map<std::string, unsigned int>::const_iterator
+	    colfind = headersmap.find(varname);
+
+	if (colfind == headersmap.end() || colfind->second >= columns) break;
+
+	ColumnIndex index;
+	std::string error;
+
+	if (!index.open(csvfilename, varname, colfind->second, error)) {
+	    if (error.size()) ignored.push_back(error);
+	    break;
+	}
+
+	if (!index.lookup(op, value, matching, throwhere)) break;
+
+	// lines pass this operand if it may be true or throw, or if a
+	// preceding one may throw.
+	passing.clear();
+	std::set_union(matching.begin(), matching.end(), throwhere.begin(), throwhere.end(),
+		       std::back_inserter(passing));
+
+	merged.clear();
+	std::set_union(passing.begin(), passing.end(), throwing.begin(), throwing.end(),
+		       std::back_inserter(merged));
+
+	if (used.empty()) {
+	    lines.swap(merged);
+	}
+	else {
+	    passing.clear();
+	    std::set_intersection(lines.begin(), lines.end(), merged.begin(), merged.end(),
+				  std::back_inserter(passing));
+	    lines.swap(passing);
+	}
+
+	merged.clear();
+	std::set_union(throwing.begin(), throwing.end(), throwhere.begin(), throwhere.end(),
+		       std::back_inserter(merged));
+	throwing.swap(merged);
+
+	if (std::find(used.begin(), used.end(), varname) == used.end())
+	    used.push_back(varname);
+    }
+
+    return !used.empty();
+}
+
+#endif // _STX_CSVTOOL_FILEINDEX_H_
@@ -0,0 +1,365 @@
+// $Id$
+
+/*
+ * STX Expression Parser C++ Framework v0.7
+ * Copyright (C) 2007 Timo Bingmann
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/** \file hashjoin.h
+ * Hash join of the csvtool example: the rows of a second CSV file are loaded
+ * into a hash table keyed by an expression, which is probed with the key of
+ * each input row. A bloom filter rejects most input rows without a match
+ * before the hash table is probed.
+ */
+
+#ifndef _STX_CSVTOOL_HASHJOIN_H_
+#define _STX_CSVTOOL_HASHJOIN_H_
+
+#include "ExpressionParser.h"
+#include "../csvreader.h"
+#include "bloomfilter.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+
+#include <limits.h>
+
+#include <boost/unordered_map.hpp>
+
+// joins the input rows with the rows of a second CSV file, the build
+// side. The build side is loaded into memory: a mapped file is referenced,
+// other input is copied into one contiguous buffer, and each row is stored
+// only as its offset and length. Its fields are split again for each match.
+// The rows are hashed by the text of a key expression over the build side's
+// columns, rows with equal keys are chained in input order. Each input row
+// is probed with the text of its own key expression, and then combined with
+// each matching build row: the build columns follow the input columns and
+// are named by the prefix "join_".
+class HashJoin
+{
+private:
+    // one row of the build side
+    struct BuildRow
+    {
+	// the line's offset in the build data and its length
+	size_t		offset;
+	unsigned int	size;
+
+	// the next row with an equal key or UINT_MAX
+	unsigned int	next;
+    };
+
+    // the first and last row of each key
+    typedef boost::unordered_map<std::string, std::pair<unsigned int, unsigned int> > keymap_type;
+
+    // the reader of the build side, which keeps a mapped file
+    CSVReader		reader;
+
+    // the copied lines of a build side which is not mapped
+    std::string		buffer;
+
+    // the start of the build data
+    const char		*base;
+
+    // the column headers of the build side
+    std::vector<std::string> headers;
+
+    // the rows of the build side and the hash table of their keys
+    std::vector<BuildRow> rows;
+    keymap_type		keymap;
+
+    // the bloom filter of the keys in the hash table
+    BloomFilter		bloom;
+
+    // the key program of the input rows
+    stx::ParseProgram	probekey;
+
+    // number of input columns preceding the build columns
+    unsigned int	probecolumns;
+
+    // the build rows matching the last probe
+    std::vector<unsigned int> matches;
+
+    // the key of the last probe and the fields of a build row
+    std::string		key;
+    std::vector<CSVField> buildfields;
+
+    // statistics of the probes
+    unsigned int	probed, bloomrejected, hashrejected;
+
+    // disabled copy constructor
+    HashJoin(const HashJoin &j);
+
+    // disabled assignment operator
+    HashJoin& operator=(const HashJoin &j);
+
+public:
+    explicit HashJoin(char delimiter)
+	: reader(delimiter), base(NULL), probecolumns(0),
+	  probed(0), bloomrejected(0), hashrejected(0)
+    {
+    }
+
+    // load the build side from the file and hash its rows by the key
+    // expression over its columns. Rows whose key throws an exception are
+    // skipped. returns false and the message in error if the file cannot be
+    // read or the key not be bound.
+    bool load(const std::string &filename, const stx::ParseTree &buildkey, std::string &error)
+    {
+	if (!reader.openFile(filename.c_str())) {
+	    error = "Error opening CSV file " + filename;
+	    return false;
+	}
+
+	const char *mapbase = reader.getPos();
+
+	CSVRow headerrow;
+	if (!reader.readRow(headerrow)) {
+	    error = "Error read column headers of " + filename + ": no input";
+	    return false;
+	}
+
+	std::map<std::string, unsigned int> headersmap;
+
+	for(unsigned int i = 0; i < headerrow.fields.size(); ++i)
+	{
+	    headers.push_back( headerrow.fields[i].str() );
+	    headersmap[ headers.back() ] = i;
+	}
+
+	CSVRowSymbolTable symboltable(headersmap);
+	stx::ParseProgram keyprogram;
+
+	std::set<std::string> varset = buildkey.getVariables();
+
+	for(std::set<std::string>::const_iterator vi = varset.begin();
+	    vi != varset.end(); ++vi)
+	{
+	    if (headersmap.find(*vi) == headersmap.end()) {
+		error = "Bad join key: " + buildkey.toString() + ": column " + *vi + " could not be found in " + filename + ".";
+		return false;
+	    }
+	}
+
+	try
+	{
+	    keyprogram = buildkey.compile();
+	    keyprogram.bindVariables(headersmap);
+	    keyprogram.bindFunctions(symboltable);
+	}
+	catch (stx::ExpressionParserException &e)
+	{
+	    error = std::string("ExpressionParserException: ") + e.what();
+	    return false;
+	}
+
+	reader.setMaxFields( symboltable.getNeededFields(varset) );
+
+	std::vector<CSVRow> block;
+	unsigned int blockrows;
+
+	while( (blockrows = reader.readRows(block, 1024)) > 0 )
+	{
+	    for(unsigned int r = 0; r < blockrows; ++r)
+	    {
+		symboltable.setRow(block[r].fields);
+
+		try
+		{
+		    key = keyprogram.evaluate( symboltable.fillSlots(keyprogram.getBoundSlots()),
+					       symboltable ).getString();
+		}
+		catch (stx::ExpressionParserException &e)
+		{
+		    continue;
+		}
+
+		BuildRow row;
+		row.size = block[r].linesize;
+		row.next = UINT_MAX;
+
+		if (reader.isMapped()) {
+		    row.offset = block[r].line - mapbase;
+		}
+		else {
+		    row.offset = buffer.size();
+		    buffer.append(block[r].line, block[r].linesize);
+		}
+
+		unsigned int index = rows.size();
+		rows.push_back(row);
+
+		// append the row to the chain of its key
+		keymap_type::iterator ki = keymap.find(key);
+
+		if (ki == keymap.end()) {
+		    keymap.insert(keymap_type::value_type(key, std::make_pair(index, index)));
+		}
+		else {
+		    rows[ki->second.second].next = index;
+		    ki->second.second = index;
+		}
+	    }
+	}
+
+	if (reader.isMapped()) {
+	    base = mapbase;
+	}
+	else {
+	    base = buffer.data();
+	    reader.close();
+	}
+
+	bloom.init(keymap.size());
+
+	for(keymap_type::const_iterator ki = keymap.begin(); ki != keymap.end(); ++ki)
+	    bloom.insert(ki->first);
+
+	return true;
+    }
+
+    // return the column headers of the build side
+    inline const std::vector<std::string>& getHeaders() const
+    {
+	return headers;
+    }
+
+    // number of rows and distinct keys loaded
+    inline unsigned int getRows() const
+    {
+	return rows.size();
+    }
+
+    inline unsigned int getKeys() const
+    {
+	return keymap.size();
+    }
+
+    // statistics of the probes: the number of input rows probed and those
+    // rejected by the bloom filter and the hash table.
+    inline unsigned int getProbed() const
+    {
+	return probed;
+    }
+
+    inline unsigned int getBloomRejected() const
+    {
+	return bloomrejected;
+    }
+
+    inline unsigned int getHashRejected() const
+    {
+	return hashrejected;
+    }
+
+    // bind the key expression of the input rows to the first _probecolumns
+    // columns of the symbol table. returns false and the message in error
+    // if it cannot be bound.
+    bool bindProbeKey(const stx::ParseTree &probetree, unsigned int _probecolumns,
+		      CSVRowSymbolTable &symboltable, std::string &error)
+    {
+	probecolumns = _probecolumns;
+
+	std::set<std::string> varset = probetree.getVariables();
+
+	for(std::set<std::string>::const_iterator vi = varset.begin();
+	    vi != varset.end(); ++vi)
+	{
+	    std::map<std::string, unsigned int>::const_iterator
+		colfind = symboltable.headersmap.find(*vi);
+
+	    if (colfind == symboltable.headersmap.end() || colfind->second >= probecolumns) {
+		error = "Bad join key: " + probetree.toString() + ": column " + *vi + " could not be found.";
+		return false;
+	    }
+	}
+
+	try
+	{
+	    probekey = probetree.compile();
+	    probekey.bindVariables(symboltable.headersmap);
+	    probekey.bindFunctions(symboltable);
+	}
+	catch (stx::ExpressionParserException &e)
+	{
+	    error = std::string("ExpressionParserException: ") + e.what();
+	    return false;
+	}
+
+	return true;
+    }
+
+    // evaluate the key of the current input row of the symbol table and find
+    // the matching build rows. returns their number.
+    unsigned int probe(CSVRowSymbolTable &symboltable)
+    {
+	matches.clear();
+	probed++;
+
+	try
+	{
+	    key = probekey.evaluate( symboltable.fillSlots(probekey.getBoundSlots()),
+				     symboltable ).getString();
+	}
+	catch (stx::ExpressionParserException &e)
+	{
+	    // rows without a key match nothing
+	    return 0;
+	}
+
+	if (!bloom.contains(key)) {
+	    bloomrejected++;
+	    return 0;
+	}
+
+	keymap_type::const_iterator ki = keymap.find(key);
+
+	if (ki == keymap.end()) {
+	    hashrejected++;
+	    return 0;
+	}
+
+	for(unsigned int i = ki->second.first; i != UINT_MAX; i = rows[i].next)
+	    matches.push_back(i);
+
+	return matches.size();
+    }
+
+    // combine the fields of the input row with those of the m-th match of the
+    // last probe. Missing fields of both are empty.
+    void combine(const std::vector<CSVField> &probefields, unsigned int m,
+		 std::vector<CSVField> &fields)
+    {
+	static const CSVField empty = { "", 0 };
+
+	fields.assign(probefields.begin(),
+		      probefields.begin() + std::min<size_t>(probefields.size(), probecolumns));
+	fields.resize(probecolumns, empty);
+
+	const BuildRow &row = rows[ matches[m] ];
+
+	reader.splitFields(base + row.offset, base + row.offset + row.size,
+			   buildfields, headers.size());
+	buildfields.resize(headers.size(), empty);
+
+	fields.insert(fields.end(), buildfields.begin(), buildfields.end());
+    }
+};
+
+#endif // _STX_CSVTOOL_HASHJOIN_H_
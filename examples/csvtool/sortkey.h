@@ -0,0 +1,512 @@
+// $Id$
+
+/*
+ * STX Expression Parser C++ Framework v0.7
+ * Copyright (C) 2007 Timo Bingmann
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/** \file sortkey.h
+ * Normalized sort keys of the csvtool example: the sort columns or
+ * expressions of a row are encoded once into a byte string, which compares
+ * with memcmp() like the natural sort order of strnatcasecmp(). Also contains
+ * the parallel sort of the keys.
+ */
+
+#ifndef _STX_CSVTOOL_SORTKEY_H_
+#define _STX_CSVTOOL_SORTKEY_H_
+
+#include "ExpressionParser.h"
+#include "../csvreader.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#include <ctype.h>
+#include <string.h>
+#include <pthread.h>
+
+// append the natural sort key of the text s[0,n) to key. Comparing the keys
+// bytewise yields the same order as strnatcasecmp() on the texts, which
+// ignores white space, folds case and compares runs of digits by their
+// value. The characters are compared as signed chars like strnatcasecmp()
+// does, so each byte is flipped at the sign bit. The end of the text is
+// encoded as a flipped 0 byte, thus the keys are prefix-free and can be
+// concatenated or inverted for descending order. A run of digits starts
+// with the flipped digit '0' or '1':
+// - a run with a leading zero is compared digit by digit as a fraction. It
+//   is encoded as its flipped digits followed by a 0 byte, which orders a
+//   shorter run before a longer one.
+// - other runs are compared first by their length, then by their digits.
+//   They are encoded as a flipped '1', the length in four bytes and the
+//   flipped digits.
+// Like the texts passed as C strings, the text ends at the first 0 byte.
+static inline void append_natural_key(std::string &key, const char *s, size_t n)
+{
+    const char *end = static_cast<const char*>(memchr(s, 0, n));
+    if (!end) end = s + n;
+
+    while (s != end)
+    {
+	unsigned char c = *s;
+
+	if (isspace(c)) {
+	    ++s;
+	}
+	else if (isdigit(c))
+	{
+	    const char *run = s;
+	    while (s != end && isdigit(static_cast<unsigned char>(*s))) ++s;
+
+	    if (c == '0')
+	    {
+		for(; run != s; ++run)
+		    key += static_cast<char>(*run ^ 0x80);
+
+		key += static_cast<char>(0);
+	    }
+	    else
+	    {
+		unsigned int length = s - run;
+
+		key += static_cast<char>('1' ^ 0x80);
+		key += static_cast<char>(length >> 24);
+		key += static_cast<char>(length >> 16);
+		key += static_cast<char>(length >> 8);
+		key += static_cast<char>(length);
+
+		for(; run != s; ++run)
+		    key += static_cast<char>(*run ^ 0x80);
+	    }
+	}
+	else
+	{
+	    key += static_cast<char>(toupper(c) ^ 0x80);
+	    ++s;
+	}
+    }
+
+    key += static_cast<char>(0x80);
+}
+
+// append the sort key of an evaluated value: exceptions come first, then
+// numbers in numeric order and finally strings in natural order. Each is
+// marked by a type byte, numbers are followed by the eight bytes of the
+// double, whose sign bit is flipped or which are all inverted if negative.
+static inline void append_value_key(std::string &key, const stx::AnyScalar &val)
+{
+    if (val.isBooleanType() || val.isIntegerType() || val.isFloatingType())
+    {
+	// adding 0.0 turns -0.0 into 0.0
+	double d = val.getDouble() + 0.0;
+
+	unsigned long long bits;
+	memcpy(&bits, &d, sizeof(bits));
+
+	if (bits & 0x8000000000000000ULL)
+	    bits = ~bits;
+	else
+	    bits |= 0x8000000000000000ULL;
+
+	key += static_cast<char>(2);
+	for(int shift = 56; shift >= 0; shift -= 8)
+	    key += static_cast<char>(bits >> shift);
+    }
+    else
+    {
+	std::string str = val.getString();
+
+	key += static_cast<char>(3);
+	append_natural_key(key, str.data(), str.size());
+    }
+}
+
+// the sort key of the data rows given by a comma separated list of items:
+// column names, "EvalResult" for the result of the filter expression or
+// expressions over the columns. A '!' in front of an item sorts it
+// descending, unless the item is itself a column name. The items of each row
+// are encoded once into one key, whose bytes are inverted for descending
+// items, so rows are sorted by comparing the keys only.
+class SortKey
+{
+private:
+    // one item of the sort key
+    struct Item
+    {
+	enum { COLUMN, EVALRESULT, EXPRESSION } type;
+
+	// the column index of a column item
+	unsigned int	column;
+
+	// invert the key of the item
+	bool		descending;
+
+	// the compiled and bound program of an expression item
+	stx::ParseProgram program;
+    };
+
+    // the items in order of precedence
+    std::vector<Item>	items;
+
+    // the leading fields of a row needed to encode the key
+    unsigned int	neededfields;
+
+    // split the list of items at the commas, which are not within parentheses
+    // or string literals.
+    static std::vector<std::string> splitItems(const std::string &spec)
+    {
+	std::vector<std::string> itemlist(1);
+	int depth = 0;
+	bool quoted = false;
+
+	for(std::string::size_type i = 0; i < spec.size(); ++i)
+	{
+	    char c = spec[i];
+
+	    if (quoted) {
+		if (c == '\\' && i + 1 < spec.size())
+		    itemlist.back() += spec[i++];
+		else if (c == '"')
+		    quoted = false;
+	    }
+	    else if (c == '"') quoted = true;
+	    else if (c == '(') ++depth;
+	    else if (c == ')') --depth;
+	    else if (c == ',' && depth == 0) {
+		itemlist.push_back(std::string());
+		continue;
+	    }
+
+	    itemlist.back() += c;
+	}
+
+	return itemlist;
+    }
+
+    // remove spaces at both ends
+    static std::string trim(const std::string &str)
+    {
+	std::string::size_type pos1 = str.find_first_not_of(' ');
+	if (pos1 == std::string::npos) return std::string();
+
+	std::string::size_type pos2 = str.find_last_not_of(' ');
+	return str.substr(pos1, pos2 - pos1 + 1);
+    }
+
+public:
+    SortKey()
+	: neededfields(0)
+    {
+    }
+
+    // returns true if no sort key is given.
+    inline bool empty() const
+    {
+	return items.empty();
+    }
+
+    // returns the number of leading fields of a row needed by encode().
+    inline unsigned int getNeededFields() const
+    {
+	return neededfields;
+    }
+
+    // append an item sorting by the given column.
+    void addColumn(unsigned int column, bool descending = false)
+    {
+	items.push_back(Item());
+	items.back().type = Item::COLUMN;
+	items.back().column = column;
+	items.back().descending = descending;
+
+	neededfields = std::max(neededfields, column + 1);
+    }
+
+    // returns true if an item sorts by the result of the filter expression.
+    bool usesEvalResult() const
+    {
+	for(unsigned int i = 0; i < items.size(); ++i)
+	{
+	    if (items[i].type == Item::EVALRESULT) return true;
+	}
+	return false;
+    }
+
+    // parse the list of items. The whole list is taken as a single item if it
+    // is a column name. Expressions are bound to the columns and functions of
+    // the symbol table. returns false and the message in error if an item
+    // cannot be resolved.
+    bool parse(const std::string &spec, CSVRowSymbolTable &symboltable, std::string &error)
+    {
+	const std::map<std::string, unsigned int> &headersmap = symboltable.headersmap;
+
+	items.clear();
+	neededfields = 0;
+
+	std::vector<std::string> itemlist;
+
+	if (headersmap.find(spec) != headersmap.end() ||
+	    (spec[0] == '!' && headersmap.find(spec.substr(1)) != headersmap.end()))
+	    itemlist.push_back(spec);
+	else
+	    itemlist = splitItems(spec);
+
+	for(unsigned int i = 0; i < itemlist.size(); ++i)
+	{
+	    std::string itemstr = trim(itemlist[i]);
+
+	    items.push_back(Item());
+	    Item &item = items.back();
+
+	    item.descending = false;
+
+	    std::map<std::string, unsigned int>::const_iterator
+		colfind = headersmap.find(itemstr);
+
+	    if (colfind == headersmap.end() && itemstr.size() && itemstr[0] == '!') {
+		itemstr = trim(itemstr.substr(1));
+		colfind = headersmap.find(itemstr);
+		item.descending = true;
+	    }
+
+	    if (colfind != headersmap.end())
+	    {
+		item.type = Item::COLUMN;
+		item.column = colfind->second;
+
+		neededfields = std::max(neededfields, item.column + 1);
+		continue;
+	    }
+
+	    if (itemstr == "EvalResult")
+	    {
+		item.type = Item::EVALRESULT;
+		continue;
+	    }
+
+	    // otherwise the item must be an expression over the columns
+	    item.type = Item::EXPRESSION;
+
+	    stx::ParseTree pt;
+	    std::set<std::string> varset;
+
+	    try
+	    {
+		pt = stx::parseExpression(itemstr);
+		varset = pt.getVariables();
+	    }
+	    catch (stx::ExpressionParserException &e)
+	    {
+		error = "Bad sort expression: " + itemstr + ": " + e.what();
+		return false;
+	    }
+
+	    for(std::set<std::string>::const_iterator vi = varset.begin();
+		vi != varset.end(); ++vi)
+	    {
+		if (headersmap.find(*vi) != headersmap.end()) continue;
+
+		if (*vi == itemstr)
+		    error = "Bad sort column: " + itemstr + " could not be found.";
+		else
+		    error = "Bad sort expression: " + itemstr + ": column " + *vi + " could not be found.";
+		return false;
+	    }
+
+	    try
+	    {
+		item.program = pt.compile();
+		item.program.bindVariables(headersmap);
+		item.program.bindFunctions(symboltable);
+	    }
+	    catch (stx::ExpressionParserException &e)
+	    {
+		error = "Bad sort expression: " + itemstr + ": " + e.what();
+		return false;
+	    }
+
+	    neededfields = std::max(neededfields, symboltable.getNeededFields(varset));
+	}
+
+	return true;
+    }
+
+    // append the key of the current row of the symbol table to key. fields
+    // are the row's fields and evalresult the result of the filter expression
+    // or NULL if it has none.
+    void encode(std::string &key, CSVRowSymbolTable &symboltable,
+		const std::vector<CSVField> &fields, const std::string *evalresult) const
+    {
+	for(unsigned int i = 0; i < items.size(); ++i)
+	{
+	    const Item &item = items[i];
+	    std::string::size_type begin = key.size();
+
+	    if (item.type == Item::COLUMN)
+	    {
+		// a missing column sorts like an empty one
+		if (item.column < fields.size())
+		    append_natural_key(key, fields[item.column].data, fields[item.column].size);
+		else
+		    append_natural_key(key, "", 0);
+	    }
+	    else if (item.type == Item::EVALRESULT)
+	    {
+		if (evalresult)
+		    append_natural_key(key, evalresult->data(), evalresult->size());
+		else
+		    append_natural_key(key, "", 0);
+	    }
+	    else
+	    {
+		try
+		{
+		    append_value_key(key, item.program.evaluate( symboltable.fillSlots(item.program.getBoundSlots()),
+								 symboltable ));
+		}
+		catch (stx::ExpressionParserException &e)
+		{
+		    key.resize(begin);
+		    key += static_cast<char>(1);
+		}
+	    }
+
+	    if (item.descending)
+	    {
+		for(std::string::size_type j = begin; j < key.size(); ++j)
+		    key[j] = ~key[j];
+	    }
+	}
+    }
+};
+
+// an entry of the parallel sort: the key of a record and its index, which
+// orders equal keys by input position.
+struct SortEntry
+{
+    const std::string	*key;
+    unsigned int	index;
+};
+
+// order of the sort entries, which compares the keys bytewise
+struct SortEntryOrder
+{
+    inline bool operator()(const SortEntry &a, const SortEntry &b) const
+    {
+	int cmp = a.key->compare(*b.key);
+	return (cmp < 0) || (cmp == 0 && a.index < b.index);
+    }
+};
+
+// a part of the parallel sort done by one thread: sort [begin,end), or merge
+// [begin,mid) and [mid,end) into out.
+struct SortSlice
+{
+    SortEntry	*begin, *mid, *end;
+    SortEntry	*out;
+};
+
+static void* sort_slice(void *arg)
+{
+    SortSlice &slice = *static_cast<SortSlice*>(arg);
+
+    if (!slice.out)
+	std::sort(slice.begin, slice.end, SortEntryOrder());
+    else
+	std::merge(slice.begin, slice.mid, slice.mid, slice.end, slice.out, SortEntryOrder());
+
+    return NULL;
+}
+
+// run the slices in parallel threads, the first one in the calling thread.
+static void run_sort_slices(std::vector<SortSlice> &slices)
+{
+    std::vector<pthread_t> threadids(slices.size());
+
+    for(unsigned int t = 1; t < slices.size(); ++t)
+	pthread_create(&threadids[t], NULL, sort_slice, &slices[t]);
+
+    sort_slice(&slices[0]);
+
+    for(unsigned int t = 1; t < slices.size(); ++t)
+	pthread_join(threadids[t], NULL);
+}
+
+// sort the entries using the given number of threads: each sorts a slice of
+// the entries, then the sorted slices are merged pairwise in rounds, whose
+// merges again run in parallel. Because the index decides between equal
+// keys, the result does not depend on the number of threads.
+static void parallel_sort(std::vector<SortEntry> &entries, unsigned int threads)
+{
+    size_t n = entries.size();
+
+    // small inputs are not worth the threads
+    threads = std::min<size_t>(threads, n / 16384);
+
+    if (threads <= 1) {
+	std::sort(entries.begin(), entries.end(), SortEntryOrder());
+	return;
+    }
+
+    std::vector<size_t> bounds;
+    for(unsigned int t = 0; t <= threads; ++t)
+	bounds.push_back(n * t / threads);
+
+    std::vector<SortSlice> slices(threads);
+    for(unsigned int t = 0; t < threads; ++t)
+    {
+	slices[t].begin = &entries[0] + bounds[t];
+	slices[t].end = &entries[0] + bounds[t + 1];
+	slices[t].mid = slices[t].end;
+	slices[t].out = NULL;
+    }
+
+    run_sort_slices(slices);
+
+    std::vector<SortEntry> buffer(n);
+    SortEntry *src = &entries[0], *dst = &buffer[0];
+
+    while (bounds.size() > 2)
+    {
+	std::vector<size_t> newbounds;
+	slices.clear();
+
+	for(unsigned int i = 0; i + 1 < bounds.size(); i += 2)
+	{
+	    // an odd last slice is merged with an empty one, which copies it.
+	    SortSlice slice;
+	    slice.begin = src + bounds[i];
+	    slice.mid = src + bounds[i + 1];
+	    slice.end = src + bounds[std::min<size_t>(i + 2, bounds.size() - 1)];
+	    slice.out = dst + bounds[i];
+	    slices.push_back(slice);
+
+	    newbounds.push_back(bounds[i]);
+	}
+	newbounds.push_back(n);
+
+	run_sort_slices(slices);
+
+	std::swap(src, dst);
+	bounds.swap(newbounds);
+    }
+
+    if (src != &entries[0]) entries.swap(buffer);
+}
+
+#endif // _STX_CSVTOOL_SORTKEY_H_
@@ -0,0 +1,215 @@
+// $Id$
+
+/*
+ * STX Expression Parser C++ Framework v0.7
+ * Copyright (C) 2007 Timo Bingmann
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/** \file indexbench.cc
+ * Benchmark program for the stx::ExpressionIndex: it generates many random
+ * subscriptions, conjunctions of comparisons of variables with constants and
+ * some disjunctions, and matches random records against them. The
+ * throughput in records/s of evaluating each compiled subscription is
+ * compared with that of the index, and both results are checked to be
+ * identical.
+ */
+
+// Expression Index Matching Benchmark
+
+#include "ExpressionParser.h"
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <stdlib.h>
+#include <sys/time.h>
+
+// number of numeric and string variables of the records
+static const unsigned int numvars = 20, strvars = 5;
+
+// the string values used in records and subscriptions
+static const char* const strvalues[8] = {
+    "red", "green", "blue", "yellow", "black", "white", "orange", "purple"
+};
+
+// return the current time in seconds
+static inline double timestamp()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// simple deterministic random generator
+static unsigned int seed = 1;
+
+static inline unsigned int random_uint(unsigned int range)
+{
+    seed = seed * 1103515245 + 12345;
+    return ((seed >> 8) & 0xFFFFFF) % range;
+}
+
+// return a random predicate: a numeric variable compared with 0..99 or a
+// string variable compared for equality.
+static std::string random_predicate()
+{
+    static const char* const ops[6] = { "==", "<", ">", "<=", ">=", "!=" };
+    std::ostringstream os;
+
+    if (random_uint(4) == 0)
+	os << "s" << random_uint(strvars) << " == \"" << strvalues[random_uint(8)] << "\"";
+    else
+	os << "v" << random_uint(numvars) << " " << ops[random_uint(6)] << " " << random_uint(100);
+
+    return os.str();
+}
+
+// return a random subscription: mostly a conjunction of two to four
+// predicates, every tenth is a disjunction of two conjunctions.
+static std::string random_subscription()
+{
+    std::string expr;
+
+    unsigned int disjuncts = (random_uint(10) == 0) ? 2 : 1;
+
+    for(unsigned int d = 0; d < disjuncts; ++d)
+    {
+	if (d > 0) expr += " or ";
+	expr += "(";
+
+	unsigned int preds = 2 + random_uint(3);
+	for(unsigned int p = 0; p < preds; ++p)
+	{
+	    if (p > 0) expr += " and ";
+	    expr += random_predicate();
+	}
+	expr += ")";
+    }
+
+    return expr;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int subscriptions = 20000, records = 200;
+
+    // parse arguments: [-n subscriptions] [-r records]
+    for(int i = 1; i < argc; ++i)
+    {
+	if (std::string(argv[i]) == "-n" && i + 1 < argc)
+	    subscriptions = atoi(argv[++i]);
+	else if (std::string(argv[i]) == "-r" && i + 1 < argc)
+	    records = atoi(argv[++i]);
+	else {
+	    std::cerr << "Usage: " << argv[0] << " [-n subscriptions] [-r records]\n";
+	    return 0;
+	}
+    }
+
+    std::vector<stx::ParseTree> trees;
+    std::vector<stx::ParseProgram> programs;
+    stx::ExpressionIndex index;
+
+    double ts1 = timestamp();
+
+    for(unsigned int i = 0; i < subscriptions; ++i)
+    {
+	trees.push_back( stx::parseExpression(random_subscription()) );
+	programs.push_back( trees.back().compile() );
+    }
+
+    double ts2 = timestamp();
+
+    for(unsigned int i = 0; i < subscriptions; ++i)
+	index.add(trees[i]);
+
+    double ts3 = timestamp();
+
+    std::vector<stx::BasicSymbolTable> tables(records);
+
+    for(unsigned int r = 0; r < records; ++r)
+    {
+	for(unsigned int v = 0; v < numvars; ++v)
+	{
+	    std::ostringstream os;
+	    os << "v" << v;
+	    tables[r].setVariable(os.str(), static_cast<int>(random_uint(100)));
+	}
+	for(unsigned int v = 0; v < strvars; ++v)
+	{
+	    std::ostringstream os;
+	    os << "s" << v;
+	    tables[r].setVariable(os.str(), strvalues[random_uint(8)]);
+	}
+    }
+
+    // brute force: evaluate all compiled subscriptions for each record
+    size_t brutematches = 0;
+    std::vector< std::vector<unsigned int> > bruteresults(records);
+
+    double ts4 = timestamp();
+
+    for(unsigned int r = 0; r < records; ++r)
+    {
+	for(unsigned int i = 0; i < subscriptions; ++i)
+	{
+	    stx::AnyScalar result = programs[i].evaluate(tables[r]);
+
+	    if (result.getType() == stx::AnyScalar::ATTRTYPE_BOOL && result.getBoolean())
+		bruteresults[r].push_back(i);
+	}
+	brutematches += bruteresults[r].size();
+    }
+
+    double ts5 = timestamp();
+
+    // index: match each record
+    size_t indexmatches = 0;
+    unsigned int errors = 0;
+    std::vector<unsigned int> matches;
+
+    double ts6 = timestamp();
+
+    for(unsigned int r = 0; r < records; ++r)
+    {
+	index.match(tables[r], matches);
+	indexmatches += matches.size();
+
+	if (matches != bruteresults[r]) errors++;
+    }
+
+    double ts7 = timestamp();
+
+    double brutersec = records / (ts5 - ts4);
+    double indexrsec = records / (ts7 - ts6);
+
+    std::cout << "subscriptions: " << subscriptions << ", parsed in " << (ts2 - ts1) << " s, "
+	      << "indexed in " << (ts3 - ts2) << " s\n"
+	      << "records: " << records << ", " << brutematches << " matches\n"
+	      << "brute force: " << brutersec << " records/s, "
+	      << (brutematches / (ts5 - ts4)) << " matches/s\n"
+	      << "index:       " << indexrsec << " records/s, "
+	      << (indexmatches / (ts7 - ts6)) << " matches/s\n"
+	      << "speedup:     " << (indexrsec / brutersec) << "\n";
+
+    if (errors)
+	std::cout << "mismatching results for " << errors << " records\n";
+
+    return (errors == 0) ? 0 : 1;
+}
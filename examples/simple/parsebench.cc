@@ -0,0 +1,185 @@
+// $Id$
+
+/*
+ * STX Expression Parser C++ Framework v0.7
+ * Copyright (C) 2007 Timo Bingmann
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/** \file parsebench.cc
+ * Benchmark program for the expression parser: it parses a set of
+ * expressions repeatedly and measures the throughput in MB/s of the
+ * hand-written parser used by stx::parseExpression() and of the
+ * boost::spirit grammar used by stx::parseExpressionSpirit(). Then it
+ * measures the scaling of stx::parseExpressionBulk() with the number of
+ * threads on a large set of expressions.
+ */
+
+// Expression Parser Throughput Benchmark
+
+#include "ExpressionParser.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+// expressions parsed if none are given on the command line: typical filter
+// expressions of csvfilter and some arithmetic.
+static const char* const default_expressions[] = {
+    "name == \"Germany\"",
+    "population > 1000000 && continent = \"Europe\"",
+    "(lifeexpectancy >= 70.5 or gnp / population * 1000 > 2.5) and not independent",
+    "a + b * c - d / e ^ 2",
+    "sqrt(x * x + y * y) <= 10 && (integer)z != 0",
+    "(double)area * 1.5e3 / (population + 1) < 0.25 || name = \"Antarctica\"",
+    "!(age < 18) and (state == \"CA\" or state == \"NY\" or state == \"TX\")",
+    "((1 + 2) * 3 - 4 / 2 + (integer)\"5\") * 2 == 24",
+    NULL
+};
+
+// return the current time in seconds
+static inline double timestamp()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// parse all expressions repeatedly using the given parser function and
+// return the number of parse tree nodes printed, to check the results.
+static size_t run_parser(const stx::ParseTree (*parser)(const std::string &),
+			 const std::vector<std::string> &exprs, unsigned int repeats)
+{
+    size_t check = 0;
+
+    for(unsigned int r = 0; r < repeats; ++r)
+    {
+	for(unsigned int i = 0; i < exprs.size(); ++i)
+	{
+	    stx::ParseTree pt = parser(exprs[i]);
+	    if (r == 0) check += pt.toString().size();
+	}
+    }
+
+    return check;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int repeats = 10000;
+    std::vector<std::string> exprs;
+
+    // number of expressions parsed in bulk and maximum number of threads
+    unsigned int bulksize = 100000, maxthreads = 0;
+
+    // parse arguments: [-r repeats] [-b bulksize] [-t maxthreads] [expressions...]
+    for(int i = 1; i < argc; ++i)
+    {
+	if (std::string(argv[i]) == "-r" && i + 1 < argc)
+	    repeats = atoi(argv[++i]);
+	else if (std::string(argv[i]) == "-b" && i + 1 < argc)
+	    bulksize = atoi(argv[++i]);
+	else if (std::string(argv[i]) == "-t" && i + 1 < argc)
+	    maxthreads = atoi(argv[++i]);
+	else
+	    exprs.push_back(argv[i]);
+    }
+
+    if (repeats == 0) repeats = 1;
+
+    if (exprs.empty())
+    {
+	for(const char* const* e = default_expressions; *e; ++e)
+	    exprs.push_back(*e);
+    }
+
+    size_t bytes = 0;
+    for(unsigned int i = 0; i < exprs.size(); ++i)
+    {
+	try {
+	    stx::parseExpression(exprs[i]);
+	}
+	catch (stx::ExpressionParserException &e) {
+	    std::cerr << "ExpressionParserException: " << e.what() << "\n";
+	    return 0;
+	}
+	bytes += exprs[i].size();
+    }
+
+    double ts1 = timestamp();
+    size_t checkhand = run_parser(stx::parseExpression, exprs, repeats);
+    double ts2 = timestamp();
+    size_t checkspirit = run_parser(stx::parseExpressionSpirit, exprs, repeats);
+    double ts3 = timestamp();
+
+    double mbytes = static_cast<double>(bytes) * repeats / (1024 * 1024);
+    double mbshand = mbytes / (ts2 - ts1);
+    double mbsspirit = mbytes / (ts3 - ts2);
+
+    std::cout << "expressions: " << exprs.size() << ", " << bytes << " bytes x " << repeats << " repeats\n"
+	      << "hand-written: " << mbshand << " MB/s, "
+	      << (ts2 - ts1) / (exprs.size() * static_cast<double>(repeats)) * 1e9 << " ns/expression\n"
+	      << "spirit:       " << mbsspirit << " MB/s, "
+	      << (ts3 - ts2) / (exprs.size() * static_cast<double>(repeats)) * 1e9 << " ns/expression\n"
+	      << "speedup:      " << (mbshand / mbsspirit) << "\n";
+
+    // parse a large set of expressions in bulk with increasing numbers of
+    // threads.
+    std::vector<std::string> bulk(bulksize);
+    size_t bulkbytes = 0;
+
+    for(unsigned int i = 0; i < bulksize; ++i)
+    {
+	bulk[i] = exprs[i % exprs.size()];
+	bulkbytes += bulk[i].size();
+    }
+
+    long nprocs = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int processors = (nprocs > 0) ? static_cast<unsigned int>(nprocs) : 1;
+    if (maxthreads != 0) processors = maxthreads;
+
+    std::cout << "bulk: " << bulksize << " expressions, " << bulkbytes << " bytes\n";
+
+    double mbsbulk1 = 0;
+    unsigned int errors = 0;
+
+    for(unsigned int threads = 1; ; threads *= 2)
+    {
+	if (threads > processors) threads = processors;
+
+	double ts4 = timestamp();
+	std::vector<stx::BulkParseResult> results = stx::parseExpressionBulk(bulk, threads);
+	double ts5 = timestamp();
+
+	for(unsigned int i = 0; i < results.size(); ++i)
+	    if (results[i].isError()) errors++;
+
+	double mbsbulk = static_cast<double>(bulkbytes) / (1024 * 1024) / (ts5 - ts4);
+	if (threads == 1) mbsbulk1 = mbsbulk;
+
+	std::cout << "threads " << threads << ": " << mbsbulk << " MB/s, "
+		  << (bulksize / (ts5 - ts4)) << " expressions/s, "
+		  << "scaling " << (mbsbulk / mbsbulk1) << "\n";
+
+	if (threads == processors) break;
+    }
+
+    return (checkhand == checkspirit && errors == 0) ? 0 : 1;
+}
@@ -36,6 +36,85 @@
 
 namespace stx {
 
+namespace {
+
+/// Provides a zero-terminated version of a string for the strtol() family of
+/// functions. Referenced strings are copied, short ones into a buffer on the
+/// stack.
+class TerminatedString
+{
+private:
+    /// Buffer for short strings
+    char		buffer[64];
+
+    /// Copy of long strings
+    std::string		longstr;
+
+    /// The zero-terminated string
+    const char*		str;
+
+public:
+    /// Terminate the n characters at s, unless terminated is already set.
+    TerminatedString(const char *s, unsigned int n, bool terminated)
+    {
+	if (terminated) {
+	    str = s;
+	}
+	else if (n < sizeof(buffer)) {
+	    memcpy(buffer, s, n);
+	    buffer[n] = 0;
+	    str = buffer;
+	}
+	else {
+	    longstr.assign(s, n);
+	    str = longstr.c_str();
+	}
+    }
+
+    /// Return the zero-terminated string.
+    inline const char*	c_str() const
+    {
+	return str;
+    }
+};
+
+} // namespace
+
+void AnyScalar::str_append(const char *s, unsigned int n)
+{
+    if (str_isref()) {
+	detachStringRef();
+    }
+
+    if (str_isheap()) {
+	val._string->append(s, n);
+    }
+    else if (strlength + n <= inline_capacity) {
+	memcpy(val._inline + strlength, s, n);
+	strlength += n;
+	val._inline[strlength] = 0;
+    }
+    else {
+	std::string *str = new std::string;
+	str->reserve(strlength + n);
+	str->append(val._inline, strlength);
+	str->append(s, n);
+
+	val._string = str;
+	strlength = heap_string;
+    }
+}
+
+int AnyScalar::str_compare(const AnyScalar &b) const
+{
+    unsigned int la = str_size(), lb = b.str_size();
+
+    int r = memcmp(str_data(), b.str_data(), std::min(la, lb));
+    if (r != 0) return r;
+
+    return (la < lb) ? -1 : (la > lb) ? 1 : 0;
+}
+
 bool AnyScalar::operator==(const AnyScalar &a) const
 {
     if (atype != a.atype) return false;
@@ -70,8 +149,8 @@ bool AnyScalar::operator==(const AnyScalar &a) const
 	return (val._double == a.val._double);
 
     case ATTRTYPE_STRING:
-	assert(val._string && a.val._string);
-	return (*val._string == *a.val._string);
+	return (str_size() == a.str_size() &&
+		memcmp(str_data(), a.str_data(), str_size()) == 0);
     }
 
     assert(0);
@@ -256,8 +335,7 @@ unsigned int AnyScalar::getValueLength() const
 	return sizeof(double);
 
     case ATTRTYPE_STRING:
-	assert(val._string);
-	return sizeof(unsigned char) + static_cast<unsigned int>(val._string->size());
+	return sizeof(unsigned char) + str_size();
     }
 
     assert(0);
@@ -346,8 +424,7 @@ bool AnyScalar::setInteger(int i)
 	return true;
 
     case ATTRTYPE_STRING:
-	assert(val._string);
-	*val._string = boost::lexical_cast<std::string>(i);
+	str_assign( boost::lexical_cast<std::string>(i) );
 	return true;
     }
 
@@ -438,8 +515,7 @@ bool AnyScalar::setLong(long long l)
 	return true;
 
     case ATTRTYPE_STRING:
-	assert(val._string);
-	*val._string = boost::lexical_cast<std::string>(l);
+	str_assign( boost::lexical_cast<std::string>(l) );
 	return true;
     }
 
@@ -492,8 +568,7 @@ bool AnyScalar::setDouble(double d)
 	return true;
 
     case ATTRTYPE_STRING:
-	assert(val._string);
-	*val._string = boost::lexical_cast<std::string>(d);
+	str_assign( boost::lexical_cast<std::string>(d) );
 	return true;
     }
 
@@ -592,8 +667,7 @@ bool AnyScalar::setString(const std::string &s)
 
     case ATTRTYPE_STRING:
     {
-	assert(val._string);
-	*val._string = s;
+	str_assign(s);
 	return true;
     }
     }
@@ -647,16 +721,16 @@ bool AnyScalar::setStringQuoted(const std::string &s)
     return setString(t);
 }
 
-AnyScalar& AnyScalar::setAutoString(const std::string &input)
+bool AnyScalar::setAutoNumber(const char *input)
 {
     // - int: input was readable by strtoll and is small enough.
     // - long: input was readable by strtoll
     {
 	char *endptr;
 #ifndef _MSC_VER
-	long long l = strtoll(input.c_str(), &endptr, 10);
+	long long l = strtoll(input, &endptr, 10);
 #else
-	long long l = _strtoi64(input.c_str(), &endptr, 10);
+	long long l = _strtoi64(input, &endptr, 10);
 #endif
 	if (endptr != NULL && *endptr == 0)
 	{
@@ -664,13 +738,13 @@ AnyScalar& AnyScalar::setAutoString(const std::string &input)
 	    {
 		resetType(ATTRTYPE_INTEGER);
 		val._int = l;
-		return *this;
+		return true;
 	    }
 	    else
 	    {
 		resetType(ATTRTYPE_LONG);
 		val._long = l;
-		return *this;
+		return true;
 	    }
 	}
     }
@@ -678,22 +752,62 @@ AnyScalar& AnyScalar::setAutoString(const std::string &input)
     // - double: input was readble by strtod
     {
 	char *endptr;
-	double d = strtod(input.c_str(), &endptr);
+	double d = strtod(input, &endptr);
 	if (endptr != NULL && *endptr == 0)
 	{
 	    resetType(ATTRTYPE_DOUBLE);
 	    val._double = d;
-	    return *this;
+	    return true;
 	}
     }
 
+    return false;
+}
+
+AnyScalar& AnyScalar::setAutoString(const std::string &input)
+{
+    if (setAutoNumber(input.c_str()))
+	return *this;
+
     // - string: all above failed.
     resetType(ATTRTYPE_STRING);
-    *val._string = input;
+    str_assign(input);
+
+    return *this;
+}
+
+AnyScalar& AnyScalar::setStringRef(const char *s, unsigned int n)
+{
+    if (atype == ATTRTYPE_STRING) str_free();
+
+    atype = ATTRTYPE_STRING;
+    val._ref.data = s;
+    val._ref.size = n;
+    strlength = ref_string;
 
     return *this;
 }
 
+AnyScalar& AnyScalar::setAutoStringRef(const char *s, unsigned int n)
+{
+    TerminatedString ts(s, n, false);
+
+    if (setAutoNumber(ts.c_str()))
+	return *this;
+
+    return setStringRef(s, n);
+}
+
+void AnyScalar::detachStringRef()
+{
+    if (atype != ATTRTYPE_STRING || !str_isref()) return;
+
+    const char *s = val._ref.data;
+    unsigned int n = val._ref.size;
+
+    str_init(s, n);
+}
+
 bool AnyScalar::getBoolean() const
 {
     switch(atype)
@@ -729,14 +843,12 @@ bool AnyScalar::getBoolean() const
 
     case ATTRTYPE_STRING:
     {
-	assert(val._string);
-
-	if (*val._string == "0" || *val._string == "f" || *val._string == "false"
-	    || *val._string == "n" || *val._string == "no") {
+	if (str_equal("0") || str_equal("f") || str_equal("false")
+	    || str_equal("n") || str_equal("no")) {
 	    return false;
 	}
-	if (*val._string == "1" || *val._string == "t" || *val._string == "true"
-	    || *val._string == "y" || *val._string == "yes") {
+	if (str_equal("1") || str_equal("t") || str_equal("true")
+	    || str_equal("y") || str_equal("yes")) {
 	    return true;
 	}
 
@@ -787,9 +899,9 @@ int AnyScalar::getInteger() const
 
     case ATTRTYPE_STRING:
     {
-	assert(val._string);
+	TerminatedString ts(str_data(), str_size(), !str_isref());
 	char *endptr;
-	long i = strtol(val._string->c_str(), &endptr, 10);
+	long i = strtol(ts.c_str(), &endptr, 10);
 	if (endptr != NULL && *endptr == 0)
 	    return i;
 
@@ -834,9 +946,9 @@ unsigned int AnyScalar::getUnsignedInteger() const
 
     case ATTRTYPE_STRING:
     {
-	assert(val._string);
+	TerminatedString ts(str_data(), str_size(), !str_isref());
 	char *endptr;
-	unsigned long i = strtoul(val._string->c_str(), &endptr, 10);
+	unsigned long i = strtoul(ts.c_str(), &endptr, 10);
 	if (endptr != NULL && *endptr == 0)
 	    return i;
 
@@ -879,12 +991,12 @@ long long AnyScalar::getLong() const
 
     case ATTRTYPE_STRING:
     {
-	assert(val._string);
+	TerminatedString ts(str_data(), str_size(), !str_isref());
 	char *endptr;
 #ifndef _MSC_VER
-	long long l = strtoll(val._string->c_str(), &endptr, 10);
+	long long l = strtoll(ts.c_str(), &endptr, 10);
 #else
-	long long l = _strtoi64(val._string->c_str(), &endptr, 10);
+	long long l = _strtoi64(ts.c_str(), &endptr, 10);
 #endif
 	if (endptr != NULL && *endptr == 0)
 	    return l;
@@ -930,12 +1042,12 @@ unsigned long long AnyScalar::getUnsignedLong() const
 
     case ATTRTYPE_STRING:
     {
-	assert(val._string);
+	TerminatedString ts(str_data(), str_size(), !str_isref());
 	char *endptr;
 #ifndef _MSC_VER
-	unsigned long long u = strtoull(val._string->c_str(), &endptr, 10);
+	unsigned long long u = strtoull(ts.c_str(), &endptr, 10);
 #else
-	unsigned long long u = _strtoui64(val._string->c_str(), &endptr, 10);
+	unsigned long long u = _strtoui64(ts.c_str(), &endptr, 10);
 #endif
 	if (endptr != NULL && *endptr == 0)
 	    return u;
@@ -978,9 +1090,9 @@ double AnyScalar::getDouble() const
 
     case ATTRTYPE_STRING:
     {
-	assert(val._string);
+	TerminatedString ts(str_data(), str_size(), !str_isref());
 	char *endptr;
-	double d = strtod(val._string->c_str(), &endptr);
+	double d = strtod(ts.c_str(), &endptr);
 	if (endptr != NULL && *endptr == 0)
 	    return d;
 
@@ -997,7 +1109,7 @@ std::string AnyScalar::getString() const
     {
     case ATTRTYPE_INVALID:
 	assert(0);
-	return false;
+	return std::string();
 
     case ATTRTYPE_BOOL:
 	if (val._int == 0) return "false";
@@ -1041,12 +1153,11 @@ std::string AnyScalar::getString() const
 
     case ATTRTYPE_STRING:
     {
-	assert(val._string);
-	return *val._string;
+	return std::string(str_data(), str_size());
     } 
     }
     assert(0);
-    return false;
+    return std::string();
 }
 
 std::string AnyScalar::getStringQuoted() const
@@ -1116,12 +1227,12 @@ void AnyScalar::resetType(attrtype_t t)
     // if setting to a string and this is not a string, create the object
     if (t == ATTRTYPE_STRING) {
 	if (atype != ATTRTYPE_STRING) {
-	    val._string = new std::string;
+	    str_init("", 0);
 	}
     }
     else {
 	if (atype == ATTRTYPE_STRING) {
-	    delete val._string;
+	    str_free();
 	}
 
 	val._ulong = 0;
@@ -1141,7 +1252,7 @@ bool AnyScalar::convertType(attrtype_t t)
     {
 	atype = t;
 	if (atype == ATTRTYPE_STRING) {
-	    val._string = new std::string;
+	    str_init("", 0);
 	}
 	return true;
     }
@@ -1155,7 +1266,7 @@ bool AnyScalar::convertType(attrtype_t t)
     case ATTRTYPE_BOOL:
     {
 	bool v = getBoolean();
-	if (atype == ATTRTYPE_STRING) delete val._string;
+	if (atype == ATTRTYPE_STRING) str_free();
 	val._int = v;
 	atype = t;
 	return true;
@@ -1166,7 +1277,7 @@ bool AnyScalar::convertType(attrtype_t t)
     case ATTRTYPE_INTEGER:
     {
 	int v = getInteger();
-	if (atype == ATTRTYPE_STRING) delete val._string;
+	if (atype == ATTRTYPE_STRING) str_free();
 	val._int = v;
 	atype = t;
 	return true;
@@ -1177,7 +1288,7 @@ bool AnyScalar::convertType(attrtype_t t)
     case ATTRTYPE_DWORD:
     {
 	unsigned int v = getUnsignedInteger();
-	if (atype == ATTRTYPE_STRING) delete val._string;
+	if (atype == ATTRTYPE_STRING) str_free();
 	val._uint = v;
 	atype = t;
 	return true;
@@ -1186,7 +1297,7 @@ bool AnyScalar::convertType(attrtype_t t)
     case ATTRTYPE_LONG:
     {
 	long long v = getLong();
-	if (atype == ATTRTYPE_STRING) delete val._string;
+	if (atype == ATTRTYPE_STRING) str_free();
 	val._long = v;
 	atype = t;
 	return true;
@@ -1195,7 +1306,7 @@ bool AnyScalar::convertType(attrtype_t t)
     case ATTRTYPE_QWORD:
     {
 	unsigned long long v = getLong();
-	if (atype == ATTRTYPE_STRING) delete val._string;
+	if (atype == ATTRTYPE_STRING) str_free();
 	val._ulong = v;
 	atype = t;
 	return true;
@@ -1204,7 +1315,7 @@ bool AnyScalar::convertType(attrtype_t t)
     case ATTRTYPE_FLOAT:
     {
 	float f = static_cast<float>(getDouble());
-	if (atype == ATTRTYPE_STRING) delete val._string;
+	if (atype == ATTRTYPE_STRING) str_free();
 	val._float = f;
 	atype = t;
 	return true;
@@ -1213,7 +1324,7 @@ bool AnyScalar::convertType(attrtype_t t)
     case ATTRTYPE_DOUBLE:
     {
 	double d = getDouble();
-	if (atype == ATTRTYPE_STRING) delete val._string;
+	if (atype == ATTRTYPE_STRING) str_free();
 	val._double = d;
 	atype = t;
 	return true;
@@ -1221,7 +1332,8 @@ bool AnyScalar::convertType(attrtype_t t)
 
     case ATTRTYPE_STRING:
     {
-	val._string = new std::string(getString());
+	std::string s = getString();
+	str_init(s.data(), static_cast<unsigned int>(s.size()));
 	atype = t;
 	return true;
     } 
@@ -1787,7 +1899,10 @@ AnyScalar AnyScalar::binary_arith_op(const AnyScalar &b) const
 	case ATTRTYPE_STRING:
 	    if (OpName == '+')
 	    {
-		return AnyScalar( *val._string + *b.val._string );
+		AnyScalar r(ATTRTYPE_STRING);
+		r.str_append(str_data(), str_size());
+		r.str_append(b.str_data(), b.str_size());
+		return r;
 	    }
 
 	    throw(ConversionException(std::string("Binary operator ")+OpName+" is not allowed between two string values."));
@@ -2300,8 +2415,8 @@ bool AnyScalar::binary_comp_op(const AnyScalar &b) const
 
 	case ATTRTYPE_STRING:
 	{
-	    Operator<std::string> op;
-	    return op(*val._string, *b.val._string);
+	    Operator<int> op;
+	    return op(str_compare(b), 0);
 	}
 	}
 	break;
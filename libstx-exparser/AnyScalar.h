@@ -32,6 +32,7 @@
 #include <functional>
 #include <ostream>
 #include <assert.h>
+#include <string.h>
 
 namespace stx {
 
@@ -40,7 +41,16 @@ namespace stx {
  * values and strings. The class provides operators which will compare scalars
  * between other scalars by converting them into a common domain. Furthermore
  * arithmetic operator will compose one or two scalars where the calculation is
- * done in the "higher" domain. */
+ * done in the "higher" domain.
+ *
+ * Strings of up to inline_capacity characters are stored inside the object,
+ * so that copying short string values does not allocate memory. Only longer
+ * strings are held in an allocated std::string.
+ *
+ * A string value may also reference characters owned by the caller, see
+ * setStringRef(). Such a reference is not copied when the object is copied or
+ * assigned, thus the referenced characters must stay valid as long as any
+ * copy of the object is used, usually for the duration of one evaluation. */
 
 class AnyScalar
 {
@@ -93,10 +103,23 @@ public:
 	ATTRTYPE_STRING = 0x40
     };
 
+    /// Maximum length of strings stored inline in the object.
+    static const unsigned int inline_capacity = 15;
+
 private:
+    /// Value of strlength marking an allocated std::string in val._string.
+    static const unsigned char heap_string = 0xFF;
+
+    /// Value of strlength marking a referenced string in val._ref.
+    static const unsigned char ref_string = 0xFE;
+
     /// The currently set type in the union.
     attrtype_t		atype;
 
+    /// For ATTRTYPE_STRING: the length of the string stored inline in
+    /// val._inline, heap_string or ref_string.
+    unsigned char	strlength;
+
     /// Union type to holding the current value of an AnyScalar.
     union value_t
     {
@@ -118,20 +141,136 @@ private:
 	/// Used for ATTRTYPE_DOUBLE
 	double			_double;
 
-	/// Used for ATTRTYPE_STRING, make sure it get delete'ed correctly.
+	/// Used for ATTRTYPE_STRING with long strings, make sure it get
+	/// delete'ed correctly.
 	std::string*		_string;
+
+	/// Used for ATTRTYPE_STRING with short strings: the characters and a
+	/// terminating zero.
+	char			_inline[inline_capacity + 1];
+
+	/// Used for ATTRTYPE_STRING referencing characters owned by the
+	/// caller, which are not zero-terminated.
+	struct {
+	    const char*		data;
+	    unsigned int	size;
+	}			_ref;
     };
 
     /// Union holding the current value of set type.
     union value_t	val;
+
+    // *** String storage helpers, only valid if atype == ATTRTYPE_STRING.
+
+    /// Returns true if the string is held in an allocated std::string.
+    inline bool		str_isheap() const
+    {
+	return (strlength == heap_string);
+    }
+
+    /// Returns true if the string references characters owned by the caller.
+    inline bool		str_isref() const
+    {
+	return (strlength == ref_string);
+    }
+
+    /// Return the characters of the string, which are zero-terminated unless
+    /// the string is a reference.
+    inline const char*	str_data() const
+    {
+	if (str_isheap()) return val._string->c_str();
+	if (str_isref()) return val._ref.data;
+	return val._inline;
+    }
+
+    /// Return the length of the string.
+    inline unsigned int	str_size() const
+    {
+	if (str_isheap()) return static_cast<unsigned int>(val._string->size());
+	if (str_isref()) return val._ref.size;
+	return strlength;
+    }
+
+    /// Set the string of an object which holds none yet.
+    inline void		str_init(const char *s, unsigned int n)
+    {
+	if (n <= inline_capacity) {
+	    memcpy(val._inline, s, n);
+	    val._inline[n] = 0;
+	    strlength = n;
+	}
+	else {
+	    val._string = new std::string(s, n);
+	    strlength = heap_string;
+	}
+    }
+
+    /// Set the string of an object which holds none yet to the string of a:
+    /// a reference is copied as reference.
+    inline void		str_copy(const AnyScalar &a)
+    {
+	if (a.str_isref()) {
+	    val._ref = a.val._ref;
+	    strlength = ref_string;
+	}
+	else {
+	    str_init(a.str_data(), a.str_size());
+	}
+    }
+
+    /// Free the allocated std::string, if any.
+    inline void		str_free()
+    {
+	if (str_isheap()) {
+	    delete val._string;
+	    val._string = NULL;
+	}
+    }
+
+    /// Replace the string, reusing an allocated std::string for long
+    /// strings.
+    inline void		str_assign(const char *s, unsigned int n)
+    {
+	if (str_isheap() && n > inline_capacity) {
+	    val._string->assign(s, n);
+	}
+	else {
+	    str_free();
+	    str_init(s, n);
+	}
+    }
+
+    /// Replace the string.
+    inline void		str_assign(const std::string &s)
+    {
+	str_assign(s.data(), static_cast<unsigned int>(s.size()));
+    }
+
+    /// Append characters to the string.
+    void		str_append(const char *s, unsigned int n);
+
+    /// Compare the string with the string of b like std::string::compare().
+    int			str_compare(const AnyScalar &b) const;
+
+    /// Compare the string with a zero-terminated string.
+    inline bool		str_equal(const char *s) const
+    {
+	return (strlen(s) == str_size() && memcmp(str_data(), s, str_size()) == 0);
+    }
+
+    /// Set the type and value to the integer or floating point number in the
+    /// zero-terminated input like setAutoString(). Returns false and leaves
+    /// the object unchanged if the input is no number.
+    bool		setAutoNumber(const char *input);
     
+
 public:
     /// Create a new empty AnyScalar object of given type.
     explicit inline AnyScalar(attrtype_t t = ATTRTYPE_INVALID)
 	: atype(t)
     { 
 	if (atype == ATTRTYPE_STRING) {
-	    val._string = new std::string;
+	    str_init("", 0);
 	}
 	else {
 	    val._ulong = 0;
@@ -241,24 +380,23 @@ public:
 	: atype(ATTRTYPE_STRING)
     {
 	if (s == NULL) 
-	    val._string = new std::string;
+	    str_init("", 0);
 	else
-	    val._string = new std::string(s);
+	    str_init(s, static_cast<unsigned int>(strlen(s)));
     }
     /// Construct a new AnyScalar object of type ATTRTYPE_STRING and set the
     /// given string value.
     inline AnyScalar(const std::string &s)
 	: atype(ATTRTYPE_STRING)
     {
-	val._string = new std::string(s);
+	str_init(s.data(), static_cast<unsigned int>(s.size()));
     }
 
     /// Destroy the object: free associated string memory if necessary.
     inline ~AnyScalar()
     {
 	if (atype == ATTRTYPE_STRING) {
-	    delete val._string;
-	    val._string = NULL;
+	    str_free();
 	}
     }
     
@@ -302,7 +440,7 @@ public:
 	    break;
 
 	case ATTRTYPE_STRING:
-	    val._string = new std::string(*a.val._string);
+	    str_copy(a);
 	    break;
 	}
     }
@@ -314,9 +452,15 @@ public:
 	// check if we are to assign ourself
 	if (this == &a) return *this;
 
-	if (atype == ATTRTYPE_STRING) {
-	    delete val._string;
-	    val._string = NULL;
+	if (atype == ATTRTYPE_STRING)
+	{
+	    // reuse the allocated string if both are strings
+	    if (a.atype == ATTRTYPE_STRING && !a.str_isref()) {
+		str_assign(a.str_data(), a.str_size());
+		return *this;
+	    }
+
+	    str_free();
 	}
 
 	atype = a.atype;
@@ -357,13 +501,61 @@ public:
 	    break;
 
 	case ATTRTYPE_STRING:
-	    val._string = new std::string(*a.val._string);
+	    str_copy(a);
 	    break;
 	}
 
 	return *this;
     }
 
+#if __cplusplus >= 201103L
+    /// Move-constructor: transfers type and value, an allocated string is
+    /// taken over and a is left holding an empty string.
+    inline AnyScalar(AnyScalar &&a) noexcept
+	: atype(a.atype), val(a.val)
+    {
+	if (atype == ATTRTYPE_STRING) {
+	    strlength = a.strlength;
+	    a.strlength = 0;
+	    a.val._inline[0] = 0;
+	}
+    }
+
+    /// Move-assignment: transfers type and value, an allocated string is
+    /// taken over and a is left holding an empty string.
+    inline AnyScalar& operator=(AnyScalar &&a) noexcept
+    {
+	if (this == &a) return *this;
+
+	if (atype == ATTRTYPE_STRING) str_free();
+
+	atype = a.atype;
+	val = a.val;
+
+	if (atype == ATTRTYPE_STRING) {
+	    strlength = a.strlength;
+	    a.strlength = 0;
+	    a.val._inline[0] = 0;
+	}
+
+	return *this;
+    }
+
+    /// Construct a new AnyScalar object of type ATTRTYPE_STRING and take over
+    /// the given string value.
+    inline AnyScalar(std::string &&s)
+	: atype(ATTRTYPE_STRING)
+    {
+	if (s.size() <= inline_capacity) {
+	    str_init(s.data(), static_cast<unsigned int>(s.size()));
+	}
+	else {
+	    val._string = new std::string(std::move(s));
+	    strlength = heap_string;
+	}
+    }
+#endif
+
     /// Comparison operator. Directly compares type _and_ value. Does NOT
     /// attempt to convert the values into a common domain.
     bool operator==(const AnyScalar &a) const;
@@ -572,6 +764,37 @@ public:
      */
     AnyScalar&		setAutoString(const std::string &input);
 
+    /** Change the type to ATTRTYPE_STRING and let the value reference the n
+     * characters at s, which need not be zero-terminated. The characters are
+     * not copied and must stay valid as long as this object or any copy of
+     * it is used. All functions operate directly on the referenced
+     * characters, only functions creating a new string, like the
+     * concatenation, return an object holding its own string.
+     *
+     * @return reference to this for chaining.
+     */
+    AnyScalar&		setStringRef(const char *s, unsigned int n);
+
+    /** Change the type _and_ value of the current object like setAutoString()
+     * from the n characters at s, which need not be zero-terminated. If the
+     * input is neither an integer nor a floating point number, the value
+     * references the characters like setStringRef().
+     *
+     * @return reference to this for chaining.
+     */
+    AnyScalar&		setAutoStringRef(const char *s, unsigned int n);
+
+    /// Returns true if this object is a string referencing characters owned
+    /// by the caller.
+    inline bool		isStringRef() const
+    {
+	return (atype == ATTRTYPE_STRING && str_isref());
+    }
+
+    /// Copy a referenced string into the object, so that it does not depend
+    /// on the referenced characters anymore. Does nothing for other values.
+    void		detachStringRef();
+
     // *** Getters
 
     // Return the enclosed value in different types, converting if
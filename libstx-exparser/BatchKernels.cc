@@ -0,0 +1,544 @@
+// $Id$
+
+/*
+ * STX Expression Parser C++ Framework v0.7
+ * Copyright (C) 2007 Timo Bingmann
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/** \file BatchKernels.cc
+ * Implementation of the arithmetic and comparison kernels of the batch
+ * evaluation for plain C++, SSE 4.2, AVX2 and AVX-512, and the runtime
+ * detection of the instruction set.
+ */
+
+#include "BatchKernels.h"
+
+#include <functional>
+
+#include <pthread.h>
+
+#ifdef STX_EXPARSER_SIMD
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
+
+namespace stx {
+
+namespace BatchKernels {
+
+// *** Plain C++ kernels
+
+/// Arithmetic kernel using the same operators as AnyScalar.
+template <typename Type>
+static void scalar_arith(arithop_t op, const Type *a, bool consta, const Type *b, bool constb,
+			 Type *r, unsigned int n)
+{
+    switch(op)
+    {
+    case ARITH_ADD: binary<Type, std::plus>(a, consta, b, constb, r, n); break;
+    case ARITH_SUB: binary<Type, std::minus>(a, consta, b, constb, r, n); break;
+    case ARITH_MUL: binary<Type, std::multiplies>(a, consta, b, constb, r, n); break;
+    case ARITH_DIV: binary<Type, std::divides>(a, consta, b, constb, r, n); break;
+    }
+}
+
+/// Comparison kernel using the same operators as AnyScalar.
+template <typename Type>
+static void scalar_comp(compop_t op, const Type *a, bool consta, const Type *b, bool constb,
+			unsigned char *r, unsigned int n)
+{
+    switch(op)
+    {
+    case COMP_EQUAL: binary<Type, std::equal_to>(a, consta, b, constb, r, n); break;
+    case COMP_NOTEQUAL: binary<Type, std::not_equal_to>(a, consta, b, constb, r, n); break;
+    case COMP_LESS: binary<Type, std::less>(a, consta, b, constb, r, n); break;
+    case COMP_GREATER: binary<Type, std::greater>(a, consta, b, constb, r, n); break;
+    case COMP_LESSEQUAL: binary<Type, std::less_equal>(a, consta, b, constb, r, n); break;
+    case COMP_GREATEREQUAL: binary<Type, std::greater_equal>(a, consta, b, constb, r, n); break;
+    }
+}
+
+/// The kernel table of the plain C++ kernels.
+static const KernelTable scalar_table = {
+    "scalar",
+    &scalar_arith<int>, &scalar_arith<long long>, &scalar_arith<float>, &scalar_arith<double>,
+    &scalar_comp<int>, &scalar_comp<long long>, &scalar_comp<float>, &scalar_comp<double>
+};
+
+#ifdef STX_EXPARSER_SIMD
+
+// *** SSE 4.2 kernels with 128 bit vectors
+
+#pragma GCC push_options
+#pragma GCC target("sse4.2")
+
+namespace sse42 {
+
+static const char *simd_name = "sse4.2";
+
+/// Traits of int vectors: SSE 4.1 has the multiplication.
+struct VecI32
+{
+    typedef int scalar;
+    typedef __m128i vec;
+    enum { width = 4 };
+
+    static inline vec load(const int *p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+    static inline vec set1(int v) { return _mm_set1_epi32(v); }
+    static inline void store(int *p, vec v) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+
+    static inline vec add(vec a, vec b) { return _mm_add_epi32(a, b); }
+    static inline vec sub(vec a, vec b) { return _mm_sub_epi32(a, b); }
+    static inline vec mul(vec a, vec b) { return _mm_mullo_epi32(a, b); }
+
+    static inline unsigned int mask(vec v) { return _mm_movemask_ps(_mm_castsi128_ps(v)); }
+    static inline unsigned int cmpeq(vec a, vec b) { return mask(_mm_cmpeq_epi32(a, b)); }
+    static inline unsigned int cmpne(vec a, vec b) { return ~cmpeq(a, b) & 0xF; }
+    static inline unsigned int cmplt(vec a, vec b) { return mask(_mm_cmplt_epi32(a, b)); }
+    static inline unsigned int cmpgt(vec a, vec b) { return mask(_mm_cmpgt_epi32(a, b)); }
+    static inline unsigned int cmple(vec a, vec b) { return ~cmpgt(a, b) & 0xF; }
+    static inline unsigned int cmpge(vec a, vec b) { return ~cmplt(a, b) & 0xF; }
+};
+
+/// Traits of long long vectors: SSE 4.2 has the comparison, but there is no
+/// multiplication, which is done lane-wise.
+struct VecI64
+{
+    typedef long long scalar;
+    typedef __m128i vec;
+    enum { width = 2 };
+
+    static inline vec load(const long long *p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+    static inline vec set1(long long v) { return _mm_set1_epi64x(v); }
+    static inline void store(long long *p, vec v) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+
+    static inline vec add(vec a, vec b) { return _mm_add_epi64(a, b); }
+    static inline vec sub(vec a, vec b) { return _mm_sub_epi64(a, b); }
+    static inline vec mul(vec a, vec b)
+    {
+	long long x[width], y[width];
+	store(x, a); store(y, b);
+	for(unsigned int k = 0; k < width; ++k) x[k] *= y[k];
+	return load(x);
+    }
+
+    static inline unsigned int mask(vec v) { return _mm_movemask_pd(_mm_castsi128_pd(v)); }
+    static inline unsigned int cmpeq(vec a, vec b) { return mask(_mm_cmpeq_epi64(a, b)); }
+    static inline unsigned int cmpne(vec a, vec b) { return ~cmpeq(a, b) & 0x3; }
+    static inline unsigned int cmplt(vec a, vec b) { return mask(_mm_cmpgt_epi64(b, a)); }
+    static inline unsigned int cmpgt(vec a, vec b) { return mask(_mm_cmpgt_epi64(a, b)); }
+    static inline unsigned int cmple(vec a, vec b) { return ~cmpgt(a, b) & 0x3; }
+    static inline unsigned int cmpge(vec a, vec b) { return ~cmplt(a, b) & 0x3; }
+};
+
+/// Traits of float vectors. The comparisons are ordered except for !=, like
+/// the scalar operators on NaN values.
+struct VecF32
+{
+    typedef float scalar;
+    typedef __m128 vec;
+    enum { width = 4 };
+
+    static inline vec load(const float *p) { return _mm_loadu_ps(p); }
+    static inline vec set1(float v) { return _mm_set1_ps(v); }
+    static inline void store(float *p, vec v) { _mm_storeu_ps(p, v); }
+
+    static inline vec add(vec a, vec b) { return _mm_add_ps(a, b); }
+    static inline vec sub(vec a, vec b) { return _mm_sub_ps(a, b); }
+    static inline vec mul(vec a, vec b) { return _mm_mul_ps(a, b); }
+    static inline vec div(vec a, vec b) { return _mm_div_ps(a, b); }
+
+    static inline unsigned int cmpeq(vec a, vec b) { return _mm_movemask_ps(_mm_cmpeq_ps(a, b)); }
+    static inline unsigned int cmpne(vec a, vec b) { return _mm_movemask_ps(_mm_cmpneq_ps(a, b)); }
+    static inline unsigned int cmplt(vec a, vec b) { return _mm_movemask_ps(_mm_cmplt_ps(a, b)); }
+    static inline unsigned int cmpgt(vec a, vec b) { return _mm_movemask_ps(_mm_cmpgt_ps(a, b)); }
+    static inline unsigned int cmple(vec a, vec b) { return _mm_movemask_ps(_mm_cmple_ps(a, b)); }
+    static inline unsigned int cmpge(vec a, vec b) { return _mm_movemask_ps(_mm_cmpge_ps(a, b)); }
+};
+
+/// Traits of double vectors.
+struct VecF64
+{
+    typedef double scalar;
+    typedef __m128d vec;
+    enum { width = 2 };
+
+    static inline vec load(const double *p) { return _mm_loadu_pd(p); }
+    static inline vec set1(double v) { return _mm_set1_pd(v); }
+    static inline void store(double *p, vec v) { _mm_storeu_pd(p, v); }
+
+    static inline vec add(vec a, vec b) { return _mm_add_pd(a, b); }
+    static inline vec sub(vec a, vec b) { return _mm_sub_pd(a, b); }
+    static inline vec mul(vec a, vec b) { return _mm_mul_pd(a, b); }
+    static inline vec div(vec a, vec b) { return _mm_div_pd(a, b); }
+
+    static inline unsigned int cmpeq(vec a, vec b) { return _mm_movemask_pd(_mm_cmpeq_pd(a, b)); }
+    static inline unsigned int cmpne(vec a, vec b) { return _mm_movemask_pd(_mm_cmpneq_pd(a, b)); }
+    static inline unsigned int cmplt(vec a, vec b) { return _mm_movemask_pd(_mm_cmplt_pd(a, b)); }
+    static inline unsigned int cmpgt(vec a, vec b) { return _mm_movemask_pd(_mm_cmpgt_pd(a, b)); }
+    static inline unsigned int cmple(vec a, vec b) { return _mm_movemask_pd(_mm_cmple_pd(a, b)); }
+    static inline unsigned int cmpge(vec a, vec b) { return _mm_movemask_pd(_mm_cmpge_pd(a, b)); }
+};
+
+#include "BatchKernelsSimd.h"
+
+} // namespace sse42
+
+#pragma GCC pop_options
+
+// *** AVX2 kernels with 256 bit vectors
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+
+namespace avx2 {
+
+static const char *simd_name = "avx2";
+
+/// Traits of int vectors.
+struct VecI32
+{
+    typedef int scalar;
+    typedef __m256i vec;
+    enum { width = 8 };
+
+    static inline vec load(const int *p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+    static inline vec set1(int v) { return _mm256_set1_epi32(v); }
+    static inline void store(int *p, vec v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+
+    static inline vec add(vec a, vec b) { return _mm256_add_epi32(a, b); }
+    static inline vec sub(vec a, vec b) { return _mm256_sub_epi32(a, b); }
+    static inline vec mul(vec a, vec b) { return _mm256_mullo_epi32(a, b); }
+
+    static inline unsigned int mask(vec v) { return _mm256_movemask_ps(_mm256_castsi256_ps(v)); }
+    static inline unsigned int cmpeq(vec a, vec b) { return mask(_mm256_cmpeq_epi32(a, b)); }
+    static inline unsigned int cmpne(vec a, vec b) { return ~cmpeq(a, b) & 0xFF; }
+    static inline unsigned int cmplt(vec a, vec b) { return mask(_mm256_cmpgt_epi32(b, a)); }
+    static inline unsigned int cmpgt(vec a, vec b) { return mask(_mm256_cmpgt_epi32(a, b)); }
+    static inline unsigned int cmple(vec a, vec b) { return ~cmpgt(a, b) & 0xFF; }
+    static inline unsigned int cmpge(vec a, vec b) { return ~cmplt(a, b) & 0xFF; }
+};
+
+/// Traits of long long vectors, the multiplication is done lane-wise.
+struct VecI64
+{
+    typedef long long scalar;
+    typedef __m256i vec;
+    enum { width = 4 };
+
+    static inline vec load(const long long *p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+    static inline vec set1(long long v) { return _mm256_set1_epi64x(v); }
+    static inline void store(long long *p, vec v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+
+    static inline vec add(vec a, vec b) { return _mm256_add_epi64(a, b); }
+    static inline vec sub(vec a, vec b) { return _mm256_sub_epi64(a, b); }
+    static inline vec mul(vec a, vec b)
+    {
+	long long x[width], y[width];
+	store(x, a); store(y, b);
+	for(unsigned int k = 0; k < width; ++k) x[k] *= y[k];
+	return load(x);
+    }
+
+    static inline unsigned int mask(vec v) { return _mm256_movemask_pd(_mm256_castsi256_pd(v)); }
+    static inline unsigned int cmpeq(vec a, vec b) { return mask(_mm256_cmpeq_epi64(a, b)); }
+    static inline unsigned int cmpne(vec a, vec b) { return ~cmpeq(a, b) & 0xF; }
+    static inline unsigned int cmplt(vec a, vec b) { return mask(_mm256_cmpgt_epi64(b, a)); }
+    static inline unsigned int cmpgt(vec a, vec b) { return mask(_mm256_cmpgt_epi64(a, b)); }
+    static inline unsigned int cmple(vec a, vec b) { return ~cmpgt(a, b) & 0xF; }
+    static inline unsigned int cmpge(vec a, vec b) { return ~cmplt(a, b) & 0xF; }
+};
+
+/// Traits of float vectors.
+struct VecF32
+{
+    typedef float scalar;
+    typedef __m256 vec;
+    enum { width = 8 };
+
+    static inline vec load(const float *p) { return _mm256_loadu_ps(p); }
+    static inline vec set1(float v) { return _mm256_set1_ps(v); }
+    static inline void store(float *p, vec v) { _mm256_storeu_ps(p, v); }
+
+    static inline vec add(vec a, vec b) { return _mm256_add_ps(a, b); }
+    static inline vec sub(vec a, vec b) { return _mm256_sub_ps(a, b); }
+    static inline vec mul(vec a, vec b) { return _mm256_mul_ps(a, b); }
+    static inline vec div(vec a, vec b) { return _mm256_div_ps(a, b); }
+
+    static inline unsigned int cmpeq(vec a, vec b) { return _mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_EQ_OQ)); }
+    static inline unsigned int cmpne(vec a, vec b) { return _mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_NEQ_UQ)); }
+    static inline unsigned int cmplt(vec a, vec b) { return _mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_LT_OQ)); }
+    static inline unsigned int cmpgt(vec a, vec b) { return _mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_GT_OQ)); }
+    static inline unsigned int cmple(vec a, vec b) { return _mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_LE_OQ)); }
+    static inline unsigned int cmpge(vec a, vec b) { return _mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_GE_OQ)); }
+};
+
+/// Traits of double vectors.
+struct VecF64
+{
+    typedef double scalar;
+    typedef __m256d vec;
+    enum { width = 4 };
+
+    static inline vec load(const double *p) { return _mm256_loadu_pd(p); }
+    static inline vec set1(double v) { return _mm256_set1_pd(v); }
+    static inline void store(double *p, vec v) { _mm256_storeu_pd(p, v); }
+
+    static inline vec add(vec a, vec b) { return _mm256_add_pd(a, b); }
+    static inline vec sub(vec a, vec b) { return _mm256_sub_pd(a, b); }
+    static inline vec mul(vec a, vec b) { return _mm256_mul_pd(a, b); }
+    static inline vec div(vec a, vec b) { return _mm256_div_pd(a, b); }
+
+    static inline unsigned int cmpeq(vec a, vec b) { return _mm256_movemask_pd(_mm256_cmp_pd(a, b, _CMP_EQ_OQ)); }
+    static inline unsigned int cmpne(vec a, vec b) { return _mm256_movemask_pd(_mm256_cmp_pd(a, b, _CMP_NEQ_UQ)); }
+    static inline unsigned int cmplt(vec a, vec b) { return _mm256_movemask_pd(_mm256_cmp_pd(a, b, _CMP_LT_OQ)); }
+    static inline unsigned int cmpgt(vec a, vec b) { return _mm256_movemask_pd(_mm256_cmp_pd(a, b, _CMP_GT_OQ)); }
+    static inline unsigned int cmple(vec a, vec b) { return _mm256_movemask_pd(_mm256_cmp_pd(a, b, _CMP_LE_OQ)); }
+    static inline unsigned int cmpge(vec a, vec b) { return _mm256_movemask_pd(_mm256_cmp_pd(a, b, _CMP_GE_OQ)); }
+};
+
+#include "BatchKernelsSimd.h"
+
+} // namespace avx2
+
+#pragma GCC pop_options
+
+// *** AVX-512 kernels with 512 bit vectors
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512dq")
+
+namespace avx512 {
+
+static const char *simd_name = "avx512";
+
+/// Traits of int vectors, the comparisons directly yield bit masks.
+struct VecI32
+{
+    typedef int scalar;
+    typedef __m512i vec;
+    enum { width = 16 };
+
+    static inline vec load(const int *p) { return _mm512_loadu_si512(p); }
+    static inline vec set1(int v) { return _mm512_set1_epi32(v); }
+    static inline void store(int *p, vec v) { _mm512_storeu_si512(p, v); }
+
+    static inline vec add(vec a, vec b) { return _mm512_add_epi32(a, b); }
+    static inline vec sub(vec a, vec b) { return _mm512_sub_epi32(a, b); }
+    static inline vec mul(vec a, vec b) { return _mm512_mullo_epi32(a, b); }
+
+    static inline unsigned int cmpeq(vec a, vec b) { return _mm512_cmp_epi32_mask(a, b, _MM_CMPINT_EQ); }
+    static inline unsigned int cmpne(vec a, vec b) { return _mm512_cmp_epi32_mask(a, b, _MM_CMPINT_NE); }
+    static inline unsigned int cmplt(vec a, vec b) { return _mm512_cmp_epi32_mask(a, b, _MM_CMPINT_LT); }
+    static inline unsigned int cmpgt(vec a, vec b) { return _mm512_cmp_epi32_mask(a, b, _MM_CMPINT_NLE); }
+    static inline unsigned int cmple(vec a, vec b) { return _mm512_cmp_epi32_mask(a, b, _MM_CMPINT_LE); }
+    static inline unsigned int cmpge(vec a, vec b) { return _mm512_cmp_epi32_mask(a, b, _MM_CMPINT_NLT); }
+};
+
+/// Traits of long long vectors, AVX-512DQ has the multiplication.
+struct VecI64
+{
+    typedef long long scalar;
+    typedef __m512i vec;
+    enum { width = 8 };
+
+    static inline vec load(const long long *p) { return _mm512_loadu_si512(p); }
+    static inline vec set1(long long v) { return _mm512_set1_epi64(v); }
+    static inline void store(long long *p, vec v) { _mm512_storeu_si512(p, v); }
+
+    static inline vec add(vec a, vec b) { return _mm512_add_epi64(a, b); }
+    static inline vec sub(vec a, vec b) { return _mm512_sub_epi64(a, b); }
+    static inline vec mul(vec a, vec b) { return _mm512_mullo_epi64(a, b); }
+
+    static inline unsigned int cmpeq(vec a, vec b) { return _mm512_cmp_epi64_mask(a, b, _MM_CMPINT_EQ); }
+    static inline unsigned int cmpne(vec a, vec b) { return _mm512_cmp_epi64_mask(a, b, _MM_CMPINT_NE); }
+    static inline unsigned int cmplt(vec a, vec b) { return _mm512_cmp_epi64_mask(a, b, _MM_CMPINT_LT); }
+    static inline unsigned int cmpgt(vec a, vec b) { return _mm512_cmp_epi64_mask(a, b, _MM_CMPINT_NLE); }
+    static inline unsigned int cmple(vec a, vec b) { return _mm512_cmp_epi64_mask(a, b, _MM_CMPINT_LE); }
+    static inline unsigned int cmpge(vec a, vec b) { return _mm512_cmp_epi64_mask(a, b, _MM_CMPINT_NLT); }
+};
+
+/// Traits of float vectors.
+struct VecF32
+{
+    typedef float scalar;
+    typedef __m512 vec;
+    enum { width = 16 };
+
+    static inline vec load(const float *p) { return _mm512_loadu_ps(p); }
+    static inline vec set1(float v) { return _mm512_set1_ps(v); }
+    static inline void store(float *p, vec v) { _mm512_storeu_ps(p, v); }
+
+    static inline vec add(vec a, vec b) { return _mm512_add_ps(a, b); }
+    static inline vec sub(vec a, vec b) { return _mm512_sub_ps(a, b); }
+    static inline vec mul(vec a, vec b) { return _mm512_mul_ps(a, b); }
+    static inline vec div(vec a, vec b) { return _mm512_div_ps(a, b); }
+
+    static inline unsigned int cmpeq(vec a, vec b) { return _mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ); }
+    static inline unsigned int cmpne(vec a, vec b) { return _mm512_cmp_ps_mask(a, b, _CMP_NEQ_UQ); }
+    static inline unsigned int cmplt(vec a, vec b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+    static inline unsigned int cmpgt(vec a, vec b) { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+    static inline unsigned int cmple(vec a, vec b) { return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+    static inline unsigned int cmpge(vec a, vec b) { return _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ); }
+};
+
+/// Traits of double vectors.
+struct VecF64
+{
+    typedef double scalar;
+    typedef __m512d vec;
+    enum { width = 8 };
+
+    static inline vec load(const double *p) { return _mm512_loadu_pd(p); }
+    static inline vec set1(double v) { return _mm512_set1_pd(v); }
+    static inline void store(double *p, vec v) { _mm512_storeu_pd(p, v); }
+
+    static inline vec add(vec a, vec b) { return _mm512_add_pd(a, b); }
+    static inline vec sub(vec a, vec b) { return _mm512_sub_pd(a, b); }
+    static inline vec mul(vec a, vec b) { return _mm512_mul_pd(a, b); }
+    static inline vec div(vec a, vec b) { return _mm512_div_pd(a, b); }
+
+    static inline unsigned int cmpeq(vec a, vec b) { return _mm512_cmp_pd_mask(a, b, _CMP_EQ_OQ); }
+    static inline unsigned int cmpne(vec a, vec b) { return _mm512_cmp_pd_mask(a, b, _CMP_NEQ_UQ); }
+    static inline unsigned int cmplt(vec a, vec b) { return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ); }
+    static inline unsigned int cmpgt(vec a, vec b) { return _mm512_cmp_pd_mask(a, b, _CMP_GT_OQ); }
+    static inline unsigned int cmple(vec a, vec b) { return _mm512_cmp_pd_mask(a, b, _CMP_LE_OQ); }
+    static inline unsigned int cmpge(vec a, vec b) { return _mm512_cmp_pd_mask(a, b, _CMP_GE_OQ); }
+};
+
+#include "BatchKernelsSimd.h"
+
+} // namespace avx512
+
+#pragma GCC pop_options
+
+/// Read the extended control register, which tells which vector registers
+/// the operating system saves on context switches.
+static inline unsigned long long xgetbv(unsigned int index)
+{
+    unsigned int eax, edx;
+    __asm__ __volatile__("xgetbv" : "=a" (eax), "=d" (edx) : "c" (index));
+    return (static_cast<unsigned long long>(edx) << 32) | eax;
+}
+
+#endif // STX_EXPARSER_SIMD
+
+/// Query the processor via cpuid for the best supported instruction set.
+static BatchColumn::simd_t detect_simd()
+{
+#ifdef STX_EXPARSER_SIMD
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+	return BatchColumn::SIMD_NONE;
+
+    // ecx bit 20: SSE 4.2
+    if (!(ecx & (1 << 20)))
+	return BatchColumn::SIMD_NONE;
+
+    // ecx bit 27: OSXSAVE, bit 28: AVX. The OS must save the XMM and YMM
+    // registers.
+    if (!(ecx & (1 << 27)) || !(ecx & (1 << 28)))
+	return BatchColumn::SIMD_SSE42;
+
+    unsigned long long xcr0 = xgetbv(0);
+
+    if ((xcr0 & 0x06) != 0x06 || __get_cpuid_max(0, NULL) < 7)
+	return BatchColumn::SIMD_SSE42;
+
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+    // ebx bit 5: AVX2
+    if (!(ebx & (1 << 5)))
+	return BatchColumn::SIMD_SSE42;
+
+    // ebx bit 16: AVX-512F, bit 17: AVX-512DQ. The OS must also save the
+    // opmask and ZMM registers.
+    if ((ebx & (1 << 16)) && (ebx & (1 << 17)) && (xcr0 & 0xE6) == 0xE6)
+	return BatchColumn::SIMD_AVX512;
+
+    return BatchColumn::SIMD_AVX2;
+#else
+    return BatchColumn::SIMD_NONE;
+#endif
+}
+
+/// The best instruction set of the processor, detected once.
+static BatchColumn::simd_t simd_detected = BatchColumn::SIMD_NONE;
+
+/// The instruction set selected for the kernels.
+static BatchColumn::simd_t simd_selected = BatchColumn::SIMD_NONE;
+
+/// Guards the detection, which may be first needed by multiple threads or
+/// by static initializers of other translation units.
+static pthread_once_t simd_once = PTHREAD_ONCE_INIT;
+
+static void init_simd()
+{
+    simd_detected = simd_selected = detect_simd();
+}
+
+const KernelTable& getTable(BatchColumn::simd_t simd)
+{
+    switch(simd)
+    {
+#ifdef STX_EXPARSER_SIMD
+    case BatchColumn::SIMD_SSE42: return sse42::table;
+    case BatchColumn::SIMD_AVX2: return avx2::table;
+    case BatchColumn::SIMD_AVX512: return avx512::table;
+#endif
+    default: return scalar_table;
+    }
+}
+
+const KernelTable& getTable()
+{
+    pthread_once(&simd_once, init_simd);
+    return getTable(simd_selected);
+}
+
+} // namespace BatchKernels
+
+BatchColumn::simd_t BatchColumn::detectSimd()
+{
+    pthread_once(&BatchKernels::simd_once, BatchKernels::init_simd);
+    return BatchKernels::simd_detected;
+}
+
+BatchColumn::simd_t BatchColumn::getSimd()
+{
+    pthread_once(&BatchKernels::simd_once, BatchKernels::init_simd);
+    return BatchKernels::simd_selected;
+}
+
+BatchColumn::simd_t BatchColumn::setSimd(simd_t simd)
+{
+    pthread_once(&BatchKernels::simd_once, BatchKernels::init_simd);
+
+    if (simd > BatchKernels::simd_detected)
+	simd = BatchKernels::simd_detected;
+
+    BatchKernels::simd_selected = simd;
+    return simd;
+}
+
+const char* BatchColumn::getSimdName(simd_t simd)
+{
+    return BatchKernels::getTable(simd).name;
+}
+
+} // namespace stx
@@ -0,0 +1,125 @@
+// $Id$
+
+/*
+ * STX Expression Parser C++ Framework v0.7
+ * Copyright (C) 2007 Timo Bingmann
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/** \file BatchKernels.h
+ * Internal interface of the arithmetic and comparison kernels used by the
+ * batch evaluation. The kernels are implemented once in plain C++ and once
+ * for each supported SIMD instruction set; the instruction set is selected
+ * once on first use by querying the processor via cpuid. This header is not
+ * installed.
+ */
+
+#ifndef _STX_BatchKernels_H_
+#define _STX_BatchKernels_H_
+
+#include "ExpressionParser.h"
+
+// SIMD kernels are only compiled for GCC compatible compilers on x86-64, where
+// the scalar floating point operations are also done with SSE and therefore
+// yield the same bits. Define STX_EXPARSER_NO_SIMD to disable them.
+#if !defined(STX_EXPARSER_NO_SIMD) && defined(__x86_64__) && \
+    (defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#define STX_EXPARSER_SIMD 1
+#endif
+
+namespace stx {
+
+/// Namespace of the internal column kernels.
+namespace BatchKernels {
+
+/// Arithmetic operations of the kernels.
+enum arithop_t { ARITH_ADD, ARITH_SUB, ARITH_MUL, ARITH_DIV };
+
+/// Comparison operations of the kernels, in the same order as the comparison
+/// opcodes of ParseProgram.
+enum compop_t { COMP_EQUAL, COMP_NOTEQUAL, COMP_LESS, COMP_GREATER, COMP_LESSEQUAL, COMP_GREATEREQUAL };
+
+/** Table of the kernel functions of one instruction set. Each kernel applies
+ * the operation to the arrays a and b of n values and writes the results into
+ * r. If consta or constb is set, the array contains only one value which
+ * applies to all rows, and if both are set only r[0] is written. Integer
+ * division is always done by the scalar kernels, the caller has to check for
+ * zero divisors. */
+struct KernelTable
+{
+    /// Name of the instruction set.
+    const char*	name;
+
+    /// Arithmetic kernels for int, long long, float and double arrays.
+    void	(*arith_i32)(arithop_t op, const int *a, bool consta, const int *b, bool constb, int *r, unsigned int n);
+    void	(*arith_i64)(arithop_t op, const long long *a, bool consta, const long long *b, bool constb, long long *r, unsigned int n);
+    void	(*arith_f32)(arithop_t op, const float *a, bool consta, const float *b, bool constb, float *r, unsigned int n);
+    void	(*arith_f64)(arithop_t op, const double *a, bool consta, const double *b, bool constb, double *r, unsigned int n);
+
+    /// Comparison kernels writing 0 or 1 for each row.
+    void	(*comp_i32)(compop_t op, const int *a, bool consta, const int *b, bool constb, unsigned char *r, unsigned int n);
+    void	(*comp_i64)(compop_t op, const long long *a, bool consta, const long long *b, bool constb, unsigned char *r, unsigned int n);
+    void	(*comp_f32)(compop_t op, const float *a, bool consta, const float *b, bool constb, unsigned char *r, unsigned int n);
+    void	(*comp_f64)(compop_t op, const double *a, bool consta, const double *b, bool constb, unsigned char *r, unsigned int n);
+};
+
+/// Return the kernel table of the currently selected instruction set.
+const KernelTable& getTable();
+
+/// Return the kernel table of the given instruction set, which must be
+/// supported by the processor.
+const KernelTable& getTable(BatchColumn::simd_t simd);
+
+/// Apply the binary Operator<Type> to two arrays of n rows and write the
+/// results into r. Either operand may be a constant array holding a single
+/// value, which is then applied to all rows. Type is the type both operands
+/// are promoted to, the same as in AnyScalar::binary_arith_op() and
+/// AnyScalar::binary_comp_op().
+template <typename Type, template <typename> class Operator,
+	  typename TypeA, typename TypeB, typename TypeR>
+static inline void binary(const TypeA *a, bool consta, const TypeB *b, bool constb,
+			  TypeR *r, unsigned int n)
+{
+    Operator<Type> op;
+
+    if (consta && constb)
+    {
+	r[0] = op(a[0], b[0]);
+    }
+    else if (consta)
+    {
+	const Type va = a[0];
+	for(unsigned int i = 0; i < n; ++i)
+	    r[i] = op(va, b[i]);
+    }
+    else if (constb)
+    {
+	const Type vb = b[0];
+	for(unsigned int i = 0; i < n; ++i)
+	    r[i] = op(a[i], vb);
+    }
+    else
+    {
+	for(unsigned int i = 0; i < n; ++i)
+	    r[i] = op(a[i], b[i]);
+    }
+}
+
+} // namespace BatchKernels
+
+} // namespace stx
+
+#endif // _STX_BatchKernels_H_
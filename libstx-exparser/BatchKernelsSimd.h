@@ -0,0 +1,292 @@
+// $Id$
+
+/*
+ * STX Expression Parser C++ Framework v0.7
+ * Copyright (C) 2007 Timo Bingmann
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/** \file BatchKernelsSimd.h
+ * Generic SIMD loops of the batch kernels. This file is included by
+ * BatchKernels.cc once for each instruction set, inside a namespace and a
+ * region compiled for that instruction set, which defines the vector traits
+ * VecI32, VecI64, VecF32 and VecF64 beforehand. Each traits class contains
+ * the scalar type, the vector type, the number of lanes and the load, store,
+ * arithmetic and comparison operations. The comparisons return a bit mask of
+ * the lanes. The tail rows which do not fill a vector are processed with the
+ * same scalar operations as the plain C++ kernels.
+ */
+
+/// Vector addition.
+struct OpAdd
+{
+    template <typename Vec>
+    static inline typename Vec::vec apply(typename Vec::vec a, typename Vec::vec b)
+    { return Vec::add(a, b); }
+
+    template <typename Type>
+    static inline Type scalar(const Type &a, const Type &b)
+    { return a + b; }
+};
+
+/// Vector subtraction.
+struct OpSub
+{
+    template <typename Vec>
+    static inline typename Vec::vec apply(typename Vec::vec a, typename Vec::vec b)
+    { return Vec::sub(a, b); }
+
+    template <typename Type>
+    static inline Type scalar(const Type &a, const Type &b)
+    { return a - b; }
+};
+
+/// Vector multiplication.
+struct OpMul
+{
+    template <typename Vec>
+    static inline typename Vec::vec apply(typename Vec::vec a, typename Vec::vec b)
+    { return Vec::mul(a, b); }
+
+    template <typename Type>
+    static inline Type scalar(const Type &a, const Type &b)
+    { return a * b; }
+};
+
+/// Vector division, only for floating point types.
+struct OpDiv
+{
+    template <typename Vec>
+    static inline typename Vec::vec apply(typename Vec::vec a, typename Vec::vec b)
+    { return Vec::div(a, b); }
+
+    template <typename Type>
+    static inline Type scalar(const Type &a, const Type &b)
+    { return a / b; }
+};
+
+/// Vector comparison ==.
+struct CmpEqual
+{
+    template <typename Vec>
+    static inline unsigned int apply(typename Vec::vec a, typename Vec::vec b)
+    { return Vec::cmpeq(a, b); }
+
+    template <typename Type>
+    static inline bool scalar(const Type &a, const Type &b)
+    { return a == b; }
+};
+
+/// Vector comparison !=.
+struct CmpNotEqual
+{
+    template <typename Vec>
+    static inline unsigned int apply(typename Vec::vec a, typename Vec::vec b)
+    { return Vec::cmpne(a, b); }
+
+    template <typename Type>
+    static inline bool scalar(const Type &a, const Type &b)
+    { return a != b; }
+};
+
+/// Vector comparison <.
+struct CmpLess
+{
+    template <typename Vec>
+    static inline unsigned int apply(typename Vec::vec a, typename Vec::vec b)
+    { return Vec::cmplt(a, b); }
+
+    template <typename Type>
+    static inline bool scalar(const Type &a, const Type &b)
+    { return a < b; }
+};
+
+/// Vector comparison >.
+struct CmpGreater
+{
+    template <typename Vec>
+    static inline unsigned int apply(typename Vec::vec a, typename Vec::vec b)
+    { return Vec::cmpgt(a, b); }
+
+    template <typename Type>
+    static inline bool scalar(const Type &a, const Type &b)
+    { return a > b; }
+};
+
+/// Vector comparison <=.
+struct CmpLessEqual
+{
+    template <typename Vec>
+    static inline unsigned int apply(typename Vec::vec a, typename Vec::vec b)
+    { return Vec::cmple(a, b); }
+
+    template <typename Type>
+    static inline bool scalar(const Type &a, const Type &b)
+    { return a <= b; }
+};
+
+/// Vector comparison >=.
+struct CmpGreaterEqual
+{
+    template <typename Vec>
+    static inline unsigned int apply(typename Vec::vec a, typename Vec::vec b)
+    { return Vec::cmpge(a, b); }
+
+    template <typename Type>
+    static inline bool scalar(const Type &a, const Type &b)
+    { return a >= b; }
+};
+
+/// Apply an arithmetic operation to full vectors and the remaining rows.
+template <typename Vec, typename Op>
+static void arith_loop(const typename Vec::scalar *a, bool consta,
+		       const typename Vec::scalar *b, bool constb,
+		       typename Vec::scalar *r, unsigned int n)
+{
+    typedef typename Vec::vec vec;
+
+    unsigned int i = 0;
+
+    if (consta && constb)
+    {
+	r[0] = Op::scalar(a[0], b[0]);
+    }
+    else if (consta)
+    {
+	const vec va = Vec::set1(a[0]);
+	for(; i + Vec::width <= n; i += Vec::width)
+	    Vec::store(r + i, Op::template apply<Vec>(va, Vec::load(b + i)));
+	for(; i < n; ++i)
+	    r[i] = Op::scalar(a[0], b[i]);
+    }
+    else if (constb)
+    {
+	const vec vb = Vec::set1(b[0]);
+	for(; i + Vec::width <= n; i += Vec::width)
+	    Vec::store(r + i, Op::template apply<Vec>(Vec::load(a + i), vb));
+	for(; i < n; ++i)
+	    r[i] = Op::scalar(a[i], b[0]);
+    }
+    else
+    {
+	for(; i + Vec::width <= n; i += Vec::width)
+	    Vec::store(r + i, Op::template apply<Vec>(Vec::load(a + i), Vec::load(b + i)));
+	for(; i < n; ++i)
+	    r[i] = Op::scalar(a[i], b[i]);
+    }
+}
+
+/// Expand the bit mask of a vector comparison into one byte per row.
+template <typename Vec>
+static inline void expand_mask(unsigned int mask, unsigned char *r)
+{
+    for(unsigned int k = 0; k < Vec::width; ++k)
+	r[k] = (mask >> k) & 1;
+}
+
+/// Apply a comparison to full vectors and the remaining rows.
+template <typename Vec, typename Cmp>
+static void comp_loop(const typename Vec::scalar *a, bool consta,
+		      const typename Vec::scalar *b, bool constb,
+		      unsigned char *r, unsigned int n)
+{
+    typedef typename Vec::vec vec;
+
+    unsigned int i = 0;
+
+    if (consta && constb)
+    {
+	r[0] = Cmp::scalar(a[0], b[0]);
+    }
+    else if (consta)
+    {
+	const vec va = Vec::set1(a[0]);
+	for(; i + Vec::width <= n; i += Vec::width)
+	    expand_mask<Vec>(Cmp::template apply<Vec>(va, Vec::load(b + i)), r + i);
+	for(; i < n; ++i)
+	    r[i] = Cmp::scalar(a[0], b[i]);
+    }
+    else if (constb)
+    {
+	const vec vb = Vec::set1(b[0]);
+	for(; i + Vec::width <= n; i += Vec::width)
+	    expand_mask<Vec>(Cmp::template apply<Vec>(Vec::load(a + i), vb), r + i);
+	for(; i < n; ++i)
+	    r[i] = Cmp::scalar(a[i], b[0]);
+    }
+    else
+    {
+	for(; i + Vec::width <= n; i += Vec::width)
+	    expand_mask<Vec>(Cmp::template apply<Vec>(Vec::load(a + i), Vec::load(b + i)), r + i);
+	for(; i < n; ++i)
+	    r[i] = Cmp::scalar(a[i], b[i]);
+    }
+}
+
+/// Arithmetic kernel for integer types: the division is done by the scalar
+/// kernel, as there are no SIMD integer division instructions.
+template <typename Vec>
+static void arith_int(arithop_t op, const typename Vec::scalar *a, bool consta,
+		      const typename Vec::scalar *b, bool constb,
+		      typename Vec::scalar *r, unsigned int n)
+{
+    switch(op)
+    {
+    case ARITH_ADD: arith_loop<Vec, OpAdd>(a, consta, b, constb, r, n); break;
+    case ARITH_SUB: arith_loop<Vec, OpSub>(a, consta, b, constb, r, n); break;
+    case ARITH_MUL: arith_loop<Vec, OpMul>(a, consta, b, constb, r, n); break;
+    case ARITH_DIV: binary<typename Vec::scalar, std::divides>(a, consta, b, constb, r, n); break;
+    }
+}
+
+/// Arithmetic kernel for floating point types.
+template <typename Vec>
+static void arith_float(arithop_t op, const typename Vec::scalar *a, bool consta,
+			const typename Vec::scalar *b, bool constb,
+			typename Vec::scalar *r, unsigned int n)
+{
+    switch(op)
+    {
+    case ARITH_ADD: arith_loop<Vec, OpAdd>(a, consta, b, constb, r, n); break;
+    case ARITH_SUB: arith_loop<Vec, OpSub>(a, consta, b, constb, r, n); break;
+    case ARITH_MUL: arith_loop<Vec, OpMul>(a, consta, b, constb, r, n); break;
+    case ARITH_DIV: arith_loop<Vec, OpDiv>(a, consta, b, constb, r, n); break;
+    }
+}
+
+/// Comparison kernel for all types.
+template <typename Vec>
+static void comp(compop_t op, const typename Vec::scalar *a, bool consta,
+		 const typename Vec::scalar *b, bool constb,
+		 unsigned char *r, unsigned int n)
+{
+    switch(op)
+    {
+    case COMP_EQUAL: comp_loop<Vec, CmpEqual>(a, consta, b, constb, r, n); break;
+    case COMP_NOTEQUAL: comp_loop<Vec, CmpNotEqual>(a, consta, b, constb, r, n); break;
+    case COMP_LESS: comp_loop<Vec, CmpLess>(a, consta, b, constb, r, n); break;
+    case COMP_GREATER: comp_loop<Vec, CmpGreater>(a, consta, b, constb, r, n); break;
+    case COMP_LESSEQUAL: comp_loop<Vec, CmpLessEqual>(a, consta, b, constb, r, n); break;
+    case COMP_GREATEREQUAL: comp_loop<Vec, CmpGreaterEqual>(a, consta, b, constb, r, n); break;
+    }
+}
+
+/// The kernel table of this instruction set.
+static const KernelTable table = {
+    simd_name,
+    &arith_int<VecI32>, &arith_int<VecI64>, &arith_float<VecF32>, &arith_float<VecF64>,
+    &comp<VecI32>, &comp<VecI64>, &comp<VecF32>, &comp<VecF64>
+};
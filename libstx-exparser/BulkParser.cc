@@ -0,0 +1,117 @@
+// $Id$
+
+/*
+ * STX Expression Parser C++ Framework v0.7
+ * Copyright (C) 2007 Timo Bingmann
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/** \file BulkParser.cc
+ * Implementation of parseExpressionBulk(): parsing large sets of expressions
+ * in parallel using a pool of threads.
+ */
+
+#include "ExpressionParser.h"
+#include "Threads.h"
+
+#include <istream>
+#include <ctype.h>
+
+namespace stx {
+
+namespace {
+
+/// Number of expressions fetched at once by a worker thread.
+const size_t bulkchunk = 64;
+
+/// Parses the inputs into the result vector in parallel.
+class BulkParseWork : public ParallelWork
+{
+private:
+    /// The input expressions
+    const std::vector<std::string>	&inputs;
+
+    /// The results with the same index
+    std::vector<BulkParseResult>	&results;
+
+public:
+    BulkParseWork(const std::vector<std::string> &_inputs, std::vector<BulkParseResult> &_results)
+	: inputs(_inputs), results(_results)
+    {
+    }
+
+    virtual void process(size_t begin, size_t end)
+    {
+	for(size_t i = begin; i < end; ++i)
+	{
+	    try {
+		results[i].tree = parseExpression(inputs[i]);
+	    }
+	    catch (std::exception &e) {
+		results[i].error = e.what();
+	    }
+	}
+    }
+};
+
+} // namespace
+
+std::vector<BulkParseResult> parseExpressionBulk(const std::vector<std::string> &inputs,
+						 unsigned int threads)
+{
+    std::vector<BulkParseResult> results(inputs.size());
+
+    for(size_t i = 0; i < results.size(); ++i)
+	results[i].line = i;
+
+    BulkParseWork work(inputs, results);
+    work.run(inputs.size(), bulkchunk, threads);
+
+    return results;
+}
+
+std::vector<BulkParseResult> parseExpressionBulk(std::istream &input,
+						 unsigned int threads)
+{
+    std::vector<std::string> inputs;
+    std::vector<size_t> lines;
+
+    std::string line;
+    for(size_t lineno = 1; std::getline(input, line); ++lineno)
+    {
+	// remove the carriage return of DOS line ends
+	if (!line.empty() && line[line.size() - 1] == '\r')
+	    line.erase(line.size() - 1);
+
+	// skip empty lines
+	std::string::const_iterator si = line.begin();
+	while (si != line.end() && isspace(static_cast<unsigned char>(*si))) ++si;
+
+	if (si == line.end()) continue;
+
+	inputs.push_back(line);
+	lines.push_back(lineno);
+    }
+
+    std::vector<BulkParseResult> results = parseExpressionBulk(inputs, threads);
+
+    for(size_t i = 0; i < results.size(); ++i)
+	results[i].line = lines[i];
+
+    return results;
+}
+
+} // namespace stx
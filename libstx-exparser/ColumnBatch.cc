@@ -0,0 +1,1106 @@
+// $Id$
+
+/*
+ * STX Expression Parser C++ Framework v0.7
+ * Copyright (C) 2007 Timo Bingmann
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/** \file ColumnBatch.cc
+ * Implementation of the column-wise batch evaluation: the ColumnBatch and
+ * BatchColumn classes and the operator kernels processing whole columns.
+ */
+
+#include "ExpressionParser.h"
+#include "BatchKernels.h"
+
+#include <functional>
+#include <cmath>
+
+namespace stx {
+
+// *** ColumnBatch
+
+ColumnBatch::ColumnBatch(const ColumnBatch &batch, const std::vector<unsigned int> &_selection)
+    : rows(_selection.size()), columns(batch.columns), hasselection(true)
+{
+    // map the rows of a selection of a selection to the column arrays.
+    selection.resize(_selection.size());
+
+    for(unsigned int i = 0; i < _selection.size(); ++i)
+    {
+	assert(_selection[i] < batch.size());
+	selection[i] = batch.getRow(_selection[i]);
+    }
+}
+
+void ColumnBatch::addColumn(const std::string &varname, coltype_t type, const void *data)
+{
+    Column col;
+    col.type = type;
+    col.data = data;
+
+    columns[varname] = col;
+}
+
+void ColumnBatch::addColumn(const std::string &varname, const int *data)
+{
+    addColumn(varname, COLUMN_INT32, data);
+}
+
+void ColumnBatch::addColumn(const std::string &varname, const long long *data)
+{
+    addColumn(varname, COLUMN_INT64, data);
+}
+
+void ColumnBatch::addColumn(const std::string &varname, const float *data)
+{
+    addColumn(varname, COLUMN_FLOAT, data);
+}
+
+void ColumnBatch::addColumn(const std::string &varname, const double *data)
+{
+    addColumn(varname, COLUMN_DOUBLE, data);
+}
+
+void ColumnBatch::addColumn(const std::string &varname, const std::string *data)
+{
+    addColumn(varname, COLUMN_STRING, data);
+}
+
+void ColumnBatch::addColumn(const std::string &varname, const BatchColumn &column)
+{
+    assert(!column.isConstant());
+
+    switch(column.getType())
+    {
+    case COLUMN_BOOL: addColumn(varname, COLUMN_BOOL, column.getBools()); break;
+    case COLUMN_INT32: addColumn(varname, COLUMN_INT32, column.getInts()); break;
+    case COLUMN_INT64: addColumn(varname, COLUMN_INT64, column.getLongs()); break;
+    case COLUMN_FLOAT: addColumn(varname, COLUMN_FLOAT, column.getFloats()); break;
+    case COLUMN_DOUBLE: addColumn(varname, COLUMN_DOUBLE, column.getDoubles()); break;
+    case COLUMN_STRING: addColumn(varname, COLUMN_STRING, column.getStrings()); break;
+    case COLUMN_ANY: addColumn(varname, COLUMN_ANY, column.getValues()); break;
+    }
+}
+
+const ColumnBatch::Column* ColumnBatch::findColumn(const std::string &varname) const
+{
+    columnmap_type::const_iterator ci = columns.find(varname);
+
+    if (ci == columns.end()) return NULL;
+
+    return &ci->second;
+}
+
+AnyScalar ColumnBatch::getValue(const Column &col, unsigned int row)
+{
+    switch(col.type)
+    {
+    case COLUMN_BOOL:
+	return AnyScalar( static_cast<const unsigned char*>(col.data)[row] != 0 );
+
+    case COLUMN_INT32:
+	return AnyScalar( static_cast<const int*>(col.data)[row] );
+
+    case COLUMN_INT64:
+	return AnyScalar( static_cast<const long long*>(col.data)[row] );
+
+    case COLUMN_FLOAT:
+	return AnyScalar( static_cast<const float*>(col.data)[row] );
+
+    case COLUMN_DOUBLE:
+	return AnyScalar( static_cast<const double*>(col.data)[row] );
+
+    case COLUMN_STRING:
+	return AnyScalar( static_cast<const std::string*>(col.data)[row] );
+
+    case COLUMN_ANY:
+	return static_cast<const AnyScalar*>(col.data)[row];
+    }
+
+    assert(0);
+    return AnyScalar();
+}
+
+/// Return a pointer to the first element of a vector or NULL if it is empty.
+template <typename Type>
+static inline Type* vector_data(std::vector<Type> &v)
+{
+    return v.empty() ? NULL : &v[0];
+}
+
+/// Copy the selected rows of a column array.
+template <typename Type>
+static inline void batch_gather(const void *data, const std::vector<unsigned int> &selection,
+				Type *r)
+{
+    const Type *a = static_cast<const Type*>(data);
+
+    for(unsigned int i = 0; i < selection.size(); ++i)
+	r[i] = a[ selection[i] ];
+}
+
+void ColumnBatch::loadColumn(const Column &col, BatchColumn &dest) const
+{
+    if (!hasselection)
+    {
+	dest.setView(col.type, col.data, rows);
+	return;
+    }
+
+    switch(col.type)
+    {
+    case COLUMN_BOOL:
+	batch_gather(col.data, selection, dest.initBools(rows));
+	break;
+
+    case COLUMN_INT32:
+	batch_gather(col.data, selection, dest.initInts(rows));
+	break;
+
+    case COLUMN_INT64:
+	batch_gather(col.data, selection, dest.initLongs(rows));
+	break;
+
+    case COLUMN_FLOAT:
+	batch_gather(col.data, selection, dest.initFloats(rows));
+	break;
+
+    case COLUMN_DOUBLE:
+	batch_gather(col.data, selection, dest.initDoubles(rows));
+	break;
+
+    case COLUMN_STRING:
+	batch_gather(col.data, selection, dest.initStrings(rows));
+	break;
+
+    case COLUMN_ANY:
+	batch_gather(col.data, selection, dest.initValues(rows));
+	break;
+    }
+}
+
+// *** BatchColumn
+
+AnyScalar BatchColumn::getValue(unsigned int row) const
+{
+    ColumnBatch::Column col;
+    col.type = type;
+    col.data = data;
+
+    return ColumnBatch::getValue(col, constant ? 0 : row);
+}
+
+void BatchColumn::swap(BatchColumn &bc)
+{
+    // the vectors keep their arrays when swapped, so data stays valid.
+    std::swap(type, bc.type);
+    std::swap(rows, bc.rows);
+    std::swap(constant, bc.constant);
+    std::swap(data, bc.data);
+
+    bools.swap(bc.bools);
+    ints.swap(bc.ints);
+    longs.swap(bc.longs);
+    floats.swap(bc.floats);
+    doubles.swap(bc.doubles);
+    strings.swap(bc.strings);
+    values.swap(bc.values);
+}
+
+void BatchColumn::setView(coltype_t _type, const void *_data, unsigned int _rows)
+{
+    type = _type;
+    rows = _rows;
+    constant = false;
+    data = _data;
+}
+
+void BatchColumn::setConstant(const AnyScalar &value, unsigned int _rows)
+{
+    std::vector<AnyScalar> v(1, value);
+
+    rows = _rows;
+    constant = true;
+
+    storeValues(v);
+}
+
+void BatchColumn::setValues(std::vector<AnyScalar> &v)
+{
+    rows = v.size();
+    constant = false;
+
+    storeValues(v);
+}
+
+void BatchColumn::storeValues(std::vector<AnyScalar> &v)
+{
+    AnyScalar::attrtype_t atype = v.empty() ? AnyScalar::ATTRTYPE_BOOL : v[0].getType();
+
+    for(unsigned int i = 1; i < v.size(); ++i)
+    {
+	if (v[i].getType() != atype) {
+	    atype = AnyScalar::ATTRTYPE_INVALID;
+	    break;
+	}
+    }
+
+    switch(atype)
+    {
+    case AnyScalar::ATTRTYPE_BOOL:
+	bools.resize(v.size());
+	for(unsigned int i = 0; i < v.size(); ++i)
+	    bools[i] = v[i].getBoolean();
+
+	type = ColumnBatch::COLUMN_BOOL;
+	data = vector_data(bools);
+	break;
+
+    case AnyScalar::ATTRTYPE_INTEGER:
+	ints.resize(v.size());
+	for(unsigned int i = 0; i < v.size(); ++i)
+	    ints[i] = v[i].getInteger();
+
+	type = ColumnBatch::COLUMN_INT32;
+	data = vector_data(ints);
+	break;
+
+    case AnyScalar::ATTRTYPE_LONG:
+	longs.resize(v.size());
+	for(unsigned int i = 0; i < v.size(); ++i)
+	    longs[i] = v[i].getLong();
+
+	type = ColumnBatch::COLUMN_INT64;
+	data = vector_data(longs);
+	break;
+
+    case AnyScalar::ATTRTYPE_FLOAT:
+	floats.resize(v.size());
+	for(unsigned int i = 0; i < v.size(); ++i)
+	    floats[i] = static_cast<float>(v[i].getDouble());
+
+	type = ColumnBatch::COLUMN_FLOAT;
+	data = vector_data(floats);
+	break;
+
+    case AnyScalar::ATTRTYPE_DOUBLE:
+	doubles.resize(v.size());
+	for(unsigned int i = 0; i < v.size(); ++i)
+	    doubles[i] = v[i].getDouble();
+
+	type = ColumnBatch::COLUMN_DOUBLE;
+	data = vector_data(doubles);
+	break;
+
+    case AnyScalar::ATTRTYPE_STRING:
+	strings.resize(v.size());
+	for(unsigned int i = 0; i < v.size(); ++i)
+	    strings[i] = v[i].getString();
+
+	type = ColumnBatch::COLUMN_STRING;
+	data = vector_data(strings);
+	break;
+
+    default:
+	// mixed or other types: keep the AnyScalar objects
+	values.swap(v);
+
+	type = ColumnBatch::COLUMN_ANY;
+	data = vector_data(values);
+	break;
+    }
+}
+
+unsigned char* BatchColumn::initBools(unsigned int _rows, bool _constant)
+{
+    bools.resize(_constant ? 1 : _rows);
+
+    type = ColumnBatch::COLUMN_BOOL;
+    rows = _rows;
+    constant = _constant;
+    data = vector_data(bools);
+
+    return vector_data(bools);
+}
+
+int* BatchColumn::initInts(unsigned int _rows, bool _constant)
+{
+    ints.resize(_constant ? 1 : _rows);
+
+    type = ColumnBatch::COLUMN_INT32;
+    rows = _rows;
+    constant = _constant;
+    data = vector_data(ints);
+
+    return vector_data(ints);
+}
+
+long long* BatchColumn::initLongs(unsigned int _rows, bool _constant)
+{
+    longs.resize(_constant ? 1 : _rows);
+
+    type = ColumnBatch::COLUMN_INT64;
+    rows = _rows;
+    constant = _constant;
+    data = vector_data(longs);
+
+    return vector_data(longs);
+}
+
+float* BatchColumn::initFloats(unsigned int _rows, bool _constant)
+{
+    floats.resize(_constant ? 1 : _rows);
+
+    type = ColumnBatch::COLUMN_FLOAT;
+    rows = _rows;
+    constant = _constant;
+    data = vector_data(floats);
+
+    return vector_data(floats);
+}
+
+double* BatchColumn::initDoubles(unsigned int _rows, bool _constant)
+{
+    doubles.resize(_constant ? 1 : _rows);
+
+    type = ColumnBatch::COLUMN_DOUBLE;
+    rows = _rows;
+    constant = _constant;
+    data = vector_data(doubles);
+
+    return vector_data(doubles);
+}
+
+std::string* BatchColumn::initStrings(unsigned int _rows, bool _constant)
+{
+    strings.resize(_constant ? 1 : _rows);
+
+    type = ColumnBatch::COLUMN_STRING;
+    rows = _rows;
+    constant = _constant;
+    data = vector_data(strings);
+
+    return vector_data(strings);
+}
+
+AnyScalar* BatchColumn::initValues(unsigned int _rows, bool _constant)
+{
+    values.resize(_constant ? 1 : _rows);
+
+    type = ColumnBatch::COLUMN_ANY;
+    rows = _rows;
+    constant = _constant;
+    data = vector_data(values);
+
+    return vector_data(values);
+}
+
+// *** Operator kernels processing whole columns
+
+/// Functor for the ^ operator, which works on doubles only.
+template <typename Type>
+struct batch_power
+{
+    inline Type operator()(const Type &a, const Type &b) const
+    {
+	return std::pow(a, b);
+    }
+};
+
+/// Functor for && on bool columns.
+template <typename Type>
+struct batch_and
+{
+    inline Type operator()(const Type &a, const Type &b) const
+    {
+	return a & b;
+    }
+};
+
+/// Functor for || on bool columns.
+template <typename Type>
+struct batch_or
+{
+    inline Type operator()(const Type &a, const Type &b) const
+    {
+	return a | b;
+    }
+};
+
+/// Returns true for the column types holding numbers.
+static inline bool is_numeric(ColumnBatch::coltype_t t)
+{
+    return (t == ColumnBatch::COLUMN_INT32 || t == ColumnBatch::COLUMN_INT64 ||
+	    t == ColumnBatch::COLUMN_FLOAT || t == ColumnBatch::COLUMN_DOUBLE);
+}
+
+/// Return the type two numeric columns are promoted to by the AnyScalar
+/// operators: int with int stays int, long long with any integer is long
+/// long, float with any integer is float and anything with a double is a
+/// double.
+static inline ColumnBatch::coltype_t promote_numeric(ColumnBatch::coltype_t a,
+						     ColumnBatch::coltype_t b)
+{
+    if (a == ColumnBatch::COLUMN_DOUBLE || b == ColumnBatch::COLUMN_DOUBLE)
+	return ColumnBatch::COLUMN_DOUBLE;
+
+    if (a == ColumnBatch::COLUMN_FLOAT || b == ColumnBatch::COLUMN_FLOAT)
+	return ColumnBatch::COLUMN_FLOAT;
+
+    if (a == ColumnBatch::COLUMN_INT64 || b == ColumnBatch::COLUMN_INT64)
+	return ColumnBatch::COLUMN_INT64;
+
+    return ColumnBatch::COLUMN_INT32;
+}
+
+/// Copy the values of a column into a typed array of another type.
+template <typename TypeR, typename TypeA>
+static inline void batch_convert(const TypeA *a, TypeR *r, unsigned int n)
+{
+    for(unsigned int i = 0; i < n; ++i)
+	r[i] = static_cast<TypeR>(a[i]);
+}
+
+/// Return the array of a numeric column, selected by the pointer type.
+static inline const int* column_array(const BatchColumn &a, const int*)
+{ return a.getInts(); }
+
+static inline const long long* column_array(const BatchColumn &a, const long long*)
+{ return a.getLongs(); }
+
+static inline const float* column_array(const BatchColumn &a, const float*)
+{ return a.getFloats(); }
+
+static inline const double* column_array(const BatchColumn &a, const double*)
+{ return a.getDoubles(); }
+
+/// Return the numeric column a as an array of Type, which is the type t. A
+/// column of another type is converted into tmp with static_cast, the same
+/// as the AnyScalar operators promote their operands.
+template <typename Type>
+static const Type* batch_promote(const BatchColumn &a, ColumnBatch::coltype_t t,
+				 std::vector<Type> &tmp)
+{
+    if (a.getType() == t)
+	return column_array(a, static_cast<const Type*>(NULL));
+
+    unsigned int n = a.isConstant() ? 1 : a.size();
+    tmp.resize(n);
+
+    switch(a.getType())
+    {
+    case ColumnBatch::COLUMN_INT32:
+	batch_convert(a.getInts(), vector_data(tmp), n);
+	break;
+
+    case ColumnBatch::COLUMN_INT64:
+	batch_convert(a.getLongs(), vector_data(tmp), n);
+	break;
+
+    case ColumnBatch::COLUMN_FLOAT:
+	batch_convert(a.getFloats(), vector_data(tmp), n);
+	break;
+
+    case ColumnBatch::COLUMN_DOUBLE:
+	batch_convert(a.getDoubles(), vector_data(tmp), n);
+	break;
+
+    default:
+	assert(0);
+    }
+
+    return vector_data(tmp);
+}
+
+/// Apply an arithmetic operator to two numeric columns using the kernels of
+/// the selected instruction set.
+static void batch_arith(BatchKernels::arithop_t op, const BatchColumn &a, const BatchColumn &b,
+			BatchColumn &dest)
+{
+    const BatchKernels::KernelTable &kt = BatchKernels::getTable();
+
+    bool constant = a.isConstant() && b.isConstant();
+    unsigned int n = a.size();
+
+    ColumnBatch::coltype_t t = promote_numeric(a.getType(), b.getType());
+
+    switch(t)
+    {
+    case ColumnBatch::COLUMN_INT32:
+    {
+	std::vector<int> ta, tb;
+	kt.arith_i32(op, batch_promote(a, t, ta), a.isConstant(), batch_promote(b, t, tb), b.isConstant(),
+		     dest.initInts(n, constant), n);
+	break;
+    }
+    case ColumnBatch::COLUMN_INT64:
+    {
+	std::vector<long long> ta, tb;
+	kt.arith_i64(op, batch_promote(a, t, ta), a.isConstant(), batch_promote(b, t, tb), b.isConstant(),
+		     dest.initLongs(n, constant), n);
+	break;
+    }
+    case ColumnBatch::COLUMN_FLOAT:
+    {
+	std::vector<float> ta, tb;
+	kt.arith_f32(op, batch_promote(a, t, ta), a.isConstant(), batch_promote(b, t, tb), b.isConstant(),
+		     dest.initFloats(n, constant), n);
+	break;
+    }
+    default:
+    {
+	std::vector<double> ta, tb;
+	kt.arith_f64(op, batch_promote(a, t, ta), a.isConstant(), batch_promote(b, t, tb), b.isConstant(),
+		     dest.initDoubles(n, constant), n);
+	break;
+    }
+    }
+}
+
+/// Apply the ^ operator to two numeric columns, which are both promoted to
+/// double.
+static void batch_pow(const BatchColumn &a, const BatchColumn &b, BatchColumn &dest)
+{
+    std::vector<double> ta, tb;
+
+    const double *da = batch_promote(a, ColumnBatch::COLUMN_DOUBLE, ta);
+    const double *db = batch_promote(b, ColumnBatch::COLUMN_DOUBLE, tb);
+
+    BatchKernels::binary<double, batch_power>(da, a.isConstant(), db, b.isConstant(),
+					      dest.initDoubles(a.size(), a.isConstant() && b.isConstant()),
+					      a.size());
+}
+
+/// Apply a comparison operator to two numeric, two bool or two string
+/// columns. Numeric columns are processed by the kernels of the selected
+/// instruction set.
+template <template <typename> class Operator>
+static void batch_compare(BatchKernels::compop_t op, const BatchColumn &a, const BatchColumn &b,
+			  BatchColumn &dest)
+{
+    bool constant = a.isConstant() && b.isConstant();
+    unsigned int n = a.size();
+    unsigned char *r = dest.initBools(n, constant);
+
+    if (a.getType() == ColumnBatch::COLUMN_BOOL)
+    {
+	BatchKernels::binary<bool, Operator>(a.getBools(), a.isConstant(),
+					     b.getBools(), b.isConstant(), r, n);
+	return;
+    }
+    if (a.getType() == ColumnBatch::COLUMN_STRING)
+    {
+	BatchKernels::binary<std::string, Operator>(a.getStrings(), a.isConstant(),
+						    b.getStrings(), b.isConstant(), r, n);
+	return;
+    }
+
+    const BatchKernels::KernelTable &kt = BatchKernels::getTable();
+
+    ColumnBatch::coltype_t t = promote_numeric(a.getType(), b.getType());
+
+    switch(t)
+    {
+    case ColumnBatch::COLUMN_INT32:
+    {
+	std::vector<int> ta, tb;
+	kt.comp_i32(op, batch_promote(a, t, ta), a.isConstant(), batch_promote(b, t, tb), b.isConstant(), r, n);
+	break;
+    }
+    case ColumnBatch::COLUMN_INT64:
+    {
+	std::vector<long long> ta, tb;
+	kt.comp_i64(op, batch_promote(a, t, ta), a.isConstant(), batch_promote(b, t, tb), b.isConstant(), r, n);
+	break;
+    }
+    case ColumnBatch::COLUMN_FLOAT:
+    {
+	std::vector<float> ta, tb;
+	kt.comp_f32(op, batch_promote(a, t, ta), a.isConstant(), batch_promote(b, t, tb), b.isConstant(), r, n);
+	break;
+    }
+    default:
+    {
+	std::vector<double> ta, tb;
+	kt.comp_f64(op, batch_promote(a, t, ta), a.isConstant(), batch_promote(b, t, tb), b.isConstant(), r, n);
+	break;
+    }
+    }
+}
+
+/// Throw the same exception as AnyScalar's operator/ if an integer divisor is
+/// zero in any row.
+static void batch_check_divisor(const BatchColumn &b)
+{
+    unsigned int n = b.isConstant() ? 1 : b.size();
+
+    if (b.getType() == ColumnBatch::COLUMN_INT32)
+    {
+	const int *d = b.getInts();
+	for(unsigned int i = 0; i < n; ++i)
+	    if (d[i] == 0) throw(ArithmeticException("Integer division by zero"));
+    }
+    else if (b.getType() == ColumnBatch::COLUMN_INT64)
+    {
+	const long long *d = b.getLongs();
+	for(unsigned int i = 0; i < n; ++i)
+	    if (d[i] == 0) throw(ArithmeticException("Integer division by zero"));
+    }
+}
+
+/// Apply a binary operator to two AnyScalar values, exactly like the
+/// ParseProgram's stack machine.
+static AnyScalar scalar_binary(ParseProgram::opcode_t op, const AnyScalar &a, const AnyScalar &b)
+{
+    switch(op)
+    {
+    case ParseProgram::OP_ADD: return a + b;
+    case ParseProgram::OP_SUB: return a - b;
+    case ParseProgram::OP_MUL: return a * b;
+    case ParseProgram::OP_DIV: return a / b;
+    case ParseProgram::OP_POW: return AnyScalar( std::pow(a.getDouble(), b.getDouble()) );
+    case ParseProgram::OP_EQUAL: return AnyScalar( a.equal_to(b) );
+    case ParseProgram::OP_NOTEQUAL: return AnyScalar( a.not_equal_to(b) );
+    case ParseProgram::OP_LESS: return AnyScalar( a.less(b) );
+    case ParseProgram::OP_GREATER: return AnyScalar( a.greater(b) );
+    case ParseProgram::OP_LESSEQUAL: return AnyScalar( a.less_equal(b) );
+    case ParseProgram::OP_GREATEREQUAL: return AnyScalar( a.greater_equal(b) );
+    default:
+	assert(0);
+	return AnyScalar();
+    }
+}
+
+/// Apply an unary operator to an AnyScalar value, exactly like the
+/// ParseProgram's stack machine.
+static AnyScalar scalar_unary(ParseProgram::opcode_t op, unsigned int arg, const AnyScalar &a)
+{
+    switch(op)
+    {
+    case ParseProgram::OP_NEG:
+	return -a;
+
+    case ParseProgram::OP_NOT:
+	if (a.getType() != AnyScalar::ATTRTYPE_BOOL)
+	    throw(BadSyntaxException("Invalid operand for !. Operand must be of type bool."));
+	return -a;
+
+    case ParseProgram::OP_CAST:
+    {
+	AnyScalar v = a;
+	v.convertType(static_cast<AnyScalar::attrtype_t>(arg));
+	return v;
+    }
+
+    default:
+	assert(0);
+	return AnyScalar();
+    }
+}
+
+void BatchColumn::applyUnary(ParseProgram::opcode_t op, unsigned int arg,
+			     const BatchColumn &a, BatchColumn &dest)
+{
+    unsigned int n = a.isConstant() ? 1 : a.size();
+
+    if (op == ParseProgram::OP_NEG)
+    {
+	switch(a.getType())
+	{
+	case ColumnBatch::COLUMN_BOOL:
+	{
+	    // negation of a bool inverts it.
+	    const unsigned char *s = a.getBools();
+	    unsigned char *r = dest.initBools(a.size(), a.isConstant());
+	    for(unsigned int i = 0; i < n; ++i) r[i] = !s[i];
+	    return;
+	}
+	case ColumnBatch::COLUMN_INT32:
+	{
+	    const int *s = a.getInts();
+	    int *r = dest.initInts(a.size(), a.isConstant());
+	    for(unsigned int i = 0; i < n; ++i) r[i] = -s[i];
+	    return;
+	}
+	case ColumnBatch::COLUMN_INT64:
+	{
+	    const long long *s = a.getLongs();
+	    long long *r = dest.initLongs(a.size(), a.isConstant());
+	    for(unsigned int i = 0; i < n; ++i) r[i] = -s[i];
+	    return;
+	}
+	case ColumnBatch::COLUMN_FLOAT:
+	{
+	    const float *s = a.getFloats();
+	    float *r = dest.initFloats(a.size(), a.isConstant());
+	    for(unsigned int i = 0; i < n; ++i) r[i] = -s[i];
+	    return;
+	}
+	case ColumnBatch::COLUMN_DOUBLE:
+	{
+	    const double *s = a.getDoubles();
+	    double *r = dest.initDoubles(a.size(), a.isConstant());
+	    for(unsigned int i = 0; i < n; ++i) r[i] = -s[i];
+	    return;
+	}
+	default:
+	    break;
+	}
+    }
+    else if (op == ParseProgram::OP_NOT)
+    {
+	if (a.getType() == ColumnBatch::COLUMN_BOOL)
+	{
+	    const unsigned char *s = a.getBools();
+	    unsigned char *r = dest.initBools(a.size(), a.isConstant());
+	    for(unsigned int i = 0; i < n; ++i) r[i] = !s[i];
+	    return;
+	}
+	else if (a.getType() != ColumnBatch::COLUMN_ANY && a.size() > 0)
+	{
+	    throw(BadSyntaxException("Invalid operand for !. Operand must be of type bool."));
+	}
+    }
+    else if (op == ParseProgram::OP_CAST)
+    {
+	AnyScalar::attrtype_t t = static_cast<AnyScalar::attrtype_t>(arg);
+
+	// conversions which do not change the values of integers and doubles
+	switch(a.getType())
+	{
+	case ColumnBatch::COLUMN_BOOL:
+	    if (t == AnyScalar::ATTRTYPE_BOOL) {
+		batch_convert(a.getBools(), dest.initBools(a.size(), a.isConstant()), n);
+		return;
+	    }
+	    break;
+
+	case ColumnBatch::COLUMN_INT32:
+	    if (t == AnyScalar::ATTRTYPE_INTEGER) {
+		batch_convert(a.getInts(), dest.initInts(a.size(), a.isConstant()), n);
+		return;
+	    }
+	    if (t == AnyScalar::ATTRTYPE_LONG) {
+		batch_convert(a.getInts(), dest.initLongs(a.size(), a.isConstant()), n);
+		return;
+	    }
+	    if (t == AnyScalar::ATTRTYPE_DOUBLE) {
+		batch_convert(a.getInts(), dest.initDoubles(a.size(), a.isConstant()), n);
+		return;
+	    }
+	    break;
+
+	case ColumnBatch::COLUMN_INT64:
+	    if (t == AnyScalar::ATTRTYPE_LONG) {
+		batch_convert(a.getLongs(), dest.initLongs(a.size(), a.isConstant()), n);
+		return;
+	    }
+	    if (t == AnyScalar::ATTRTYPE_DOUBLE) {
+		batch_convert(a.getLongs(), dest.initDoubles(a.size(), a.isConstant()), n);
+		return;
+	    }
+	    break;
+
+	case ColumnBatch::COLUMN_FLOAT:
+	    if (t == AnyScalar::ATTRTYPE_FLOAT) {
+		batch_convert(a.getFloats(), dest.initFloats(a.size(), a.isConstant()), n);
+		return;
+	    }
+	    if (t == AnyScalar::ATTRTYPE_DOUBLE) {
+		batch_convert(a.getFloats(), dest.initDoubles(a.size(), a.isConstant()), n);
+		return;
+	    }
+	    break;
+
+	case ColumnBatch::COLUMN_DOUBLE:
+	    if (t == AnyScalar::ATTRTYPE_DOUBLE) {
+		batch_convert(a.getDoubles(), dest.initDoubles(a.size(), a.isConstant()), n);
+		return;
+	    }
+	    break;
+
+	default:
+	    break;
+	}
+    }
+
+    // all other types and conversions are processed per row.
+    if (a.isConstant())
+    {
+	dest.setConstant(scalar_unary(op, arg, a.getValue(0)), a.size());
+	return;
+    }
+
+    std::vector<AnyScalar> v;
+    v.reserve(a.size());
+
+    for(unsigned int i = 0; i < a.size(); ++i)
+	v.push_back( scalar_unary(op, arg, a.getValue(i)) );
+
+    dest.setValues(v);
+}
+
+void BatchColumn::applyBinary(ParseProgram::opcode_t op,
+			      const BatchColumn &a, const BatchColumn &b, BatchColumn &dest)
+{
+    assert(a.size() == b.size());
+
+    if (is_numeric(a.getType()) && is_numeric(b.getType()))
+    {
+	switch(op)
+	{
+	case ParseProgram::OP_ADD:
+	    batch_arith(BatchKernels::ARITH_ADD, a, b, dest);
+	    return;
+
+	case ParseProgram::OP_SUB:
+	    batch_arith(BatchKernels::ARITH_SUB, a, b, dest);
+	    return;
+
+	case ParseProgram::OP_MUL:
+	    batch_arith(BatchKernels::ARITH_MUL, a, b, dest);
+	    return;
+
+	case ParseProgram::OP_DIV:
+	    if (promote_numeric(a.getType(), b.getType()) == ColumnBatch::COLUMN_INT32 ||
+		promote_numeric(a.getType(), b.getType()) == ColumnBatch::COLUMN_INT64)
+		batch_check_divisor(b);
+	    batch_arith(BatchKernels::ARITH_DIV, a, b, dest);
+	    return;
+
+	case ParseProgram::OP_POW:
+	    batch_pow(a, b, dest);
+	    return;
+
+	default:
+	    break;
+	}
+    }
+
+    if ((is_numeric(a.getType()) && is_numeric(b.getType())) ||
+	(a.getType() == ColumnBatch::COLUMN_BOOL && b.getType() == ColumnBatch::COLUMN_BOOL) ||
+	(a.getType() == ColumnBatch::COLUMN_STRING && b.getType() == ColumnBatch::COLUMN_STRING))
+    {
+	switch(op)
+	{
+	case ParseProgram::OP_EQUAL:
+	    batch_compare<std::equal_to>(BatchKernels::COMP_EQUAL, a, b, dest);
+	    return;
+
+	case ParseProgram::OP_NOTEQUAL:
+	    batch_compare<std::not_equal_to>(BatchKernels::COMP_NOTEQUAL, a, b, dest);
+	    return;
+
+	case ParseProgram::OP_LESS:
+	    batch_compare<std::less>(BatchKernels::COMP_LESS, a, b, dest);
+	    return;
+
+	case ParseProgram::OP_GREATER:
+	    batch_compare<std::greater>(BatchKernels::COMP_GREATER, a, b, dest);
+	    return;
+
+	case ParseProgram::OP_LESSEQUAL:
+	    batch_compare<std::less_equal>(BatchKernels::COMP_LESSEQUAL, a, b, dest);
+	    return;
+
+	case ParseProgram::OP_GREATEREQUAL:
+	    batch_compare<std::greater_equal>(BatchKernels::COMP_GREATEREQUAL, a, b, dest);
+	    return;
+
+	default:
+	    break;
+	}
+    }
+
+    // mixed types are processed per row by the AnyScalar operators.
+    if (a.isConstant() && b.isConstant())
+    {
+	dest.setConstant(scalar_binary(op, a.getValue(0), b.getValue(0)), a.size());
+	return;
+    }
+
+    std::vector<AnyScalar> v;
+    v.reserve(a.size());
+
+    for(unsigned int i = 0; i < a.size(); ++i)
+	v.push_back( scalar_binary(op, a.getValue(i), b.getValue(i)) );
+
+    dest.setValues(v);
+}
+
+void BatchColumn::applyLogic(bool isand, const BatchColumn &a, const BatchColumn &b,
+			     BatchColumn &dest)
+{
+    assert(a.size() == b.size());
+
+    unsigned char *r = dest.initBools(a.size(), a.isConstant() && b.isConstant());
+
+    if (isand)
+	BatchKernels::binary<unsigned char, batch_and>(a.getBools(), a.isConstant(),
+					       b.getBools(), b.isConstant(), r, a.size());
+    else
+	BatchKernels::binary<unsigned char, batch_or>(a.getBools(), a.isConstant(),
+					      b.getBools(), b.isConstant(), r, a.size());
+}
+
+// *** Evaluation of the parse tree
+
+/** SymbolTable used to evaluate single rows of a ColumnBatch: variables with a
+ * column in the batch return the value of the current row, all other lookups
+ * and function calls are passed on to the symbol table given to
+ * evaluateBatch(). */
+class BatchRowSymbolTable : public SymbolTable
+{
+public:
+    /// Batch containing the columns.
+    const ColumnBatch	&batch;
+
+    /// Symbol table for all other variables and the functions.
+    const SymbolTable	&st;
+
+    /// Current row evaluated.
+    unsigned int	row;
+
+    /// Construct for the first row of the batch.
+    BatchRowSymbolTable(const ColumnBatch &_batch, const SymbolTable &_st)
+	: batch(_batch), st(_st), row(0)
+    {
+    }
+
+    /// Return the value of the current row or look the variable up in the
+    /// other symbol table.
+    virtual AnyScalar	lookupVariable(const std::string &varname) const
+    {
+	const ColumnBatch::Column *col = batch.findColumn(varname);
+
+	if (col) return ColumnBatch::getValue(*col, batch.getRow(row));
+
+	return st.lookupVariable(varname);
+    }
+
+    /// Pass the function call on to the other symbol table.
+    virtual AnyScalar	processFunction(const std::string &funcname,
+					const paramlist_type &paramlist) const
+    {
+	return st.processFunction(funcname, paramlist);
+    }
+};
+
+void ParseNode::evaluateBatch(const ColumnBatch &batch, const SymbolTable &st,
+			      BatchColumn &dest) const
+{
+    BatchRowSymbolTable rowst(batch, st);
+
+    std::vector<AnyScalar> v;
+    v.reserve(batch.size());
+
+    for(rowst.row = 0; rowst.row < batch.size(); ++rowst.row)
+	v.push_back( evaluate(rowst) );
+
+    dest.setValues(v);
+}
+
+void ParseTree::evaluateBatch(const ColumnBatch &batch, BatchColumn &result,
+			      const SymbolTable &st) const
+{
+    assert(rootnode.get() != NULL);
+
+    try
+    {
+	rootnode->evaluateBatch(batch, st, result);
+    }
+    catch (ExpressionParserException &)
+    {
+	// the kernels process rows which a short-circuit operator would skip
+	// and do not stop at the first failing row, so repeat row by row.
+	rootnode->ParseNode::evaluateBatch(batch, st, result);
+    }
+}
+
+void ParseNode::evaluateSelection(const ColumnBatch &batch, const SymbolTable &st,
+				  std::vector<unsigned int> &selection) const
+{
+    if (selection.empty()) return;
+
+    BatchColumn result;
+
+    // the selection of increasing rows contains all rows if it is as long.
+    if (selection.size() == batch.size())
+	evaluateBatch(batch, st, result);
+    else
+	evaluateBatch(ColumnBatch(batch, selection), st, result);
+
+    if (result.getType() != ColumnBatch::COLUMN_BOOL)
+	throw(BadSyntaxException("Invalid expression for a selection. Result must be of type bool."));
+
+    const unsigned char *r = result.getBools();
+
+    if (result.isConstant())
+    {
+	if (!r[0]) selection.clear();
+	return;
+    }
+
+    unsigned int k = 0;
+
+    for(unsigned int i = 0; i < selection.size(); ++i)
+    {
+	if (r[i]) selection[k++] = selection[i];
+    }
+
+    selection.resize(k);
+}
+
+void ParseTree::evaluateBatch(const ColumnBatch &batch, std::vector<unsigned int> &selection,
+			      const SymbolTable &st) const
+{
+    assert(rootnode.get() != NULL);
+
+    selection.resize(batch.size());
+
+    for(unsigned int i = 0; i < batch.size(); ++i)
+	selection[i] = i;
+
+    try
+    {
+	rootnode->evaluateSelection(batch, st, selection);
+	return;
+    }
+    catch (ExpressionParserException &)
+    {
+	// repeat row by row to raise the exception of the first failing row
+	// or of a result which is not bool.
+    }
+
+    BatchColumn result;
+    rootnode->ParseNode::evaluateBatch(batch, st, result);
+
+    selection.clear();
+
+    if (result.getType() != ColumnBatch::COLUMN_BOOL)
+	throw(BadSyntaxException("Invalid expression for a selection. Result must be of type bool."));
+
+    const unsigned char *r = result.getBools();
+
+    for(unsigned int i = 0; i < result.size(); ++i)
+    {
+	if (r[i]) selection.push_back(i);
+    }
+}
+
+} // namespace stx
@@ -0,0 +1,284 @@
+// $Id$
+
+/*
+ * STX Expression Parser C++ Framework v0.7
+ * Copyright (C) 2007 Timo Bingmann
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/** \file ExpressionCache.cc
+ * Implementation of the ExpressionCache: a striped LRU map from normalized
+ * expression strings to their parse trees.
+ */
+
+#include "ExpressionParser.h"
+#include "Threads.h"
+
+#include <list>
+#include <map>
+
+#include <ctype.h>
+
+namespace stx {
+
+/// One part of the cache: a LRU list of the entries, the map from the keys to
+/// the list items and the counters, all protected by the mutex.
+struct ExpressionCache::Stripe
+{
+    /// A cached parse tree
+    struct Entry
+    {
+	/// Normalized expression string
+	std::string	key;
+
+	/// Parse tree of the expression
+	ParseTree	tree;
+
+	/// Memory accounted for this entry
+	size_t		bytes;
+    };
+
+    /// The LRU list: the most recently used entry is at the front.
+    typedef std::list<Entry>	lrulist_type;
+
+    /// Map from the normalized expression to its entry in the LRU list.
+    typedef std::map<std::string, lrulist_type::iterator>	keymap_type;
+
+    /// Mutex protecting all other fields.
+    pthread_mutex_t	mutex;
+
+    /// The LRU list of entries.
+    lrulist_type	lrulist;
+
+    /// Map of the keys in the LRU list.
+    keymap_type		keymap;
+
+    /// Maximum number of entries in this stripe.
+    size_t		maxentries;
+
+    /// Maximum number of bytes used by entries of this stripe.
+    size_t		maxbytes;
+
+    /// Current number of entries, std::list::size() may be linear.
+    size_t		entries;
+
+    /// Current number of bytes used by the entries.
+    size_t		bytes;
+
+    /// Counters of this stripe.
+    size_t		hits, misses, evictions;
+
+    Stripe()
+	: maxentries(0), maxbytes(0), entries(0), bytes(0),
+	  hits(0), misses(0), evictions(0)
+    {
+	pthread_mutex_init(&mutex, NULL);
+    }
+
+    ~Stripe()
+    {
+	pthread_mutex_destroy(&mutex);
+    }
+
+    /// Look up the key and move it to the front of the LRU list. Returns
+    /// false if it is not cached. The mutex must be locked.
+    bool find(const std::string &key, ParseTree &tree)
+    {
+	keymap_type::iterator ki = keymap.find(key);
+	if (ki == keymap.end()) return false;
+
+	lrulist.splice(lrulist.begin(), lrulist, ki->second);
+	tree = ki->second->tree;
+	return true;
+    }
+
+    /// Insert a new entry at the front of the LRU list and evict the least
+    /// recently used entries exceeding the capacity. The mutex must be
+    /// locked.
+    void insert(const std::string &key, const ParseTree &tree)
+    {
+	Entry entry;
+	entry.key = key;
+	entry.tree = tree;
+	entry.bytes = tree.getMemoryUsage() + key.size();
+
+	lrulist.push_front(entry);
+	keymap[key] = lrulist.begin();
+
+	entries++;
+	bytes += entry.bytes;
+
+	while (entries > maxentries || bytes > maxbytes)
+	{
+	    Entry &last = lrulist.back();
+
+	    keymap.erase(last.key);
+	    entries--;
+	    bytes -= last.bytes;
+	    evictions++;
+
+	    lrulist.pop_back();
+	}
+    }
+
+    /// Remove all entries. The mutex must be locked.
+    void clear()
+    {
+	keymap.clear();
+	lrulist.clear();
+	entries = bytes = 0;
+    }
+};
+
+ExpressionCache::ExpressionCache(size_t maxentries, size_t maxbytes, unsigned int _stripes)
+{
+    // use at least one entry per stripe
+    stripecount = _stripes;
+    if (stripecount > maxentries) stripecount = static_cast<unsigned int>(maxentries);
+    if (stripecount == 0) stripecount = 1;
+
+    stripes = new Stripe[stripecount];
+
+    // divide the capacity evenly among the stripes
+    for(unsigned int i = 0; i < stripecount; ++i)
+    {
+	stripes[i].maxentries = maxentries / stripecount + (i < maxentries % stripecount ? 1 : 0);
+	stripes[i].maxbytes = maxbytes / stripecount + (i < maxbytes % stripecount ? 1 : 0);
+    }
+}
+
+ExpressionCache::~ExpressionCache()
+{
+    delete [] stripes;
+}
+
+ExpressionCache::Stripe& ExpressionCache::getStripe(const std::string &key) const
+{
+    // FNV-1a hash of the key
+    unsigned int hash = 2166136261u;
+
+    for(std::string::const_iterator ki = key.begin(); ki != key.end(); ++ki)
+    {
+	hash ^= static_cast<unsigned char>(*ki);
+	hash *= 16777619u;
+    }
+
+    return stripes[hash % stripecount];
+}
+
+const ParseTree ExpressionCache::parse(const std::string &input)
+{
+    std::string key = normalize(input);
+    Stripe &stripe = getStripe(key);
+
+    ParseTree tree;
+
+    {
+	MutexLock lock(stripe.mutex);
+
+	if (stripe.find(key, tree)) {
+	    stripe.hits++;
+	    return tree;
+	}
+
+	stripe.misses++;
+    }
+
+    // parse the original input without holding the lock, so that syntax
+    // errors report the positions of the input. exceptions are passed on.
+    tree = parseExpression(input);
+
+    MutexLock lock(stripe.mutex);
+
+    // another thread may have inserted the same expression meanwhile.
+    ParseTree cached;
+    if (stripe.find(key, cached))
+	return cached;
+
+    stripe.insert(key, tree);
+
+    return tree;
+}
+
+void ExpressionCache::clear()
+{
+    for(unsigned int i = 0; i < stripecount; ++i)
+    {
+	MutexLock lock(stripes[i].mutex);
+	stripes[i].clear();
+    }
+}
+
+ExpressionCache::Statistics ExpressionCache::getStatistics() const
+{
+    Statistics stats;
+    stats.hits = stats.misses = stats.evictions = stats.entries = stats.bytes = 0;
+
+    for(unsigned int i = 0; i < stripecount; ++i)
+    {
+	MutexLock lock(stripes[i].mutex);
+
+	stats.hits += stripes[i].hits;
+	stats.misses += stripes[i].misses;
+	stats.evictions += stripes[i].evictions;
+	stats.entries += stripes[i].entries;
+	stats.bytes += stripes[i].bytes;
+    }
+
+    return stats;
+}
+
+std::string ExpressionCache::normalize(const std::string &input)
+{
+    std::string key;
+    key.reserve(input.size());
+
+    bool instring = false, whitespace = false;
+
+    for(std::string::const_iterator si = input.begin(); si != input.end(); ++si)
+    {
+	if (instring)
+	{
+	    // copy string constants verbatim, including escaped quotes.
+	    key += *si;
+
+	    if (*si == '\\' && si + 1 != input.end())
+		key += *++si;
+	    else if (*si == '"')
+		instring = false;
+
+	    continue;
+	}
+
+	if (isspace(static_cast<unsigned char>(*si))) {
+	    whitespace = true;
+	    continue;
+	}
+
+	if (whitespace && !key.empty()) key += ' ';
+	whitespace = false;
+
+	if (*si == '"') instring = true;
+	key += *si;
+    }
+
+    // trailing whitespace is a syntax error and must not be removed.
+    if (whitespace && !key.empty()) key += ' ';
+
+    return key;
+}
+
+} // namespace stx
@@ -0,0 +1,718 @@
+// $Id$
+
+/*
+ * STX Expression Parser C++ Framework v0.7
+ * Copyright (C) 2007 Timo Bingmann
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/** \file ExpressionIndex.cc
+ * Implementation of the ExpressionIndex: per-variable indexes of the
+ * predicates of many boolean expressions and the counting match algorithm.
+ */
+
+#include "ExpressionParser.h"
+
+#include <algorithm>
+#include <map>
+
+#include <limits.h>
+
+#include <boost/unordered_map.hpp>
+
+namespace stx {
+
+/// The per-variable indexes of the predicates, the subscriptions and their
+/// conjunctions and the scratch space of match().
+struct ExpressionIndex::Impl
+{
+    /// Kinds of values which are compared exactly by the indexes.
+    enum kind_t { KIND_NUMBER, KIND_STRING, KIND_BOOL, KIND_OTHER };
+
+    /// Bits of the per-conjunction scratch flags.
+    enum flag_t
+    {
+	/// The conjunction is in the touched list.
+	FLAG_TOUCHED = 1,
+	/// A predicate was counted without being decided.
+	FLAG_UNDECIDED = 2,
+	/// A != predicate failed.
+	FLAG_FAILED = 4
+    };
+
+    /// List of conjunction or subscription ids.
+    typedef std::vector<unsigned int>	idlist_type;
+
+    /// An indexed predicate "varname op value" of a conjunction.
+    struct Predicate
+    {
+	/// Name of the compared variable
+	std::string	varname;
+
+	/// Comparison opcode of ParseProgram
+	int		op;
+
+	/// Constant compared with
+	AnyScalar	value;
+    };
+
+    /// One conjunction of the top-level or-chain of a subscription.
+    struct Conjunction
+    {
+	/// Subscription the conjunction belongs to
+	unsigned int	subscription;
+
+	/// Indexed predicates, all of which must be satisfied.
+	std::vector<Predicate> predicates;
+
+	/// Number of predicates which are counted when satisfied, all others
+	/// are != predicates which fail the conjunction.
+	unsigned int	positives;
+
+	/// True if the predicates alone do not decide whether the
+	/// subscription matches.
+	bool		verify;
+    };
+
+    /// A subscription: the tree is empty for unused ids.
+    struct Subscription
+    {
+	/// Boolean expression of the subscription
+	ParseTree	tree;
+
+	/// Compiled tree used to verify candidates
+	ParseProgram	program;
+
+	/// Ids of the subscription's conjunctions
+	idlist_type	conjunctions;
+    };
+
+    /// Hash table of numeric (in)equality predicates.
+    typedef boost::unordered_map<double, idlist_type>		numhash_type;
+
+    /// Hash table of string (in)equality predicates.
+    typedef boost::unordered_map<std::string, idlist_type>	strhash_type;
+
+    /// Range predicates as pairs of constant and conjunction, sorted to be
+    /// scanned sequentially.
+    typedef std::vector< std::pair<double, unsigned int> >	rangemap_type;
+
+    /// The predicates on one variable.
+    struct VarIndex
+    {
+	/// Conjunctions with var == number by the number.
+	numhash_type	numequal;
+
+	/// Conjunctions with var != number by the number.
+	numhash_type	numnotequal;
+
+	/// Conjunctions with var < number, > number, <= number and >=
+	/// number, in the order of the opcodes.
+	rangemap_type	range[4];
+
+	/// Number of numeric predicates.
+	unsigned int	numcount;
+
+	/// Conjunctions with var == string by the string.
+	strhash_type	strequal;
+
+	/// Conjunctions with var != string by the string.
+	strhash_type	strnotequal;
+
+	/// Number of string predicates.
+	unsigned int	strcount;
+
+	/// Conjunctions with var == false and var == true. A != bool
+	/// predicate is indexed as == with the negated bool.
+	idlist_type	boolequal[2];
+
+	VarIndex()
+	    : numcount(0), strcount(0)
+	{
+	}
+
+	/// Total number of predicates on the variable.
+	inline unsigned int predcount() const
+	{
+	    return numcount + strcount + boolequal[0].size() + boolequal[1].size();
+	}
+    };
+
+    /// Map of the indexed variables.
+    typedef std::map<std::string, VarIndex>	varmap_type;
+
+    /// The indexed variables.
+    varmap_type		vars;
+
+    /// All subscriptions by id.
+    std::vector<Subscription> subscriptions;
+
+    /// Unused ids of subscriptions.
+    idlist_type		freesubscriptions;
+
+    /// All conjunctions by id.
+    std::vector<Conjunction> conjunctions;
+
+    /// Unused ids of conjunctions.
+    idlist_type		freeconjunctions;
+
+    /// Conjunctions without counted predicates, which are candidates unless
+    /// one of their != predicates fails.
+    idlist_type		always;
+
+    /// Number of subscriptions.
+    size_t		subscriptioncount;
+
+    /// Scratch: number of satisfied predicates of each conjunction.
+    std::vector<unsigned int> counts;
+
+    /// Scratch: flag_t bits of each conjunction.
+    std::vector<unsigned char> flags;
+
+    /// Scratch: conjunctions with FLAG_TOUCHED set.
+    idlist_type		touched;
+
+    /// Scratch: pairs of subscription and whether it must be verified.
+    std::vector< std::pair<unsigned int, bool> > candidates;
+
+    Impl()
+	: subscriptioncount(0)
+    {
+    }
+
+    /// Largest magnitude up to which all integers are exact as double.
+    static const long long maxexact;
+
+    /// Classify a value: returns the kind and for numbers the double value,
+    /// which compares exactly like the original. Integers beyond 2^53, NaN,
+    /// float and unsigned values are KIND_OTHER.
+    static int classify(const AnyScalar &v, double &d)
+    {
+	switch(v.getType())
+	{
+	case AnyScalar::ATTRTYPE_BOOL:
+	    return KIND_BOOL;
+
+	case AnyScalar::ATTRTYPE_CHAR:
+	case AnyScalar::ATTRTYPE_SHORT:
+	case AnyScalar::ATTRTYPE_INTEGER:
+	    d = v.getInteger();
+	    return KIND_NUMBER;
+
+	case AnyScalar::ATTRTYPE_LONG:
+	{
+	    long long l = v.getLong();
+	    if (l < -maxexact || l > maxexact) return KIND_OTHER;
+	    d = static_cast<double>(l);
+	    return KIND_NUMBER;
+	}
+
+	case AnyScalar::ATTRTYPE_DOUBLE:
+	    d = v.getDouble();
+	    if (d != d) return KIND_OTHER;
+	    d += 0.0;	// -0.0 hashes like 0.0
+	    return KIND_NUMBER;
+
+	case AnyScalar::ATTRTYPE_STRING:
+	    return KIND_STRING;
+
+	default:
+	    return KIND_OTHER;
+	}
+    }
+
+    /// Remove one occurrence of the id from the list.
+    static void eraseId(idlist_type &list, unsigned int id)
+    {
+	idlist_type::iterator i = std::find(list.begin(), list.end(), id);
+	assert(i != list.end());
+	list.erase(i);
+    }
+
+    /// Remove one occurrence of the id from the hash table's list of key.
+    template <typename HashType, typename KeyType>
+    static void eraseId(HashType &hash, const KeyType &key, unsigned int id)
+    {
+	typename HashType::iterator hi = hash.find(key);
+	assert(hi != hash.end());
+
+	eraseId(hi->second, id);
+	if (hi->second.empty()) hash.erase(hi);
+    }
+
+    /// Try to index the predicate for the conjunction, a != bool predicate
+    /// is changed into == the negated bool. Returns false if the predicate
+    /// cannot be decided exactly by the indexes.
+    bool insertPredicate(Predicate &p, unsigned int conj)
+    {
+	double d = 0;
+	int kind = classify(p.value, d);
+
+	if (kind == KIND_NUMBER)
+	{
+	    if (p.op == ParseProgram::OP_EQUAL)
+		vars[p.varname].numequal[d].push_back(conj);
+	    else if (p.op == ParseProgram::OP_NOTEQUAL)
+		vars[p.varname].numnotequal[d].push_back(conj);
+	    else
+	    {
+		rangemap_type &rm = vars[p.varname].range[p.op - ParseProgram::OP_LESS];
+		std::pair<double, unsigned int> entry(d, conj);
+		rm.insert(std::lower_bound(rm.begin(), rm.end(), entry), entry);
+	    }
+
+	    vars[p.varname].numcount++;
+	    return true;
+	}
+	else if (kind == KIND_STRING)
+	{
+	    if (p.op == ParseProgram::OP_EQUAL)
+		vars[p.varname].strequal[p.value.getString()].push_back(conj);
+	    else if (p.op == ParseProgram::OP_NOTEQUAL)
+		vars[p.varname].strnotequal[p.value.getString()].push_back(conj);
+	    else
+		return false;
+
+	    vars[p.varname].strcount++;
+	    return true;
+	}
+	else if (kind == KIND_BOOL)
+	{
+	    if (p.op == ParseProgram::OP_NOTEQUAL) {
+		p.op = ParseProgram::OP_EQUAL;
+		p.value = AnyScalar(!p.value.getBoolean());
+	    }
+	    else if (p.op != ParseProgram::OP_EQUAL) {
+		return false;
+	    }
+
+	    vars[p.varname].boolequal[p.value.getBoolean()].push_back(conj);
+	    return true;
+	}
+
+	return false;
+    }
+
+    /// Remove an indexed predicate of the conjunction.
+    void erasePredicate(const Predicate &p, unsigned int conj)
+    {
+	varmap_type::iterator vi = vars.find(p.varname);
+	assert(vi != vars.end());
+
+	double d = 0;
+	int kind = classify(p.value, d);
+
+	if (kind == KIND_NUMBER)
+	{
+	    if (p.op == ParseProgram::OP_EQUAL)
+		eraseId(vi->second.numequal, d, conj);
+	    else if (p.op == ParseProgram::OP_NOTEQUAL)
+		eraseId(vi->second.numnotequal, d, conj);
+	    else
+	    {
+		rangemap_type &rm = vi->second.range[p.op - ParseProgram::OP_LESS];
+		rangemap_type::iterator ri = std::lower_bound(rm.begin(), rm.end(), std::make_pair(d, conj));
+
+		assert(ri != rm.end() && ri->second == conj);
+		rm.erase(ri);
+	    }
+	    vi->second.numcount--;
+	}
+	else if (kind == KIND_STRING)
+	{
+	    if (p.op == ParseProgram::OP_EQUAL)
+		eraseId(vi->second.strequal, p.value.getString(), conj);
+	    else
+		eraseId(vi->second.strnotequal, p.value.getString(), conj);
+
+	    vi->second.strcount--;
+	}
+	else
+	{
+	    eraseId(vi->second.boolequal[p.value.getBoolean()], conj);
+	}
+
+	if (vi->second.predcount() == 0)
+	    vars.erase(vi);
+    }
+
+    /// Create a conjunction of the subscription from the operands of an
+    /// and-chain.
+    unsigned int addConjunction(unsigned int sub, const std::vector<const ParseNode*> &operands,
+				bool verify)
+    {
+	unsigned int conj;
+
+	if (!freeconjunctions.empty()) {
+	    conj = freeconjunctions.back();
+	    freeconjunctions.pop_back();
+	}
+	else {
+	    conj = conjunctions.size();
+	    conjunctions.push_back(Conjunction());
+	    counts.push_back(0);
+	    flags.push_back(0);
+	}
+
+	Conjunction &c = conjunctions[conj];
+	c.subscription = sub;
+	c.positives = 0;
+	c.verify = verify;
+
+	for(unsigned int i = 0; i < operands.size(); ++i)
+	{
+	    Predicate p;
+
+	    if (operands[i]->getPredicate(p.varname, p.op, p.value) && insertPredicate(p, conj))
+	    {
+		c.predicates.push_back(p);
+		if (p.op != ParseProgram::OP_NOTEQUAL) c.positives++;
+	    }
+	    else
+		c.verify = true;
+	}
+
+	if (c.positives == 0)
+	    always.push_back(conj);
+
+	return conj;
+    }
+
+    /// Remove the conjunction from the indexes and free its id.
+    void eraseConjunction(unsigned int conj)
+    {
+	Conjunction &c = conjunctions[conj];
+
+	for(unsigned int i = 0; i < c.predicates.size(); ++i)
+	    erasePredicate(c.predicates[i], conj);
+
+	if (c.positives == 0)
+	    eraseId(always, conj);
+
+	c.predicates.clear();
+	freeconjunctions.push_back(conj);
+    }
+
+    /// Set flag bits of the conjunction.
+    inline void mark(unsigned int conj, unsigned char bits)
+    {
+	if (flags[conj] == 0) touched.push_back(conj);
+	flags[conj] |= bits | FLAG_TOUCHED;
+    }
+
+    /// Set flag bits of all conjunctions in the list.
+    inline void markAll(const idlist_type &list, unsigned char bits)
+    {
+	for(idlist_type::const_iterator i = list.begin(); i != list.end(); ++i)
+	    mark(*i, bits);
+    }
+
+    /// Set flag bits of all conjunctions in the hash table.
+    template <typename HashType>
+    inline void markAll(const HashType &hash, unsigned char bits)
+    {
+	for(typename HashType::const_iterator hi = hash.begin(); hi != hash.end(); ++hi)
+	    markAll(hi->second, bits);
+    }
+
+    /// Count one satisfied or undecided predicate of the conjunction.
+    inline void hit(unsigned int conj, bool undecided)
+    {
+	counts[conj]++;
+	mark(conj, undecided ? FLAG_UNDECIDED : 0);
+    }
+
+    /// Count all predicates in the list.
+    inline void hitAll(const idlist_type &list, bool undecided)
+    {
+	for(idlist_type::const_iterator i = list.begin(); i != list.end(); ++i)
+	    hit(*i, undecided);
+    }
+
+    /// Return the first range predicate with constant >= d.
+    static inline rangemap_type::const_iterator lowerBound(const rangemap_type &rm, double d)
+    {
+	return std::lower_bound(rm.begin(), rm.end(), std::make_pair(d, 0u));
+    }
+
+    /// Return the first range predicate with constant > d.
+    static inline rangemap_type::const_iterator upperBound(const rangemap_type &rm, double d)
+    {
+	return std::upper_bound(rm.begin(), rm.end(), std::make_pair(d, UINT_MAX));
+    }
+
+    /// Count the range predicates in [begin,end).
+    inline void hitRange(rangemap_type::const_iterator begin, rangemap_type::const_iterator end,
+			 bool undecided)
+    {
+	for(rangemap_type::const_iterator i = begin; i != end; ++i)
+	    hit(i->second, undecided);
+    }
+
+    /// Count the numeric predicates on the variable satisfied by d and fail
+    /// those with != d.
+    void matchNumber(const VarIndex &vi, double d)
+    {
+	numhash_type::const_iterator ni = vi.numequal.find(d);
+	if (ni != vi.numequal.end()) hitAll(ni->second, false);
+
+	ni = vi.numnotequal.find(d);
+	if (ni != vi.numnotequal.end()) markAll(ni->second, FLAG_FAILED);
+
+	// var < c and var <= c are satisfied for the constants above d
+	const rangemap_type &less = vi.range[0], &lessequal = vi.range[2];
+	hitRange(upperBound(less, d), less.end(), false);
+	hitRange(lowerBound(lessequal, d), lessequal.end(), false);
+
+	// var > c and var >= c for the constants below d
+	const rangemap_type &greater = vi.range[1], &greaterequal = vi.range[3];
+	hitRange(greater.begin(), lowerBound(greater, d), false);
+	hitRange(greaterequal.begin(), upperBound(greaterequal, d), false);
+    }
+
+    /// Count the string predicates on the variable satisfied by s and fail
+    /// those with != s.
+    void matchString(const VarIndex &vi, const std::string &s)
+    {
+	strhash_type::const_iterator si = vi.strequal.find(s);
+	if (si != vi.strequal.end()) hitAll(si->second, false);
+
+	si = vi.strnotequal.find(s);
+	if (si != vi.strnotequal.end()) markAll(si->second, FLAG_FAILED);
+    }
+
+    /// Count all numeric predicates on the variable as undecided.
+    void undecideNumbers(const VarIndex &vi)
+    {
+	for(numhash_type::const_iterator ni = vi.numequal.begin(); ni != vi.numequal.end(); ++ni)
+	    hitAll(ni->second, true);
+
+	for(unsigned int r = 0; r < 4; ++r)
+	    hitRange(vi.range[r].begin(), vi.range[r].end(), true);
+
+	markAll(vi.numnotequal, FLAG_UNDECIDED);
+    }
+
+    /// Count all string predicates on the variable as undecided.
+    void undecideStrings(const VarIndex &vi)
+    {
+	for(strhash_type::const_iterator si = vi.strequal.begin(); si != vi.strequal.end(); ++si)
+	    hitAll(si->second, true);
+
+	markAll(vi.strnotequal, FLAG_UNDECIDED);
+    }
+
+    /// Collect the candidate subscriptions from the counts and flags and
+    /// reset the scratch space.
+    void collectCandidates()
+    {
+	candidates.clear();
+
+	for(idlist_type::const_iterator i = touched.begin(); i != touched.end(); ++i)
+	{
+	    const Conjunction &c = conjunctions[*i];
+
+	    if (counts[*i] == c.positives && !(flags[*i] & FLAG_FAILED))
+		candidates.push_back(std::make_pair(c.subscription, c.verify || (flags[*i] & FLAG_UNDECIDED)));
+	}
+
+	for(idlist_type::const_iterator i = always.begin(); i != always.end(); ++i)
+	{
+	    if (flags[*i] == 0)
+		candidates.push_back(std::make_pair(conjunctions[*i].subscription, conjunctions[*i].verify));
+	}
+
+	for(idlist_type::const_iterator i = touched.begin(); i != touched.end(); ++i)
+	{
+	    counts[*i] = 0;
+	    flags[*i] = 0;
+	}
+	touched.clear();
+    }
+
+    /// Evaluate the compiled subscription, true if it is the bool true.
+    static bool evaluate(const ParseProgram &program, const SymbolTable &st)
+    {
+	try {
+	    AnyScalar result = program.evaluate(st);
+	    return (result.getType() == AnyScalar::ATTRTYPE_BOOL && result.getBoolean());
+	}
+	catch (ExpressionParserException &)
+	{
+	    return false;
+	}
+    }
+};
+
+const long long ExpressionIndex::Impl::maxexact = 9007199254740992LL;
+
+ExpressionIndex::ExpressionIndex()
+    : impl(new Impl)
+{
+}
+
+ExpressionIndex::~ExpressionIndex()
+{
+    delete impl;
+}
+
+unsigned int ExpressionIndex::add(const ParseTree &pt)
+{
+    assert(!pt.isEmpty());
+
+    unsigned int sub;
+
+    if (!impl->freesubscriptions.empty()) {
+	sub = impl->freesubscriptions.back();
+	impl->freesubscriptions.pop_back();
+    }
+    else {
+	sub = impl->subscriptions.size();
+	impl->subscriptions.push_back(Impl::Subscription());
+    }
+
+    impl->subscriptions[sub].tree = pt;
+    impl->subscriptions[sub].program = pt.compile();
+    impl->subscriptioncount++;
+
+    // split the tree into the conjunctions of the top-level or-chain
+    std::vector<const ParseNode*> disjuncts;
+
+    if (pt.rootnode->flattenChain(disjuncts) != ParseProgram::CHAIN_OR) {
+	disjuncts.clear();
+	disjuncts.push_back(pt.rootnode.get());
+    }
+
+    for(unsigned int i = 0; i < disjuncts.size(); ++i)
+    {
+	std::vector<const ParseNode*> operands;
+
+	if (disjuncts[i]->flattenChain(operands) != ParseProgram::CHAIN_AND) {
+	    operands.clear();
+	    operands.push_back(disjuncts[i]);
+	}
+
+	unsigned int conj = impl->addConjunction(sub, operands, disjuncts.size() > 1);
+	impl->subscriptions[sub].conjunctions.push_back(conj);
+    }
+
+    return sub;
+}
+
+bool ExpressionIndex::remove(unsigned int id)
+{
+    if (id >= impl->subscriptions.size() || impl->subscriptions[id].tree.isEmpty())
+	return false;
+
+    Impl::Subscription &s = impl->subscriptions[id];
+
+    for(unsigned int i = 0; i < s.conjunctions.size(); ++i)
+	impl->eraseConjunction(s.conjunctions[i]);
+
+    s.conjunctions.clear();
+    s.tree = ParseTree();
+    s.program = ParseProgram();
+
+    impl->freesubscriptions.push_back(id);
+    impl->subscriptioncount--;
+
+    return true;
+}
+
+size_t ExpressionIndex::size() const
+{
+    return impl->subscriptioncount;
+}
+
+void ExpressionIndex::match(const SymbolTable &st, std::vector<unsigned int> &matches)
+{
+    matches.clear();
+
+    for(Impl::varmap_type::const_iterator vi = impl->vars.begin(); vi != impl->vars.end(); ++vi)
+    {
+	AnyScalar value;
+
+	try {
+	    value = st.lookupVariable(vi->first);
+	}
+	catch (ExpressionParserException &)
+	{
+	    // no predicate on an unknown variable is satisfied: only the !=
+	    // predicates have to be failed explicitly.
+	    impl->markAll(vi->second.numnotequal, Impl::FLAG_FAILED);
+	    impl->markAll(vi->second.strnotequal, Impl::FLAG_FAILED);
+	    continue;
+	}
+
+	double d = 0;
+	int kind = Impl::classify(value, d);
+
+	// predicates comparing with a value of another kind are counted as
+	// satisfied and their conjunctions verified.
+	if (kind == Impl::KIND_NUMBER)
+	    impl->matchNumber(vi->second, d);
+	else if (vi->second.numcount)
+	    impl->undecideNumbers(vi->second);
+
+	if (kind == Impl::KIND_STRING)
+	    impl->matchString(vi->second, value.getString());
+	else if (vi->second.strcount)
+	    impl->undecideStrings(vi->second);
+
+	if (kind == Impl::KIND_BOOL)
+	{
+	    impl->hitAll(vi->second.boolequal[value.getBoolean()], false);
+	}
+	else
+	{
+	    impl->hitAll(vi->second.boolequal[0], true);
+	    impl->hitAll(vi->second.boolequal[1], true);
+	}
+    }
+
+    impl->collectCandidates();
+
+    // each subscription is matched directly if one of its candidate
+    // conjunctions is conclusive, otherwise it is evaluated once.
+    std::sort(impl->candidates.begin(), impl->candidates.end());
+
+    for(unsigned int i = 0; i < impl->candidates.size(); )
+    {
+	unsigned int sub = impl->candidates[i].first;
+
+	// false sorts before true
+	bool verify = impl->candidates[i].second;
+
+	while (i < impl->candidates.size() && impl->candidates[i].first == sub) ++i;
+
+	if (!verify || Impl::evaluate(impl->subscriptions[sub].program, st))
+	    matches.push_back(sub);
+    }
+}
+
+bool ExpressionIndex::evaluate(const ParseTree &pt, const SymbolTable &st)
+{
+    try {
+	AnyScalar result = pt.evaluate(st);
+	return (result.getType() == AnyScalar::ATTRTYPE_BOOL && result.getBoolean());
+    }
+    catch (ExpressionParserException &)
+    {
+	return false;
+    }
+}
+
+} // namespace stx
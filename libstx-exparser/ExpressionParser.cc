@@ -20,12 +20,16 @@
  */
 
 /** \file ExpressionParser.cc
- * Implementation of the parser using a boost::spirit grammar and a different
- * specializations of ParseNode.
+ * Implementation of the parser using a hand-written recursive descent parser
+ * equivalent to a boost::spirit grammar and a different specializations of
+ * ParseNode.
  */
 
 #include "ExpressionParser.h"
+#include "Threads.h"
 #include <string.h>
+#include <ctype.h>
+#include <limits.h>
 
 #include <boost/spirit/core.hpp>
 
@@ -40,6 +44,8 @@
 #include <iostream>
 #include <sstream>
 #include <cmath>
+#include <algorithm>
+#include <iterator>
 
 // #define STX_DEBUG_PARSER
 
@@ -373,6 +379,22 @@ public:
 	}
 	return value.getString();
     }
+
+    /// Emit the constant into the program's constant pool.
+    virtual void compile(ParseProgram &prog) const
+    {
+	prog.emitConstant(value);
+    }
+
+    /// The constant is the same for all rows.
+    virtual void evaluateBatch(const ColumnBatch &batch, const class SymbolTable &,
+			       BatchColumn &dest) const
+    {
+	dest.setConstant(value, batch.size());
+    }
+
+    /// Copy the constant.
+    virtual ParseNode* optimize(ParseOptimizer &po) const;
 };
 
 /// Parse tree node representing a variable place-holder. It is filled when
@@ -407,35 +429,65 @@ public:
     {
 	return varname;
     }
+
+    /// Emit a variable lookup instruction.
+    virtual void compile(ParseProgram &prog) const
+    {
+	prog.emitVariable(varname);
+    }
+
+    /// Refer to the batch's column of the variable. Variables without a
+    /// column are looked up once in the symbol table.
+    virtual void evaluateBatch(const ColumnBatch &batch, const class SymbolTable &st,
+			       BatchColumn &dest) const
+    {
+	const ColumnBatch::Column *col = batch.findColumn(varname);
+
+	if (col)
+	    batch.loadColumn(*col, dest);
+	else
+	    dest.setConstant(st.lookupVariable(varname), batch.size());
+    }
+
+    /// Copy the variable, its type is taken from the optimizer's options.
+    virtual ParseNode* optimize(ParseOptimizer &po) const;
+
+    /// Insert the variable's name.
+    virtual void getVariables(std::set<std::string> &varset) const
+    {
+	varset.insert(varname);
+    }
+
+    /// A variable used as a condition is the predicate "varname == true".
+    virtual bool getPredicate(std::string &_varname, int &op, AnyScalar &value) const
+    {
+	_varname = varname;
+	op = ParseProgram::OP_EQUAL;
+	value = AnyScalar(true);
+	return true;
+    }
 };
 
 /// Parse tree node representing a function place-holder. It is filled when
 /// parameterized by a symbol table.
 class PNFunction : public ParseNode
 {
-public:
-    /// Type of sequence of subtrees to evaluate as function parameters.
-    typedef std::vector<const class ParseNode*> paramlist_type;
-
-private:
+protected:
     /// String name of the function
     std::string		funcname;
 
-    /// The array of function parameter subtrees
-    paramlist_type	paramlist;
+    /// The array of function parameter subtrees, allocated in the arena
+    const ParseNode* const* paramlist;
 
-public:
-    /// Constructor from the string received from the parser.
-    PNFunction(std::string _funcname, const paramlist_type& _paramlist)
-	: ParseNode(), funcname(_funcname), paramlist(_paramlist)
-    {
-    }
+    /// Number of function parameters
+    unsigned int	paramcount;
 
-    /// Delete the paramlist
-    ~PNFunction()
+public:
+    /// Constructor from the string received from the parser and the
+    /// parameter array.
+    PNFunction(std::string _funcname, const ParseNode* const* _paramlist, unsigned int _paramcount)
+	: ParseNode(), funcname(_funcname), paramlist(_paramlist), paramcount(_paramcount)
     {
-	for(unsigned int i = 0; i < paramlist.size(); ++i)
-	    delete paramlist[i];
     }
 
     /// Check the given symbol table for the actual value of this variable.
@@ -443,7 +495,7 @@ public:
     {
 	std::vector<AnyScalar> paramvalues;
 
-	for(unsigned int i = 0; i < paramlist.size(); ++i)
+	for(unsigned int i = 0; i < paramcount; ++i)
 	{
 	    paramvalues.push_back( paramlist[i]->evaluate(st) );
 	}
@@ -461,13 +513,173 @@ public:
     virtual std::string toString() const
     {
 	std::string str = funcname + "(";
-	for(unsigned int i = 0; i < paramlist.size(); ++i)
+	for(unsigned int i = 0; i < paramcount; ++i)
 	{
 	    if (i != 0) str += ",";
 	    str += paramlist[i]->toString();
 	}
 	return str + ")";
     }
+
+    /// Emit the parameter subtrees followed by the function call.
+    virtual void compile(ParseProgram &prog) const
+    {
+	for(unsigned int i = 0; i < paramcount; ++i)
+	{
+	    paramlist[i]->compile(prog);
+	}
+
+	prog.emitFunction(funcname, paramcount);
+    }
+
+    /// Evaluate the parameter columns and call the function for each row.
+    virtual void evaluateBatch(const ColumnBatch &batch, const class SymbolTable &st,
+			       BatchColumn &dest) const
+    {
+	boost::scoped_array<BatchColumn> paramcols(new BatchColumn[paramcount]);
+
+	for(unsigned int i = 0; i < paramcount; ++i)
+	{
+	    paramlist[i]->evaluateBatch(batch, st, paramcols[i]);
+	}
+
+	std::vector<AnyScalar> paramvalues(paramcount);
+	std::vector<AnyScalar> values;
+	values.reserve(batch.size());
+
+	for(unsigned int row = 0; row < batch.size(); ++row)
+	{
+	    for(unsigned int i = 0; i < paramcount; ++i)
+		paramvalues[i] = paramcols[i].getValue(row);
+
+	    values.push_back( st.processFunction(funcname, paramvalues) );
+	}
+
+	dest.setValues(values);
+    }
+
+    /// Optimize the parameters, fold or memoize calls of pure functions and
+    /// reduce POW(x,2) to x*x.
+    virtual ParseNode* optimize(ParseOptimizer &po) const;
+
+    /// Collect the variables of the parameter subtrees.
+    virtual void getVariables(std::set<std::string> &varset) const
+    {
+	for(unsigned int i = 0; i < paramcount; ++i)
+	{
+	    paramlist[i]->getVariables(varset);
+	}
+    }
+
+    /// Return the function name and the parameter subtrees.
+    virtual bool getFunctionCall(std::string &_funcname, std::vector<const ParseNode*> &params) const
+    {
+	_funcname = funcname;
+	params.assign(paramlist, paramlist + paramcount);
+	return true;
+    }
+};
+
+/// Parse tree node representing a call of a pure function, whose results are
+/// memoized by the argument values. It is created by ParseTree::optimize().
+class PNMemoFunction : public PNFunction
+{
+private:
+    /// Cache of the results by the encoded argument values.
+    typedef std::map<std::string, AnyScalar>	cache_type;
+
+    /// Maximum number of entries in the cache, it is cleared when full.
+    unsigned int	maxentries;
+
+    /// Mutex protecting the cache, as trees may be evaluated concurrently.
+    mutable pthread_mutex_t	mutex;
+
+    /// The memoized results.
+    mutable cache_type	cache;
+
+    /// Append an exact encoding of the value's type and value to the key.
+    static void appendKey(std::string &key, const AnyScalar &value)
+    {
+	key += static_cast<char>(value.getType());
+
+	if (value.getType() == AnyScalar::ATTRTYPE_STRING)
+	{
+	    std::string str = value.getString();
+	    unsigned int len = static_cast<unsigned int>(str.size());
+	    key.append(reinterpret_cast<const char*>(&len), sizeof(len));
+	    key += str;
+	}
+	else if (value.isFloatingType())
+	{
+	    double d = value.getDouble();
+	    key.append(reinterpret_cast<const char*>(&d), sizeof(d));
+	}
+	else
+	{
+	    unsigned long long l = value.getULong();
+	    key.append(reinterpret_cast<const char*>(&l), sizeof(l));
+	}
+    }
+
+public:
+    /// Constructor from the optimized parameter array.
+    PNMemoFunction(std::string _funcname, const ParseNode* const* _paramlist, unsigned int _paramcount,
+		   unsigned int _maxentries)
+	: PNFunction(_funcname, _paramlist, _paramcount), maxentries(_maxentries)
+    {
+	pthread_mutex_init(&mutex, NULL);
+    }
+
+    /// Destroy the mutex.
+    ~PNMemoFunction()
+    {
+	pthread_mutex_destroy(&mutex);
+    }
+
+    /// Evaluate the parameters and look up the result in the cache. The
+    /// function is called only for new argument values, exceptions are not
+    /// cached.
+    virtual AnyScalar evaluate(const class SymbolTable &st) const
+    {
+	std::vector<AnyScalar> paramvalues;
+	std::string key;
+
+	for(unsigned int i = 0; i < paramcount; ++i)
+	{
+	    paramvalues.push_back( paramlist[i]->evaluate(st) );
+	    appendKey(key, paramvalues.back());
+	}
+
+	{
+	    MutexLock lock(mutex);
+
+	    cache_type::const_iterator ci = cache.find(key);
+	    if (ci != cache.end()) return ci->second;
+	}
+
+	AnyScalar result = st.processFunction(funcname, paramvalues);
+	result.detachStringRef();
+
+	MutexLock lock(mutex);
+
+	if (cache.size() >= maxentries) cache.clear();
+	cache.insert(cache_type::value_type(key, result));
+
+	return result;
+    }
+
+    /// Call evaluate() instead of the function directly.
+    virtual void compile(ParseProgram &prog) const
+    {
+	prog.emitNode(this);
+    }
+
+    /// Call evaluate() for each row.
+    virtual void evaluateBatch(const ColumnBatch &batch, const class SymbolTable &st,
+			       BatchColumn &dest) const
+    {
+	ParseNode::evaluateBatch(batch, st, dest);
+    }
 };
 
 /// Parse tree node representing an unary operator: '+', '-', '!' or
@@ -490,12 +702,6 @@ public:
 	if (op == 'n' || op == 'N') op = '!';
     }
 
-    /// Recursively delete the parse tree.
-    virtual ~PNUnaryArithmExpr()
-    {
-	delete operand;
-    }
-
     /// Applies the operator to the recursively calculated value.
     virtual AnyScalar evaluate(const class SymbolTable &st) const
     {
@@ -548,6 +754,57 @@ public:
     {
 	return std::string("(") + op + " " + operand->toString() + ")";
     }
+
+    /// Emit the operand followed by the unary operator.
+    virtual void compile(ParseProgram &prog) const
+    {
+	operand->compile(prog);
+
+	if (op == '-')
+	    prog.emitUnary(ParseProgram::OP_NEG);
+	else if (op == '!')
+	    prog.emitUnary(ParseProgram::OP_NOT);
+	else
+	    assert(op == '+');
+    }
+
+    /// Apply the operator to the operand's column.
+    virtual void evaluateBatch(const ColumnBatch &batch, const class SymbolTable &st,
+			       BatchColumn &dest) const
+    {
+	if (op == '+') {
+	    operand->evaluateBatch(batch, st, dest);
+	    return;
+	}
+
+	BatchColumn vo;
+	operand->evaluateBatch(batch, st, vo);
+
+	BatchColumn::applyUnary(op == '-' ? ParseProgram::OP_NEG : ParseProgram::OP_NOT, 0, vo, dest);
+    }
+
+    /// Optimize the operand and drop unary plus and double negations.
+    virtual ParseNode* optimize(ParseOptimizer &po) const;
+
+    /// Collect the variables of the operand.
+    virtual void getVariables(std::set<std::string> &varset) const
+    {
+	operand->getVariables(varset);
+    }
+
+    /// The negation of a predicate "varname == bool" compares with the
+    /// negated bool.
+    virtual bool getPredicate(std::string &varname, int &_op, AnyScalar &value) const
+    {
+	if (op != '!' || !operand->getPredicate(varname, _op, value))
+	    return false;
+
+	if (_op != ParseProgram::OP_EQUAL || value.getType() != AnyScalar::ATTRTYPE_BOOL)
+	    return false;
+
+	value = AnyScalar(!value.getBoolean());
+	return true;
+    }
 };
 
 /// Parse tree node representing a binary operators: +, -, * and / for numeric
@@ -574,13 +831,6 @@ public:
 	  left(_left), right(_right), op(_op)
     { }
 
-    /// Recursively delete parse tree.
-    virtual ~PNBinaryArithmExpr()
-    {
-	delete left;
-	delete right;
-    }
-
     /// Applies the operator to the two recursive calculated values. The actual
     /// switching between types is handled by AnyScalar's operators.
     virtual AnyScalar evaluate(const class SymbolTable &st) const
@@ -643,6 +893,61 @@ public:
     {
 	return std::string("(") + left->toString() + " " + op + " " + right->toString() + ")";
     }
+
+    /// Emit both operands followed by the arithmetic operator.
+    virtual void compile(ParseProgram &prog) const
+    {
+	left->compile(prog);
+	right->compile(prog);
+
+	switch(op)
+	{
+	case '+': prog.emitBinary(ParseProgram::OP_ADD); break;
+	case '-': prog.emitBinary(ParseProgram::OP_SUB); break;
+	case '*': prog.emitBinary(ParseProgram::OP_MUL); break;
+	case '/': prog.emitBinary(ParseProgram::OP_DIV); break;
+	case '^': prog.emitBinary(ParseProgram::OP_POW); break;
+	default: assert(0);
+	}
+    }
+
+    /// Apply the operator to both operand columns.
+    virtual void evaluateBatch(const ColumnBatch &batch, const class SymbolTable &st,
+			       BatchColumn &dest) const
+    {
+	BatchColumn vl, vr;
+	left->evaluateBatch(batch, st, vl);
+	right->evaluateBatch(batch, st, vr);
+
+	switch(op)
+	{
+	case '+': BatchColumn::applyBinary(ParseProgram::OP_ADD, vl, vr, dest); break;
+	case '-': BatchColumn::applyBinary(ParseProgram::OP_SUB, vl, vr, dest); break;
+	case '*': BatchColumn::applyBinary(ParseProgram::OP_MUL, vl, vr, dest); break;
+	case '/': BatchColumn::applyBinary(ParseProgram::OP_DIV, vl, vr, dest); break;
+	case '^': BatchColumn::applyBinary(ParseProgram::OP_POW, vl, vr, dest); break;
+	default: assert(0);
+	}
+    }
+
+    /// Optimize both operands and simplify the operation via rewrite().
+    virtual ParseNode* optimize(ParseOptimizer &po) const;
+
+    /// Collect the variables of both operands.
+    virtual void getVariables(std::set<std::string> &varset) const
+    {
+	left->getVariables(varset);
+	right->getVariables(varset);
+    }
+
+    /// Create the node left op right from already optimized operands,
+    /// applying the identities, strength reduction and re-association.
+    static ParseNode* rewrite(ParseOptimizer &po, ParseNode *left, ParseNode *right, char op);
+
+    /// Split an optimized node x+c, c+x or x-c with an operand x of signed
+    /// integer type into x and the constant offset.
+    static bool splitOffset(const ParseOptimizer &po, const ParseNode *node,
+			    const ParseNode *&x, long long &offset);
 };
 
 /// Parse tree node handling type conversions within the tree.
@@ -663,12 +968,6 @@ public:
 	  operand(_operand), type(_type)
     { }
 
-    /// Recursively delete parse tree.
-    virtual ~PNCastExpr()
-    {
-	delete operand;
-    }
-
     /// Recursive calculation of the value and subsequent casting via
     /// AnyScalar's convertType method.
     virtual AnyScalar evaluate(const class SymbolTable &st) const
@@ -693,6 +992,32 @@ public:
     {
 	return std::string("((") + AnyScalar::getTypeString(type) + ")" + operand->toString() + ")";
     }
+
+    /// Emit the operand followed by the cast instruction.
+    virtual void compile(ParseProgram &prog) const
+    {
+	operand->compile(prog);
+	prog.emitUnary(ParseProgram::OP_CAST, type);
+    }
+
+    /// Convert the operand's column.
+    virtual void evaluateBatch(const ColumnBatch &batch, const class SymbolTable &st,
+			       BatchColumn &dest) const
+    {
+	BatchColumn vo;
+	operand->evaluateBatch(batch, st, vo);
+
+	BatchColumn::applyUnary(ParseProgram::OP_CAST, type, vo, dest);
+    }
+
+    /// Optimize the operand and drop the cast if it already has the type.
+    virtual ParseNode* optimize(ParseOptimizer &po) const;
+
+    /// Collect the variables of the operand.
+    virtual void getVariables(std::set<std::string> &varset) const
+    {
+	operand->getVariables(varset);
+    }
 };
 
 /// Parse tree node representing a binary comparison operator: ==, =, !=, <, >,
@@ -736,13 +1061,6 @@ public:
 	    throw(BadSyntaxException("Program Error: invalid binary comparision operator."));
     }
 
-    /// Recursively delete parse tree.
-    virtual ~PNBinaryComparisonExpr()
-    {
-	delete left;
-	delete right;
-    }
-
     /// Applies the operator to the two recursive calculated values. The actual
     /// switching between types is handled by AnyScalar's operators. This
     /// result type of this processing node is always bool.
@@ -834,6 +1152,85 @@ public:
     {
 	return std::string("(") + left->toString() + " " + opstr + " " + right->toString() + ")";
     }
+
+    /// Emit both operands followed by the comparison operator.
+    virtual void compile(ParseProgram &prog) const
+    {
+	left->compile(prog);
+	right->compile(prog);
+
+	switch(op)
+	{
+	case EQUAL: prog.emitBinary(ParseProgram::OP_EQUAL); break;
+	case NOTEQUAL: prog.emitBinary(ParseProgram::OP_NOTEQUAL); break;
+	case LESS: prog.emitBinary(ParseProgram::OP_LESS); break;
+	case GREATER: prog.emitBinary(ParseProgram::OP_GREATER); break;
+	case LESSEQUAL: prog.emitBinary(ParseProgram::OP_LESSEQUAL); break;
+	case GREATEREQUAL: prog.emitBinary(ParseProgram::OP_GREATEREQUAL); break;
+	default: assert(0);
+	}
+    }
+
+    /// Compare both operand columns into a bool column.
+    virtual void evaluateBatch(const ColumnBatch &batch, const class SymbolTable &st,
+			       BatchColumn &dest) const
+    {
+	BatchColumn vl, vr;
+	left->evaluateBatch(batch, st, vl);
+	right->evaluateBatch(batch, st, vr);
+
+	switch(op)
+	{
+	case EQUAL: BatchColumn::applyBinary(ParseProgram::OP_EQUAL, vl, vr, dest); break;
+	case NOTEQUAL: BatchColumn::applyBinary(ParseProgram::OP_NOTEQUAL, vl, vr, dest); break;
+	case LESS: BatchColumn::applyBinary(ParseProgram::OP_LESS, vl, vr, dest); break;
+	case GREATER: BatchColumn::applyBinary(ParseProgram::OP_GREATER, vl, vr, dest); break;
+	case LESSEQUAL: BatchColumn::applyBinary(ParseProgram::OP_LESSEQUAL, vl, vr, dest); break;
+	case GREATEREQUAL: BatchColumn::applyBinary(ParseProgram::OP_GREATEREQUAL, vl, vr, dest); break;
+	default: assert(0);
+	}
+    }
+
+    /// Optimize both operands and move constant offsets of integer operands
+    /// to the other side.
+    virtual ParseNode* optimize(ParseOptimizer &po) const;
+
+    /// Collect the variables of both operands.
+    virtual void getVariables(std::set<std::string> &varset) const
+    {
+	left->getVariables(varset);
+	right->getVariables(varset);
+    }
+
+    /// Recognize a comparison of a variable with a constant. If the constant
+    /// is on the left, the operator is mirrored.
+    virtual bool getPredicate(std::string &varname, int &_op, AnyScalar &value) const
+    {
+	static const int opcodes[6] = {
+	    ParseProgram::OP_EQUAL, ParseProgram::OP_NOTEQUAL,
+	    ParseProgram::OP_LESS, ParseProgram::OP_GREATER,
+	    ParseProgram::OP_LESSEQUAL, ParseProgram::OP_GREATEREQUAL
+	};
+	static const int mirrored[6] = {
+	    ParseProgram::OP_EQUAL, ParseProgram::OP_NOTEQUAL,
+	    ParseProgram::OP_GREATER, ParseProgram::OP_LESS,
+	    ParseProgram::OP_GREATEREQUAL, ParseProgram::OP_LESSEQUAL
+	};
+
+	if (dynamic_cast<const PNVariable*>(left) && right->evaluate_const(NULL))
+	{
+	    varname = left->toString();
+	    _op = opcodes[op];
+	    return right->evaluate_const(&value);
+	}
+	if (dynamic_cast<const PNVariable*>(right) && left->evaluate_const(NULL))
+	{
+	    varname = right->toString();
+	    _op = mirrored[op];
+	    return left->evaluate_const(&value);
+	}
+	return false;
+    }
 };
 
 /// Parse tree node representing a binary logic operator: and, or, &&, ||. This
@@ -866,13 +1263,6 @@ public:
 	    throw(BadSyntaxException("Program Error: invalid binary logic operator."));
     }
 
-    /// Recursively delete parse tree.
-    virtual ~PNBinaryLogicExpr()
-    {
-	if (left) delete left;
-	if (right) delete right;
-    }
-
     /// Calculate the operator
     inline bool do_operator(bool left, bool right) const
     {
@@ -890,20 +1280,27 @@ public:
 	return (op == OP_AND) ? "&&" : "||";
     }
 
-    /// Applies the operator to the two recursive calculated values. The actual
-    /// switching between types is handled by AnyScalar's operators.
+    /// Evaluates the left operand and, only if it does not decide the result
+    /// already, the right operand. So AND with a false left operand and OR
+    /// with a true left operand short-circuit.
     virtual AnyScalar evaluate(const class SymbolTable &st) const
     {
 	AnyScalar vl = left->evaluate(st);
-	AnyScalar vr = right->evaluate(st);
 
 	// these should never happen.
 	if (vl.getType() != AnyScalar::ATTRTYPE_BOOL)
 	    throw(BadSyntaxException(std::string("Invalid left operand for ") + get_opstr() + ". Both operands must be of type bool."));
+
+	int bvl = vl.getInteger();
+
+	if (op == OP_AND && !bvl) return AnyScalar(false);
+	if (op == OP_OR && bvl) return AnyScalar(true);
+
+	AnyScalar vr = right->evaluate(st);
+
 	if (vr.getType() != AnyScalar::ATTRTYPE_BOOL)
 	    throw(BadSyntaxException(std::string("Invalid right operand for ") + get_opstr() + ". Both operands must be of type bool."));
 
-	int bvl = vl.getInteger();
 	int bvr = vr.getInteger();
 
 	return AnyScalar( do_operator(bvl, bvr) );
@@ -912,37 +1309,49 @@ public:
     /// Applies the operator to the two recursive calculated const
     /// values. Determining if this node is constant is somewhat more tricky
     /// than with the other parse nodes: AND with a false operand is always
-    /// false. OR with a true operand is always true.
+    /// false. OR with a true operand is always true. Only the constant
+    /// operands are evaluated, the others are already folded subtrees which
+    /// depend on variables.
     virtual bool evaluate_const(AnyScalar *dest) const
     {
 	if (!dest) return false; // returns false because this node isn't always constant
 
 	AnyScalar vl(AnyScalar::ATTRTYPE_INVALID), vr(AnyScalar::ATTRTYPE_INVALID);
 	
-	bool bl = left->evaluate_const(&vl);
-	bool br = right->evaluate_const(&vr);
+	bool bl = left->evaluate_const(NULL) && left->evaluate_const(&vl);
+	bool br = right->evaluate_const(NULL) && right->evaluate_const(&vr);
 
-	if (vl.getType() != AnyScalar::ATTRTYPE_BOOL)
+	if (bl && vl.getType() != AnyScalar::ATTRTYPE_BOOL)
 	    throw(BadSyntaxException(std::string("Invalid left operand for ") + get_opstr() + ". Both operands must be of type bool."));
-	if (vr.getType() != AnyScalar::ATTRTYPE_BOOL)
+	if (br && vr.getType() != AnyScalar::ATTRTYPE_BOOL)
 	    throw(BadSyntaxException(std::string("Invalid right operand for ") + get_opstr() + ". Both operands must be of type bool."));
 
-	int bvl = vl.getInteger();
-	int bvr = vr.getInteger();
+	int bvl = bl ? vl.getInteger() : 0;
+	int bvr = br ? vr.getInteger() : 0;
 
-	*dest = AnyScalar( do_operator(bvl, bvr) );
+	if (bl && br)
+	{
+	    *dest = AnyScalar( do_operator(bvl, bvr) );
+	    return true;
+	}
 
 	if (op == OP_AND)
 	{
-	    // true if either both ops are themselves constant, or if either of
-	    // the ops are constant and evaluates to false.
-	    return (bl && br) || (bl && !bvl) || (br && !bvr);
+	    // constant if either of the ops is constant and evaluates to false.
+	    if ((bl && !bvl) || (br && !bvr)) {
+		*dest = AnyScalar(false);
+		return true;
+	    }
+	    return false;
 	}
 	else if (op == OP_OR)
 	{
-	    // true if either both ops are themselves constant, or if either of
-	    // the ops is constant and evaluates to true.
-	    return (bl && br) || (bl && bvl) || (br && bvr);
+	    // constant if either of the ops is constant and evaluates to true.
+	    if ((bl && bvl) || (br && bvr)) {
+		*dest = AnyScalar(true);
+		return true;
+	    }
+	    return false;
 	}
 	else {
 	    assert(0);
@@ -956,41 +1365,155 @@ public:
 	return std::string("(") + left->toString() + " " + get_opstr() + " " + right->toString() + ")";
     }
 
-    /// Detach left node
-    inline ParseNode* detach_left()
+    /// Emit the left operand, a short-circuit jump over the right operand and
+    /// the right operand followed by its type check.
+    virtual void compile(ParseProgram &prog) const
     {
-	ParseNode *n = left;
-	left = NULL;
-	return n;
+	left->compile(prog);
+
+	unsigned int jump = prog.emitJump(op == OP_AND ? ParseProgram::OP_JUMP_FALSE : ParseProgram::OP_JUMP_TRUE);
+
+	right->compile(prog);
+
+	prog.emitUnary(ParseProgram::OP_TEST_BOOL, op == OP_AND ? 0 : 1);
+	prog.patchJump(jump);
     }
 
-    /// Detach right node
-    inline ParseNode* detach_right()
+    /// Combine both operand columns. The right operand is only evaluated if
+    /// the left operand does not already decide all rows. It is however
+    /// evaluated for all rows, so a failure in a row which would be
+    /// short-circuited makes ParseTree::evaluateBatch() repeat row by row.
+    virtual void evaluateBatch(const ColumnBatch &batch, const class SymbolTable &st,
+			       BatchColumn &dest) const
     {
-	ParseNode *n = right;
-	right = NULL;
-	return n;
-    }
-};
+	BatchColumn vl;
+	left->evaluateBatch(batch, st, vl);
 
-// *** Functions which translate the resulting parse tree into our expression
-// *** tree, simultaneously folding constants.
+	if (vl.getType() != ColumnBatch::COLUMN_BOOL)
+	    throw(BadSyntaxException(std::string("Invalid left operand for ") + get_opstr() + ". Both operands must be of type bool."));
 
-/// Iterator type used by spirit's parsers.
-typedef std::string::const_iterator InputIterT;
+	const unsigned char *bvl = vl.getBools();
+	unsigned int n = vl.isConstant() ? 1 : vl.size();
+	unsigned char decides = (op == OP_AND) ? 0 : 1;
 
-/// Resulting match tree after parsing
-typedef tree_match<InputIterT> ParseTreeMatchT;
+	unsigned int i = 0;
+	while (i < n && bvl[i] == decides) ++i;
 
-/// The iterator of the match tree used in build_expr()
-typedef ParseTreeMatchT::const_tree_iterator TreeIterT;
+	if (i == n) {
+	    dest.swap(vl);
+	    return;
+	}
 
-/// Build_expr is the constructor method to create a parse tree from the
-/// AST-tree returned by the spirit parser.
-static ParseNode* build_expr(TreeIterT const& i)
-{
-#ifdef STX_DEBUG_PARSER
-    std::cout << "In build_expr. i->value = " <<
+	BatchColumn vr;
+	right->evaluateBatch(batch, st, vr);
+
+	if (vr.getType() != ColumnBatch::COLUMN_BOOL)
+	    throw(BadSyntaxException(std::string("Invalid right operand for ") + get_opstr() + ". Both operands must be of type bool."));
+
+	BatchColumn::applyLogic(op == OP_AND, vl, vr, dest);
+    }
+
+    /// Filter the selection: AND filters it with the left operand and the
+    /// remaining rows with the right operand. OR evaluates the right operand
+    /// only for the rows not selected by the left operand and merges both
+    /// selections.
+    virtual void evaluateSelection(const ColumnBatch &batch, const class SymbolTable &st,
+				   std::vector<unsigned int> &selection) const
+    {
+	if (op == OP_AND)
+	{
+	    left->evaluateSelection(batch, st, selection);
+	    right->evaluateSelection(batch, st, selection);
+	}
+	else
+	{
+	    std::vector<unsigned int> selleft = selection;
+	    left->evaluateSelection(batch, st, selleft);
+
+	    if (selleft.size() == selection.size()) return;
+
+	    std::vector<unsigned int> selright;
+	    selright.reserve(selection.size() - selleft.size());
+
+	    std::set_difference(selection.begin(), selection.end(),
+				selleft.begin(), selleft.end(),
+				std::back_inserter(selright));
+
+	    right->evaluateSelection(batch, st, selright);
+
+	    selection.clear();
+	    std::merge(selleft.begin(), selleft.end(), selright.begin(), selright.end(),
+		       std::back_inserter(selection));
+	}
+    }
+
+    /// Collect the operands of this node and of all directly nested nodes
+    /// with the same operator.
+    virtual int flattenChain(std::vector<const ParseNode*> &operands) const
+    {
+	int chain = (op == OP_AND) ? ParseProgram::CHAIN_AND : ParseProgram::CHAIN_OR;
+
+	const ParseNode *children[2] = { left, right };
+
+	for(unsigned int i = 0; i < 2; ++i)
+	{
+	    std::vector<const ParseNode*> sub;
+
+	    if (children[i]->flattenChain(sub) == chain)
+		operands.insert(operands.end(), sub.begin(), sub.end());
+	    else
+		operands.push_back(children[i]);
+	}
+
+	return chain;
+    }
+
+    /// Optimize both operands and fold the node if one became constant.
+    virtual ParseNode* optimize(ParseOptimizer &po) const;
+
+    /// Collect the variables of both operands.
+    virtual void getVariables(std::set<std::string> &varset) const
+    {
+	left->getVariables(varset);
+	right->getVariables(varset);
+    }
+
+    /// Detach left node
+    inline ParseNode* detach_left()
+    {
+	ParseNode *n = left;
+	left = NULL;
+	return n;
+    }
+
+    /// Detach right node
+    inline ParseNode* detach_right()
+    {
+	ParseNode *n = right;
+	right = NULL;
+	return n;
+    }
+};
+
+// *** Functions which translate the resulting parse tree into our expression
+// *** tree, simultaneously folding constants.
+
+/// Iterator type used by spirit's parsers.
+typedef std::string::const_iterator InputIterT;
+
+/// Resulting match tree after parsing
+typedef tree_match<InputIterT> ParseTreeMatchT;
+
+/// The iterator of the match tree used in build_expr()
+typedef ParseTreeMatchT::const_tree_iterator TreeIterT;
+
+/// Build_expr is the constructor method to create a parse tree from the
+/// AST-tree returned by the spirit parser. All nodes are created in the
+/// arena, subtrees folded into constants are released from it again.
+static ParseNode* build_expr(TreeIterT const& i, ParseArena &arena)
+{
+#ifdef STX_DEBUG_PARSER
+    std::cout << "In build_expr. i->value = " <<
         std::string(i->value.begin(), i->value.end()) <<
         " i->children.size() = " << i->children.size() << 
 	" i->value.id = " << i->value.id().to_long() << std::endl;
@@ -1002,32 +1525,32 @@ static ParseNode* build_expr(TreeIterT const& i)
 
     case boolean_const_id:
     {
-	return new PNConstant(AnyScalar::ATTRTYPE_BOOL,
-			      std::string(i->value.begin(), i->value.end()));
+	return arena.create<PNConstant>(AnyScalar::ATTRTYPE_BOOL,
+					std::string(i->value.begin(), i->value.end()));
     }
 
     case integer_const_id:
     {
-	return new PNConstant(AnyScalar::ATTRTYPE_INTEGER,
-			      std::string(i->value.begin(), i->value.end()));
+	return arena.create<PNConstant>(AnyScalar::ATTRTYPE_INTEGER,
+					std::string(i->value.begin(), i->value.end()));
     }
 
     case long_const_id:
     {
-	return new PNConstant(AnyScalar::ATTRTYPE_LONG,
-			      std::string(i->value.begin(), i->value.end()));
+	return arena.create<PNConstant>(AnyScalar::ATTRTYPE_LONG,
+					std::string(i->value.begin(), i->value.end()));
     }
 
     case double_const_id:
     {
-	return new PNConstant(AnyScalar::ATTRTYPE_DOUBLE,
-			      std::string(i->value.begin(), i->value.end()));
+	return arena.create<PNConstant>(AnyScalar::ATTRTYPE_DOUBLE,
+					std::string(i->value.begin(), i->value.end()));
     }
 
     case string_const_id:
     {
-	return new PNConstant(AnyScalar::ATTRTYPE_STRING,
-			      std::string(i->value.begin(), i->value.end()));
+	return arena.create<PNConstant>(AnyScalar::ATTRTYPE_STRING,
+					std::string(i->value.begin(), i->value.end()));
     }
 
     // *** Arithmetic node cases
@@ -1037,7 +1560,9 @@ static ParseNode* build_expr(TreeIterT const& i)
 	char arithop = *i->value.begin();
 	assert(i->children.size() == 1);
 
-	const ParseNode *val = build_expr(i->children.begin());
+	ParseArena::Mark mark = arena.mark();
+
+	const ParseNode *val = build_expr(i->children.begin(), arena);
 
 	if (val->evaluate_const(NULL))
 	{
@@ -1047,12 +1572,15 @@ static ParseNode* build_expr(TreeIterT const& i)
 
 	    tmpnode.evaluate_const(&constval);
 
-	    return new PNConstant(constval);
+	    // the operand is not needed anymore
+	    arena.release(mark);
+
+	    return arena.create<PNConstant>(constval);
 	}
 	else
 	{
 	    // calculation node
-	    return new PNUnaryArithmExpr(val, arithop);
+	    return arena.create<PNUnaryArithmExpr>(val, arithop);
 	}
     }
 
@@ -1065,27 +1593,28 @@ static ParseNode* build_expr(TreeIterT const& i)
 	char arithop = *i->value.begin();
 	assert(i->children.size() == 2);
 
-	// auto_ptr needed because of possible parse exceptions in build_expr.
+	ParseArena::Mark mark = arena.mark();
 
-	std::auto_ptr<const ParseNode> left( build_expr(i->children.begin()) );
-	std::auto_ptr<const ParseNode> right( build_expr(i->children.begin()+1) );
+	const ParseNode *left = build_expr(i->children.begin(), arena);
+	const ParseNode *right = build_expr(i->children.begin()+1, arena);
 
 	if (left->evaluate_const(NULL) && right->evaluate_const(NULL))
 	{
 	    // construct a constant node
-	    PNBinaryArithmExpr tmpnode(left.release(), right.release(), arithop);
+	    PNBinaryArithmExpr tmpnode(left, right, arithop);
 	    AnyScalar both(AnyScalar::ATTRTYPE_INVALID);
 
 	    tmpnode.evaluate_const(&both);
 
-	    // left and right are deleted by tmpnode's deconstructor
+	    // left and right are not needed anymore
+	    arena.release(mark);
 
-	    return new PNConstant(both);
+	    return arena.create<PNConstant>(both);
 	}
 	else
 	{
 	    // calculation node
-	    return new PNBinaryArithmExpr(left.release(), right.release(), arithop);
+	    return arena.create<PNBinaryArithmExpr>(left, right, arithop);
         }
     }
 
@@ -1098,7 +1627,9 @@ static ParseNode* build_expr(TreeIterT const& i)
 	std::string tname(i->value.begin(), i->value.end());
 	AnyScalar::attrtype_t at = AnyScalar::stringToType(tname);
 	
-	const ParseNode *val = build_expr(i->children.begin());
+	ParseArena::Mark mark = arena.mark();
+
+	const ParseNode *val = build_expr(i->children.begin(), arena);
 
 	if (val->evaluate_const(NULL))
 	{
@@ -1109,11 +1640,14 @@ static ParseNode* build_expr(TreeIterT const& i)
 
 	    tmpnode.evaluate_const(&constval);
 
-	    return new PNConstant(constval);
+	    // the operand is not needed anymore
+	    arena.release(mark);
+
+	    return arena.create<PNConstant>(constval);
 	}
 	else
 	{
-	    return new PNCastExpr(val, at);
+	    return arena.create<PNCastExpr>(val, at);
 	}
     }
 
@@ -1125,27 +1659,28 @@ static ParseNode* build_expr(TreeIterT const& i)
 
 	std::string arithop(i->value.begin(), i->value.end());
 
-	// we need auto_ptr because of possible parse exceptions in build_expr.
+	ParseArena::Mark mark = arena.mark();
 
-	std::auto_ptr<const ParseNode> left( build_expr(i->children.begin()) );
-	std::auto_ptr<const ParseNode> right( build_expr(i->children.begin()+1) );
+	const ParseNode *left = build_expr(i->children.begin(), arena);
+	const ParseNode *right = build_expr(i->children.begin()+1, arena);
 
 	if (left->evaluate_const(NULL) && right->evaluate_const(NULL))
 	{
 	    // construct a constant node
-	    PNBinaryComparisonExpr tmpnode(left.release(), right.release(), arithop);
+	    PNBinaryComparisonExpr tmpnode(left, right, arithop);
 	    AnyScalar both(AnyScalar::ATTRTYPE_INVALID);
 
 	    tmpnode.evaluate_const(&both);
 
-	    // left and right are deleted by tmpnode's deconstructor
+	    // left and right are not needed anymore
+	    arena.release(mark);
 
-	    return new PNConstant(both);
+	    return arena.create<PNConstant>(both);
 	}
 	else
 	{
 	    // calculation node
-	    return new PNBinaryComparisonExpr(left.release(), right.release(), arithop);
+	    return arena.create<PNBinaryComparisonExpr>(left, right, arithop);
         }
     }
 
@@ -1159,17 +1694,17 @@ static ParseNode* build_expr(TreeIterT const& i)
 	std::string logicop(i->value.begin(), i->value.end());
 	std::transform(logicop.begin(), logicop.end(), logicop.begin(), tolower);
 
-	// auto_ptr needed because of possible parse exceptions in build_expr.
+	ParseArena::Mark mark = arena.mark();
 
-	std::auto_ptr<ParseNode> left( build_expr(i->children.begin()) );
-	std::auto_ptr<ParseNode> right( build_expr(i->children.begin()+1) );
+	ParseNode *left = build_expr(i->children.begin(), arena);
+	ParseNode *right = build_expr(i->children.begin()+1, arena);
 
 	bool constleft = left->evaluate_const(NULL);
 	bool constright = right->evaluate_const(NULL);
 
 	// a logical node is constant if one of the two ops is constant. so we
 	// construct a calculation node and check later.
-	std::auto_ptr<PNBinaryLogicExpr> node( new PNBinaryLogicExpr(left.release(), right.release(), logicop) );
+	PNBinaryLogicExpr *node = arena.create<PNBinaryLogicExpr>(left, right, logicop);
 
 	if (constleft || constright)
 	{
@@ -1178,15 +1713,18 @@ static ParseNode* build_expr(TreeIterT const& i)
 	    // test if the node is really const.
 	    if (node->evaluate_const(&both))
 	    {
-		// return a constant node instead, node will be deleted by
-		// auto_ptr, left,right by node's destructor.
-		return new PNConstant(both);
+		// return a constant node instead, the node and its operands
+		// are released.
+		arena.release(mark);
+
+		return arena.create<PNConstant>(both);
 	    }
 	}
 	if (constleft)
 	{
 	    // left node is constant, but the evaluation is not
-	    // -> only right node is meaningful.
+	    // -> only right node is meaningful. the other nodes remain unused
+	    // in the arena.
 	    return node->detach_right();
 	}
 	if (constright)
@@ -1196,7 +1734,7 @@ static ParseNode* build_expr(TreeIterT const& i)
 	    return node->detach_left();
 	}
 
-	return node.release();
+	return node;
     }
 
     // *** Variable and Function name place-holder
@@ -1207,7 +1745,7 @@ static ParseNode* build_expr(TreeIterT const& i)
 
 	std::string varname(i->value.begin(), i->value.end());
 
-        return new PNVariable(varname);
+        return arena.create<PNVariable>(varname);
     }
 
     case function_identifier_id:
@@ -1221,29 +1759,28 @@ static ParseNode* build_expr(TreeIterT const& i)
 
 	    if (paramlistchild->value.id().to_long() == exprlist_id)
 	    {
-		try
-		{
-		    for(TreeIterT ci = paramlistchild->children.begin(); ci != paramlistchild->children.end(); ++ci)
-		    {
-			const ParseNode *pas = build_expr(ci);
-			paramlist.push_back(pas);
-		    }
-		}
-		catch (...) // need to clean-up
+		for(TreeIterT ci = paramlistchild->children.begin(); ci != paramlistchild->children.end(); ++ci)
 		{
-		    for(unsigned int i = 0; i < paramlist.size(); ++i)
-			delete paramlist[i];
-		    throw;
+		    paramlist.push_back( build_expr(ci, arena) );
 		}
 	    }
 	    else
 	    {
 		// just one subnode and its not a full expression list
-		paramlist.push_back( build_expr(paramlistchild) );
+		paramlist.push_back( build_expr(paramlistchild, arena) );
 	    }
 	}
 
-        return new PNFunction(funcname, paramlist);
+	// copy the parameter array into the arena
+	const ParseNode **paramarray = NULL;
+
+	if (!paramlist.empty())
+	{
+	    paramarray = static_cast<const ParseNode**>(arena.allocate(paramlist.size() * sizeof(ParseNode*)));
+	    std::copy(paramlist.begin(), paramlist.end(), paramarray);
+	}
+
+        return arena.create<PNFunction>(funcname, paramarray, static_cast<unsigned int>(paramlist.size()));
     }
 
     default:
@@ -1251,187 +1788,1652 @@ static ParseNode* build_expr(TreeIterT const& i)
     }
 }
 
-/// build_exprlist constructs the vector holding the ParseNode parse tree for
-/// each parse tree.
-ParseTreeList build_exprlist(TreeIterT const &i)
+// *** Hand-written recursive descent parser, which creates the parse tree
+// *** directly without the AST-tree of spirit.
+
+/** Recursive descent parser for the language of ExpressionGrammar. It scans
+ * the input string directly and creates the parse nodes in the arena in one
+ * pass, folding constant subexpressions like build_expr(). Each parse_ method
+ * implements the grammar rule of the same name and returns NULL if the rule
+ * does not match. The methods backtrack exactly where spirit's rules do, so
+ * syntax errors are reported at the same position. */
+class Parser
 {
-#ifdef STX_DEBUG_PARSER
-    std::cout << "In build_exprlist. i->value = " <<
-        std::string(i->value.begin(), i->value.end()) <<
-        " i->children.size() = " << i->children.size() << 
-	" i->value.id = " << i->value.id().to_long() << std::endl;
-#endif
+private:
+    /// Begin of the input string, used for error positions.
+    const char		*begin;
 
-    ParseTreeList ptlist;
+    /// Current parse position.
+    const char		*pos;
+
+    /// End of the input string.
+    const char		*end;
+
+    /// Arena in which the nodes of the current tree are created.
+    ParseArena		*arena;
 
-    for(TreeIterT ci = i->children.begin(); ci != i->children.end(); ++ci)
+    /// If false, exceptions thrown while folding a constant subexpression
+    /// are not passed on, instead the subexpression is left unfolded.
+    bool		strict;
+
+    /// Set if folding a constant subexpression threw an exception.
+    bool		folderror;
+
+    /// Skip whitespace like spirit's space_p skip parser.
+    inline void skip()
     {
-	ParseNode *vas = build_expr(ci);
+	while (pos != end && isspace(static_cast<unsigned char>(*pos))) ++pos;
+    }
 
-	ptlist.push_back( ParseTree(vas) );
+    static inline bool is_digit(char c)
+    {
+	return (c >= '0' && c <= '9');
     }
 
-    return ptlist;
-}
+    /// Characters which may not follow a keyword.
+    static inline bool is_keyword_tail(char c)
+    {
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || is_digit(c) || c == '_';
+    }
 
-/// Uses boost::spirit function to convert the parse tree into a XML document.
-static inline void tree_dump_xml(std::ostream &os, const std::string &input, const tree_parse_info<InputIterT> &info)
-{
-    // map used by the xml dumper to label the nodes
+    /// Skip whitespace and match the given character.
+    inline bool match_char(char c)
+    {
+	skip();
+	if (pos != end && *pos == c) {
+	    ++pos;
+	    return true;
+	}
+	return false;
+    }
 
-    std::map<parser_id, std::string> rule_names;
+    /// Scan the string s, optionally comparing the lower case input
+    /// characters like as_lower_d.
+    inline bool scan_str(const char *&p, const char *s, bool nocase) const
+    {
+	const char *q = p;
 
-    rule_names[boolean_const_id] = "boolean_const";
-    rule_names[integer_const_id] = "integer_const";
-    rule_names[long_const_id] = "long_const";
-    rule_names[double_const_id] = "double_const";
-    rule_names[string_const_id] = "string_const";
-    rule_names[constant_id] = "constant";
+	for(; *s; ++s, ++q)
+	{
+	    if (q == end) return false;
+	    char c = nocase ? static_cast<char>(tolower(static_cast<unsigned char>(*q))) : *q;
+	    if (c != *s) return false;
+	}
 
-    rule_names[function_call_id] = "function_call";
-    rule_names[function_identifier_id] = "function_identifier";
+	p = q;
+	return true;
+    }
 
-    rule_names[varname_id] = "varname";
+    /// Scan the keyword s, which may not be followed by an alphanumeric
+    /// character.
+    inline bool scan_keyword(const char *&p, const char *s, bool nocase) const
+    {
+	const char *q = p;
 
-    rule_names[unary_expr_id] = "unary_expr";
-    rule_names[pow_expr_id] = "pow_expr";
-    rule_names[mul_expr_id] = "mul_expr";
-    rule_names[add_expr_id] = "add_expr";
+	if (!scan_str(q, s, nocase)) return false;
+	if (q != end && is_keyword_tail(*q)) return false;
 
-    rule_names[cast_expr_id] = "cast_expr";
-    rule_names[cast_spec_id] = "cast_spec";
+	p = q;
+	return true;
+    }
 
-    rule_names[comp_expr_id] = "comp_expr";
-    rule_names[and_expr_id] = "and_expr";
-    rule_names[or_expr_id] = "or_expr";
+    /// Skip whitespace and match the keyword s.
+    inline bool match_keyword(const char *s)
+    {
+	skip();
+	return scan_keyword(pos, s, false);
+    }
 
-    rule_names[expr_id] = "expr";
-    rule_names[exprlist_id] = "exprlist";
+    /// Skip whitespace and match the first of the NULL-terminated list of
+    /// operators. Returns the operator matched, or NULL and restores the
+    /// position.
+    inline const char* match_op(const char* const* ops, bool nocase)
+    {
+	const char *save = pos;
+	skip();
 
-    tree_to_xml(os, info.trees, input.c_str(), rule_names);
-}
+	for(; *ops; ++ops)
+	{
+	    if (scan_str(pos, *ops, nocase)) return *ops;
+	}
 
-} // namespace Grammar
+	pos = save;
+	return NULL;
+    }
 
-const ParseTree parseExpression(const std::string &input)
-{
-    // instance of the grammar
-    Grammar::ExpressionGrammar g;
+    /// Scan an int_p: an optional sign and digits which fit into an int.
+    inline bool scan_int(const char *&p) const
+    {
+	bool neg = false;
+	if (p != end && (*p == '+' || *p == '-')) {
+	    neg = (*p == '-');
+	    ++p;
+	}
 
-#ifdef STX_DEBUG_PARSER
-    BOOST_SPIRIT_DEBUG_GRAMMAR(g);
-#endif
+	const char *digits = p;
+	long long n = 0;
 
-    Grammar::tree_parse_info<Grammar::InputIterT> info =
-	boost::spirit::ast_parse(input.begin(), input.end(),
-				 g.use_parser<0>(),	// use first entry point: expr
-				 boost::spirit::space_p);
+	for(; p != end && is_digit(*p); ++p)
+	{
+	    n = n * 10 + (*p - '0');
+	    if (n > static_cast<long long>(INT_MAX) + (neg ? 1 : 0)) return false;
+	}
 
-    if (!info.full)
+	return (p != digits);
+    }
+
+    /// Scan a long_const: an optional sign and digits.
+    inline bool scan_long(const char *&p) const
     {
-	std::ostringstream oss;
-	oss << "Syntax error at position "
-	    << static_cast<int>(info.stop - input.begin())
-	    << " near " 
-	    << std::string(info.stop, input.end());
+	if (p != end && (*p == '+' || *p == '-')) ++p;
+
+	const char *digits = p;
+	for(; p != end && is_digit(*p); ++p) { }
 
-	throw(BadSyntaxException(oss.str()));
+	return (p != digits);
     }
 
-    return ParseTree( Grammar::build_expr(info.trees.begin()) );
-}
+    /// Scan a strict_real_p: a number containing a decimal point or an
+    /// exponent.
+    inline bool scan_real(const char *&p) const
+    {
+	if (p != end && (*p == '+' || *p == '-')) ++p;
 
-std::string parseExpressionXML(const std::string &input)
-{
-    // instance of the grammar
-    Grammar::ExpressionGrammar g;
+	bool gotnumber = false;
+	for(; p != end && is_digit(*p); ++p) gotnumber = true;
 
-#ifdef STX_DEBUG_PARSER
-    BOOST_SPIRIT_DEBUG_GRAMMAR(g);
-#endif
+	if (p != end && *p == '.')
+	{
+	    ++p;
 
-    Grammar::tree_parse_info<Grammar::InputIterT> info =
-	boost::spirit::ast_parse(input.begin(), input.end(),
-				 g.use_parser<0>(),	// use first entry point: expr
-				 boost::spirit::space_p);
+	    bool gotfrac = false;
+	    for(; p != end && is_digit(*p); ++p) gotfrac = true;
 
-    if (!info.full)
-    {
-	std::ostringstream oss;
-	oss << "Syntax error at position "
-	    << static_cast<int>(info.stop - input.begin())
-	    << " near " 
-	    << std::string(info.stop, input.end());
+	    if (!gotfrac && !gotnumber) return false;
+	}
+	else
+	{
+	    // without a decimal point an exponent is required.
+	    if (!gotnumber || p == end || (*p != 'e' && *p != 'E')) return false;
+	}
+
+	if (p != end && (*p == 'e' || *p == 'E'))
+	{
+	    // the exponent may have any number of digits
+	    ++p;
+	    return scan_long(p);
+	}
 
-	throw(BadSyntaxException(oss.str()));
+	return true;
     }
 
-    std::ostringstream oss;
-    Grammar::tree_dump_xml(oss, input, info);
-    return oss.str();
-}
+    /// Scan a quoted string with C escape sequences.
+    inline bool scan_string(const char *&p) const
+    {
+	if (p == end || *p != '"') return false;
+	++p;
 
-ParseTreeList parseExpressionList(const std::string &input)
-{
-    // instance of the grammar
-    Grammar::ExpressionGrammar g;
+	while (p != end)
+	{
+	    if (*p == '"') {
+		++p;
+		return true;
+	    }
+	    if (*p != '\\') {
+		++p;
+		continue;
+	    }
 
-#ifdef STX_DEBUG_PARSER
-    BOOST_SPIRIT_DEBUG_GRAMMAR(g);
-#endif
+	    if (++p == end) return false;
 
-    Grammar::tree_parse_info<Grammar::InputIterT> info =
-	boost::spirit::ast_parse(input.begin(), input.end(),
-				 g.use_parser<1>(),	// use second entry point: exprlist
-				 boost::spirit::space_p);
+	    if (*p == 'x' || *p == 'X')
+	    {
+		// one or two hex digits, the value must fit into a char.
+		++p;
+		if (p == end || !isxdigit(static_cast<unsigned char>(*p))) return false;
 
-    if (!info.full)
-    {
-	std::ostringstream oss;
-	oss << "Syntax error at position "
-	    << static_cast<int>(info.stop - input.begin())
-	    << " near " 
-	    << std::string(info.stop, input.end());
+		const char *first = p++;
+		if (p != end && isxdigit(static_cast<unsigned char>(*p)))
+		{
+		    if (*first > '7') return false;
+		    ++p;
+		}
+	    }
+	    else
+	    {
+		// octal digits or any other character is escaped
+		++p;
+	    }
+	}
 
-	throw(BadSyntaxException(oss.str()));
+	return false;
     }
 
-    return Grammar::build_exprlist(info.trees.begin());
-}
-
-std::vector<AnyScalar> ParseTreeList::evaluate(const class SymbolTable &st) const
-{
-    std::vector<AnyScalar> vl;
-
-    for(parent_type::const_iterator i = parent_type::begin(); i != parent_type::end(); i++)
+    /// Scan an identifier for function_identifier and varname.
+    inline bool scan_identifier(const char *&p) const
     {
-	vl.push_back( i->evaluate(st) );
-    }
+	if (p == end || !isalpha(static_cast<unsigned char>(*p))) return false;
 
-    return vl;
-}
+	for(++p; p != end && (isalnum(static_cast<unsigned char>(*p)) || *p == '_'); ++p) { }
 
-std::string ParseTreeList::toString() const
-{
-    std::string sl;
+	return true;
+    }
 
-    for(parent_type::const_iterator i = parent_type::begin(); i != parent_type::end(); i++)
+    /// Evaluate the constant node into dest. In non-strict mode exceptions
+    /// are recorded and the node is not folded.
+    inline bool fold(const ParseNode &node, AnyScalar &dest)
     {
-	if (i != parent_type::begin()) {
-	    sl += ", ";
-	}
+	if (strict) return node.evaluate_const(&dest);
 
-	sl += i->toString();
+	try {
+	    return node.evaluate_const(&dest);
+	}
+	catch (ExpressionParserException &) {
+	    folderror = true;
+	    return false;
+	}
     }
 
-    return sl;
-}
+    // *** Node constructors, which fold constants like build_expr(). The mark
+    // *** is the arena position before the operands were created.
 
-/// *** SymbolTable, EmptySymbolTable and BasicSymbolTable implementation
+    ParseNode* make_unary(const ParseArena::Mark &mark, const ParseNode *val, char arithop)
+    {
+	if (val->evaluate_const(NULL))
+	{
+	    PNUnaryArithmExpr tmpnode(val, arithop);
+	    AnyScalar constval(AnyScalar::ATTRTYPE_INVALID);
 
-SymbolTable::~SymbolTable()
-{
-}
+	    if (fold(tmpnode, constval))
+	    {
+		arena->release(mark);
+		return arena->create<PNConstant>(constval);
+	    }
+	}
+	return arena->create<PNUnaryArithmExpr>(val, arithop);
+    }
+
+    ParseNode* make_cast(const ParseArena::Mark &mark, const ParseNode *val, AnyScalar::attrtype_t at)
+    {
+	if (val->evaluate_const(NULL))
+	{
+	    PNCastExpr tmpnode(val, at);
+	    AnyScalar constval(AnyScalar::ATTRTYPE_INVALID);
+
+	    if (fold(tmpnode, constval))
+	    {
+		arena->release(mark);
+		return arena->create<PNConstant>(constval);
+	    }
+	}
+	return arena->create<PNCastExpr>(val, at);
+    }
+
+    ParseNode* make_arith(const ParseArena::Mark &mark, const ParseNode *left, const ParseNode *right, char arithop)
+    {
+	if (left->evaluate_const(NULL) && right->evaluate_const(NULL))
+	{
+	    PNBinaryArithmExpr tmpnode(left, right, arithop);
+	    AnyScalar both(AnyScalar::ATTRTYPE_INVALID);
+
+	    if (fold(tmpnode, both))
+	    {
+		arena->release(mark);
+		return arena->create<PNConstant>(both);
+	    }
+	}
+	return arena->create<PNBinaryArithmExpr>(left, right, arithop);
+    }
+
+    ParseNode* make_comparison(const ParseArena::Mark &mark, const ParseNode *left, const ParseNode *right, const char *compop)
+    {
+	if (left->evaluate_const(NULL) && right->evaluate_const(NULL))
+	{
+	    PNBinaryComparisonExpr tmpnode(left, right, compop);
+	    AnyScalar both(AnyScalar::ATTRTYPE_INVALID);
+
+	    if (fold(tmpnode, both))
+	    {
+		arena->release(mark);
+		return arena->create<PNConstant>(both);
+	    }
+	}
+	return arena->create<PNBinaryComparisonExpr>(left, right, compop);
+    }
+
+    ParseNode* make_logic(const ParseArena::Mark &mark, ParseNode *left, ParseNode *right, const char *logicop)
+    {
+	bool constleft = left->evaluate_const(NULL);
+	bool constright = right->evaluate_const(NULL);
+
+	PNBinaryLogicExpr *node = arena->create<PNBinaryLogicExpr>(left, right, logicop);
+
+	if (constleft || constright)
+	{
+	    AnyScalar both(AnyScalar::ATTRTYPE_INVALID);
+
+	    if (fold(*node, both))
+	    {
+		arena->release(mark);
+		return arena->create<PNConstant>(both);
+	    }
+	}
+	if (constleft) return node->detach_right();
+	if (constright) return node->detach_left();
+
+	return node;
+    }
+
+    // *** Grammar rules
+
+    ParseNode* parse_constant()
+    {
+	skip();
+
+	const char *start = pos, *p;
+	AnyScalar::attrtype_t type;
+
+	if (scan_real(p = start))
+	    type = AnyScalar::ATTRTYPE_DOUBLE;
+	else if (scan_int(p = start))
+	    type = AnyScalar::ATTRTYPE_INTEGER;
+	else if (scan_long(p = start))
+	    type = AnyScalar::ATTRTYPE_LONG;
+	else if (scan_keyword(p = start, "true", true) || scan_keyword(p = start, "false", true))
+	    type = AnyScalar::ATTRTYPE_BOOL;
+	else if (scan_string(p = start))
+	    type = AnyScalar::ATTRTYPE_STRING;
+	else
+	    return NULL;
+
+	pos = p;
+	return arena->create<PNConstant>(type, std::string(start, p));
+    }
+
+    ParseNode* parse_atom()
+    {
+	const char *save = pos;
+	ParseArena::Mark mark = arena->mark();
+
+	if (ParseNode *constant = parse_constant())
+	    return constant;
+
+	// bracket grouping
+	pos = save;
+	if (match_char('('))
+	{
+	    ParseNode *inner = parse_expr();
+	    if (inner && match_char(')'))
+		return inner;
+
+	    arena->release(mark);
+	}
+
+	// function_call or varname
+	pos = save;
+	skip();
+
+	const char *identifier = pos;
+	if (!scan_identifier(pos)) return NULL;
+
+	std::string name(identifier, pos);
+	const char *identend = pos;
+
+	if (ParseNode *func = parse_function_call(name))
+	    return func;
+
+	arena->release(mark);
+	pos = identend;
+
+	return arena->create<PNVariable>(name);
+    }
+
+    /// Parse the bracketed parameter list following a function identifier.
+    ParseNode* parse_function_call(const std::string &funcname)
+    {
+	if (!match_char('(')) return NULL;
+
+	std::vector<const ParseNode*> paramlist;
+
+	const char *save = pos;
+	ParseArena::Mark mark = arena->mark();
+
+	if (ParseNode *param = parse_expr())
+	{
+	    paramlist.push_back(param);
+
+	    while (true)
+	    {
+		save = pos;
+		mark = arena->mark();
+
+		if (!match_char(',') || !(param = parse_expr())) {
+		    pos = save;
+		    arena->release(mark);
+		    break;
+		}
+
+		paramlist.push_back(param);
+	    }
+	}
+	else
+	{
+	    // the parameter list is optional
+	    pos = save;
+	    arena->release(mark);
+	}
+
+	if (!match_char(')')) return NULL;
+
+	// copy the parameter array into the arena
+	const ParseNode **paramarray = NULL;
+
+	if (!paramlist.empty())
+	{
+	    paramarray = static_cast<const ParseNode**>(arena->allocate(paramlist.size() * sizeof(ParseNode*)));
+	    std::copy(paramlist.begin(), paramlist.end(), paramarray);
+	}
+
+	return arena->create<PNFunction>(funcname, paramarray, static_cast<unsigned int>(paramlist.size()));
+    }
+
+    ParseNode* parse_unary()
+    {
+	static const char* const unaryops[] = { "+", "-", "!", "not", NULL };
+
+	const char *op = match_op(unaryops, true);
+
+	ParseArena::Mark mark = arena->mark();
+	ParseNode *val = parse_atom();
+
+	if (!val || !op) return val;
+
+	return make_unary(mark, val, op[0]);
+    }
+
+    ParseNode* parse_cast()
+    {
+	static const char* const casttypes[] = {
+	    "bool",
+	    "char", "short", "int", "integer", "long",
+	    "byte", "word", "dword", "qword",
+	    "float", "double",
+	    "string",
+	    NULL
+	};
+
+	// the cast specification is optional
+	const char *save = pos;
+	const char *tname = NULL;
+
+	if (match_char('('))
+	{
+	    for(const char* const* ct = casttypes; *ct && !tname; ++ct)
+	    {
+		if (match_keyword(*ct)) tname = *ct;
+	    }
+
+	    if (tname && !match_char(')')) tname = NULL;
+	}
+	if (!tname) pos = save;
+
+	ParseArena::Mark mark = arena->mark();
+	ParseNode *val = parse_unary();
+
+	if (!val || !tname) return val;
+
+	return make_cast(mark, val, AnyScalar::stringToType(tname));
+    }
+
+    ParseNode* parse_pow()
+    {
+	static const char* const powops[] = { "^", NULL };
+
+	ParseArena::Mark mark = arena->mark();
+	ParseNode *left = parse_cast();
+	if (!left) return NULL;
+
+	while (true)
+	{
+	    const char *save = pos;
+	    ParseArena::Mark rightmark = arena->mark();
+
+	    const char *op = match_op(powops, false);
+	    ParseNode *right = op ? parse_cast() : NULL;
+
+	    if (!right) {
+		pos = save;
+		arena->release(rightmark);
+		return left;
+	    }
+
+	    left = make_arith(mark, left, right, op[0]);
+	}
+    }
+
+    ParseNode* parse_mul()
+    {
+	static const char* const mulops[] = { "*", "/", NULL };
+
+	ParseArena::Mark mark = arena->mark();
+	ParseNode *left = parse_pow();
+	if (!left) return NULL;
+
+	while (true)
+	{
+	    const char *save = pos;
+	    ParseArena::Mark rightmark = arena->mark();
+
+	    const char *op = match_op(mulops, false);
+	    ParseNode *right = op ? parse_pow() : NULL;
+
+	    if (!right) {
+		pos = save;
+		arena->release(rightmark);
+		return left;
+	    }
+
+	    left = make_arith(mark, left, right, op[0]);
+	}
+    }
+
+    ParseNode* parse_add()
+    {
+	static const char* const addops[] = { "+", "-", NULL };
+
+	ParseArena::Mark mark = arena->mark();
+	ParseNode *left = parse_mul();
+	if (!left) return NULL;
+
+	while (true)
+	{
+	    const char *save = pos;
+	    ParseArena::Mark rightmark = arena->mark();
+
+	    const char *op = match_op(addops, false);
+	    ParseNode *right = op ? parse_mul() : NULL;
+
+	    if (!right) {
+		pos = save;
+		arena->release(rightmark);
+		return left;
+	    }
+
+	    left = make_arith(mark, left, right, op[0]);
+	}
+    }
+
+    ParseNode* parse_comp()
+    {
+	static const char* const compops[] = {
+	    "==", "!=", "<=", ">=", "=<", "=>", "=", "<", ">", NULL
+	};
+
+	ParseArena::Mark mark = arena->mark();
+	ParseNode *left = parse_add();
+	if (!left) return NULL;
+
+	while (true)
+	{
+	    const char *save = pos;
+	    ParseArena::Mark rightmark = arena->mark();
+
+	    const char *op = match_op(compops, false);
+	    ParseNode *right = op ? parse_add() : NULL;
+
+	    if (!right) {
+		pos = save;
+		arena->release(rightmark);
+		return left;
+	    }
+
+	    left = make_comparison(mark, left, right, op);
+	}
+    }
+
+    ParseNode* parse_and()
+    {
+	static const char* const andops[] = { "and", "&&", NULL };
+
+	ParseArena::Mark mark = arena->mark();
+	ParseNode *left = parse_comp();
+	if (!left) return NULL;
+
+	while (true)
+	{
+	    const char *save = pos;
+	    ParseArena::Mark rightmark = arena->mark();
+
+	    const char *op = match_op(andops, true);
+	    ParseNode *right = op ? parse_comp() : NULL;
+
+	    if (!right) {
+		pos = save;
+		arena->release(rightmark);
+		return left;
+	    }
+
+	    left = make_logic(mark, left, right, op);
+	}
+    }
+
+    ParseNode* parse_or()
+    {
+	static const char* const orops[] = { "or", "||", NULL };
+
+	ParseArena::Mark mark = arena->mark();
+	ParseNode *left = parse_and();
+	if (!left) return NULL;
+
+	while (true)
+	{
+	    const char *save = pos;
+	    ParseArena::Mark rightmark = arena->mark();
+
+	    const char *op = match_op(orops, true);
+	    ParseNode *right = op ? parse_and() : NULL;
+
+	    if (!right) {
+		pos = save;
+		arena->release(rightmark);
+		return left;
+	    }
+
+	    left = make_logic(mark, left, right, op);
+	}
+    }
+
+    inline ParseNode* parse_expr()
+    {
+	return parse_or();
+    }
+
+public:
+    /// Construct a parser for the input string.
+    Parser(const std::string &input, bool _strict)
+	: begin(input.data()), pos(input.data()), end(input.data() + input.size()),
+	  arena(NULL), strict(_strict), folderror(false)
+    {
+    }
+
+    /// Parse one expression at the current position with all nodes created
+    /// in the given arena. Returns NULL on a syntax error.
+    ParseNode* parseTree(ParseArena &_arena)
+    {
+	arena = &_arena;
+	return parse_expr();
+    }
+
+    /// Parse a comma-separated list of expressions, each into its own
+    /// arena. The list may be empty.
+    void parseTreeList(ParseTreeList &ptlist)
+    {
+	const char *save = pos;
+
+	while (true)
+	{
+	    if (!ptlist.empty() && !match_char(',')) break;
+
+	    boost::shared_ptr<ParseArena> treearena(new ParseArena);
+
+	    ParseNode *root = parseTree(*treearena);
+	    if (!root) break;
+
+	    ptlist.push_back( ParseTree(treearena, root) );
+	    save = pos;
+	}
+
+	pos = save;
+    }
+
+    /// Check if the input was parsed completely. Like spirit's ast_parse()
+    /// trailing whitespace is not skipped.
+    bool atEnd() const
+    {
+	return (pos == end);
+    }
+
+    /// Current parse position relative to the beginning of the input.
+    size_t position() const
+    {
+	return pos - begin;
+    }
+
+    /// True if folding a constant subexpression threw an exception, which
+    /// was suppressed.
+    bool hasFoldError() const
+    {
+	return folderror;
+    }
+};
+
+/// Throw a BadSyntaxException for the given position in the input.
+static void throw_syntax_error(const std::string &input, size_t pos)
+{
+    std::ostringstream oss;
+    oss << "Syntax error at position "
+	<< static_cast<int>(pos)
+	<< " near " 
+	<< input.substr(pos);
+
+    throw(BadSyntaxException(oss.str()));
+}
+
+/// Uses boost::spirit function to convert the parse tree into a XML document.
+static inline void tree_dump_xml(std::ostream &os, const std::string &input, const tree_parse_info<InputIterT> &info)
+{
+    // map used by the xml dumper to label the nodes
+
+    std::map<parser_id, std::string> rule_names;
+
+    rule_names[boolean_const_id] = "boolean_const";
+    rule_names[integer_const_id] = "integer_const";
+    rule_names[long_const_id] = "long_const";
+    rule_names[double_const_id] = "double_const";
+    rule_names[string_const_id] = "string_const";
+    rule_names[constant_id] = "constant";
+
+    rule_names[function_call_id] = "function_call";
+    rule_names[function_identifier_id] = "function_identifier";
+
+    rule_names[varname_id] = "varname";
+
+    rule_names[unary_expr_id] = "unary_expr";
+    rule_names[pow_expr_id] = "pow_expr";
+    rule_names[mul_expr_id] = "mul_expr";
+    rule_names[add_expr_id] = "add_expr";
+
+    rule_names[cast_expr_id] = "cast_expr";
+    rule_names[cast_spec_id] = "cast_spec";
+
+    rule_names[comp_expr_id] = "comp_expr";
+    rule_names[and_expr_id] = "and_expr";
+    rule_names[or_expr_id] = "or_expr";
+
+    rule_names[expr_id] = "expr";
+    rule_names[exprlist_id] = "exprlist";
+
+    tree_to_xml(os, info.trees, input.c_str(), rule_names);
+}
+
+} // namespace Grammar
+
+ParseArena::ParseArena(size_t initialsize)
+    : block(NULL), last(NULL), nextsize(initialsize), memsize(0)
+{
+}
+
+ParseArena::~ParseArena()
+{
+    Mark empty = { NULL, 0, NULL };
+    release(empty);
+}
+
+void* ParseArena::allocate(size_t size)
+{
+    size = (size + alignment - 1) & ~(alignment - 1);
+
+    if (!block || block->used + size > block->size)
+    {
+	// allocate a new block, large requests get a block of their own.
+	size_t bsize = nextsize;
+	if (bsize < blockheader + size) bsize = blockheader + size;
+
+	Block *b = static_cast<Block*>(::operator new(bsize));
+	b->next = block;
+	b->size = bsize;
+	b->used = blockheader;
+
+	block = b;
+	memsize += bsize;
+
+	if (nextsize < maxblocksize) nextsize *= 2;
+    }
+
+    void *p = reinterpret_cast<char*>(block) + block->used;
+    block->used += size;
+    return p;
+}
+
+ParseArena::Mark ParseArena::mark() const
+{
+    Mark m = { block, block ? block->used : 0, last };
+    return m;
+}
+
+void ParseArena::release(const Mark &m)
+{
+    // destroy the nodes created after the mark in reverse order
+    while (last != m.last)
+    {
+	last->node->~ParseNode();
+	last = last->prev;
+    }
+
+    // free the blocks allocated after the mark
+    while (block != m.block)
+    {
+	Block *b = block;
+	block = b->next;
+	memsize -= b->size;
+
+	// the block is allocated again with the same size
+	if (b->size <= maxblocksize) nextsize = b->size;
+
+	::operator delete(b);
+    }
+
+    if (block) block->used = m.used;
+}
+
+const ParseTree parseExpression(const std::string &input)
+{
+    // all nodes are allocated in the arena owned by the tree. if parsing
+    // throws, the arena destroys the nodes created so far.
+    boost::shared_ptr<ParseArena> arena(new ParseArena);
+
+    Grammar::Parser parser(input, false);
+
+    ParseNode *root = parser.parseTree(*arena);
+
+    if (!parser.atEnd() || !root)
+	Grammar::throw_syntax_error(input, parser.position());
+
+    if (parser.hasFoldError())
+    {
+	// folding a constant subexpression failed. the syntax is correct, so
+	// parse again and let the exception pass.
+	ParseArena strictarena;
+	Grammar::Parser(input, true).parseTree(strictarena);
+    }
+
+    return ParseTree(arena, root);
+}
+
+const ParseTree parseExpressionSpirit(const std::string &input)
+{
+    // instance of the grammar
+    Grammar::ExpressionGrammar g;
+
+#ifdef STX_DEBUG_PARSER
+    BOOST_SPIRIT_DEBUG_GRAMMAR(g);
+#endif
+
+    Grammar::tree_parse_info<Grammar::InputIterT> info =
+	boost::spirit::ast_parse(input.begin(), input.end(),
+				 g.use_parser<0>(),	// use first entry point: expr
+				 boost::spirit::space_p);
+
+    if (!info.full)
+	Grammar::throw_syntax_error(input, info.stop - input.begin());
+
+    // all nodes are allocated in the arena owned by the tree. if building the
+    // tree throws, the arena destroys the nodes created so far.
+    boost::shared_ptr<ParseArena> arena(new ParseArena);
+
+    ParseNode *root = Grammar::build_expr(info.trees.begin(), *arena);
+
+    return ParseTree(arena, root);
+}
+
+std::string parseExpressionXML(const std::string &input)
+{
+    // instance of the grammar
+    Grammar::ExpressionGrammar g;
+
+#ifdef STX_DEBUG_PARSER
+    BOOST_SPIRIT_DEBUG_GRAMMAR(g);
+#endif
+
+    Grammar::tree_parse_info<Grammar::InputIterT> info =
+	boost::spirit::ast_parse(input.begin(), input.end(),
+				 g.use_parser<0>(),	// use first entry point: expr
+				 boost::spirit::space_p);
+
+    if (!info.full)
+	Grammar::throw_syntax_error(input, info.stop - input.begin());
+
+    std::ostringstream oss;
+    Grammar::tree_dump_xml(oss, input, info);
+    return oss.str();
+}
+
+ParseTreeList parseExpressionList(const std::string &input)
+{
+    Grammar::Parser parser(input, false);
+
+    ParseTreeList ptlist;
+    parser.parseTreeList(ptlist);
+
+    if (!parser.atEnd())
+	Grammar::throw_syntax_error(input, parser.position());
+
+    if (parser.hasFoldError())
+    {
+	ParseTreeList strictlist;
+	Grammar::Parser(input, true).parseTreeList(strictlist);
+    }
+
+    return ptlist;
+}
+
+std::vector<AnyScalar> ParseTreeList::evaluate(const class SymbolTable &st) const
+{
+    std::vector<AnyScalar> vl;
+
+    for(parent_type::const_iterator i = parent_type::begin(); i != parent_type::end(); i++)
+    {
+	vl.push_back( i->evaluate(st) );
+    }
+
+    return vl;
+}
+
+std::string ParseTreeList::toString() const
+{
+    std::string sl;
+
+    for(parent_type::const_iterator i = parent_type::begin(); i != parent_type::end(); i++)
+    {
+	if (i != parent_type::begin()) {
+	    sl += ", ";
+	}
+
+	sl += i->toString();
+    }
+
+    return sl;
+}
+
+void ParseNode::compile(ParseProgram &prog) const
+{
+    prog.emitNode(this);
+}
+
+int ParseNode::flattenChain(std::vector<const ParseNode*> &) const
+{
+    return ParseProgram::CHAIN_NONE;
+}
+
+bool ParseNode::getPredicate(std::string &, int &, AnyScalar &) const
+{
+    return false;
+}
+
+void ParseNode::getVariables(std::set<std::string> &) const
+{
+}
+
+bool ParseNode::getFunctionCall(std::string &, std::vector<const ParseNode*> &) const
+{
+    return false;
+}
+
+bool ParseTree::getFunctionCall(std::string &funcname, std::vector<ParseTree> &params) const
+{
+    assert(rootnode.get() != NULL);
+
+    std::vector<const ParseNode*> paramnodes;
+    if (!rootnode->getFunctionCall(funcname, paramnodes)) return false;
+
+    params.clear();
+
+    for(unsigned int i = 0; i < paramnodes.size(); ++i)
+	params.push_back( ParseTree(arena, const_cast<ParseNode*>(paramnodes[i])) );
+
+    return true;
+}
+
+void ParseTree::getConjuncts(std::vector<ParseTree> &operands) const
+{
+    assert(rootnode.get() != NULL);
+
+    std::vector<const ParseNode*> nodes;
+
+    if (rootnode->flattenChain(nodes) != ParseProgram::CHAIN_AND) {
+	nodes.clear();
+	nodes.push_back(rootnode.get());
+    }
+
+    operands.clear();
+
+    for(unsigned int i = 0; i < nodes.size(); ++i)
+	operands.push_back( ParseTree(arena, const_cast<ParseNode*>(nodes[i])) );
+}
+
+bool ParseTree::getPredicate(std::string &varname, int &op, AnyScalar &value) const
+{
+    assert(rootnode.get() != NULL);
+    return rootnode->getPredicate(varname, op, value);
+}
+
+// *** Algebraic rewriting of parse trees for ParseTree::optimize()
+
+/** ParseOptimizer holds the state of ParseTree::optimize(): the arena of the
+ * new tree, the options and the log. For each node created it records the
+ * type of the node's value, as far as it is known before evaluation, and
+ * whether evaluating the node can throw an exception. The type is the one
+ * of the value if the evaluation does not throw. */
+class ParseOptimizer
+{
+public:
+    /// Arena in which the optimized nodes are created.
+    ParseArena		&arena;
+
+    /// Assumptions about variables and functions.
+    const OptimizeOptions &opts;
+
+    /// Log of the applied rewrites, may be NULL.
+    OptimizeLog		*log;
+
+private:
+    /// Type and exception information of an optimized node.
+    struct NodeInfo
+    {
+	/// Type of the node's value, ATTRTYPE_INVALID if unknown.
+	AnyScalar::attrtype_t	type;
+
+	/// True if evaluating the node cannot throw.
+	bool		nothrow;
+    };
+
+    /// Information about all nodes created.
+    std::map<const ParseNode*, NodeInfo> info;
+
+public:
+    /// Create an optimizer putting the new nodes into the arena.
+    ParseOptimizer(ParseArena &_arena, const OptimizeOptions &_opts, OptimizeLog *_log)
+	: arena(_arena), opts(_opts), log(_log)
+    {
+    }
+
+    /// Recreate the subtree optimized in the arena.
+    inline ParseNode* optimize(const ParseNode *node)
+    {
+	return node->optimize(*this);
+    }
+
+    /// Record type and exception information of a new node and return it.
+    inline ParseNode* result(ParseNode *node, AnyScalar::attrtype_t type, bool nothrow)
+    {
+	NodeInfo &ni = info[node];
+	ni.type = type;
+	ni.nothrow = nothrow;
+	return node;
+    }
+
+    /// Return the type of an optimized node's value.
+    inline AnyScalar::attrtype_t typeOf(const ParseNode *node) const
+    {
+	std::map<const ParseNode*, NodeInfo>::const_iterator ni = info.find(node);
+	return (ni != info.end()) ? ni->second.type : AnyScalar::ATTRTYPE_INVALID;
+    }
+
+    /// Return true if evaluating an optimized node cannot throw.
+    inline bool nothrow(const ParseNode *node) const
+    {
+	std::map<const ParseNode*, NodeInfo>::const_iterator ni = info.find(node);
+	return (ni != info.end()) && ni->second.nothrow;
+    }
+
+    /// Log the rewrite of node before into node after and return after.
+    inline ParseNode* rewritten(const ParseNode *before, ParseNode *after)
+    {
+	if (log) log->push_back(std::make_pair(before->toString(), after->toString()));
+	return after;
+    }
+
+    /// Create a constant node.
+    inline ParseNode* constant(const AnyScalar &value)
+    {
+	return result(arena.create<Grammar::PNConstant>(value), value.getType(), true);
+    }
+
+    /// Fold a node whose operands are constant into a constant node. Returns
+    /// NULL if the evaluation throws, the exception is left for the
+    /// evaluation of the optimized tree.
+    ParseNode* fold(const ParseNode *node)
+    {
+	AnyScalar value(AnyScalar::ATTRTYPE_INVALID);
+
+	try {
+	    if (!node->evaluate_const(&value)) return NULL;
+	}
+	catch (ExpressionParserException &) {
+	    return NULL;
+	}
+
+	return rewritten(node, constant(value));
+    }
+
+    /// Returns true if exponent is the constant 2 and base a variable of
+    /// numeric type, so base^2 can be reduced to base*base.
+    bool isSquare(const ParseNode *base, const ParseNode *exponent) const
+    {
+	AnyScalar ve(AnyScalar::ATTRTYPE_INVALID);
+
+	if (!exponent->evaluate_const(NULL) || !exponent->evaluate_const(&ve)) return false;
+	if (!isNumeric(ve.getType()) || ve.getDouble() != 2.0) return false;
+
+	return dynamic_cast<const Grammar::PNVariable*>(base) != NULL &&
+	    isNumeric(typeOf(base)) && nothrow(base);
+    }
+
+    /// Create base*base in double precision, which is the correctly rounded
+    /// value of pow(base,2).
+    ParseNode* square(ParseNode *base)
+    {
+	if (typeOf(base) != AnyScalar::ATTRTYPE_DOUBLE)
+	{
+	    base = result(arena.create<Grammar::PNCastExpr>(base, AnyScalar::ATTRTYPE_DOUBLE),
+			  AnyScalar::ATTRTYPE_DOUBLE, true);
+	}
+
+	return result(arena.create<Grammar::PNBinaryArithmExpr>(base, base, '*'),
+		      AnyScalar::ATTRTYPE_DOUBLE, true);
+    }
+
+    /// Returns true for the integer types, bool is not one of them here.
+    static inline bool isInteger(AnyScalar::attrtype_t t)
+    {
+	return (t == AnyScalar::ATTRTYPE_CHAR || t == AnyScalar::ATTRTYPE_SHORT ||
+		t == AnyScalar::ATTRTYPE_INTEGER || t == AnyScalar::ATTRTYPE_LONG ||
+		t == AnyScalar::ATTRTYPE_BYTE || t == AnyScalar::ATTRTYPE_WORD ||
+		t == AnyScalar::ATTRTYPE_DWORD || t == AnyScalar::ATTRTYPE_QWORD);
+    }
+
+    /// Returns true for the signed integer types.
+    static inline bool isSigned(AnyScalar::attrtype_t t)
+    {
+	return (t == AnyScalar::ATTRTYPE_CHAR || t == AnyScalar::ATTRTYPE_SHORT ||
+		t == AnyScalar::ATTRTYPE_INTEGER || t == AnyScalar::ATTRTYPE_LONG);
+    }
+
+    /// Returns true for the integer and floating point types.
+    static inline bool isNumeric(AnyScalar::attrtype_t t)
+    {
+	return isInteger(t) || t == AnyScalar::ATTRTYPE_FLOAT || t == AnyScalar::ATTRTYPE_DOUBLE;
+    }
+
+    /// Return the value v converted to type t.
+    static AnyScalar typedValue(AnyScalar::attrtype_t t, int v)
+    {
+	AnyScalar a(v);
+	a.convertType(t);
+	return a;
+    }
+
+    /// Return the result type of the arithmetic operator on numeric operands
+    /// of type tl and tr, otherwise ATTRTYPE_INVALID. The type promotion of
+    /// AnyScalar's operators is determined using sample values.
+    static AnyScalar::attrtype_t arithType(AnyScalar::attrtype_t tl, AnyScalar::attrtype_t tr, char op)
+    {
+	if (!isNumeric(tl) || !isNumeric(tr)) return AnyScalar::ATTRTYPE_INVALID;
+
+	if (op == '^') return AnyScalar::ATTRTYPE_DOUBLE;
+
+	AnyScalar vl = typedValue(tl, 1), vr = typedValue(tr, 1);
+
+	switch(op)
+	{
+	case '+': return (vl + vr).getType();
+	case '-': return (vl - vr).getType();
+	case '*': return (vl * vr).getType();
+	case '/': return (vl / vr).getType();
+	default: assert(0);
+	}
+	return AnyScalar::ATTRTYPE_INVALID;
+    }
+
+    /// Convert the integer constant c to type t of the arithmetic operation
+    /// it is an operand of. Returns false if the conversion is not exact.
+    static bool convertConstant(AnyScalar &c, AnyScalar::attrtype_t t)
+    {
+	if (c.getType() == t) return true;
+
+	if (c.getType() == AnyScalar::ATTRTYPE_INTEGER && t == AnyScalar::ATTRTYPE_LONG)
+	    return c.convertType(t);
+
+	return false;
+    }
+
+    /// Subtract the offset from the signed integer constant c, returns false
+    /// if the result overflows.
+    static bool subtractOffset(AnyScalar &c, long long offset)
+    {
+	if (c.getType() != AnyScalar::ATTRTYPE_INTEGER && c.getType() != AnyScalar::ATTRTYPE_LONG)
+	    return false;
+
+	long long v = c.getLong();
+
+	if (offset > 0 && v < LLONG_MIN + offset) return false;
+	if (offset < 0 && v > LLONG_MAX + offset) return false;
+
+	v -= offset;
+
+	if (INT_MIN <= v && v <= INT_MAX)
+	    c = AnyScalar(static_cast<int>(v));
+	else
+	    c = AnyScalar(v);
+
+	return true;
+    }
+};
+
+namespace Grammar {
+
+ParseNode* PNConstant::optimize(ParseOptimizer &po) const
+{
+    return po.constant(value);
+}
+
+ParseNode* PNVariable::optimize(ParseOptimizer &po) const
+{
+    ParseNode *node = po.arena.create<PNVariable>(varname);
+
+    std::map<std::string, AnyScalar::attrtype_t>::const_iterator vt = po.opts.vartypes.find(varname);
+
+    if (vt == po.opts.vartypes.end())
+	return po.result(node, AnyScalar::ATTRTYPE_INVALID, false);
+
+    return po.result(node, vt->second, true);
+}
+
+ParseNode* PNFunction::optimize(ParseOptimizer &po) const
+{
+    ParseNode **params = NULL;
+
+    if (paramcount > 0)
+    {
+	params = static_cast<ParseNode**>(po.arena.allocate(paramcount * sizeof(ParseNode*)));
+
+	for(unsigned int i = 0; i < paramcount; ++i)
+	    params[i] = po.optimize(paramlist[i]);
+    }
+
+    ParseNode *node = po.result(po.arena.create<PNFunction>(funcname, params, paramcount),
+				AnyScalar::ATTRTYPE_INVALID, false);
+
+    // call pure functions of the symbol table with constant arguments now
+    bool pure = false;
+
+    if (po.opts.symboltable)
+    {
+	SymbolTable::FunctionBinding binding;
+
+	try {
+	    pure = po.opts.symboltable->bindFunction(funcname, paramcount, binding) && binding.pure;
+	}
+	catch (ExpressionParserException &) {
+	    // a wrong number of parameters is left for the evaluation.
+	}
+
+	std::vector<AnyScalar> paramvalues(paramcount, AnyScalar(AnyScalar::ATTRTYPE_INVALID));
+	bool constparams = pure;
+
+	for(unsigned int i = 0; i < paramcount && constparams; ++i)
+	{
+	    constparams = params[i]->evaluate_const(NULL) && params[i]->evaluate_const(&paramvalues[i]);
+	}
+
+	if (constparams)
+	{
+	    try {
+		AnyScalar value = po.opts.symboltable->processFunction(funcname, paramvalues);
+		value.detachStringRef();
+		return po.rewritten(node, po.constant(value));
+	    }
+	    catch (ExpressionParserException &) {
+		// exceptions are left for the evaluation.
+	    }
+	}
+    }
+
+    if (po.opts.standardfunctions && paramcount == 2)
+    {
+	std::string fn = funcname;
+	std::transform(fn.begin(), fn.end(), fn.begin(), toupper);
+
+	// POW(x,2) calculates x^2 via std::pow()
+	if (fn == "POW" && po.isSquare(params[0], params[1]))
+	    return po.rewritten(node, po.square(params[0]));
+    }
+
+    if (pure && po.opts.memoize > 0)
+    {
+	return po.result(po.arena.create<PNMemoFunction>(funcname, params, paramcount, po.opts.memoize),
+			 AnyScalar::ATTRTYPE_INVALID, false);
+    }
+
+    return node;
+}
+
+ParseNode* PNUnaryArithmExpr::optimize(ParseOptimizer &po) const
+{
+    ParseNode *val = po.optimize(operand);
+
+    ParseNode *node = po.arena.create<PNUnaryArithmExpr>(val, op);
+
+    if (val->evaluate_const(NULL))
+    {
+	if (ParseNode *c = po.fold(node)) return c;
+    }
+
+    // unary plus returns the operand unchanged
+    if (op == '+')
+	return po.rewritten(node, val);
+
+    AnyScalar::attrtype_t type = po.typeOf(val);
+
+    const PNUnaryArithmExpr *inner = dynamic_cast<const PNUnaryArithmExpr*>(val);
+
+    if (op == '-')
+    {
+	// negation keeps numeric and bool types, so --x is x.
+	if (ParseOptimizer::isNumeric(type) || type == AnyScalar::ATTRTYPE_BOOL)
+	{
+	    if (inner && inner->op == '-' && po.typeOf(inner->operand) == type)
+		return po.rewritten(node, const_cast<ParseNode*>(inner->operand));
+
+	    return po.result(node, type, po.nothrow(val));
+	}
+
+	// strings are converted to double
+	if (type == AnyScalar::ATTRTYPE_STRING)
+	    return po.result(node, AnyScalar::ATTRTYPE_DOUBLE, false);
+
+	return po.result(node, AnyScalar::ATTRTYPE_INVALID, false);
+    }
+
+    assert(op == '!');
+
+    if (type == AnyScalar::ATTRTYPE_BOOL)
+    {
+	if (inner && inner->op == '!' && po.typeOf(inner->operand) == type)
+	    return po.rewritten(node, const_cast<ParseNode*>(inner->operand));
+
+	return po.result(node, AnyScalar::ATTRTYPE_BOOL, po.nothrow(val));
+    }
+
+    return po.result(node, AnyScalar::ATTRTYPE_BOOL, false);
+}
+
+ParseNode* PNBinaryArithmExpr::optimize(ParseOptimizer &po) const
+{
+    ParseNode *l = po.optimize(left);
+    ParseNode *r = po.optimize(right);
+
+    return rewrite(po, l, r, op);
+}
+
+ParseNode* PNBinaryArithmExpr::rewrite(ParseOptimizer &po, ParseNode *left, ParseNode *right, char op)
+{
+    ParseNode *node = po.arena.create<PNBinaryArithmExpr>(left, right, op);
+
+    AnyScalar vl(AnyScalar::ATTRTYPE_INVALID), vr(AnyScalar::ATTRTYPE_INVALID);
+
+    bool constleft = left->evaluate_const(NULL) && left->evaluate_const(&vl);
+    bool constright = right->evaluate_const(NULL) && right->evaluate_const(&vr);
+
+    if (constleft && constright)
+    {
+	if (ParseNode *c = po.fold(node)) return c;
+    }
+
+    AnyScalar::attrtype_t tl = po.typeOf(left), tr = po.typeOf(right);
+    AnyScalar::attrtype_t type = ParseOptimizer::arithType(tl, tr, op);
+
+    // string operands are converted depending on their value
+    if (type == AnyScalar::ATTRTYPE_INVALID)
+	return po.result(node, type, false);
+
+    // x*1, 1*x and x/1 are exact if the operator does not change the type.
+    if ((op == '*' || op == '/') && constright && vr.getDouble() == 1.0 && type == tl)
+	return po.rewritten(node, left);
+
+    if (op == '*' && constleft && vl.getDouble() == 1.0 && type == tr)
+	return po.rewritten(node, right);
+
+    if (ParseOptimizer::isInteger(type))
+    {
+	// x+0, 0+x and x-0. not for floating point, where -0.0 + 0 is 0.0.
+	if ((op == '+' || op == '-') && constright && vr.getDouble() == 0.0 && type == tl)
+	    return po.rewritten(node, left);
+
+	if (op == '+' && constleft && vl.getDouble() == 0.0 && type == tr)
+	    return po.rewritten(node, right);
+
+	// x*0 and 0*x, if evaluating x cannot throw.
+	if (op == '*' && ((constright && vr.getDouble() == 0.0 && po.nothrow(left)) ||
+			  (constleft && vl.getDouble() == 0.0 && po.nothrow(right))))
+	    return po.rewritten(node, po.constant(ParseOptimizer::typedValue(type, 0)));
+
+	// re-associate (x+c1)+c2 into x+(c1+c2) and (x*c1)*c2 into x*(c1*c2),
+	// also with the constants on the other side of + and *. integer
+	// arithmetic in one type is associative even if it wraps around.
+	const ParseNode *y = constright ? left : (constleft && op != '-') ? right : NULL;
+	AnyScalar c2 = constright ? vr : vl;
+
+	const PNBinaryArithmExpr *inner = dynamic_cast<const PNBinaryArithmExpr*>(y);
+
+	if (inner && po.typeOf(inner) == type && (op == '+' || op == '-' || op == '*') &&
+	    (op == '*' ? inner->op == '*' : (inner->op == '+' || inner->op == '-')) &&
+	    ParseOptimizer::convertConstant(c2, type))
+	{
+	    AnyScalar c1(AnyScalar::ATTRTYPE_INVALID);
+	    const ParseNode *x = NULL;
+
+	    if (inner->right->evaluate_const(NULL) && inner->right->evaluate_const(&c1))
+		x = inner->left;
+	    else if (inner->op != '-' && inner->left->evaluate_const(NULL) && inner->left->evaluate_const(&c1))
+		x = inner->right;
+
+	    if (x && ParseOptimizer::convertConstant(c1, type))
+	    {
+		char newop = op;
+		AnyScalar k(AnyScalar::ATTRTYPE_INVALID);
+
+		if (op == '*') {
+		    k = c1 * c2;
+		}
+		else {
+		    if (inner->op == '-') c1 = -c1;
+		    k = (op == '+') ? c1 + c2 : c1 - c2;
+		    newop = '+';
+
+		    // x + -k is written as x - k
+		    if (k.getLong() < 0 && (-k).getLong() > 0) {
+			k = -k;
+			newop = '-';
+		    }
+		}
+
+		return po.rewritten(node, rewrite(po, const_cast<ParseNode*>(x), po.constant(k), newop));
+	    }
+	}
+    }
+
+    // x^2 is reduced to x*x.
+    if (op == '^' && constright && po.isSquare(left, right))
+	return po.rewritten(node, po.square(left));
+
+    bool nothrow = po.nothrow(left) && po.nothrow(right);
+
+    // integer division by zero throws
+    if (op == '/' && ParseOptimizer::isInteger(type) && !(constright && vr.getDouble() != 0.0))
+	nothrow = false;
+
+    return po.result(node, type, nothrow);
+}
+
+bool PNBinaryArithmExpr::splitOffset(const ParseOptimizer &po, const ParseNode *node,
+				     const ParseNode *&x, long long &offset)
+{
+    const PNBinaryArithmExpr *arith = dynamic_cast<const PNBinaryArithmExpr*>(node);
+
+    if (!arith || (arith->op != '+' && arith->op != '-')) return false;
+    if (!ParseOptimizer::isSigned(po.typeOf(arith))) return false;
+
+    AnyScalar c(AnyScalar::ATTRTYPE_INVALID);
+
+    if (arith->right->evaluate_const(NULL) && arith->right->evaluate_const(&c))
+	x = arith->left;
+    else if (arith->op == '+' && arith->left->evaluate_const(NULL) && arith->left->evaluate_const(&c))
+	x = arith->right;
+    else
+	return false;
+
+    if (!ParseOptimizer::isSigned(po.typeOf(x))) return false;
+    if (c.getType() != AnyScalar::ATTRTYPE_INTEGER && c.getType() != AnyScalar::ATTRTYPE_LONG) return false;
+
+    offset = c.getLong();
+
+    if (arith->op == '-')
+    {
+	if (offset == LLONG_MIN) return false;
+	offset = -offset;
+    }
+
+    return true;
+}
+
+ParseNode* PNCastExpr::optimize(ParseOptimizer &po) const
+{
+    ParseNode *val = po.optimize(operand);
+
+    ParseNode *node = po.arena.create<PNCastExpr>(val, type);
+
+    if (val->evaluate_const(NULL))
+    {
+	if (ParseNode *c = po.fold(node)) return c;
+    }
+
+    AnyScalar::attrtype_t valtype = po.typeOf(val);
+
+    // converting a value to its own type does nothing
+    if (valtype == type)
+	return po.rewritten(node, val);
+
+    // conversions from strings may fail
+    return po.result(node, type, po.nothrow(val) && valtype != AnyScalar::ATTRTYPE_INVALID
+		     && valtype != AnyScalar::ATTRTYPE_STRING);
+}
+
+ParseNode* PNBinaryComparisonExpr::optimize(ParseOptimizer &po) const
+{
+    ParseNode *l = po.optimize(left);
+    ParseNode *r = po.optimize(right);
+
+    ParseNode *node = po.arena.create<PNBinaryComparisonExpr>(l, r, opstr);
+
+    AnyScalar vl(AnyScalar::ATTRTYPE_INVALID), vr(AnyScalar::ATTRTYPE_INVALID);
+
+    bool constleft = l->evaluate_const(NULL) && l->evaluate_const(&vl);
+    bool constright = r->evaluate_const(NULL) && r->evaluate_const(&vr);
+
+    if (constleft && constright)
+    {
+	if (ParseNode *c = po.fold(node)) return c;
+    }
+
+    // x+c1 op c2 is rewritten into x op c2-c1 and c2 op x+c1 into c2-c1 op
+    // x. this is exact if the signed integer addition does not overflow.
+    const ParseNode *x;
+    long long offset;
+
+    if (constright && PNBinaryArithmExpr::splitOffset(po, l, x, offset) &&
+	ParseOptimizer::subtractOffset(vr, offset))
+    {
+	ParseNode *n = po.arena.create<PNBinaryComparisonExpr>(x, po.constant(vr), opstr);
+	return po.rewritten(node, po.result(n, AnyScalar::ATTRTYPE_BOOL, po.nothrow(x)));
+    }
+
+    if (constleft && PNBinaryArithmExpr::splitOffset(po, r, x, offset) &&
+	ParseOptimizer::subtractOffset(vl, offset))
+    {
+	ParseNode *n = po.arena.create<PNBinaryComparisonExpr>(po.constant(vl), x, opstr);
+	return po.rewritten(node, po.result(n, AnyScalar::ATTRTYPE_BOOL, po.nothrow(x)));
+    }
+
+    // comparing strings with other types converts them
+    AnyScalar::attrtype_t tl = po.typeOf(l), tr = po.typeOf(r);
+
+    bool nothrow = po.nothrow(l) && po.nothrow(r) &&
+	((ParseOptimizer::isNumeric(tl) && ParseOptimizer::isNumeric(tr)) ||
+	 (tl == tr && tl != AnyScalar::ATTRTYPE_INVALID));
+
+    return po.result(node, AnyScalar::ATTRTYPE_BOOL, nothrow);
+}
+
+ParseNode* PNBinaryLogicExpr::optimize(ParseOptimizer &po) const
+{
+    ParseNode *l = po.optimize(left);
+    ParseNode *r = po.optimize(right);
+
+    PNBinaryLogicExpr *node = po.arena.create<PNBinaryLogicExpr>(l, r, get_opstr());
+
+    AnyScalar vl(AnyScalar::ATTRTYPE_INVALID), vr(AnyScalar::ATTRTYPE_INVALID);
+
+    bool constleft = l->evaluate_const(NULL) && l->evaluate_const(&vl);
+    bool constright = r->evaluate_const(NULL) && r->evaluate_const(&vr);
+
+    if (constleft || constright)
+    {
+	// a constant right operand deciding the result, as in X && false, is
+	// only folded if the left operand is a bool which cannot throw. The
+	// evaluation would otherwise throw its exceptions first.
+	bool leftsafe = po.nothrow(l) && po.typeOf(l) == AnyScalar::ATTRTYPE_BOOL;
+
+	if (constleft || leftsafe)
+	{
+	    if (ParseNode *c = po.fold(node)) return c;
+	}
+
+	// a constant operand which does not decide the result is dropped like
+	// in build_expr(), if both operands are bool.
+	bool booltypes = (po.typeOf(l) == AnyScalar::ATTRTYPE_BOOL && po.typeOf(r) == AnyScalar::ATTRTYPE_BOOL);
+
+	bool rightdecides = constright && vr.getType() == AnyScalar::ATTRTYPE_BOOL &&
+	    vr.getBoolean() == (op == OP_OR);
+
+	if (constleft && booltypes)
+	    return po.rewritten(node, r);
+
+	if (constright && booltypes && !rightdecides)
+	    return po.rewritten(node, l);
+    }
+
+    bool nothrow = po.nothrow(l) && po.nothrow(r) &&
+	po.typeOf(l) == AnyScalar::ATTRTYPE_BOOL && po.typeOf(r) == AnyScalar::ATTRTYPE_BOOL;
+
+    return po.result(node, AnyScalar::ATTRTYPE_BOOL, nothrow);
+}
+
+} // namespace Grammar
+
+ParseTree ParseTree::optimize(const OptimizeOptions &opts, OptimizeLog *log) const
+{
+    assert(rootnode.get() != NULL);
+
+    boost::shared_ptr<ParseArena> newarena(new ParseArena);
+    ParseOptimizer po(*newarena, opts, log);
+
+    ParseNode *root = po.optimize(rootnode.get());
+
+    return ParseTree(newarena, root);
+}
+
+/// *** SymbolTable, EmptySymbolTable and BasicSymbolTable implementation
+
+SymbolTable::~SymbolTable()
+{
+}
+
+bool SymbolTable::bindFunction(const std::string &, unsigned int,
+			       FunctionBinding &) const
+{
+    return false;
+}
 
 EmptySymbolTable::~EmptySymbolTable()
 {
@@ -1462,15 +3464,28 @@ void BasicSymbolTable::setVariable(const std::string& varname, const AnyScalar &
     std::string vn = varname;
     std::transform(vn.begin(), vn.end(), vn.begin(), tolower);
 
-    variablemap[vn] = value;
+    // the table outlives the evaluation a string reference is valid for
+    AnyScalar &stored = variablemap[vn];
+    stored = value;
+    stored.detachStringRef();
+}
+
+void BasicSymbolTable::setFunction(const std::string& funcname, int arguments, functionptr_type funcptr,
+				   bool pure)
+{
+    std::string fn = funcname;
+    std::transform(fn.begin(), fn.end(), fn.begin(), toupper);
+
+    functionmap[fn] = FunctionInfo(arguments, funcptr, NULL, NULL, pure);
 }
 
-void BasicSymbolTable::setFunction(const std::string& funcname, int arguments, functionptr_type funcptr)
+void BasicSymbolTable::setNativeFunction(const std::string& funcname, int arguments,
+					 nativestub_type stub, genericfunc_type nativefunc, bool pure)
 {
     std::string fn = funcname;
     std::transform(fn.begin(), fn.end(), fn.begin(), toupper);
 
-    functionmap[fn] = FunctionInfo(arguments, funcptr);
+    functionmap[fn] = FunctionInfo(arguments, NULL, stub, nativefunc, pure);
 }
 
 void BasicSymbolTable::clearVariables()
@@ -1538,17 +3553,19 @@ AnyScalar BasicSymbolTable::funcSQRT(const paramlist_type &paramlist)
 
 void BasicSymbolTable::addStandardFunctions()
 {
-    setFunction("PI", 0, funcPI);
-
-    setFunction("SIN", 1, funcSIN);
-    setFunction("COS", 1, funcCOS);
-    setFunction("TAN", 1, funcTAN);
-
-    setFunction("ABS", 1, funcABS);
-    setFunction("EXP", 1, funcEXP);
-    setFunction("LOGN", 1, funcLOGN);
-    setFunction("POW", 2, funcPOW);
-    setFunction("SQRT", 1, funcSQRT);
+    setFunction("PI", 0, funcPI, true);
+
+    // the pure floating point functions are registered as typed native
+    // functions, which are called without a parameter list.
+    setFunction<double(double)>("SIN", std::sin, true);
+    setFunction<double(double)>("COS", std::cos, true);
+    setFunction<double(double)>("TAN", std::tan, true);
+
+    setFunction("ABS", 1, funcABS, true);
+    setFunction<double(double)>("EXP", std::exp, true);
+    setFunction<double(double)>("LOGN", std::log, true);
+    setFunction<double(double,double)>("POW", std::pow, true);
+    setFunction<double(double)>("SQRT", std::sqrt, true);
 }
 
 AnyScalar BasicSymbolTable::lookupVariable(const std::string &_varname) const
@@ -1576,27 +3593,56 @@ AnyScalar BasicSymbolTable::processFunction(const std::string &_funcname,
 
     if (fi != functionmap.end())
     {
-	if (fi->second.arguments >= 0)
+	checkArguments(funcname, fi->second.arguments, paramlist.size());
+
+	if (fi->second.stub)
 	{
-	    if (fi->second.arguments == 0 && paramlist.size() != 0)
-	    {
-		throw(BadFunctionCallException(std::string("Function ") + funcname + "() does not take any parameter."));
-	    }
-	    else if (fi->second.arguments == 1 && paramlist.size() != 1)
-	    {
-		throw(BadFunctionCallException(std::string("Function ") + funcname + "() takes exactly one parameter."));
-	    }
-	    else if (static_cast<unsigned int>(fi->second.arguments) != paramlist.size())
-	    {
-		std::ostringstream oss;
-		oss << "Function " << funcname << "() takes exactly " << fi->second.arguments << " parameters.";
-		throw(BadFunctionCallException(oss.str()));
-	    }
+	    return fi->second.stub(fi->second.nativefunc,
+				   paramlist.empty() ? NULL : &paramlist[0]);
 	}
+
 	return fi->second.func(paramlist);
     }
 
     throw(UnknownSymbolException(std::string("Unknown function ") + funcname + "()"));
 }
 
+bool BasicSymbolTable::bindFunction(const std::string &_funcname, unsigned int paramnum,
+				    FunctionBinding &binding) const
+{
+    std::string funcname = _funcname;
+    std::transform(funcname.begin(), funcname.end(), funcname.begin(), toupper);
+
+    functionmap_type::const_iterator fi = functionmap.find(funcname);
+
+    if (fi == functionmap.end()) return false;
+
+    checkArguments(funcname, fi->second.arguments, paramnum);
+
+    binding = FunctionBinding(fi->second.func, fi->second.stub, fi->second.nativefunc,
+			      fi->second.pure);
+    return true;
+}
+
+void BasicSymbolTable::checkArguments(const std::string &funcname, int arguments,
+				      unsigned int paramnum)
+{
+    if (arguments < 0) return;
+
+    if (arguments == 0 && paramnum != 0)
+    {
+	throw(BadFunctionCallException(std::string("Function ") + funcname + "() does not take any parameter."));
+    }
+    else if (arguments == 1 && paramnum != 1)
+    {
+	throw(BadFunctionCallException(std::string("Function ") + funcname + "() takes exactly one parameter."));
+    }
+    else if (static_cast<unsigned int>(arguments) != paramnum)
+    {
+	std::ostringstream oss;
+	oss << "Function " << funcname << "() takes exactly " << arguments << " parameters.";
+	throw(BadFunctionCallException(oss.str()));
+    }
+}
+
 } // namespace stx
@@ -31,10 +31,19 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
+#include <iosfwd>
+#include <new>
 #include <assert.h>
 #include <boost/smart_ptr.hpp>
+#include <boost/version.hpp>
 #include "AnyScalar.h"
 
+// ParseTree uses the aliasing constructor of boost::shared_ptr
+#if BOOST_VERSION < 103500
+#error "The STX Expression Parser requires Boost 1.35 or newer."
+#endif
+
 /// STX - Some Template Extensions namespace
 namespace stx {
 
@@ -119,6 +128,42 @@ public:
     /// STL container type used for parameter lists: a vector
     typedef std::vector<AnyScalar>	paramlist_type;
 
+    /// Signature of a function used in the symbol table.
+    typedef AnyScalar	(*functionptr_type)(const paramlist_type& paramlist);
+
+    /// Generic function pointer type used to store typed native functions.
+    typedef void	(*genericfunc_type)();
+
+    /// Signature of the stub which converts the arguments and calls a typed
+    /// native function. See NativeFunction.
+    typedef AnyScalar	(*nativestub_type)(genericfunc_type func, const AnyScalar *args);
+
+    /// A function resolved by bindFunction(): either a function taking a
+    /// parameter list or a typed native function called via its stub.
+    struct FunctionBinding
+    {
+	/// Function called with a parameter list, or NULL.
+	functionptr_type	func;
+
+	/// Stub calling the native function with the argument array, or NULL.
+	nativestub_type		stub;
+
+	/// Typed native function pointer passed to the stub.
+	genericfunc_type	nativefunc;
+
+	/// True if the function is pure: its result depends only on the
+	/// arguments and it has no side effects.
+	bool			pure;
+
+	/// Initializing Constructor
+	FunctionBinding(functionptr_type _func = NULL,
+			nativestub_type _stub = NULL, genericfunc_type _nativefunc = NULL,
+			bool _pure = false)
+	    : func(_func), stub(_stub), nativefunc(_nativefunc), pure(_pure)
+	{
+	}
+    };
+
     /// Required for virtual functions.
     virtual ~SymbolTable();
 
@@ -129,6 +174,158 @@ public:
     /// expression.
     virtual AnyScalar	processFunction(const std::string &funcname,
 					const paramlist_type &paramlist) const = 0;
+
+    /// Called when a ParseProgram is bound to the symbol table: resolve the
+    /// function to a pointer which can be called directly, bypassing
+    /// processFunction(). Returns false if the function cannot be resolved
+    /// and must be called via processFunction() during evaluation. Throws
+    /// BadFunctionCallException if the number of parameters does not match.
+    /// This default implementation resolves no functions.
+    virtual bool	bindFunction(const std::string &funcname, unsigned int paramnum,
+				     FunctionBinding &binding) const;
+};
+
+/** Conversion of AnyScalar values to the argument types of typed native
+ * functions. Only the specializations below are defined, other argument
+ * types fail to compile. */
+template <typename Type>
+struct NativeArgument;
+
+/// Convert an AnyScalar argument to a bool parameter.
+template <>
+struct NativeArgument<bool>
+{
+    static inline bool get(const AnyScalar &a) { return a.getBoolean(); }
+};
+
+/// Convert an AnyScalar argument to an int parameter.
+template <>
+struct NativeArgument<int>
+{
+    static inline int get(const AnyScalar &a) { return a.getInteger(); }
+};
+
+/// Convert an AnyScalar argument to an unsigned int parameter.
+template <>
+struct NativeArgument<unsigned int>
+{
+    static inline unsigned int get(const AnyScalar &a) { return a.getUnsignedInteger(); }
+};
+
+/// Convert an AnyScalar argument to a long long parameter.
+template <>
+struct NativeArgument<long long>
+{
+    static inline long long get(const AnyScalar &a) { return a.getLong(); }
+};
+
+/// Convert an AnyScalar argument to an unsigned long long parameter.
+template <>
+struct NativeArgument<unsigned long long>
+{
+    static inline unsigned long long get(const AnyScalar &a) { return a.getUnsignedLong(); }
+};
+
+/// Convert an AnyScalar argument to a float parameter.
+template <>
+struct NativeArgument<float>
+{
+    static inline float get(const AnyScalar &a) { return static_cast<float>(a.getDouble()); }
+};
+
+/// Convert an AnyScalar argument to a double parameter.
+template <>
+struct NativeArgument<double>
+{
+    static inline double get(const AnyScalar &a) { return a.getDouble(); }
+};
+
+/// Convert an AnyScalar argument to a std::string parameter.
+template <>
+struct NativeArgument<std::string>
+{
+    static inline std::string get(const AnyScalar &a) { return a.getString(); }
+};
+
+/// Convert an AnyScalar argument to a const std::string& parameter.
+template <>
+struct NativeArgument<const std::string&>
+{
+    static inline std::string get(const AnyScalar &a) { return a.getString(); }
+};
+
+/** Calling stubs for typed native functions with up to four parameters. The
+ * template is specialized for function types like double(double): arguments
+ * is the number of parameters and call() converts the arguments using
+ * NativeArgument, calls the function and returns the result as an
+ * AnyScalar. */
+template <typename Signature>
+struct NativeFunction;
+
+/// Calling stub for native functions without parameters.
+template <typename R>
+struct NativeFunction<R()>
+{
+    enum { arguments = 0 };
+
+    static AnyScalar call(SymbolTable::genericfunc_type func, const AnyScalar *)
+    {
+	return AnyScalar( reinterpret_cast<R (*)()>(func)() );
+    }
+};
+
+/// Calling stub for native functions with one parameter.
+template <typename R, typename A1>
+struct NativeFunction<R(A1)>
+{
+    enum { arguments = 1 };
+
+    static AnyScalar call(SymbolTable::genericfunc_type func, const AnyScalar *args)
+    {
+	return AnyScalar( reinterpret_cast<R (*)(A1)>(func)(NativeArgument<A1>::get(args[0])) );
+    }
+};
+
+/// Calling stub for native functions with two parameters.
+template <typename R, typename A1, typename A2>
+struct NativeFunction<R(A1,A2)>
+{
+    enum { arguments = 2 };
+
+    static AnyScalar call(SymbolTable::genericfunc_type func, const AnyScalar *args)
+    {
+	return AnyScalar( reinterpret_cast<R (*)(A1,A2)>(func)(NativeArgument<A1>::get(args[0]),
+							       NativeArgument<A2>::get(args[1])) );
+    }
+};
+
+/// Calling stub for native functions with three parameters.
+template <typename R, typename A1, typename A2, typename A3>
+struct NativeFunction<R(A1,A2,A3)>
+{
+    enum { arguments = 3 };
+
+    static AnyScalar call(SymbolTable::genericfunc_type func, const AnyScalar *args)
+    {
+	return AnyScalar( reinterpret_cast<R (*)(A1,A2,A3)>(func)(NativeArgument<A1>::get(args[0]),
+								  NativeArgument<A2>::get(args[1]),
+								  NativeArgument<A3>::get(args[2])) );
+    }
+};
+
+/// Calling stub for native functions with four parameters.
+template <typename R, typename A1, typename A2, typename A3, typename A4>
+struct NativeFunction<R(A1,A2,A3,A4)>
+{
+    enum { arguments = 4 };
+
+    static AnyScalar call(SymbolTable::genericfunc_type func, const AnyScalar *args)
+    {
+	return AnyScalar( reinterpret_cast<R (*)(A1,A2,A3,A4)>(func)(NativeArgument<A1>::get(args[0]),
+								     NativeArgument<A2>::get(args[1]),
+								     NativeArgument<A3>::get(args[2]),
+								     NativeArgument<A4>::get(args[3])) );
+    }
 };
 
 /** Concrete class used for evaluation of variables and function placeholders
@@ -162,10 +359,6 @@ public:
  */
 class BasicSymbolTable : public SymbolTable
 {
-public:
-    /// Signature of a function used in the symbol table.
-    typedef AnyScalar	(*functionptr_type)(const paramlist_type& paramlist);
-
 protected:
 
     /// Container used to save a map of variable names
@@ -178,12 +371,24 @@ protected:
 	/// number of -1 for no checking.
 	int		arguments;
 
-	/// Function pointer to call.
+	/// Function pointer to call, or NULL for a typed native function.
 	functionptr_type func;
 
+	/// Stub calling the typed native function.
+	nativestub_type	stub;
+
+	/// Typed native function pointer passed to the stub.
+	genericfunc_type nativefunc;
+
+	/// True if the function is pure.
+	bool		pure;
+
 	/// Initializing Constructor
-	FunctionInfo(int _arguments = 0, functionptr_type _func = NULL)
-	    : arguments(_arguments), func(_func)
+	FunctionInfo(int _arguments = 0, functionptr_type _func = NULL,
+		     nativestub_type _stub = NULL, genericfunc_type _nativefunc = NULL,
+		     bool _pure = false)
+	    : arguments(_arguments), func(_func), stub(_stub), nativefunc(_nativefunc),
+	      pure(_pure)
 	{
 	}
     };
@@ -198,6 +403,15 @@ private:
     /// Function map used to lookup standard or user-added function
     functionmap_type	functionmap;
 
+    /// Throws BadFunctionCallException if paramnum does not match the
+    /// number of arguments of the function.
+    static void		checkArguments(const std::string &funcname, int arguments,
+				       unsigned int paramnum);
+
+    /// Add or replace a typed native function called via a stub.
+    void	setNativeFunction(const std::string& funcname, int arguments,
+				  nativestub_type stub, genericfunc_type nativefunc, bool pure);
+
 protected:
     // *** Lots of Standard Functions
 
@@ -244,11 +458,34 @@ public:
     virtual AnyScalar	processFunction(const std::string &funcname,
 					const paramlist_type &paramlist) const;
 
-    /// Add or replace a variable to the symbol table
+    /// Resolve a function of the function map for a bound ParseProgram and
+    /// check the number of parameters. Derived classes which override
+    /// processFunction() for names in the function map must also override
+    /// this function.
+    virtual bool	bindFunction(const std::string &funcname, unsigned int paramnum,
+				     FunctionBinding &binding) const;
+
+    /// Add or replace a variable to the symbol table. A referenced string
+    /// value is copied into the table.
     void	setVariable(const std::string& varname, const AnyScalar &value);
 
-    /// Add or replace a function to the symbol table
-    void	setFunction(const std::string& funcname, int arguments, functionptr_type funcptr);
+    /// Add or replace a function to the symbol table. A pure function's
+    /// result depends only on its arguments and it has no side effects, so
+    /// ParseTree::optimize() may fold or memoize its calls.
+    void	setFunction(const std::string& funcname, int arguments, functionptr_type funcptr,
+			    bool pure = false);
+
+    /// Add or replace a typed native function to the symbol table, for
+    /// example setFunction<double(double)>("SIN", ::sin). The arguments are
+    /// converted using NativeArgument and the function is called directly,
+    /// without building a parameter list.
+    template <typename Signature>
+    void	setFunction(const std::string& funcname, Signature *funcptr, bool pure = false)
+    {
+	setNativeFunction(funcname, NativeFunction<Signature>::arguments,
+			  &NativeFunction<Signature>::call,
+			  reinterpret_cast<genericfunc_type>(funcptr), pure);
+    }
 
     /// Clear variables table
     void	clearVariables();
@@ -256,7 +493,7 @@ public:
     /// Clear function table
     void	clearFunctions();
 
-    /// Add set of standard mathematic functions
+    /// Add set of standard mathematic functions, which are all pure.
     void	addStandardFunctions();
 };
 
@@ -278,8 +515,8 @@ protected:
     ParseNode& operator=(const ParseNode &pn);
     
 public:
-    /// Virtual destructor so derived classes can deallocate their children
-    /// nodes.
+    /// Virtual destructor called by the ParseArena. Children nodes are
+    /// destroyed by the arena, not by their parent.
     virtual ~ParseNode()
     {
     }
@@ -297,29 +534,954 @@ public:
 
     /// Return the parsed expression as a string, which can be parsed again.
     virtual std::string toString() const = 0;
+
+    /// (Internal) Function to lower the subtree into the flat instruction
+    /// sequence of a ParseProgram. The default implementation emits a single
+    /// instruction which calls evaluate() of this node.
+    virtual void compile(class ParseProgram &prog) const;
+
+    /// (Internal) Function to flatten a chain of equal logic operators into
+    /// the list of its operands. Returns the ParseProgram::chain_t of the
+    /// chain, the default implementation returns CHAIN_NONE.
+    virtual int flattenChain(std::vector<const ParseNode*> &operands) const;
+
+    /// (Internal) Function to recursively evaluate the subtree for all rows of
+    /// the batch, putting the values into the dest column. The default
+    /// implementation calls evaluate() for each row.
+    virtual void evaluateBatch(const class ColumnBatch &batch, const class SymbolTable &st,
+			       class BatchColumn &dest) const;
+
+    /// (Internal) Function to recursively evaluate the subtree as a filter:
+    /// the selection contains the candidate rows of the batch in increasing
+    /// order, and only those for which the subtree is true are kept. The
+    /// default implementation evaluates the subtree for the selected rows
+    /// and throws BadSyntaxException if it is not of type bool.
+    virtual void evaluateSelection(const class ColumnBatch &batch, const class SymbolTable &st,
+				   std::vector<unsigned int> &selection) const;
+
+    /// (Internal) Function to recreate the subtree in the optimizer's arena,
+    /// applying the algebraic rewrites of ParseTree::optimize() bottom-up.
+    virtual ParseNode* optimize(class ParseOptimizer &po) const = 0;
+
+    /// (Internal) Function to recognize a predicate comparing a variable with
+    /// a constant for the ExpressionIndex. Returns true and sets varname, op
+    /// and value if the node is equivalent to "varname op value", op being
+    /// one of the comparison opcodes of ParseProgram. The default
+    /// implementation returns false.
+    virtual bool getPredicate(std::string &varname, int &op, AnyScalar &value) const;
+
+    /// (Internal) Function to recursively insert the names of all variables
+    /// referenced by the subtree into the set. The default implementation
+    /// inserts nothing.
+    virtual void getVariables(std::set<std::string> &varset) const;
+
+    /// (Internal) Function to recognize a function call node. Returns true and
+    /// sets the function name and the parameter subtrees if the node is a
+    /// call. The default implementation returns false.
+    virtual bool getFunctionCall(std::string &funcname, std::vector<const ParseNode*> &params) const;
+};
+
+/** ParseProgram is the compiled form of a ParseTree: the tree is lowered into
+ * one contiguous array of instructions and a constant pool, which are executed
+ * by a small stack machine. Evaluating a program yields exactly the same
+ * results as evaluating the tree, but avoids the virtual calls and AnyScalar
+ * return values of each node. The value stack is preallocated when the program
+ * is compiled, so each ParseProgram object must be used by only one thread at
+ * a time. Copies of a program share the instructions, but not the stack.
+ *
+ * A program can additionally be bound to a schema mapping variable names to
+ * slot indexes. The bound variables are then read directly from an array of
+ * AnyScalar values passed to evaluate(), which avoids all string handling and
+ * symbol table lookups for them during evaluation. Likewise functions can be
+ * bound to a symbol table, which resolves them to function pointers and checks
+ * the number of parameters once.
+ *
+ * AND and OR are evaluated short-circuit. If the program is a chain of AND or
+ * OR operators, it can additionally be switched into an adaptive mode using
+ * setAdaptive(): the operands of the chain are then evaluated in an order
+ * which is periodically rearranged using runtime statistics of each operand,
+ * so that cheap operands which most often decide the result run first.
+ */
+class ParseProgram
+{
+public:
+    /// Enumeration of the operation codes of the stack machine.
+    enum opcode_t
+    {
+	/// Push the constant pool entry arg onto the stack.
+	OP_PUSH_CONST,
+	/// Push the value of variable name arg from the symbol table.
+	OP_PUSH_VAR,
+	/// Push the value of slot arg of the slot array. arg2 is the variable
+	/// name, which is looked up if no slot array is given.
+	OP_PUSH_SLOT,
+	/// Call function name arg with the top arg2 stack values.
+	OP_CALL,
+	/// Call bound function arg with a parameter list of the top arg2 values.
+	OP_CALL_FUNC,
+	/// Call bound native function arg with the top arg2 values.
+	OP_CALL_NATIVE,
+	/// Evaluate the parse node arg using its evaluate() function.
+	OP_EVAL_NODE,
+
+	/// Unary minus of the top value.
+	OP_NEG,
+	/// Boolean negation of the top value, which must be a bool.
+	OP_NOT,
+	/// Convert the top value into the AnyScalar type arg.
+	OP_CAST,
+
+	/// Binary arithmetic operators on the two top values.
+	OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_POW,
+
+	/// Binary comparison operators on the two top values.
+	OP_EQUAL, OP_NOTEQUAL, OP_LESS, OP_GREATER, OP_LESSEQUAL, OP_GREATEREQUAL,
+
+	/// Short-circuit AND: if the top value is false, keep it and jump to
+	/// arg, otherwise pop it. The value must be a bool.
+	OP_JUMP_FALSE,
+	/// Short-circuit OR: if the top value is true, keep it and jump to
+	/// arg, otherwise pop it. The value must be a bool.
+	OP_JUMP_TRUE,
+	/// Check that the top value, the right operand of && (arg = 0) or ||
+	/// (arg = 1), is a bool.
+	OP_TEST_BOOL
+    };
+
+    /// Type of logic operator chain found at the root of the program.
+    enum chain_t
+    {
+	CHAIN_NONE, CHAIN_AND, CHAIN_OR
+    };
+
+    /// One instruction of the program: the opcode and up to two arguments.
+    struct Instruction
+    {
+	/// Operation to perform, one of opcode_t.
+	unsigned short	opcode;
+
+	/// Second argument: the number of parameters of the OP_CALL
+	/// instructions or the name index of OP_PUSH_SLOT.
+	unsigned short	arg2;
+
+	/// First argument: index into the constant pool, the name table, the
+	/// node table, the function table or the slot array, the type to cast
+	/// to, the jump target or the operator of OP_TEST_BOOL.
+	unsigned int	arg;
+    };
+
+    /// Array type holding the instruction sequence.
+    typedef std::vector<Instruction>	code_type;
+
+    /// Schema type used to bind variable names to slot indexes.
+    typedef std::map<std::string, unsigned int>	slotmap_type;
+
+    /// Runtime statistics of one operand of an adaptively evaluated AND/OR
+    /// chain, returned by getChainStats().
+    struct OperandStats
+    {
+	/// String representation of the operand.
+	std::string		expression;
+
+	/// Current position of the operand in the evaluation order.
+	unsigned int		position;
+
+	/// Number of times the operand was evaluated.
+	unsigned long long	evaluations;
+
+	/// Number of times the operand decided the result of the chain: it was
+	/// false in an AND chain or true in an OR chain.
+	unsigned long long	decisions;
+
+	/// Average measured evaluation time of the operand in nanoseconds.
+	double			cost;
+    };
+
+private:
+    /// A function resolved by bindFunctions().
+    struct BoundFunction
+    {
+	/// Index of the function's name in the name table.
+	unsigned int			nameidx;
+
+	/// Function pointers returned by the symbol table.
+	SymbolTable::FunctionBinding	binding;
+    };
+
+    /// The shared immutable part of a compiled program.
+    struct Code
+    {
+	/// Flat instruction sequence in evaluation order.
+	code_type			code;
+
+	/// Constant pool referenced by OP_PUSH_CONST.
+	std::vector<AnyScalar>		constants;
+
+	/// Variable and function names referenced by OP_PUSH_VAR and OP_CALL.
+	std::vector<std::string>	names;
+
+	/// Parse nodes referenced by OP_EVAL_NODE.
+	std::vector<const ParseNode*>	nodes;
+
+	/// Sorted list of slot indexes referenced by OP_PUSH_SLOT.
+	std::vector<unsigned int>	slots;
+
+	/// Functions referenced by OP_CALL_FUNC and OP_CALL_NATIVE.
+	std::vector<BoundFunction>	functions;
+
+	/// Length of the main instruction sequence. It is followed by the
+	/// separately compiled operands of the root chain.
+	unsigned int			mainsize;
+
+	/// Type of logic chain at the root.
+	chain_t				chain;
+
+	/// Instruction range [first,second) of each root chain operand.
+	std::vector< std::pair<unsigned int, unsigned int> > operands;
+
+	/// String representation of each root chain operand.
+	std::vector<std::string>	operandstrs;
+
+	/// Maximum stack depth required by the code.
+	unsigned int			maxstack;
+
+	/// Current stack depth while emitting the code.
+	unsigned int			curstack;
+
+	/// Keeps the parse nodes referenced by OP_EVAL_NODE alive.
+	boost::shared_ptr<ParseNode>	rootnode;
+    };
+
+    /// Shared immutable instructions and constants of the program.
+    boost::shared_ptr<Code>		code;
+
+    /// Preallocated value stack of the machine.
+    mutable std::vector<AnyScalar>	stack;
+
+    /// Reused parameter list passed to SymbolTable::processFunction().
+    mutable std::vector<AnyScalar>	paramlist;
+
+    /// Runtime counters of a root chain operand in adaptive mode.
+    struct OperandCounter
+    {
+	/// Number of evaluations and decisions of the operand.
+	unsigned long long	evaluations, decisions;
+
+	/// Number of timed evaluations and their total time in nanoseconds.
+	unsigned long long	samples, time;
+    };
+
+    /// Number of evaluations between reordering the chain operands, zero if
+    /// adaptive mode is disabled.
+    unsigned int			adaptinterval;
+
+    /// Number of evaluations in adaptive mode.
+    mutable unsigned long long		adaptcount;
+
+    /// Current evaluation order of the root chain operands.
+    mutable std::vector<unsigned int>	adaptorder;
+
+    /// Runtime counters of the root chain operands.
+    mutable std::vector<OperandCounter>	adaptcounter;
+
+    /// Append an instruction and track the stack depth changes.
+    void	emit(opcode_t op, unsigned int arg, unsigned int arg2, int stackdelta);
+
+    /// Execute the instructions [begin,end) on the value stack and return
+    /// the new stack top.
+    AnyScalar*	execute(unsigned int begin, unsigned int end, AnyScalar *sp,
+			const AnyScalar *slots, const class SymbolTable &st) const;
+
+    /// Evaluate the root chain operands in adaptive order.
+    AnyScalar	evaluateAdaptive(const AnyScalar *slots, const class SymbolTable &st) const;
+
+    /// Rearrange the adaptive evaluation order using the counters.
+    void	reorderAdaptive() const;
+
+public:
+    /// Create an empty program. It must be assigned before evaluating it.
+    ParseProgram();
+
+    /// Compile a program from the given root node. The root node is referenced
+    /// for the lifetime of the program.
+    explicit ParseProgram(const boost::shared_ptr<ParseNode> &rootnode);
+
+    /// Copy the program: the code is shared but a new value stack allocated.
+    ParseProgram(const ParseProgram &p);
+
+    /// Assign the program: the code is shared but a new value stack allocated.
+    ParseProgram& operator=(const ParseProgram &p);
+
+    /// Returns true if this object does not contain a program.
+    inline bool	isEmpty() const
+    {
+	return (code.get() == NULL);
+    }
+
+    /// Execute the instructions and return the calculated value based on the
+    /// given symbol table.
+    AnyScalar	evaluate(const class SymbolTable &st = BasicSymbolTable()) const;
+
+    /// Execute the instructions and return the calculated value. Bound
+    /// variables are read from the slots array, all others are looked up in
+    /// the symbol table. If slots is NULL, all variables are looked up.
+    AnyScalar	evaluate(const AnyScalar *slots, const class SymbolTable &st = BasicSymbolTable()) const;
+
+    /// Bind all variables of the program, whose names are found in the
+    /// schema, to the given slot index. Variables not found in the schema
+    /// remain symbol table lookups. A program may be rebound to another
+    /// schema, copies of the program are not affected. Returns the number of
+    /// variable references bound.
+    unsigned int bindVariables(const slotmap_type &schema);
+
+    /// Resolve all function calls of the program, which the symbol table can
+    /// bind, to direct function pointer calls. The number of parameters is
+    /// checked here instead of during each evaluation, so this throws
+    /// BadFunctionCallException on a mismatch. Functions not resolved by the
+    /// symbol table remain calls to SymbolTable::processFunction(). Returns
+    /// the number of calls bound.
+    unsigned int bindFunctions(const class SymbolTable &st);
+
+    /// Return the type of logic operator chain at the root of the program.
+    inline chain_t getChain() const
+    {
+	assert(code.get() != NULL);
+	return code->chain;
+    }
+
+    /// Enable adaptive reordering of the root chain operands: every interval
+    /// evaluations the operands are sorted by their average cost divided by
+    /// the fraction of evaluations they decided. Evaluations throwing an
+    /// exception count as not deciding, and operands whose cost was not yet
+    /// measured stay behind the measured ones. Because of the reordering,
+    /// an exception thrown by one operand may be skipped or raised in
+    /// different evaluations than in the fixed left-to-right order. An
+    /// interval of zero disables adaptive mode. Has no effect on programs
+    /// without a root chain.
+    void	setAdaptive(unsigned int interval = 1024);
+
+    /// Returns true if adaptive mode is enabled and the program has a root
+    /// chain.
+    inline bool	isAdaptive() const
+    {
+	return adaptinterval != 0 && code.get() && code->chain != CHAIN_NONE;
+    }
+
+    /// Return the runtime statistics of the root chain operands in their
+    /// original order. Statistics are only gathered in adaptive mode.
+    std::vector<OperandStats> getChainStats() const;
+
+    /// Return the sorted list of slot indexes read by evaluate(). Only these
+    /// entries of the slot array need to be filled.
+    inline const std::vector<unsigned int>& getBoundSlots() const
+    {
+	assert(code.get() != NULL);
+	return code->slots;
+    }
+
+    /// Return the instruction sequence.
+    inline const code_type& getCode() const
+    {
+	assert(code.get() != NULL);
+	return code->code;
+    }
+
+    /// Return a human-readable listing of the instructions and constants.
+    std::string	toString() const;
+
+    // *** Functions called by ParseNode::compile() to emit the instructions
+
+    /// (Internal) Emit instruction to push a constant value.
+    void	emitConstant(const AnyScalar &value);
+
+    /// (Internal) Emit instruction to push a variable's value.
+    void	emitVariable(const std::string &varname);
+
+    /// (Internal) Emit instruction to call a function with the given number
+    /// of parameters, which were emitted before.
+    void	emitFunction(const std::string &funcname, unsigned int paramnum);
+
+    /// (Internal) Emit instruction to evaluate a parse node via its virtual
+    /// evaluate() function.
+    void	emitNode(const ParseNode *node);
+
+    /// (Internal) Emit an unary operator applied to the top value.
+    void	emitUnary(opcode_t op, unsigned int arg = 0);
+
+    /// (Internal) Emit a binary operator applied to the two top values.
+    void	emitBinary(opcode_t op);
+
+    /// (Internal) Emit a short-circuit jump instruction, the target is set
+    /// later by patchJump(). Returns the instruction's index.
+    unsigned int emitJump(opcode_t op);
+
+    /// (Internal) Set the target of the jump at index to the next
+    /// instruction emitted.
+    void	patchJump(unsigned int index);
 };
 
-/** ParseTree contains the root node of a parse tree. It correctly allocates
- * and deletes parse node, because they themselves are not copy-constructable
- * or assignable. Pimpl class pattern with exposed inner class. */
+/** ColumnBatch describes a batch of rows stored column-wise: a set of typed
+ * column arrays of equal length, keyed by variable name, which are evaluated
+ * all at once by ParseTree::evaluateBatch(). The batch does not copy or own
+ * the arrays, they must stay valid while it is used. Integer columns appear
+ * as AnyScalar integer or long values, double columns as doubles and string
+ * columns as plain strings without automatic type recognition. Variables
+ * without a column are looked up once per batch in the symbol table.
+ *
+ * A batch can also be a selection of the rows of another batch, which shares
+ * its columns. The selected rows are copied when the columns are loaded for
+ * evaluation. This is used to evaluate the later operands of AND and OR only
+ * for the rows they can still decide. */
+class ColumnBatch
+{
+public:
+    /// Enumeration of the element types of a column array.
+    enum coltype_t
+    {
+	/// Boolean values stored as unsigned char 0 or 1.
+	COLUMN_BOOL,
+	/// 32 bit signed int values.
+	COLUMN_INT32,
+	/// 64 bit signed long long values.
+	COLUMN_INT64,
+	/// float values.
+	COLUMN_FLOAT,
+	/// double values.
+	COLUMN_DOUBLE,
+	/// std::string values.
+	COLUMN_STRING,
+	/// AnyScalar values of any other or mixed type.
+	COLUMN_ANY
+    };
+
+    /// Typed pointer to the first element of a column array.
+    struct Column
+    {
+	/// Element type of the array.
+	coltype_t	type;
+
+	/// Pointer to the first element.
+	const void*	data;
+    };
+
+    /// Type of the map of columns by variable name.
+    typedef std::map<std::string, Column>	columnmap_type;
+
+private:
+    /// Number of rows in each column.
+    unsigned int	rows;
+
+    /// Columns of the batch.
+    columnmap_type	columns;
+
+    /// True if the batch contains only the selected rows of the columns.
+    bool		hasselection;
+
+    /// Indexes of the selected rows in the column arrays.
+    std::vector<unsigned int>	selection;
+
+    /// Add or replace a column.
+    void	addColumn(const std::string &varname, coltype_t type, const void *data);
+
+public:
+    /// Create a batch of the given number of rows without columns.
+    explicit ColumnBatch(unsigned int _rows = 0)
+	: rows(_rows), hasselection(false)
+    {
+    }
+
+    /// Create a batch containing the selected rows of another batch, which
+    /// must be given in increasing order. The columns are shared with the
+    /// other batch.
+    ColumnBatch(const ColumnBatch &batch, const std::vector<unsigned int> &selection);
+
+    /// Return the number of rows in the batch.
+    inline unsigned int size() const
+    {
+	return rows;
+    }
+
+    /// Change the number of rows, the column arrays must be at least that
+    /// long.
+    inline void	resize(unsigned int _rows)
+    {
+	rows = _rows;
+    }
+
+    /// Remove all columns.
+    inline void	clear()
+    {
+	columns.clear();
+    }
+
+    /// Add an int column for the variable name.
+    void	addColumn(const std::string &varname, const int *data);
+
+    /// Add a long long column for the variable name.
+    void	addColumn(const std::string &varname, const long long *data);
+
+    /// Add a float column for the variable name.
+    void	addColumn(const std::string &varname, const float *data);
+
+    /// Add a double column for the variable name.
+    void	addColumn(const std::string &varname, const double *data);
+
+    /// Add a string column for the variable name.
+    void	addColumn(const std::string &varname, const std::string *data);
+
+    /// Add the array of a non-constant BatchColumn for the variable name. This
+    /// can be used to pack AnyScalar values into typed columns via
+    /// BatchColumn::setValues().
+    void	addColumn(const std::string &varname, const class BatchColumn &column);
+
+    /// Return the column for the variable name or NULL if it has none.
+    const Column* findColumn(const std::string &varname) const;
+
+    /// Return true if the batch is a selection of the column rows.
+    inline bool	isSelection() const
+    {
+	return hasselection;
+    }
+
+    /// Return the index in the column arrays of a row of the batch.
+    inline unsigned int getRow(unsigned int row) const
+    {
+	return hasselection ? selection[row] : row;
+    }
+
+    /// (Internal) Put the rows of the batch of a column into dest: either a
+    /// view of the array or a copy of the selected rows.
+    void	loadColumn(const Column &col, class BatchColumn &dest) const;
+
+    /// Return the value of one row of a column array as an AnyScalar.
+    static AnyScalar	getValue(const Column &col, unsigned int row);
+};
+
+/** BatchColumn holds the values of one expression node for all rows of a
+ * ColumnBatch. The values are stored in a typed array, so that the operators
+ * can process whole columns in tight loops instead of one AnyScalar per
+ * row. The array is either owned by the object or a view of a column of the
+ * batch. A constant column holds only a single value, which applies to all
+ * rows. Columns are not copyable, but can be swapped.
+ *
+ * The arithmetic and comparison operators on numeric columns are processed by
+ * kernels using the SIMD instructions of the processor, which is queried via
+ * cpuid at startup. The kernels yield bit-identical results to the AnyScalar
+ * operators. */
+class BatchColumn
+{
+public:
+    /// Type of the column array, the same as in ColumnBatch.
+    typedef ColumnBatch::coltype_t	coltype_t;
+
+    /// Enumeration of the SIMD instruction sets used by the kernels.
+    enum simd_t
+    {
+	/// Plain C++ kernels.
+	SIMD_NONE,
+	/// 128 bit SSE up to SSE 4.2.
+	SIMD_SSE42,
+	/// 256 bit AVX2.
+	SIMD_AVX2,
+	/// 512 bit AVX-512 foundation and doubleword/quadword instructions.
+	SIMD_AVX512
+    };
+
+private:
+    /// Element type of the column.
+    coltype_t		type;
+
+    /// Number of rows represented.
+    unsigned int	rows;
+
+    /// True if the column holds only one value for all rows.
+    bool		constant;
+
+    /// Pointer to the array holding the values, either one of the vectors
+    /// below or a column of the batch.
+    const void*		data;
+
+    /// Storage for bool columns.
+    std::vector<unsigned char>	bools;
+
+    /// Storage for int columns.
+    std::vector<int>		ints;
+
+    /// Storage for long long columns.
+    std::vector<long long>	longs;
+
+    /// Storage for float columns.
+    std::vector<float>		floats;
+
+    /// Storage for double columns.
+    std::vector<double>		doubles;
+
+    /// Storage for string columns.
+    std::vector<std::string>	strings;
+
+    /// Storage for AnyScalar columns.
+    std::vector<AnyScalar>	values;
+
+    /// Disable copy construction
+    BatchColumn(const BatchColumn &bc);
+
+    /// And disable assignment
+    BatchColumn& operator=(const BatchColumn &bc);
+
+    /// Store the values in the typed array matching their common type, or in
+    /// the AnyScalar array if they differ.
+    void	storeValues(std::vector<AnyScalar> &values);
+
+public:
+    /// Create an empty bool column.
+    BatchColumn()
+	: type(ColumnBatch::COLUMN_BOOL), rows(0), constant(false), data(NULL)
+    {
+    }
+
+    /// Return the element type of the column.
+    inline coltype_t	getType() const
+    {
+	return type;
+    }
+
+    /// Return the number of rows represented by the column.
+    inline unsigned int	size() const
+    {
+	return rows;
+    }
+
+    /// Returns true if the column holds one value for all rows.
+    inline bool		isConstant() const
+    {
+	return constant;
+    }
+
+    /// Return the array of a bool column.
+    inline const unsigned char* getBools() const
+    {
+	assert(type == ColumnBatch::COLUMN_BOOL);
+	return static_cast<const unsigned char*>(data);
+    }
+
+    /// Return the array of an int column.
+    inline const int*	getInts() const
+    {
+	assert(type == ColumnBatch::COLUMN_INT32);
+	return static_cast<const int*>(data);
+    }
+
+    /// Return the array of a long long column.
+    inline const long long* getLongs() const
+    {
+	assert(type == ColumnBatch::COLUMN_INT64);
+	return static_cast<const long long*>(data);
+    }
+
+    /// Return the array of a float column.
+    inline const float*	getFloats() const
+    {
+	assert(type == ColumnBatch::COLUMN_FLOAT);
+	return static_cast<const float*>(data);
+    }
+
+    /// Return the array of a double column.
+    inline const double* getDoubles() const
+    {
+	assert(type == ColumnBatch::COLUMN_DOUBLE);
+	return static_cast<const double*>(data);
+    }
+
+    /// Return the array of a string column.
+    inline const std::string* getStrings() const
+    {
+	assert(type == ColumnBatch::COLUMN_STRING);
+	return static_cast<const std::string*>(data);
+    }
+
+    /// Return the array of an AnyScalar column.
+    inline const AnyScalar* getValues() const
+    {
+	assert(type == ColumnBatch::COLUMN_ANY);
+	return static_cast<const AnyScalar*>(data);
+    }
+
+    /// Return the value of one row as an AnyScalar.
+    AnyScalar	getValue(unsigned int row) const;
+
+    /// Exchange the contents of two columns.
+    void	swap(BatchColumn &bc);
+
+    // *** Functions used by ParseNode::evaluateBatch() to fill the column
+
+    /// (Internal) Make the column a view of an external array.
+    void	setView(coltype_t type, const void *data, unsigned int rows);
+
+    /// (Internal) Make the column a constant column of the value.
+    void	setConstant(const AnyScalar &value, unsigned int rows);
+
+    /// (Internal) Take over a vector of per-row values. If all values have
+    /// the same type which has a typed array, they are stored in it.
+    void	setValues(std::vector<AnyScalar> &values);
+
+    /// (Internal) Allocate a writable bool array of the column.
+    unsigned char*	initBools(unsigned int rows, bool constant = false);
+
+    /// (Internal) Allocate a writable int array of the column.
+    int*		initInts(unsigned int rows, bool constant = false);
+
+    /// (Internal) Allocate a writable long long array of the column.
+    long long*		initLongs(unsigned int rows, bool constant = false);
+
+    /// (Internal) Allocate a writable float array of the column.
+    float*		initFloats(unsigned int rows, bool constant = false);
+
+    /// (Internal) Allocate a writable double array of the column.
+    double*		initDoubles(unsigned int rows, bool constant = false);
+
+    /// (Internal) Allocate a writable string array of the column.
+    std::string*	initStrings(unsigned int rows, bool constant = false);
+
+    /// (Internal) Allocate a writable AnyScalar array of the column.
+    AnyScalar*		initValues(unsigned int rows, bool constant = false);
+
+    /// (Internal) Apply an unary operator: OP_NEG, OP_NOT or OP_CAST with the
+    /// target type in arg.
+    static void	applyUnary(ParseProgram::opcode_t op, unsigned int arg,
+			   const BatchColumn &a, BatchColumn &dest);
+
+    /// (Internal) Apply a binary arithmetic or comparison operator, OP_ADD up
+    /// to OP_GREATEREQUAL. Throws the same exceptions as the AnyScalar
+    /// operators for the first offending row.
+    static void	applyBinary(ParseProgram::opcode_t op,
+			    const BatchColumn &a, const BatchColumn &b, BatchColumn &dest);
+
+    /// (Internal) Combine two bool columns with && or ||.
+    static void	applyLogic(bool isand, const BatchColumn &a, const BatchColumn &b,
+			   BatchColumn &dest);
+
+    // *** Selection of the SIMD instruction set
+
+    /// Return the best instruction set supported by both the processor and
+    /// the compiled library.
+    static simd_t	detectSimd();
+
+    /// Return the instruction set currently used by the kernels.
+    static simd_t	getSimd();
+
+    /// Select the instruction set used by the kernels, it is limited to
+    /// detectSimd(). Returns the instruction set actually selected. This is
+    /// intended for tests and benchmarks and must not be called while other
+    /// threads evaluate batches.
+    static simd_t	setSimd(simd_t simd);
+
+    /// Return the name of an instruction set.
+    static const char*	getSimdName(simd_t simd);
+};
+
+/** ParseArena is a bump-pointer allocator holding all nodes of a parse tree
+ * in a few contiguous memory blocks. The nodes are laid out in the order they
+ * are created, which for the parser is the post-order the tree is evaluated
+ * in. The nodes do not delete their children, instead all nodes are destroyed
+ * and the blocks freed together with the arena. */
+class ParseArena
+{
+private:
+    /// Header of an allocated memory block, the data follows it.
+    struct Block
+    {
+	/// Previously allocated block.
+	Block*		next;
+
+	/// Size of the whole block including the header.
+	size_t		size;
+
+	/// Bytes of the block used, including the header.
+	size_t		used;
+    };
+
+    /// Header of each node created, linking the nodes for destruction.
+    struct Entry
+    {
+	/// Previously created node entry.
+	Entry*		prev;
+
+	/// The node following the entry.
+	ParseNode*	node;
+    };
+
+    /// Alignment of all allocations.
+    static const size_t	alignment = 2 * sizeof(double);
+
+    /// Size of the block and entry headers rounded up to the alignment.
+    static const size_t	blockheader = (sizeof(Block) + alignment - 1) & ~(alignment - 1);
+    static const size_t	entryheader = (sizeof(Entry) + alignment - 1) & ~(alignment - 1);
+
+    /// Maximum size of the blocks, which grow from the initial size.
+    static const size_t	maxblocksize = 16384;
+
+    /// The current block, which links to the previous ones.
+    Block*		block;
+
+    /// The last node entry created.
+    Entry*		last;
+
+    /// Size of the next block allocated.
+    size_t		nextsize;
+
+    /// Total size of all blocks.
+    size_t		memsize;
+
+    /// Link a constructed node for destruction.
+    template <typename Node>
+    inline Node*	link(Entry *e, Node *n)
+    {
+	e->prev = last;
+	e->node = n;
+	last = e;
+	return n;
+    }
+
+    /// Disable copy construction
+    ParseArena(const ParseArena &pa);
+
+    /// And disable assignment
+    ParseArena& operator=(const ParseArena &pa);
+
+public:
+    /// Position in the arena, up to which allocations can be released.
+    struct Mark
+    {
+	/// The current block at the time of the mark.
+	Block*		block;
+
+	/// The bytes used in it.
+	size_t		used;
+
+	/// The last node entry.
+	Entry*		last;
+    };
+
+    /// Create an empty arena, the first block will have the given size.
+    explicit ParseArena(size_t initialsize = 512);
+
+    /// Destroy all nodes in reverse order of creation and free the memory.
+    ~ParseArena();
+
+    /// Allocate uninitialized memory, which is freed with the arena.
+    void*	allocate(size_t size);
+
+    /// Construct a node with one parameter in the arena.
+    template <typename Node, typename A1>
+    inline Node*	create(const A1 &a1)
+    {
+	Entry *e = static_cast<Entry*>(allocate(entryheader + sizeof(Node)));
+	return link(e, new (reinterpret_cast<char*>(e) + entryheader) Node(a1));
+    }
+
+    /// Construct a node with two parameters in the arena.
+    template <typename Node, typename A1, typename A2>
+    inline Node*	create(const A1 &a1, const A2 &a2)
+    {
+	Entry *e = static_cast<Entry*>(allocate(entryheader + sizeof(Node)));
+	return link(e, new (reinterpret_cast<char*>(e) + entryheader) Node(a1, a2));
+    }
+
+    /// Construct a node with three parameters in the arena.
+    template <typename Node, typename A1, typename A2, typename A3>
+    inline Node*	create(const A1 &a1, const A2 &a2, const A3 &a3)
+    {
+	Entry *e = static_cast<Entry*>(allocate(entryheader + sizeof(Node)));
+	return link(e, new (reinterpret_cast<char*>(e) + entryheader) Node(a1, a2, a3));
+    }
+
+    /// Construct a node with four parameters in the arena.
+    template <typename Node, typename A1, typename A2, typename A3, typename A4>
+    inline Node*	create(const A1 &a1, const A2 &a2, const A3 &a3, const A4 &a4)
+    {
+	Entry *e = static_cast<Entry*>(allocate(entryheader + sizeof(Node)));
+	return link(e, new (reinterpret_cast<char*>(e) + entryheader) Node(a1, a2, a3, a4));
+    }
+
+    /// Return the current position in the arena.
+    Mark	mark() const;
+
+    /// Destroy all nodes created after the mark and release their memory for
+    /// reuse. Used to drop subtrees replaced by folded constants.
+    void	release(const Mark &m);
+
+    /// Return the total size of the memory blocks held by the arena.
+    inline size_t	getMemoryUsage() const
+    {
+	return memsize;
+    }
+};
+
+/** OptimizeOptions are the assumptions ParseTree::optimize() may make about
+ * the symbol table the optimized tree is evaluated with. Without any, only
+ * rewrites which are exact for values of all types are applied. */
+struct OptimizeOptions
+{
+    /// Types of variables: a variable listed here is assumed to be always
+    /// defined with a value of exactly this type.
+    std::map<std::string, AnyScalar::attrtype_t>	vartypes;
+
+    /// If true, the functions named like those of
+    /// BasicSymbolTable::addStandardFunctions() are assumed to be them.
+    bool	standardfunctions;
+
+    /// Symbol table whose pure functions are called at optimization time if
+    /// all arguments are constant. The optimized tree must be evaluated with
+    /// symbol tables defining the same functions.
+    const class SymbolTable *symboltable;
+
+    /// If not zero, calls of pure functions of the symbol table with
+    /// non-constant arguments are memoized, each call in its own cache of at
+    /// most this many argument lists.
+    unsigned int	memoize;
+
+    /// Default options: nothing is known about variables and functions.
+    OptimizeOptions()
+	: standardfunctions(false), symboltable(NULL), memoize(0)
+    {
+    }
+};
+
+/// Log of the rewrites applied by ParseTree::optimize(): the toString() of
+/// each rewritten subexpression before and after the rewrite.
+typedef std::vector< std::pair<std::string, std::string> > OptimizeLog;
+
+/** ParseTree contains the root node of a parse tree. The nodes are allocated
+ * in a ParseArena owned by the tree, because they themselves are not
+ * copy-constructable or assignable. Pimpl class pattern with exposed inner
+ * class. */
 class ParseTree
 {
 protected:
+    /// Arena holding all nodes of the tree.
+    boost::shared_ptr<ParseArena>	arena;
+
     /// Enclosed smart ptr so that the parse tree is not cloned when ParseTree
-    /// instances are copied.
+    /// instances are copied. It shares ownership of the arena, so compiled
+    /// programs referencing the root node keep the nodes alive.
     boost::shared_ptr<ParseNode>	rootnode;
 
+    /// The index decomposes the trees of its subscriptions.
+    friend class ExpressionIndex;
+
 public:
     /// Create NULL parse tree object from the root ParseNode. All functions
     /// will assert() or segfault unless the tree is assigned.
     ParseTree()
-	: rootnode(static_cast<ParseNode*>(NULL))
+	: arena(), rootnode()
     {
     }
 
-    /// Create parse tree object from the root ParseNode.
-    ParseTree(ParseNode* pt)
-	: rootnode(pt)
+    /// Create parse tree object from the root ParseNode allocated in the
+    /// arena. The root pointer shares ownership of the arena using the
+    /// aliasing constructor of boost::shared_ptr.
+    ParseTree(const boost::shared_ptr<ParseArena> &_arena, ParseNode* pt)
+	: arena(_arena), rootnode(_arena, pt)
     {
     }
 
@@ -343,12 +1505,93 @@ public:
 	assert(rootnode.get() != NULL);
 	return rootnode->toString();
     }
+
+    /// Return the names of all variables referenced by the expression. An
+    /// application can use this to read and convert only the data actually
+    /// needed to evaluate it.
+    std::set<std::string> getVariables() const
+    {
+	assert(rootnode.get() != NULL);
+	std::set<std::string> varset;
+	rootnode->getVariables(varset);
+	return varset;
+    }
+
+    /// Returns true if the expression is a function call "funcname(...)" and
+    /// sets the function name and the parse trees of the parameters, which
+    /// share the nodes of this tree. An application can use this to give
+    /// functions a special meaning, e.g. aggregate functions over many rows.
+    bool	getFunctionCall(std::string &funcname, std::vector<ParseTree> &params) const;
+
+    /// Split the expression at its top-level and-chain into the parse trees
+    /// of the operands, in the order they are evaluated, which share the
+    /// nodes of this tree. An expression which is not an and-chain is its
+    /// own single operand.
+    void	getConjuncts(std::vector<ParseTree> &operands) const;
+
+    /// Returns true if the expression compares a variable with a constant,
+    /// like x > 5 or "abc" == s, and sets varname, op and value so that it is
+    /// equivalent to "varname op value", op being one of the comparison
+    /// opcodes of ParseProgram. A bool variable x is the predicate
+    /// "x == true". An application can use this to answer the expression
+    /// from an index over the variable's values.
+    bool	getPredicate(std::string &varname, int &op, AnyScalar &value) const;
+
+    /// Return the size of the arena memory holding the tree's nodes in bytes.
+    inline size_t	getMemoryUsage() const
+    {
+	return arena ? arena->getMemoryUsage() : 0;
+    }
+
+    /// Compile the parse tree into a flat ParseProgram, which can be evaluated
+    /// repeatedly much faster than the tree itself.
+    ParseProgram	compile() const
+    {
+	assert(rootnode.get() != NULL);
+	return ParseProgram(rootnode);
+    }
+
+    /// Evaluate the expression for all rows of the batch at once, keeping the
+    /// intermediate values column-wise. The result column holds one value per
+    /// row, which may reference the batch's arrays. If any row throws an
+    /// exception, the batch is evaluated row by row, so that exactly the
+    /// exception of the first failing row is raised.
+    void	evaluateBatch(const ColumnBatch &batch, BatchColumn &result,
+			      const class SymbolTable &st = BasicSymbolTable()) const;
+
+    /// Evaluate the boolean expression for all rows of the batch and fill the
+    /// selection vector with the indexes of the rows for which it is
+    /// true. The later operands of AND are only evaluated for the rows still
+    /// selected and those of OR only for the rows not yet selected. Throws
+    /// BadSyntaxException if the result is not of type bool.
+    void	evaluateBatch(const ColumnBatch &batch, std::vector<unsigned int> &selection,
+			      const class SymbolTable &st = BasicSymbolTable()) const;
+
+    /// Return an optimized copy of the parse tree in a new arena. Besides
+    /// folding constants, it simplifies identities like x*1, x+0, x*0, --x
+    /// and not not b, removes casts to the operand's own type, reduces x^2
+    /// and POW(x,2) to x*x, re-associates constants in chains like (x+1)+2
+    /// and rewrites comparisons like x+3 > 10 into x > 7. Calls of pure
+    /// functions are folded or memoized as set in the options. Each rewrite is
+    /// only applied if it yields exactly the same values and exceptions for
+    /// the types given in the options: e.g. X && f() with a pure call
+    /// folded to false is only folded to false if X cannot throw. (The parser
+    /// itself already folds X && false when parsing, regardless of X's
+    /// exceptions.) Signed integer arithmetic is assumed not to overflow, as in C++ itself. If log is not NULL, each applied
+    /// rewrite is appended to it.
+    ParseTree	optimize(const OptimizeOptions &opts = OptimizeOptions(),
+			 OptimizeLog *log = NULL) const;
 };
 
 /// Parse the given input expression into a parse tree. The parse tree is
 /// represented by its root node, which can be evaluated.
 const ParseTree parseExpression(const std::string &input);
 
+/// Parse the given input expression using the boost::spirit grammar instead of
+/// the hand-written parser. The resulting parse tree is the same, this
+/// function is kept as a reference for testing and benchmarking.
+const ParseTree parseExpressionSpirit(const std::string &input);
+
 /// Parse the given input expression into a parse tree. The parse tree is then
 /// transformed into a XML tree for better visualisation.
 std::string parseExpressionXML(const std::string &input);
@@ -377,6 +1620,181 @@ public:
 /// which can be evaluated.
 ParseTreeList parseExpressionList(const std::string &input);
 
+/// Result of one expression parsed by parseExpressionBulk(): either the parse
+/// tree or the message of the exception thrown by parseExpression().
+struct BulkParseResult
+{
+    /// Index of the expression in the input vector, or its line number in
+    /// the input stream starting with 1.
+    size_t	line;
+
+    /// The parse tree, empty if an exception was thrown.
+    ParseTree	tree;
+
+    /// Message of the exception, empty if the expression was parsed.
+    std::string	error;
+
+    /// Returns true if the expression could not be parsed.
+    inline bool	isError() const
+    {
+	return tree.isEmpty();
+    }
+};
+
+/// Parse all input expressions using a pool of threads, 0 threads selects the
+/// number of processors. Exceptions are not thrown but reported in the result
+/// of each expression, which are returned in the order of the inputs.
+std::vector<BulkParseResult> parseExpressionBulk(const std::vector<std::string> &inputs,
+						 unsigned int threads = 0);
+
+/// Read a newline-delimited list of expressions from the stream and parse
+/// them like parseExpressionBulk() above. Empty lines are skipped, the
+/// results hold the line numbers.
+std::vector<BulkParseResult> parseExpressionBulk(std::istream &input,
+						 unsigned int threads = 0);
+
+/** ExpressionCache maps expression strings to their parse trees, so that
+ * frequently repeated expressions are parsed only once. The key is the
+ * normalized expression text, in which runs of whitespace outside of string
+ * constants are collapsed. The least recently used trees are evicted when the
+ * cache exceeds its capacity in entries or in bytes of arena memory.
+ *
+ * The cache may be used by many threads at once: it is split into stripes by
+ * the hash of the key, each protected by its own mutex. The returned parse
+ * trees are immutable and may be shared and evaluated concurrently, but each
+ * thread must compile its own ParseProgram. */
+class ExpressionCache
+{
+public:
+    /// Counters and current size of the cache.
+    struct Statistics
+    {
+	/// Number of parse() calls which returned a cached tree.
+	size_t	hits;
+
+	/// Number of parse() calls which parsed the expression.
+	size_t	misses;
+
+	/// Number of trees evicted to keep the capacity.
+	size_t	evictions;
+
+	/// Number of trees currently cached.
+	size_t	entries;
+
+	/// Arena memory and key size of the cached trees in bytes.
+	size_t	bytes;
+    };
+
+private:
+    /// One independently locked part of the cache, defined in
+    /// ExpressionCache.cc.
+    struct Stripe;
+
+    /// Array of the stripes.
+    Stripe		*stripes;
+
+    /// Number of stripes.
+    unsigned int	stripecount;
+
+    /// Select the stripe of a normalized key.
+    Stripe&		getStripe(const std::string &key) const;
+
+    /// Disabled copy constructor
+    ExpressionCache(const ExpressionCache &ec);
+
+    /// Disabled assignment operator
+    ExpressionCache& operator=(const ExpressionCache &ec);
+
+public:
+    /// Create a cache holding at most maxentries parse trees using at most
+    /// maxbytes memory. The capacity is divided evenly among the stripes.
+    explicit ExpressionCache(size_t maxentries = 4096, size_t maxbytes = 16 * 1024 * 1024,
+			     unsigned int stripes = 16);
+
+    /// Releases all cached trees. Trees still referenced elsewhere stay
+    /// valid.
+    ~ExpressionCache();
+
+    /// Return the cached parse tree of the input expression or parse it like
+    /// parseExpression() and insert it into the cache. Expressions throwing
+    /// an exception are not cached.
+    const ParseTree	parse(const std::string &input);
+
+    /// Remove all parse trees from the cache. The counters are kept.
+    void		clear();
+
+    /// Return the sum of the counters of all stripes.
+    Statistics		getStatistics() const;
+
+    /// Return the normalized form of the expression used as cache key: leading
+    /// whitespace is removed and all other runs of whitespace outside of
+    /// string constants are replaced by a single space.
+    static std::string	normalize(const std::string &input);
+};
+
+/** ExpressionIndex matches records against a large set of boolean
+ * expressions, called subscriptions, without evaluating each of them for
+ * every record. Each subscription is split at its top-level or-chain into
+ * conjunctions and each conjunction at its and-chain into operands. Operands
+ * comparing a variable with a constant, like x > 5, "abc" == s or a bool
+ * variable b, are the predicates put into per-variable indexes: hash tables
+ * for equality and inequality and sorted maps for the ranges. For a record,
+ * the value of each indexed variable is looked up once and the satisfied
+ * predicates are counted per conjunction, only conjunctions with all
+ * predicates satisfied and no failed inequality are candidates.
+ *
+ * The result is always the same as evaluating each subscription's tree: a
+ * subscription matches if its tree evaluates to true, exceptions count as no
+ * match. Candidates for which the predicates alone are not conclusive,
+ * because the conjunction has other operands, the subscription has several
+ * conjunctions or the record's values are not comparable exactly, are
+ * confirmed by evaluating the tree.
+ *
+ * The index is not thread-safe: match() uses internal scratch space. */
+class ExpressionIndex
+{
+private:
+    /// Index structures, defined in ExpressionIndex.cc.
+    struct Impl;
+
+    /// Pointer to the index structures.
+    Impl	*impl;
+
+    /// Disabled copy constructor
+    ExpressionIndex(const ExpressionIndex &ei);
+
+    /// Disabled assignment operator
+    ExpressionIndex& operator=(const ExpressionIndex &ei);
+
+public:
+    /// Create an empty index.
+    ExpressionIndex();
+
+    /// Releases all subscriptions.
+    ~ExpressionIndex();
+
+    /// Add a subscription with the boolean expression tree. Returns the id of
+    /// the subscription, the ids of removed subscriptions are reused.
+    unsigned int	add(const ParseTree &pt);
+
+    /// Remove the subscription with the id. Returns false if there is no
+    /// such subscription.
+    bool		remove(unsigned int id);
+
+    /// Return the number of subscriptions.
+    size_t		size() const;
+
+    /// Fill matches with the ids of all subscriptions matching the record,
+    /// whose variables are looked up in the symbol table, in increasing
+    /// order.
+    void		match(const class SymbolTable &st, std::vector<unsigned int> &matches);
+
+    /// Evaluate a subscription's tree for the record without the index:
+    /// returns true if it evaluates to the bool true. This is used to confirm
+    /// candidates and is the brute-force equivalent of match().
+    static bool		evaluate(const ParseTree &pt, const class SymbolTable &st);
+};
+
 } // namespace stx
 
 #endif // _STX_ExpressionParser_H_
@@ -0,0 +1,709 @@
+// $Id$
+
+/*
+ * STX Expression Parser C++ Framework v0.7
+ * Copyright (C) 2007 Timo Bingmann
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/** \file ParseProgram.cc
+ * Implementation of the compiled ParseProgram and the stack machine executing
+ * its instructions.
+ */
+
+#include "ExpressionParser.h"
+
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+
+#ifndef _MSC_VER
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+#else
+#include <time.h>
+#endif
+
+namespace stx {
+
+/// Return a timestamp in nanoseconds used to measure the cost of chain
+/// operands. Falls back to gettimeofday() or clock() on systems without POSIX
+/// timers, their lower resolution is averaged out over many samples.
+static inline unsigned long long timestamp_ns()
+{
+#if defined(_POSIX_TIMERS) && (_POSIX_TIMERS > 0) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#elif !defined(_MSC_VER)
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000000ULL + tv.tv_usec * 1000ULL;
+#else
+    return static_cast<unsigned long long>(clock()) * (1000000000ULL / CLOCKS_PER_SEC);
+#endif
+}
+
+/// Every n-th evaluation in adaptive mode the chain operands are timed.
+static const unsigned int adaptive_sample_rate = 16;
+
+ParseProgram::ParseProgram()
+    : adaptinterval(0), adaptcount(0)
+{
+}
+
+ParseProgram::ParseProgram(const boost::shared_ptr<ParseNode> &rootnode)
+    : code(new Code), adaptinterval(0), adaptcount(0)
+{
+    code->maxstack = 0;
+    code->curstack = 0;
+    code->rootnode = rootnode;
+
+    rootnode->compile(*this);
+
+    assert(code->curstack == 1);
+
+    code->mainsize = code->code.size();
+
+    // compile the operands of a root chain again as separate sequences,
+    // which are evaluated in variable order in adaptive mode.
+    std::vector<const ParseNode*> operands;
+    code->chain = static_cast<chain_t>(rootnode->flattenChain(operands));
+
+    for(unsigned int i = 0; i < operands.size(); ++i)
+    {
+	unsigned int begin = code->code.size();
+
+	code->curstack = 0;
+	operands[i]->compile(*this);
+
+	assert(code->curstack == 1);
+
+	code->operands.push_back( std::make_pair(begin, code->code.size()) );
+	code->operandstrs.push_back( operands[i]->toString() );
+    }
+
+    stack.resize(code->maxstack);
+}
+
+ParseProgram::ParseProgram(const ParseProgram &p)
+    : code(p.code),
+      adaptinterval(p.adaptinterval), adaptcount(p.adaptcount),
+      adaptorder(p.adaptorder), adaptcounter(p.adaptcounter)
+{
+    if (code.get()) stack.resize(code->maxstack);
+}
+
+ParseProgram& ParseProgram::operator=(const ParseProgram &p)
+{
+    if (this == &p) return *this;
+
+    code = p.code;
+    stack.clear();
+    paramlist.clear();
+
+    adaptinterval = p.adaptinterval;
+    adaptcount = p.adaptcount;
+    adaptorder = p.adaptorder;
+    adaptcounter = p.adaptcounter;
+
+    if (code.get()) stack.resize(code->maxstack);
+
+    return *this;
+}
+
+void ParseProgram::emit(opcode_t op, unsigned int arg, unsigned int arg2, int stackdelta)
+{
+    Instruction ins;
+    ins.opcode = op;
+    ins.arg = arg;
+    ins.arg2 = arg2;
+
+    code->code.push_back(ins);
+
+    code->curstack += stackdelta;
+    if (code->curstack > code->maxstack)
+	code->maxstack = code->curstack;
+}
+
+void ParseProgram::emitConstant(const AnyScalar &value)
+{
+    code->constants.push_back(value);
+    emit(OP_PUSH_CONST, code->constants.size() - 1, 0, +1);
+}
+
+void ParseProgram::emitVariable(const std::string &varname)
+{
+    code->names.push_back(varname);
+    emit(OP_PUSH_VAR, code->names.size() - 1, 0, +1);
+}
+
+void ParseProgram::emitFunction(const std::string &funcname, unsigned int paramnum)
+{
+    code->names.push_back(funcname);
+    emit(OP_CALL, code->names.size() - 1, paramnum, 1 - static_cast<int>(paramnum));
+}
+
+void ParseProgram::emitNode(const ParseNode *node)
+{
+    code->nodes.push_back(node);
+    emit(OP_EVAL_NODE, code->nodes.size() - 1, 0, +1);
+}
+
+void ParseProgram::emitUnary(opcode_t op, unsigned int arg)
+{
+    emit(op, arg, 0, 0);
+}
+
+void ParseProgram::emitBinary(opcode_t op)
+{
+    emit(op, 0, 0, -1);
+}
+
+unsigned int ParseProgram::emitJump(opcode_t op)
+{
+    // the operand is popped if the jump is not taken.
+    emit(op, 0, 0, -1);
+    return code->code.size() - 1;
+}
+
+void ParseProgram::patchJump(unsigned int index)
+{
+    code->code[index].arg = code->code.size();
+}
+
+unsigned int ParseProgram::bindVariables(const slotmap_type &schema)
+{
+    assert(code.get() != NULL);
+
+    // copy-on-write: other copies of the program keep their binding
+    if (!code.unique())
+	code.reset(new Code(*code));
+
+    unsigned int bound = 0;
+    code->slots.clear();
+
+    for(code_type::iterator ci = code->code.begin(); ci != code->code.end(); ++ci)
+    {
+	unsigned int nameidx;
+
+	if (ci->opcode == OP_PUSH_VAR)
+	    nameidx = ci->arg;
+	else if (ci->opcode == OP_PUSH_SLOT)
+	    nameidx = ci->arg2;
+	else
+	    continue;
+
+	slotmap_type::const_iterator sf = schema.find(code->names[nameidx]);
+
+	// the name index must fit into arg2, otherwise the variable is not bound.
+	if (sf != schema.end() && nameidx <= 0xFFFF)
+	{
+	    ci->opcode = OP_PUSH_SLOT;
+	    ci->arg = sf->second;
+	    ci->arg2 = nameidx;
+
+	    code->slots.push_back(sf->second);
+	    ++bound;
+	}
+	else
+	{
+	    ci->opcode = OP_PUSH_VAR;
+	    ci->arg = nameidx;
+	    ci->arg2 = 0;
+	}
+    }
+
+    std::sort(code->slots.begin(), code->slots.end());
+    code->slots.erase(std::unique(code->slots.begin(), code->slots.end()), code->slots.end());
+
+    return bound;
+}
+
+unsigned int ParseProgram::bindFunctions(const class SymbolTable &st)
+{
+    assert(code.get() != NULL);
+
+    // copy-on-write: other copies of the program keep their binding
+    if (!code.unique())
+	code.reset(new Code(*code));
+
+    std::vector<BoundFunction> functions;
+
+    for(code_type::iterator ci = code->code.begin(); ci != code->code.end(); ++ci)
+    {
+	unsigned int nameidx;
+
+	if (ci->opcode == OP_CALL)
+	    nameidx = ci->arg;
+	else if (ci->opcode == OP_CALL_FUNC || ci->opcode == OP_CALL_NATIVE)
+	    nameidx = code->functions[ci->arg].nameidx;
+	else
+	    continue;
+
+	BoundFunction bf;
+	bf.nameidx = nameidx;
+
+	if (st.bindFunction(code->names[nameidx], ci->arg2, bf.binding)
+	    && (bf.binding.stub || bf.binding.func))
+	{
+	    ci->opcode = bf.binding.stub ? OP_CALL_NATIVE : OP_CALL_FUNC;
+	    ci->arg = functions.size();
+
+	    functions.push_back(bf);
+	}
+	else
+	{
+	    ci->opcode = OP_CALL;
+	    ci->arg = nameidx;
+	}
+    }
+
+    code->functions.swap(functions);
+
+    return code->functions.size();
+}
+
+AnyScalar ParseProgram::evaluate(const class SymbolTable &st) const
+{
+    return evaluate(NULL, st);
+}
+
+AnyScalar ParseProgram::evaluate(const AnyScalar *slots, const class SymbolTable &st) const
+{
+    assert(code.get() != NULL);
+
+    if (adaptinterval != 0 && code->chain != CHAIN_NONE)
+	return evaluateAdaptive(slots, st);
+
+    AnyScalar *sp = execute(0, code->mainsize, &stack[0], slots, st);
+
+    assert(sp == &stack[0] + 1);
+    (void)sp;
+
+    return stack[0];
+}
+
+AnyScalar* ParseProgram::execute(unsigned int begin, unsigned int end, AnyScalar *sp,
+				 const AnyScalar *slots, const class SymbolTable &st) const
+{
+    const Instruction *ipbegin = &code->code[0];
+    const Instruction *ip = ipbegin + begin;
+    const Instruction *ipend = ipbegin + end;
+
+    // sp points to the next free stack entry
+    for(; ip != ipend; ++ip)
+    {
+	switch(ip->opcode)
+	{
+	case OP_PUSH_CONST:
+	    *sp++ = code->constants[ip->arg];
+	    break;
+
+	case OP_PUSH_VAR:
+	    *sp++ = st.lookupVariable(code->names[ip->arg]);
+	    break;
+
+	case OP_PUSH_SLOT:
+	    if (slots)
+		*sp++ = slots[ip->arg];
+	    else
+		*sp++ = st.lookupVariable(code->names[ip->arg2]);
+	    break;
+
+	case OP_CALL:
+	{
+	    sp -= ip->arg2;
+
+	    paramlist.resize(ip->arg2);
+	    for(unsigned int i = 0; i < ip->arg2; ++i)
+		paramlist[i] = sp[i];
+
+	    *sp++ = st.processFunction(code->names[ip->arg], paramlist);
+	    break;
+	}
+
+	case OP_CALL_FUNC:
+	{
+	    sp -= ip->arg2;
+
+	    paramlist.resize(ip->arg2);
+	    for(unsigned int i = 0; i < ip->arg2; ++i)
+		paramlist[i] = sp[i];
+
+	    *sp++ = code->functions[ip->arg].binding.func(paramlist);
+	    break;
+	}
+
+	case OP_CALL_NATIVE:
+	{
+	    const SymbolTable::FunctionBinding &fb = code->functions[ip->arg].binding;
+
+	    sp -= ip->arg2;
+	    *sp = fb.stub(fb.nativefunc, sp);
+	    ++sp;
+	    break;
+	}
+
+	case OP_EVAL_NODE:
+	    *sp++ = code->nodes[ip->arg]->evaluate(st);
+	    break;
+
+	case OP_NEG:
+	    sp[-1] = -sp[-1];
+	    break;
+
+	case OP_NOT:
+	    if (sp[-1].getType() != AnyScalar::ATTRTYPE_BOOL)
+		throw(BadSyntaxException("Invalid operand for !. Operand must be of type bool."));
+	    sp[-1] = -sp[-1];
+	    break;
+
+	case OP_CAST:
+	    sp[-1].convertType(static_cast<AnyScalar::attrtype_t>(ip->arg));
+	    break;
+
+	case OP_ADD:
+	    --sp;
+	    sp[-1] = sp[-1] + sp[0];
+	    break;
+
+	case OP_SUB:
+	    --sp;
+	    sp[-1] = sp[-1] - sp[0];
+	    break;
+
+	case OP_MUL:
+	    --sp;
+	    sp[-1] = sp[-1] * sp[0];
+	    break;
+
+	case OP_DIV:
+	    --sp;
+	    sp[-1] = sp[-1] / sp[0];
+	    break;
+
+	case OP_POW:
+	    --sp;
+	    sp[-1] = AnyScalar( std::pow(sp[-1].getDouble(), sp[0].getDouble()) );
+	    break;
+
+	case OP_EQUAL:
+	    --sp;
+	    sp[-1] = AnyScalar( sp[-1].equal_to(sp[0]) );
+	    break;
+
+	case OP_NOTEQUAL:
+	    --sp;
+	    sp[-1] = AnyScalar( sp[-1].not_equal_to(sp[0]) );
+	    break;
+
+	case OP_LESS:
+	    --sp;
+	    sp[-1] = AnyScalar( sp[-1].less(sp[0]) );
+	    break;
+
+	case OP_GREATER:
+	    --sp;
+	    sp[-1] = AnyScalar( sp[-1].greater(sp[0]) );
+	    break;
+
+	case OP_LESSEQUAL:
+	    --sp;
+	    sp[-1] = AnyScalar( sp[-1].less_equal(sp[0]) );
+	    break;
+
+	case OP_GREATEREQUAL:
+	    --sp;
+	    sp[-1] = AnyScalar( sp[-1].greater_equal(sp[0]) );
+	    break;
+
+	case OP_JUMP_FALSE:
+	case OP_JUMP_TRUE:
+	{
+	    const char *opstr = (ip->opcode == OP_JUMP_FALSE) ? "&&" : "||";
+
+	    if (sp[-1].getType() != AnyScalar::ATTRTYPE_BOOL)
+		throw(BadSyntaxException(std::string("Invalid left operand for ") + opstr + ". Both operands must be of type bool."));
+
+	    bool bvl = sp[-1].getInteger();
+
+	    if (bvl == (ip->opcode == OP_JUMP_TRUE)) {
+		// short-circuit: the left operand is the result
+		ip = ipbegin + ip->arg - 1;
+	    }
+	    else {
+		--sp;
+	    }
+	    break;
+	}
+
+	case OP_TEST_BOOL:
+	    if (sp[-1].getType() != AnyScalar::ATTRTYPE_BOOL)
+		throw(BadSyntaxException(std::string("Invalid right operand for ") + (ip->arg ? "||" : "&&") + ". Both operands must be of type bool."));
+	    break;
+
+	default:
+	    assert(0);
+	    throw(ExpressionParserException("Invalid instruction in ParseProgram. This should never happen."));
+	}
+    }
+
+    return sp;
+}
+
+AnyScalar ParseProgram::evaluateAdaptive(const AnyScalar *slots, const class SymbolTable &st) const
+{
+    unsigned int opnum = code->operands.size();
+
+    if (adaptorder.size() != opnum)
+    {
+	adaptorder.resize(opnum);
+	for(unsigned int i = 0; i < opnum; ++i)
+	    adaptorder[i] = i;
+
+	adaptcounter.assign(opnum, OperandCounter());
+    }
+
+    if (adaptcount != 0 && adaptcount % adaptinterval == 0)
+	reorderAdaptive();
+
+    bool sample = (adaptcount % adaptive_sample_rate == 0);
+    ++adaptcount;
+
+    // an AND chain is decided by a false operand, an OR chain by a true one.
+    bool decider = (code->chain == CHAIN_OR);
+    const char *opstr = (code->chain == CHAIN_AND) ? "&&" : "||";
+
+    for(unsigned int i = 0; i < opnum; ++i)
+    {
+	unsigned int opi = adaptorder[i];
+	OperandCounter &oc = adaptcounter[opi];
+
+	unsigned long long ts = sample ? timestamp_ns() : 0;
+
+	// an operand throwing an exception is counted as a non-deciding
+	// evaluation, otherwise it would look free and be moved to the front.
+	try
+	{
+	    AnyScalar *sp = execute(code->operands[opi].first, code->operands[opi].second,
+				    &stack[0], slots, st);
+
+	    assert(sp == &stack[0] + 1);
+	    (void)sp;
+	}
+	catch (...)
+	{
+	    if (sample) {
+		oc.samples++;
+		oc.time += timestamp_ns() - ts;
+	    }
+	    oc.evaluations++;
+	    throw;
+	}
+
+	if (sample) {
+	    oc.samples++;
+	    oc.time += timestamp_ns() - ts;
+	}
+
+	oc.evaluations++;
+
+	if (stack[0].getType() != AnyScalar::ATTRTYPE_BOOL)
+	    throw(BadSyntaxException(std::string("Invalid operand for ") + opstr + ". Both operands must be of type bool."));
+
+	if (stack[0].getBoolean() == decider)
+	{
+	    oc.decisions++;
+	    return AnyScalar(decider);
+	}
+    }
+
+    return AnyScalar(!decider);
+}
+
+/// Sort relation of the chain operands used by reorderAdaptive().
+struct AdaptiveRankLess
+{
+    /// Rank of each operand
+    const std::vector<double> &rank;
+
+    /// Initializing Constructor
+    AdaptiveRankLess(const std::vector<double> &_rank)
+	: rank(_rank)
+    {
+    }
+
+    /// Compare operands by rank
+    inline bool operator()(unsigned int a, unsigned int b) const
+    {
+	return rank[a] < rank[b];
+    }
+};
+
+void ParseProgram::reorderAdaptive() const
+{
+    // the expected cost of evaluating an operand until the chain is decided
+    // is minimized by sorting by cost / P(operand decides). The decision
+    // probability is smoothed so that operands rarely evaluated still get a
+    // chance to move forward. Operands whose cost was never measured keep
+    // their place behind the measured ones.
+    std::vector<double> rank(adaptcounter.size());
+
+    for(unsigned int i = 0; i < adaptcounter.size(); ++i)
+    {
+	const OperandCounter &oc = adaptcounter[i];
+
+	if (oc.samples == 0) {
+	    rank[i] = HUGE_VAL;
+	    continue;
+	}
+
+	double cost = static_cast<double>(oc.time) / oc.samples;
+	double prob = (oc.decisions + 1.0) / (oc.evaluations + 2.0);
+
+	rank[i] = (cost + 1.0) / prob;
+    }
+
+    std::stable_sort(adaptorder.begin(), adaptorder.end(), AdaptiveRankLess(rank));
+}
+
+void ParseProgram::setAdaptive(unsigned int interval)
+{
+    adaptinterval = interval;
+    adaptcount = 0;
+    adaptorder.clear();
+    adaptcounter.clear();
+}
+
+std::vector<ParseProgram::OperandStats> ParseProgram::getChainStats() const
+{
+    assert(code.get() != NULL);
+
+    std::vector<OperandStats> stats(code->operands.size());
+
+    for(unsigned int i = 0; i < stats.size(); ++i)
+    {
+	OperandStats &os = stats[i];
+
+	os.expression = code->operandstrs[i];
+	os.position = i;
+	os.evaluations = os.decisions = 0;
+	os.cost = 0.0;
+
+	if (i < adaptcounter.size())
+	{
+	    const OperandCounter &oc = adaptcounter[i];
+
+	    os.evaluations = oc.evaluations;
+	    os.decisions = oc.decisions;
+	    os.cost = oc.samples ? static_cast<double>(oc.time) / oc.samples : 0.0;
+	}
+    }
+
+    for(unsigned int i = 0; i < adaptorder.size(); ++i)
+	stats[ adaptorder[i] ].position = i;
+
+    return stats;
+}
+
+std::string ParseProgram::toString() const
+{
+    static const char *opnames[] = {
+	"push_const", "push_var", "push_slot",
+	"call", "call_func", "call_native", "eval_node",
+	"neg", "not", "cast",
+	"add", "sub", "mul", "div", "pow",
+	"equal", "notequal", "less", "greater", "lessequal", "greaterequal",
+	"jump_false", "jump_true", "test_bool"
+    };
+
+    assert(code.get() != NULL);
+
+    std::ostringstream oss;
+
+    unsigned int nextoperand = 0;
+
+    for(unsigned int i = 0; i < code->code.size(); ++i)
+    {
+	const Instruction &ins = code->code[i];
+
+	if (nextoperand < code->operands.size() && code->operands[nextoperand].first == i)
+	{
+	    oss << "operand " << nextoperand << " of "
+		<< (code->chain == CHAIN_AND ? "&&" : "||") << " chain: "
+		<< code->operandstrs[nextoperand] << "\n";
+	    ++nextoperand;
+	}
+
+	oss << i << ": " << opnames[ins.opcode];
+
+	switch(ins.opcode)
+	{
+	case OP_PUSH_CONST:
+	{
+	    const AnyScalar &value = code->constants[ins.arg];
+	    if (value.getType() == AnyScalar::ATTRTYPE_STRING)
+		oss << " " << value.getStringQuoted();
+	    else
+		oss << " " << value.getString();
+	    oss << " (" << value.getTypeString() << ")";
+	    break;
+	}
+
+	case OP_PUSH_VAR:
+	    oss << " " << code->names[ins.arg];
+	    break;
+
+	case OP_PUSH_SLOT:
+	    oss << " " << ins.arg << " (" << code->names[ins.arg2] << ")";
+	    break;
+
+	case OP_CALL:
+	    oss << " " << code->names[ins.arg] << "/" << ins.arg2;
+	    break;
+
+	case OP_CALL_FUNC:
+	case OP_CALL_NATIVE:
+	    oss << " " << code->names[code->functions[ins.arg].nameidx] << "/" << ins.arg2;
+	    break;
+
+	case OP_EVAL_NODE:
+	    oss << " " << code->nodes[ins.arg]->toString();
+	    break;
+
+	case OP_CAST:
+	    oss << " " << AnyScalar::getTypeString(static_cast<AnyScalar::attrtype_t>(ins.arg));
+	    break;
+
+	case OP_JUMP_FALSE:
+	case OP_JUMP_TRUE:
+	    oss << " " << ins.arg;
+	    break;
+
+	case OP_TEST_BOOL:
+	    oss << " " << (ins.arg ? "||" : "&&");
+	    break;
+	}
+
+	oss << "\n";
+    }
+
+    return oss.str();
+}
+
+} // namespace stx
@@ -0,0 +1,174 @@
+// $Id$
+
+/*
+ * STX Expression Parser C++ Framework v0.7
+ * Copyright (C) 2007 Timo Bingmann
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/** \file Threads.h
+ * Internal helpers for the thread-safe and parallel parts of the library: a
+ * scoped pthread mutex lock and a minimal work pool processing an index
+ * range in chunks. This header is not installed.
+ */
+
+#ifndef _STX_Threads_H_
+#define _STX_Threads_H_
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include <vector>
+
+namespace stx {
+
+/// Scoped lock of a pthread mutex.
+class MutexLock
+{
+private:
+    /// The locked mutex
+    pthread_mutex_t	&mutex;
+
+    /// Disabled copy constructor
+    MutexLock(const MutexLock &ml);
+
+    /// Disabled assignment operator
+    MutexLock& operator=(const MutexLock &ml);
+
+public:
+    /// Lock the mutex
+    explicit MutexLock(pthread_mutex_t &_mutex)
+	: mutex(_mutex)
+    {
+	pthread_mutex_lock(&mutex);
+    }
+
+    /// Unlock the mutex
+    ~MutexLock()
+    {
+	pthread_mutex_unlock(&mutex);
+    }
+};
+
+/// Return the number of online processors, at least 1.
+inline unsigned int getProcessorCount()
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? static_cast<unsigned int>(n) : 1;
+}
+
+/** ParallelWork processes the items [0,size) using a pool of threads, which
+ * fetch chunks of consecutive items until all are done. Subclasses implement
+ * process(), which is called concurrently for disjoint ranges and must not
+ * throw. */
+class ParallelWork
+{
+private:
+    /// Mutex protecting next.
+    pthread_mutex_t	mutex;
+
+    /// Next item not yet handed out.
+    size_t		next;
+
+    /// Number of items.
+    size_t		size;
+
+    /// Number of items handed out at once.
+    size_t		chunksize;
+
+    /// Fetch the next chunk, returns false if all items are handed out.
+    bool fetch(size_t &begin, size_t &end)
+    {
+	MutexLock lock(mutex);
+
+	if (next >= size) return false;
+
+	begin = next;
+	end = (size - next > chunksize) ? next + chunksize : size;
+	next = end;
+	return true;
+    }
+
+    /// Thread main function: process chunks until none are left.
+    static void* worker(void *arg)
+    {
+	ParallelWork &pw = *static_cast<ParallelWork*>(arg);
+
+	size_t begin, end;
+	while (pw.fetch(begin, end))
+	    pw.process(begin, end);
+
+	return NULL;
+    }
+
+    /// Disabled copy constructor
+    ParallelWork(const ParallelWork &pw);
+
+    /// Disabled assignment operator
+    ParallelWork& operator=(const ParallelWork &pw);
+
+public:
+    ParallelWork()
+	: next(0), size(0), chunksize(1)
+    {
+	pthread_mutex_init(&mutex, NULL);
+    }
+
+    virtual ~ParallelWork()
+    {
+	pthread_mutex_destroy(&mutex);
+    }
+
+    /// Process the items [begin,end).
+    virtual void process(size_t begin, size_t end) = 0;
+
+    /// Process all items [0,_size) in chunks using the given number of
+    /// threads, 0 selects the number of processors. The calling thread works
+    /// as one of them. Returns after all items are processed.
+    void run(size_t _size, size_t _chunksize, unsigned int threads = 0)
+    {
+	next = 0;
+	size = _size;
+	chunksize = _chunksize ? _chunksize : 1;
+
+	if (threads == 0) threads = getProcessorCount();
+
+	// no more threads than chunks
+	size_t chunks = (size + chunksize - 1) / chunksize;
+	if (threads > chunks) threads = chunks ? static_cast<unsigned int>(chunks) : 1;
+
+	std::vector<pthread_t> pool;
+
+	for(unsigned int t = 1; t < threads; ++t)
+	{
+	    pthread_t thread;
+
+	    // if no thread can be created, fewer threads do the work.
+	    if (pthread_create(&thread, NULL, worker, this) != 0) break;
+
+	    pool.push_back(thread);
+	}
+
+	worker(this);
+
+	for(unsigned int t = 0; t < pool.size(); ++t)
+	    pthread_join(pool[t], NULL);
+    }
+};
+
+} // namespace stx
+
+#endif // _STX_Threads_H_
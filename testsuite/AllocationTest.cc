@@ -0,0 +1,191 @@
+// $Id$
+
+/*
+ * STX Expression Parser C++ Framework v0.7
+ * Copyright (C) 2007 Timo Bingmann
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "ExpressionParser.h"
+
+#include <new>
+#include <stdlib.h>
+
+// count the heap allocations of the whole test program while enabled.
+
+static bool alloc_counting = false;
+static unsigned int alloc_count = 0;
+
+#if __cplusplus >= 201103L
+#define ALLOC_THROW
+#define ALLOC_NOTHROW noexcept
+#else
+#define ALLOC_THROW throw(std::bad_alloc)
+#define ALLOC_NOTHROW throw()
+#endif
+
+// the allocation functions are not inlined, otherwise GCC warns about
+// mismatched malloc() and operator delete.
+#ifdef __GNUC__
+#define ALLOC_NOINLINE __attribute__((noinline))
+#else
+#define ALLOC_NOINLINE
+#endif
+
+ALLOC_NOINLINE void* operator new(std::size_t size) ALLOC_THROW
+{
+    if (alloc_counting) alloc_count++;
+
+    void *p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+ALLOC_NOINLINE void operator delete(void *p) ALLOC_NOTHROW
+{
+    free(p);
+}
+
+#ifdef __cpp_sized_deallocation
+ALLOC_NOINLINE void operator delete(void *p, std::size_t) ALLOC_NOTHROW
+{
+    free(p);
+}
+#endif
+
+class AllocationTest : public CPPUNIT_NS::TestFixture
+{
+    CPPUNIT_TEST_SUITE( AllocationTest );
+    CPPUNIT_TEST(test_anyscalar);
+    CPPUNIT_TEST(test_evaluate);
+    CPPUNIT_TEST_SUITE_END();
+
+protected:
+
+    static inline void start_counting()
+    {
+	alloc_count = 0;
+	alloc_counting = true;
+    }
+
+    static inline unsigned int stop_counting()
+    {
+	alloc_counting = false;
+	return alloc_count;
+    }
+
+public:
+
+    void test_anyscalar()
+    {
+	stx::AnyScalar a("short string"), b(5);
+	stx::AnyScalar l("a string which is too long to be stored inline");
+
+	// copying and concatenating short strings does not allocate
+	start_counting();
+	{
+	    stx::AnyScalar c = a;
+	    b = c;
+	    c = stx::AnyScalar("abc") + stx::AnyScalar("def");
+	    b = a;
+	    c.setString("123");
+	    c.convertType(stx::AnyScalar::ATTRTYPE_INTEGER);
+	    c = a;
+	    CPPUNIT_ASSERT( c.equal_to(b) && !c.less(a) );
+	}
+	CPPUNIT_ASSERT( stop_counting() == 0 );
+
+	CPPUNIT_ASSERT( b.getType() == stx::AnyScalar::ATTRTYPE_STRING );
+	CPPUNIT_ASSERT( b.getString() == "short string" );
+
+	// long strings are held in a std::string: the object and its buffer
+	start_counting();
+	{
+	    stx::AnyScalar c = l;
+	}
+	CPPUNIT_ASSERT( stop_counting() == 2 );
+
+	// concatenating moves the string onto the heap
+	stx::AnyScalar c = a + stx::AnyScalar(" and more");
+	CPPUNIT_ASSERT( c.getString() == "short string and more" );
+	CPPUNIT_ASSERT( c == stx::AnyScalar("short string and more") );
+	CPPUNIT_ASSERT( c.greater(a) && a.less(c) );
+
+	c = a;
+	CPPUNIT_ASSERT( c.getString() == "short string" );
+
+#if __cplusplus >= 201103L
+	// moving takes over a long string
+	start_counting();
+	{
+	    stx::AnyScalar m = std::move(l);
+	    CPPUNIT_ASSERT( l.getValueLength() == 1 );
+	    l = std::move(m);
+	}
+	CPPUNIT_ASSERT( stop_counting() == 0 );
+	CPPUNIT_ASSERT( l.getString() == "a string which is too long to be stored inline" );
+#endif
+    }
+
+    void test_evaluate()
+    {
+	stx::BasicSymbolTable bst;
+	bst.setVariable("s", "abc");
+	bst.setVariable("t", "hello");
+
+	stx::ParseTree pt = stx::parseExpression("s == \"abc\" && t + \"xyz\" != s && s < t");
+	stx::ParseProgram pp = pt.compile();
+
+	std::map<std::string, unsigned int> slotmap;
+	slotmap["s"] = 0;
+	slotmap["t"] = 1;
+
+	stx::ParseProgram ppbound = pp;
+	ppbound.bindVariables(slotmap);
+
+	stx::AnyScalar slots[2] = { stx::AnyScalar("abc"), stx::AnyScalar("hello") };
+
+	// evaluating expressions over short strings does not allocate
+	start_counting();
+	for(unsigned int i = 0; i < 100; ++i)
+	{
+	    CPPUNIT_ASSERT( pt.evaluate(bst).getBoolean() );
+	    CPPUNIT_ASSERT( pp.evaluate(bst).getBoolean() );
+	    CPPUNIT_ASSERT( ppbound.evaluate(slots, bst).getBoolean() );
+	}
+	CPPUNIT_ASSERT( stop_counting() == 0 );
+
+	// long strings referencing an input buffer are not copied either
+	const char line[] = "a string which is too long to be stored inline";
+
+	slots[0].setAutoStringRef(line, 14);
+	slots[1].setAutoStringRef(line, sizeof(line) - 1);
+
+	stx::ParseProgram ppref = stx::parseExpression("s < t && t != \"abc\" && s == \"a string which\"").compile();
+	ppref.bindVariables(slotmap);
+
+	start_counting();
+	for(unsigned int i = 0; i < 100; ++i)
+	{
+	    CPPUNIT_ASSERT( ppref.evaluate(slots, bst).getBoolean() );
+	}
+	CPPUNIT_ASSERT( stop_counting() == 0 );
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION( AllocationTest );
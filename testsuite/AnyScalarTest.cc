@@ -36,6 +36,7 @@ class AnyScalarTest : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(test_short);
     CPPUNIT_TEST(test_integer);
     CPPUNIT_TEST(test1);
+    CPPUNIT_TEST(test_stringref);
     CPPUNIT_TEST_SUITE_END();
 
 protected:
@@ -240,6 +241,56 @@ protected:
 	    CPPUNIT_ASSERT( s.setAutoString("-34023598298abc65.3334").getTypeString() == "string" );
 	}
     }
+
+    void test_stringref()
+    {
+	// fields of an input line, which are not zero-terminated
+	const char line[] = "abc\t42\t-1.5\tyes\ta rather long string field\t";
+
+	AnyScalar a, n, d, y, l;
+	a.setStringRef(line, 3);
+	n.setAutoStringRef(line + 4, 2);
+	d.setAutoStringRef(line + 7, 4);
+	y.setAutoStringRef(line + 12, 3);
+	l.setAutoStringRef(line + 16, 26);
+
+	CPPUNIT_ASSERT( a.isStringRef() && a.getString() == "abc" );
+	CPPUNIT_ASSERT( n.getType() == AnyScalar::ATTRTYPE_INTEGER && n.getInteger() == 42 );
+	CPPUNIT_ASSERT( d.getType() == AnyScalar::ATTRTYPE_DOUBLE && d.getDouble() == -1.5 );
+	CPPUNIT_ASSERT( y.isStringRef() && y.getBoolean() == true );
+	CPPUNIT_ASSERT( l.isStringRef() && l.getValueLength() == 27 );
+
+	// comparisons with constants and owned strings
+	CPPUNIT_ASSERT( a == AnyScalar("abc") && a != AnyScalar("abcd") );
+	CPPUNIT_ASSERT( a.less(AnyScalar("abd")) && a.greater(AnyScalar("ab")) );
+	CPPUNIT_ASSERT( l.equal_to(AnyScalar("a rather long string field")) );
+	CPPUNIT_ASSERT( l.less(a) );
+
+	// conversions parse the referenced characters only
+	AnyScalar r;
+	r.setStringRef(line + 4, 1);
+	CPPUNIT_ASSERT( r.getInteger() == 4 && r.getLong() == 4 && r.getDouble() == 4.0 );
+	CPPUNIT_ASSERT( r.convertType(AnyScalar::ATTRTYPE_INTEGER) && r.getInteger() == 4 );
+	r.setStringRef(line, 3);
+	CPPUNIT_ASSERT_THROW( r.getInteger(), ConversionException );
+
+	// copies are references too, new strings are not
+	AnyScalar c = l;
+	CPPUNIT_ASSERT( c.isStringRef() && c == l );
+	c = a;
+	CPPUNIT_ASSERT( c.isStringRef() && c == a );
+
+	AnyScalar cat = a + l;
+	CPPUNIT_ASSERT( !cat.isStringRef() && cat.getString() == "abca rather long string field" );
+
+	c.detachStringRef();
+	CPPUNIT_ASSERT( !c.isStringRef() && c == a );
+
+	// assigning an owned string ends the reference
+	l = AnyScalar("xyz");
+	CPPUNIT_ASSERT( !l.isStringRef() && l.getString() == "xyz" );
+	CPPUNIT_ASSERT( !r.setAutoString("abc").isStringRef() );
+    }
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION( AnyScalarTest );
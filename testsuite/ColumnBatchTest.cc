@@ -0,0 +1,528 @@
+// $Id$
+
+/*
+ * STX Expression Parser C++ Framework v0.7
+ * Copyright (C) 2007 Timo Bingmann
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "ExpressionParser.h"
+
+#include <math.h>
+#include <limits.h>
+#include <string.h>
+
+class ColumnBatchTest : public CPPUNIT_NS::TestFixture
+{
+    CPPUNIT_TEST_SUITE( ColumnBatchTest );
+    CPPUNIT_TEST(test_compare);
+    CPPUNIT_TEST(test_types);
+    CPPUNIT_TEST(test_exceptions);
+    CPPUNIT_TEST(test_selection);
+    CPPUNIT_TEST(test_packed);
+    CPPUNIT_TEST(test_simd);
+    CPPUNIT_TEST_SUITE_END();
+
+protected:
+
+    static const unsigned int rows = 8;
+
+    int		coli[rows];
+    int		colz[rows];
+    long long	coll[rows];
+    float	colf[rows];
+    double	cold[rows];
+    std::string	cols[rows];
+    std::string	coln[rows];
+
+    stx::ColumnBatch		batch;
+
+    stx::BasicSymbolTable	bst;
+
+public:
+
+    void setUp()
+    {
+	static const int i[rows] = { 1, -2, 3, 0, 5, 7, -8, 9 };
+	static const int z[rows] = { 1, 0, 1, 3, 2, 3, 0, 4 };
+	static const long long l[rows] = { 10, -20, 3, 4000000000LL, 5, -6, 7, 8 };
+	static const float f[rows] = { 0.5f, -1.25f, 3.0f, 2.0f, 0.0f, -7.5f, 1e10f, 0.1f };
+	static const double d[rows] = { 1.5, 2.5, -3.0, 0.0, 4.25, 100.0, -0.5, 9.0 };
+	static const char *s[rows] = { "a", "bb", "c", "bb", "", "zz", "a", "c" };
+	static const char *n[rows] = { "1.5", "-2", "3", "0", "4.25", "7", "8", "9" };
+
+	for(unsigned int r = 0; r < rows; ++r)
+	{
+	    coli[r] = i[r];
+	    colz[r] = z[r];
+	    coll[r] = l[r];
+	    colf[r] = f[r];
+	    cold[r] = d[r];
+	    cols[r] = s[r];
+	    coln[r] = n[r];
+	}
+
+	batch = stx::ColumnBatch(rows);
+	batch.addColumn("i", coli);
+	batch.addColumn("z", colz);
+	batch.addColumn("l", coll);
+	batch.addColumn("f", colf);
+	batch.addColumn("d", cold);
+	batch.addColumn("s", cols);
+	batch.addColumn("n", coln);
+
+	bst.setVariable("a", 42);
+	bst.setVariable("t", true);
+    }
+
+    // compare two values including their type, NaN equals NaN.
+    static bool same_value(const stx::AnyScalar &a, const stx::AnyScalar &b)
+    {
+	if (a.getType() != b.getType()) return false;
+
+	if (a.getType() == stx::AnyScalar::ATTRTYPE_DOUBLE ||
+	    a.getType() == stx::AnyScalar::ATTRTYPE_FLOAT)
+	{
+	    double da = a.getDouble(), db = b.getDouble();
+	    return (da == db) || (isnan(da) && isnan(db));
+	}
+
+	return a.equal_to(b);
+    }
+
+    // evaluate the expression over the batch and row by row, both must yield
+    // the same values or the same exception.
+    void check_batch(const std::string &expr)
+    {
+	stx::ParseTree pt = stx::parseExpression(expr);
+
+	stx::BatchColumn result;
+	bool batchthrow = false;
+	std::string batchwhat;
+
+	try {
+	    pt.evaluateBatch(batch, result, bst);
+	    CPPUNIT_ASSERT( result.size() == rows );
+	}
+	catch (stx::ExpressionParserException &e) {
+	    batchthrow = true;
+	    batchwhat = e.what();
+	}
+
+	for(unsigned int r = 0; r < rows; ++r)
+	{
+	    stx::BasicSymbolTable rowst = bst;
+	    rowst.setVariable("i", coli[r]);
+	    rowst.setVariable("z", colz[r]);
+	    rowst.setVariable("l", coll[r]);
+	    rowst.setVariable("f", colf[r]);
+	    rowst.setVariable("d", cold[r]);
+	    rowst.setVariable("s", cols[r]);
+	    rowst.setVariable("n", coln[r]);
+
+	    try {
+		stx::AnyScalar val = pt.evaluate(rowst);
+
+		if (!batchthrow)
+		    CPPUNIT_ASSERT( same_value(result.getValue(r), val) );
+	    }
+	    catch (stx::ExpressionParserException &e) {
+		// the batch must fail with the exception of the first failing row
+		CPPUNIT_ASSERT( batchthrow );
+		CPPUNIT_ASSERT( batchwhat == e.what() );
+		return;
+	    }
+	}
+
+	CPPUNIT_ASSERT( !batchthrow );
+    }
+
+    void test_compare()
+    {
+	// arithmetic with type promotion
+	check_batch("i + i");
+	check_batch("i + l");
+	check_batch("l - i");
+	check_batch("i * d");
+	check_batch("l * d");
+	check_batch("d / i");
+	check_batch("l / 3");
+	check_batch("i / z");
+	check_batch("i ^ 2");
+	check_batch("d ^ 0.5");
+	check_batch("i + a");
+	check_batch("-i");
+	check_batch("-l");
+	check_batch("-d");
+	check_batch("-n");
+	check_batch("+d");
+	check_batch("1 + 2");
+	check_batch("s + s");
+	check_batch("i + n");
+	check_batch("i + s");
+	check_batch("f * i");
+	check_batch("f / l");
+	check_batch("f - d");
+	check_batch("-f");
+
+	// comparisons
+	check_batch("i == 3");
+	check_batch("i < l");
+	check_batch("d >= i");
+	check_batch("l <= d");
+	check_batch("i != z");
+	check_batch("d > 2");
+	check_batch("s == \"bb\"");
+	check_batch("s < \"c\"");
+	check_batch("s >= n");
+	check_batch("i == n");
+	check_batch("(i > 2) == (d > 2)");
+	check_batch("(i > 2) != t");
+	check_batch("f < i");
+	check_batch("f >= 0.5");
+
+	// casts
+	check_batch("(long)i");
+	check_batch("(double)i");
+	check_batch("(double)l");
+	check_batch("(integer)d");
+	check_batch("(integer)l");
+	check_batch("(string)i");
+	check_batch("(bool)i");
+	check_batch("(double)n");
+	check_batch("(short)i + 1");
+	check_batch("(float)i");
+	check_batch("(double)f");
+
+	// logic operators
+	check_batch("i > 2 && d < 4.5");
+	check_batch("i > 2 || s == \"a\"");
+	check_batch("i > 100 && i / z > 1");
+	check_batch("i > -100 || i / z > 1");
+	check_batch("i > 0 && i / z > 1");
+	check_batch("i > 0 || i / z > 1");
+	check_batch("!(i > 2)");
+	check_batch("not (d < 0) and t");
+	check_batch("i > 2 && i");
+	check_batch("i && t");
+
+	// functions
+	check_batch("SQRT(d) + 1");
+	check_batch("POW(i, 2)");
+	check_batch("PI() * d");
+	check_batch("ABS(i)");
+    }
+
+    void test_types()
+    {
+	stx::BatchColumn result;
+
+	// typed operands are kept in typed columns
+	stx::parseExpression("i + l").evaluateBatch(batch, result);
+	CPPUNIT_ASSERT( result.getType() == stx::ColumnBatch::COLUMN_INT64 );
+	CPPUNIT_ASSERT( !result.isConstant() );
+	CPPUNIT_ASSERT( result.getLongs()[3] == 4000000000LL );
+
+	stx::parseExpression("i * 2").evaluateBatch(batch, result);
+	CPPUNIT_ASSERT( result.getType() == stx::ColumnBatch::COLUMN_INT32 );
+	CPPUNIT_ASSERT( result.getInts()[7] == 18 );
+
+	stx::parseExpression("i < d").evaluateBatch(batch, result);
+	CPPUNIT_ASSERT( result.getType() == stx::ColumnBatch::COLUMN_BOOL );
+
+	stx::parseExpression("d * 2").evaluateBatch(batch, result);
+	CPPUNIT_ASSERT( result.getType() == stx::ColumnBatch::COLUMN_DOUBLE );
+	CPPUNIT_ASSERT( result.getDoubles()[4] == 8.5 );
+
+	stx::parseExpression("s").evaluateBatch(batch, result);
+	CPPUNIT_ASSERT( result.getType() == stx::ColumnBatch::COLUMN_STRING );
+	CPPUNIT_ASSERT( result.getStrings() == cols );
+
+	// constants and variables without column are constant columns
+	stx::parseExpression("a * 2").evaluateBatch(batch, result, bst);
+	CPPUNIT_ASSERT( result.isConstant() );
+	CPPUNIT_ASSERT( result.size() == rows );
+	CPPUNIT_ASSERT( result.getValue(5) == 84 );
+
+	// mixed types fall back to AnyScalar values
+	stx::parseExpression("(short)i").evaluateBatch(batch, result);
+	CPPUNIT_ASSERT( result.getType() == stx::ColumnBatch::COLUMN_ANY );
+	CPPUNIT_ASSERT( result.getValues()[2].getType() == stx::AnyScalar::ATTRTYPE_SHORT );
+	CPPUNIT_ASSERT( result.getValues()[2].getInteger() == 3 );
+    }
+
+    void test_exceptions()
+    {
+	stx::BatchColumn result;
+
+	CPPUNIT_ASSERT_THROW( stx::parseExpression("i / z").evaluateBatch(batch, result), stx::ArithmeticException );
+	CPPUNIT_ASSERT_THROW( stx::parseExpression("x + i").evaluateBatch(batch, result), stx::UnknownSymbolException );
+	CPPUNIT_ASSERT_THROW( stx::parseExpression("!i").evaluateBatch(batch, result), stx::BadSyntaxException );
+	CPPUNIT_ASSERT_THROW( stx::parseExpression("i + (i > 2)").evaluateBatch(batch, result), stx::ConversionException );
+
+	// the empty batch evaluates nothing
+	stx::ColumnBatch empty;
+	empty.addColumn("i", coli);
+	stx::parseExpression("i / 0").evaluateBatch(empty, result);
+	CPPUNIT_ASSERT( result.size() == 0 );
+    }
+
+    void test_selection()
+    {
+	std::vector<unsigned int> sel;
+
+	stx::parseExpression("i > 2").evaluateBatch(batch, sel);
+	CPPUNIT_ASSERT( sel.size() == 4 );
+	CPPUNIT_ASSERT( sel[0] == 2 && sel[1] == 4 && sel[2] == 5 && sel[3] == 7 );
+
+	stx::parseExpression("i > 0 && i / z >= 2").evaluateBatch(batch, sel);
+	CPPUNIT_ASSERT( sel.size() == 4 );
+	CPPUNIT_ASSERT( sel[0] == 2 && sel[1] == 4 && sel[2] == 5 && sel[3] == 7 );
+
+	stx::parseExpression("t").evaluateBatch(batch, sel, bst);
+	CPPUNIT_ASSERT( sel.size() == rows );
+
+	stx::parseExpression("d < -100").evaluateBatch(batch, sel);
+	CPPUNIT_ASSERT( sel.empty() );
+
+	CPPUNIT_ASSERT_THROW( stx::parseExpression("i + 1").evaluateBatch(batch, sel), stx::BadSyntaxException );
+
+	// OR evaluates the right operand only for rows not yet selected
+	stx::parseExpression("i < 0 || i / z > 2").evaluateBatch(batch, sel);
+	CPPUNIT_ASSERT( sel.size() == 3 );
+	CPPUNIT_ASSERT( sel[0] == 1 && sel[1] == 2 && sel[2] == 6 );
+
+	stx::parseExpression("(i < 0 || d > 4) && s != \"zz\"").evaluateBatch(batch, sel);
+	CPPUNIT_ASSERT( sel.size() == 4 );
+	CPPUNIT_ASSERT( sel[0] == 1 && sel[1] == 4 && sel[2] == 6 && sel[3] == 7 );
+
+	CPPUNIT_ASSERT_THROW( stx::parseExpression("i > 100 || i / z > 1").evaluateBatch(batch, sel), stx::ArithmeticException );
+	CPPUNIT_ASSERT_THROW( stx::parseExpression("i > 2 && i").evaluateBatch(batch, sel), stx::BadSyntaxException );
+
+	// batches of selected rows
+	std::vector<unsigned int> rowsel;
+	rowsel.push_back(1);
+	rowsel.push_back(3);
+	rowsel.push_back(5);
+
+	stx::ColumnBatch sub(batch, rowsel);
+	CPPUNIT_ASSERT( sub.size() == 3 && sub.isSelection() );
+
+	stx::parseExpression("l > 0").evaluateBatch(sub, sel);
+	CPPUNIT_ASSERT( sel.size() == 1 && sel[0] == 1 );
+
+	stx::parseExpression("s == \"bb\" && d > 0").evaluateBatch(sub, sel);
+	CPPUNIT_ASSERT( sel.size() == 1 && sel[0] == 0 );
+
+	stx::BatchColumn result;
+	stx::parseExpression("i * 2").evaluateBatch(sub, result);
+	CPPUNIT_ASSERT( result.size() == 3 && result.getInts()[2] == 14 );
+
+	rowsel.assign(1, 2);
+	stx::ColumnBatch subsub(sub, rowsel);
+	CPPUNIT_ASSERT( subsub.getRow(0) == 5 );
+
+	stx::parseExpression("i == 7").evaluateBatch(subsub, sel);
+	CPPUNIT_ASSERT( sel.size() == 1 && sel[0] == 0 );
+    }
+
+    void test_packed()
+    {
+	// AnyScalar values of one type are packed into a typed column
+	std::vector<stx::AnyScalar> values;
+	for(unsigned int r = 0; r < rows; ++r)
+	    values.push_back( stx::AnyScalar().setAutoString(coln[r]) );
+
+	stx::BatchColumn packed;
+	packed.setValues(values);
+	CPPUNIT_ASSERT( packed.getType() == stx::ColumnBatch::COLUMN_ANY );
+
+	values.clear();
+	for(unsigned int r = 0; r < rows; ++r)
+	    values.push_back( stx::AnyScalar(coli[r]) );
+
+	packed.setValues(values);
+	CPPUNIT_ASSERT( packed.getType() == stx::ColumnBatch::COLUMN_INT32 );
+
+	batch.addColumn("p", packed);
+
+	std::vector<unsigned int> sel;
+	stx::parseExpression("p == i").evaluateBatch(batch, sel);
+	CPPUNIT_ASSERT( sel.size() == rows );
+
+	stx::parseExpression("p > 4").evaluateBatch(batch, sel);
+	CPPUNIT_ASSERT( sel.size() == 3 );
+    }
+
+    // compare two values including their type and the bits of floating point
+    // numbers.
+    static bool same_bits(const stx::AnyScalar &a, const stx::AnyScalar &b)
+    {
+	if (a.getType() != b.getType()) return false;
+
+	if (a.getType() == stx::AnyScalar::ATTRTYPE_DOUBLE ||
+	    a.getType() == stx::AnyScalar::ATTRTYPE_FLOAT)
+	{
+	    double da = a.getDouble(), db = b.getDouble();
+	    return memcmp(&da, &db, sizeof(double)) == 0;
+	}
+
+	return a.equal_to(b);
+    }
+
+    void test_simd()
+    {
+	// columns with a length which is not a multiple of the vector width
+	static const unsigned int n = 1003;
+
+	std::vector<int> vi(n), vj(n), vp(n), vq(n);
+	std::vector<long long> vl(n), vm(n);
+	std::vector<float> vf(n), vg(n);
+	std::vector<double> vd(n), ve(n);
+
+	unsigned int seed = 12345;
+
+	for(unsigned int r = 0; r < n; ++r)
+	{
+	    seed = seed * 1103515245 + 12345;
+	    int x = (seed >> 8) % 60001 - 30000;
+	    seed = seed * 1103515245 + 12345;
+	    int y = (seed >> 8) % 2001 - 1000;
+
+	    // no overflows and zero divisors in the arithmetic columns
+	    vi[r] = x;
+	    vj[r] = (y != 0) ? y : 1;
+	    vl[r] = static_cast<long long>(x) * 33333333LL + y;
+	    vm[r] = vj[r];
+	    vf[r] = static_cast<float>(x) / 7.0f;
+	    vg[r] = static_cast<float>(y) / 3.0f;
+	    vd[r] = static_cast<double>(x) / 3.0;
+	    ve[r] = static_cast<double>(y) * 1.5;
+
+	    // extreme values for the comparisons
+	    vp[r] = (r % 7 == 0) ? INT_MIN : (r % 7 == 1) ? INT_MAX : x % 5;
+	    vq[r] = (r % 5 == 0) ? INT_MAX : (r % 5 == 1) ? INT_MIN : y % 5;
+
+	    if (r % 11 == 0) { vf[r] = vg[r]; vd[r] = ve[r]; vl[r] = vm[r]; }
+	}
+
+	// special floating point values
+	vf[3] = NAN; vf[10] = INFINITY; vf[17] = -0.0f; vg[17] = 0.0f; vg[20] = -INFINITY;
+	vd[5] = NAN; ve[6] = NAN; vd[12] = INFINITY; ve[12] = INFINITY; vd[19] = -0.0; ve[19] = 0.0;
+
+	stx::ColumnBatch big(n);
+	big.addColumn("i", &vi[0]);
+	big.addColumn("j", &vj[0]);
+	big.addColumn("p", &vp[0]);
+	big.addColumn("q", &vq[0]);
+	big.addColumn("l", &vl[0]);
+	big.addColumn("m", &vm[0]);
+	big.addColumn("f", &vf[0]);
+	big.addColumn("g", &vg[0]);
+	big.addColumn("d", &vd[0]);
+	big.addColumn("e", &ve[0]);
+
+	static const char *arith[] = {
+	    "i OP j", "i OP 7", "3 OP j", "l OP m", "l OP i", "7 OP l",
+	    "f OP g", "f OP i", "i OP g", "f OP l", "f OP 2.5", "d OP e",
+	    "d OP f", "i OP d", "l OP e", "d OP 0.25", NULL
+	};
+	static const char *arithop[] = { "+", "-", "*", "/", NULL };
+
+	static const char *comp[] = {
+	    "p OP q", "p OP 0", "0 OP q", "i OP j", "l OP m", "l OP i",
+	    "f OP g", "f OP i", "l OP f", "d OP e", "d OP f", "e OP 0.0",
+	    "i OP d", "2 OP f", NULL
+	};
+	static const char *compop[] = { "==", "!=", "<", ">", "<=", ">=", NULL };
+
+	std::vector<std::string> exprs;
+
+	for(unsigned int x = 0; arith[x]; ++x)
+	{
+	    for(unsigned int o = 0; arithop[o]; ++o)
+	    {
+		std::string e = arith[x];
+		e.replace(e.find("OP"), 2, arithop[o]);
+		exprs.push_back(e);
+	    }
+	}
+	for(unsigned int x = 0; comp[x]; ++x)
+	{
+	    for(unsigned int o = 0; compop[o]; ++o)
+	    {
+		std::string e = comp[x];
+		e.replace(e.find("OP"), 2, compop[o]);
+		exprs.push_back(e);
+	    }
+	}
+
+	// calculate the expected values row by row
+	std::vector< std::vector<stx::AnyScalar> > expected(exprs.size());
+
+	for(unsigned int x = 0; x < exprs.size(); ++x)
+	{
+	    stx::ParseTree pt = stx::parseExpression(exprs[x]);
+
+	    for(unsigned int r = 0; r < n; ++r)
+	    {
+		stx::BasicSymbolTable rowst;
+		rowst.setVariable("i", vi[r]);
+		rowst.setVariable("j", vj[r]);
+		rowst.setVariable("p", vp[r]);
+		rowst.setVariable("q", vq[r]);
+		rowst.setVariable("l", vl[r]);
+		rowst.setVariable("m", vm[r]);
+		rowst.setVariable("f", vf[r]);
+		rowst.setVariable("g", vg[r]);
+		rowst.setVariable("d", vd[r]);
+		rowst.setVariable("e", ve[r]);
+
+		expected[x].push_back( pt.evaluate(rowst) );
+	    }
+	}
+
+	// all instruction sets supported by this processor must yield the same
+	// bits.
+	stx::BatchColumn::simd_t detected = stx::BatchColumn::detectSimd();
+
+	for(int level = stx::BatchColumn::SIMD_NONE; level <= detected; ++level)
+	{
+	    stx::BatchColumn::simd_t simd = static_cast<stx::BatchColumn::simd_t>(level);
+	    CPPUNIT_ASSERT( stx::BatchColumn::setSimd(simd) == simd );
+	    CPPUNIT_ASSERT( stx::BatchColumn::getSimd() == simd );
+	    CPPUNIT_ASSERT( stx::BatchColumn::getSimdName(simd) != NULL );
+
+	    for(unsigned int x = 0; x < exprs.size(); ++x)
+	    {
+		stx::BatchColumn result;
+		stx::parseExpression(exprs[x]).evaluateBatch(big, result);
+
+		CPPUNIT_ASSERT( result.size() == n );
+
+		for(unsigned int r = 0; r < n; ++r)
+		    CPPUNIT_ASSERT( same_bits(result.getValue(r), expected[x][r]) );
+	    }
+	}
+
+	// the selection is limited to the processor
+	CPPUNIT_ASSERT( stx::BatchColumn::setSimd(stx::BatchColumn::SIMD_AVX512) == detected );
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION( ColumnBatchTest );
@@ -0,0 +1,169 @@
+// $Id$
+
+/*
+ * STX Expression Parser C++ Framework v0.7
+ * Copyright (C) 2007 Timo Bingmann
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "ExpressionParser.h"
+
+#include <pthread.h>
+
+class ExpressionCacheTest : public CPPUNIT_NS::TestFixture
+{
+    CPPUNIT_TEST_SUITE( ExpressionCacheTest );
+    CPPUNIT_TEST(test_normalize);
+    CPPUNIT_TEST(test_lru);
+    CPPUNIT_TEST(test_threads);
+    CPPUNIT_TEST_SUITE_END();
+
+protected:
+
+    // expressions parsed concurrently by the threads
+    static const char* const thread_exprs[8];
+
+    struct ThreadData
+    {
+	stx::ExpressionCache	*cache;
+	unsigned int		seed;
+	unsigned int		errors;
+    };
+
+    static void* thread_run(void *arg)
+    {
+	ThreadData &td = *static_cast<ThreadData*>(arg);
+
+	stx::BasicSymbolTable bst;
+	bst.setVariable("a", 3);
+
+	for(unsigned int i = 0; i < 2000; ++i)
+	{
+	    td.seed = td.seed * 1103515245 + 12345;
+	    unsigned int e = (td.seed >> 16) % 8;
+
+	    stx::ParseTree pt = td.cache->parse(thread_exprs[e]);
+
+	    if (pt.evaluate(bst) != stx::AnyScalar(static_cast<int>(3 + e)))
+		td.errors++;
+	}
+
+	return NULL;
+    }
+
+public:
+
+    void test_normalize()
+    {
+	CPPUNIT_ASSERT( stx::ExpressionCache::normalize("  a  +\tb\n") == "a + b " );
+	CPPUNIT_ASSERT( stx::ExpressionCache::normalize("a==\"x  y\"") == "a==\"x  y\"" );
+	CPPUNIT_ASSERT( stx::ExpressionCache::normalize("\"a\\\"  b\"  c") == "\"a\\\"  b\" c" );
+	CPPUNIT_ASSERT( stx::ExpressionCache::normalize("! =") == "! =" );
+	CPPUNIT_ASSERT( stx::ExpressionCache::normalize("") == "" );
+    }
+
+    void test_lru()
+    {
+	stx::ExpressionCache cache(3, 1024 * 1024, 1);
+
+	stx::ParseTree pt1 = cache.parse("a + 1");
+	stx::ParseTree pt2 = cache.parse("  a  +   1");
+	CPPUNIT_ASSERT( pt1.toString() == "(a + 1)" );
+	CPPUNIT_ASSERT( pt2.toString() == "(a + 1)" );
+
+	stx::ExpressionCache::Statistics stats = cache.getStatistics();
+	CPPUNIT_ASSERT( stats.hits == 1 && stats.misses == 1 );
+	CPPUNIT_ASSERT( stats.entries == 1 && stats.bytes >= pt1.getMemoryUsage() );
+
+	cache.parse("b");
+	cache.parse("c");
+	cache.parse("a + 1");	// now the most recently used
+	cache.parse("d");	// evicts b
+
+	stats = cache.getStatistics();
+	CPPUNIT_ASSERT( stats.entries == 3 && stats.evictions == 1 );
+
+	cache.parse("a \t+ 1");
+	cache.parse("a + 1");
+	cache.parse("c");
+	CPPUNIT_ASSERT( cache.getStatistics().hits == 5 );
+
+	cache.parse("b");
+	CPPUNIT_ASSERT( cache.getStatistics().misses == 5 );
+
+	// errors are passed on and not cached, also if the normalized key is
+	// valid.
+	CPPUNIT_ASSERT_THROW( cache.parse("a +"), stx::BadSyntaxException );
+	CPPUNIT_ASSERT_THROW( cache.parse("1 / 0"), stx::ArithmeticException );
+	CPPUNIT_ASSERT_THROW( cache.parse("c "), stx::BadSyntaxException );
+	CPPUNIT_ASSERT( cache.getStatistics().entries == 3 );
+
+	// the byte capacity evicts as well
+	stx::ExpressionCache small(100, 2000, 1);
+	small.parse("x + 1");
+	small.parse("x + 2");
+	small.parse("x + 3");
+	small.parse("x + 4");
+
+	stats = small.getStatistics();
+	CPPUNIT_ASSERT( stats.bytes <= 2000 && stats.evictions > 0 );
+	CPPUNIT_ASSERT( stats.entries + stats.evictions == 4 );
+
+	// cached trees remain valid after clearing
+	cache.clear();
+	CPPUNIT_ASSERT( cache.getStatistics().entries == 0 );
+	CPPUNIT_ASSERT( pt1.toString() == "(a + 1)" );
+    }
+
+    void test_threads()
+    {
+	stx::ExpressionCache cache(6, 1024 * 1024, 4);
+
+	const unsigned int threadnum = 8;
+	pthread_t threads[threadnum];
+	ThreadData data[threadnum];
+
+	for(unsigned int t = 0; t < threadnum; ++t)
+	{
+	    data[t].cache = &cache;
+	    data[t].seed = t;
+	    data[t].errors = 0;
+	    CPPUNIT_ASSERT( pthread_create(&threads[t], NULL, thread_run, &data[t]) == 0 );
+	}
+
+	unsigned int errors = 0;
+	for(unsigned int t = 0; t < threadnum; ++t)
+	{
+	    pthread_join(threads[t], NULL);
+	    errors += data[t].errors;
+	}
+
+	CPPUNIT_ASSERT( errors == 0 );
+
+	stx::ExpressionCache::Statistics stats = cache.getStatistics();
+	CPPUNIT_ASSERT( stats.hits + stats.misses == threadnum * 2000 );
+	CPPUNIT_ASSERT( stats.entries <= 6 );
+	CPPUNIT_ASSERT( stats.entries + stats.evictions <= stats.misses );
+    }
+};
+
+const char* const ExpressionCacheTest::thread_exprs[8] = {
+    "a", "a + 1", "a + 2", "a + 3", "a + 4", "2 + a + 3", "a * 2 + 3 * (1 + 1) - 3", "(integer)(a * 2.5) + 3"
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION( ExpressionCacheTest );
@@ -0,0 +1,231 @@
+// $Id$
+
+/*
+ * STX Expression Parser C++ Framework v0.7
+ * Copyright (C) 2007 Timo Bingmann
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "ExpressionParser.h"
+
+#include <algorithm>
+#include <limits>
+
+class ExpressionIndexTest : public CPPUNIT_NS::TestFixture
+{
+    CPPUNIT_TEST_SUITE( ExpressionIndexTest );
+    CPPUNIT_TEST(test_match);
+    CPPUNIT_TEST(test_random);
+    CPPUNIT_TEST_SUITE_END();
+
+protected:
+
+    // operands of the random subscriptions
+    static const char* const atoms[30];
+
+    // values of the random records' variables
+    static stx::AnyScalar randomValue(unsigned int &seed, char var)
+    {
+	seed = seed * 1103515245 + 12345;
+	unsigned int r = (seed >> 16) % 8;
+
+	switch(var)
+	{
+	case 'a':
+	{
+	    static const stx::AnyScalar values[8] = {
+		stx::AnyScalar(-2), stx::AnyScalar(0), stx::AnyScalar(2), stx::AnyScalar(2.5),
+		stx::AnyScalar(-0.0), stx::AnyScalar(3LL), stx::AnyScalar("2"),
+		stx::AnyScalar(std::numeric_limits<double>::quiet_NaN())
+	    };
+	    return values[r];
+	}
+	case 's':
+	{
+	    static const stx::AnyScalar values[8] = {
+		stx::AnyScalar("x"), stx::AnyScalar("y"), stx::AnyScalar("m"), stx::AnyScalar("x"),
+		stx::AnyScalar("y"), stx::AnyScalar(""), stx::AnyScalar(1), stx::AnyScalar(true)
+	    };
+	    return values[r];
+	}
+	case 'f':
+	{
+	    static const stx::AnyScalar values[8] = {
+		stx::AnyScalar(true), stx::AnyScalar(false), stx::AnyScalar(true), stx::AnyScalar(false),
+		stx::AnyScalar(1), stx::AnyScalar("true"), stx::AnyScalar(true), stx::AnyScalar(0.0f)
+	    };
+	    return values[r];
+	}
+	default:
+	{
+	    static const stx::AnyScalar values[8] = {
+		stx::AnyScalar(3000000000LL), stx::AnyScalar(9007199254740993LL), stx::AnyScalar(5),
+		stx::AnyScalar(5u), stx::AnyScalar(-1), stx::AnyScalar(3000000000.0),
+		stx::AnyScalar(2.0f), stx::AnyScalar(9007199254740992LL)
+	    };
+	    return values[r];
+	}
+	}
+    }
+
+public:
+
+    void test_match()
+    {
+	stx::ExpressionIndex index;
+
+	unsigned int id0 = index.add( stx::parseExpression("a > 5 && b == \"x\"") );
+	unsigned int id1 = index.add( stx::parseExpression("10 >= a and c") );
+	unsigned int id2 = index.add( stx::parseExpression("a == 7 || b == \"y\"") );
+	unsigned int id3 = index.add( stx::parseExpression("a * 2 == 14 and !c") );
+	unsigned int id4 = index.add( stx::parseExpression("true") );
+
+	CPPUNIT_ASSERT( index.size() == 5 );
+	CPPUNIT_ASSERT( id0 == 0 && id1 == 1 && id2 == 2 && id3 == 3 && id4 == 4 );
+
+	stx::BasicSymbolTable bst;
+	bst.setVariable("a", 7);
+	bst.setVariable("b", "x");
+	bst.setVariable("c", false);
+
+	std::vector<unsigned int> matches;
+	index.match(bst, matches);
+
+	CPPUNIT_ASSERT( matches.size() == 4 );
+	CPPUNIT_ASSERT( matches[0] == 0 && matches[1] == 2 && matches[2] == 3 && matches[3] == 4 );
+
+	bst.setVariable("a", 7.5);
+	bst.setVariable("b", "y");
+	bst.setVariable("c", true);
+	index.match(bst, matches);
+
+	CPPUNIT_ASSERT( matches.size() == 3 );
+	CPPUNIT_ASSERT( matches[0] == 1 && matches[1] == 2 && matches[2] == 4 );
+
+	// an unknown variable fails the predicates on it
+	bst.clearVariables();
+	bst.setVariable("b", "y");
+	index.match(bst, matches);
+
+	CPPUNIT_ASSERT( matches.size() == 1 && matches[0] == 4 );
+
+	// a variable of another type is decided by evaluation: c is no bool
+	bst.setVariable("a", 3);
+	bst.setVariable("c", 1);
+	index.match(bst, matches);
+
+	CPPUNIT_ASSERT( matches.size() == 2 && matches[0] == 2 && matches[1] == 4 );
+
+	// removed ids are reused
+	CPPUNIT_ASSERT( index.remove(id2) );
+	CPPUNIT_ASSERT( !index.remove(id2) );
+	CPPUNIT_ASSERT( !index.remove(100) );
+	CPPUNIT_ASSERT( index.size() == 4 );
+
+	bst.setVariable("a", 7);
+	bst.setVariable("c", false);
+	index.match(bst, matches);
+	CPPUNIT_ASSERT( matches.size() == 2 && matches[0] == 3 && matches[1] == 4 );
+
+	CPPUNIT_ASSERT( index.add( stx::parseExpression("b != \"x\"") ) == id2 );
+	index.match(bst, matches);
+	CPPUNIT_ASSERT( matches.size() == 3 && matches[0] == 2 );
+
+	CPPUNIT_ASSERT( stx::ExpressionIndex::evaluate(stx::parseExpression("a == 7"), bst) );
+	CPPUNIT_ASSERT( !stx::ExpressionIndex::evaluate(stx::parseExpression("a + 7"), bst) );
+	CPPUNIT_ASSERT( !stx::ExpressionIndex::evaluate(stx::parseExpression("a == z"), bst) );
+    }
+
+    void test_random()
+    {
+	stx::ExpressionIndex index;
+	std::vector<stx::ParseTree> trees;
+	std::vector<unsigned int> ids;
+	unsigned int seed = 1;
+
+	// random subscriptions of up to three operands joined by and/or
+	for(unsigned int i = 0; i < 2000; ++i)
+	{
+	    std::string expr;
+	    seed = seed * 1103515245 + 12345;
+	    unsigned int n = 1 + (seed >> 16) % 3;
+
+	    for(unsigned int j = 0; j < n; ++j)
+	    {
+		seed = seed * 1103515245 + 12345;
+		if (j > 0) expr += ((seed >> 8) % 3 == 0) ? " or " : " and ";
+		expr += atoms[(seed >> 16) % 30];
+	    }
+
+	    trees.push_back( stx::parseExpression(expr) );
+	    ids.push_back( index.add(trees.back()) );
+	    CPPUNIT_ASSERT( ids.back() == i );
+	}
+
+	std::vector<unsigned int> matches, expected;
+	stx::BasicSymbolTable bst;
+
+	for(unsigned int r = 0; r < 400; ++r)
+	{
+	    // remove and re-add some subscriptions in between
+	    if (r % 50 == 49)
+	    {
+		for(unsigned int i = r; i < trees.size(); i += 7)
+		    CPPUNIT_ASSERT( index.remove(ids[i]) );
+
+		for(unsigned int i = r; i < trees.size(); i += 7)
+		    ids[i] = index.add(trees[i]);
+
+		CPPUNIT_ASSERT( index.size() == trees.size() );
+	    }
+
+	    bst.clearVariables();
+
+	    const char vars[4] = { 'a', 's', 'f', 'l' };
+	    for(unsigned int v = 0; v < 4; ++v)
+	    {
+		seed = seed * 1103515245 + 12345;
+		if ((seed >> 16) % 8 == 0) continue;	// missing variable
+
+		bst.setVariable(std::string(1, vars[v]), randomValue(seed, vars[v]));
+	    }
+
+	    expected.clear();
+	    for(unsigned int i = 0; i < trees.size(); ++i)
+	    {
+		if (stx::ExpressionIndex::evaluate(trees[i], bst))
+		    expected.push_back(ids[i]);
+	    }
+	    std::sort(expected.begin(), expected.end());
+
+	    index.match(bst, matches);
+	    CPPUNIT_ASSERT( matches == expected );
+	}
+    }
+};
+
+const char* const ExpressionIndexTest::atoms[30] = {
+    "a > 1", "a >= 2", "a < 0", "a <= -2", "a == 2", "a == 0", "3 > a", "2 <= a",
+    "a == 2.5", "a != 2", "a + 1 > 2", "a > 2.25",
+    "s == \"x\"", "\"y\" == s", "s < \"n\"", "s != \"m\"",
+    "f", "!f", "f == true", "not (f == false)", "f and a > 0",
+    "l > 2999999999", "l == 9007199254740992", "l <= 5", "l == 5", "l == -1.0",
+    "(a > 0 or s == \"y\")", "(f or l < 0)", "f != false", "s != 1"
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION( ExpressionIndexTest );
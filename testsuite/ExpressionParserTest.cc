@@ -24,12 +24,23 @@
 #include "ExpressionParser.h"
 
 #include <stdlib.h>
+#include <sstream>
+#include <algorithm>
 #include <boost/lexical_cast.hpp>
 
 class ExpressionParserTest : public CPPUNIT_NS::TestFixture
 {
     CPPUNIT_TEST_SUITE( ExpressionParserTest );
     CPPUNIT_TEST(test1);
+    CPPUNIT_TEST(test_arena);
+    CPPUNIT_TEST(test_spirit);
+    CPPUNIT_TEST(test_list);
+    CPPUNIT_TEST(test_variables);
+    CPPUNIT_TEST(test_functioncall);
+    CPPUNIT_TEST(test_conjuncts);
+    CPPUNIT_TEST(test_bulk);
+    CPPUNIT_TEST(test_optimize);
+    CPPUNIT_TEST(test_purefunctions);
     CPPUNIT_TEST_SUITE_END();
 
 protected:
@@ -110,6 +121,400 @@ protected:
 	    CPPUNIT_ASSERT( xmlstr.size() == 1010 );
 	}
     }
+
+    void test_arena()
+    {
+	stx::BasicSymbolTable bst;
+	bst.setVariable("a", 2);
+
+	CPPUNIT_ASSERT( stx::ParseTree().getMemoryUsage() == 0 );
+
+	// folded subtrees are released: the constant fits into the first block
+	stx::ParseTree pt = stx::parseExpression("((1 + 2) * 3 - 4 / 2 + (integer)\"5\") * 2 == 24 && (2 > 1 || false)");
+	CPPUNIT_ASSERT( pt.toString() == "true" );
+	CPPUNIT_ASSERT( pt.getMemoryUsage() == 512 );
+
+	// large trees allocate more blocks
+	std::string expr = "a";
+	for(unsigned int i = 0; i < 1000; ++i)
+	    expr += " + a * 2";
+
+	pt = stx::parseExpression(expr);
+	CPPUNIT_ASSERT( pt.getMemoryUsage() > 1000 * 3 * 32 );
+	CPPUNIT_ASSERT( pt.evaluate(bst) == 4002 );
+
+	// compiled programs keep the arena alive
+	stx::ParseProgram pp = pt.compile();
+	pt = stx::ParseTree();
+	CPPUNIT_ASSERT( pp.evaluate(bst) == 4002 );
+
+	// errors while building the tree release all nodes
+	CPPUNIT_ASSERT_THROW( stx::parseExpression("a + f(a, a * 2, 1 / 0)"), stx::ArithmeticException );
+
+	// mark and release nodes directly in an arena
+	stx::ParseArena arena(64);
+	CPPUNIT_ASSERT( arena.getMemoryUsage() == 0 );
+
+	void *p1 = arena.allocate(8);
+	stx::ParseArena::Mark m = arena.mark();
+	arena.allocate(200);
+	CPPUNIT_ASSERT( arena.getMemoryUsage() > 64 );
+
+	arena.release(m);
+	CPPUNIT_ASSERT( arena.getMemoryUsage() == 64 );
+	CPPUNIT_ASSERT( arena.allocate(8) == static_cast<char*>(p1) + 16 );
+    }
+
+    // parse the expression with both parsers and return the tree or the
+    // error message.
+    static std::string parse_with(const stx::ParseTree (*parser)(const std::string &),
+				  const std::string &input)
+    {
+	try {
+	    return parser(input).toString();
+	}
+	catch (stx::ExpressionParserException &e) {
+	    return std::string("error: ") + e.what();
+	}
+    }
+
+    void test_spirit()
+    {
+	// the hand-written parser creates the same trees and reports the same
+	// errors as the spirit grammar.
+	static const char* const inputs[] = {
+	    "a + b * c ^ 2 ^ 3 - -d / +e",
+	    "(int)x + (integer) 5.5 * ( double )\"1e3\"",
+	    "(Int)x", "(int)", "(int) + 3", "(inte)",
+	    "not a and NOT b or !c && nothing", "not", "- - 5", "--5", "+-5.",
+	    "a == b != c <= d >= e =< f => g = h < i > j", "a <> b", "a = = b",
+	    "x andy", "x oR y", "a &&& b", "a || or",
+	    "f()", "f(a)", "f (a, b+1, g(c, (d)))", "f(a,)", "f(,a)", "f(a b)",
+	    "1.5e3 + .5 + 5. + 1.e2 + 2E-2", "1e", "1.e", ".e5", ".", "1e99999",
+	    "2147483647 + 2147483648 + -2147483648 + -2147483649",
+	    "true + TRUE + falsey + false_",
+	    "\"a\\\"b\" + \"\\x41\\X7f\\101\\777\"", "\"\\x80\"", "\"\\xg\"", "\"abc",
+	    "1 / 0", "(1 / 0", "a + 1 / 0 +", "(integer)\"abc\"", "!5", "1 / 0 + a +",
+	    "a ", " a", "", "  ", "a\tb", "(a", "a)", "a + (b * c",
+	    NULL
+	};
+
+	for(const char* const* in = inputs; *in; ++in)
+	{
+	    CPPUNIT_ASSERT_EQUAL( parse_with(stx::parseExpressionSpirit, *in),
+				  parse_with(stx::parseExpression, *in) );
+	}
+
+	CPPUNIT_ASSERT( parse_with(stx::parseExpression, "a ") == "error: Syntax error at position 1 near  " );
+	CPPUNIT_ASSERT_THROW( stx::parseExpression("2 * (1 / 0)"), stx::ArithmeticException );
+	CPPUNIT_ASSERT_THROW( stx::parseExpression("2 * (1 / 0"), stx::BadSyntaxException );
+    }
+
+    void test_list()
+    {
+	stx::ParseTreeList ptl = stx::parseExpressionList("a + b, 5 * 3, f(x, y)");
+	CPPUNIT_ASSERT( ptl.size() == 3 );
+	CPPUNIT_ASSERT( ptl.toString() == "(a + b), 15, f(x,y)" );
+
+	CPPUNIT_ASSERT( stx::parseExpressionList("a + b").size() == 1 );
+	CPPUNIT_ASSERT( stx::parseExpressionList("(a)").size() == 1 );
+	CPPUNIT_ASSERT( stx::parseExpressionList("").size() == 0 );
+
+	CPPUNIT_ASSERT_THROW( stx::parseExpressionList("a, "), stx::BadSyntaxException );
+	CPPUNIT_ASSERT_THROW( stx::parseExpressionList("a, 1 / 0"), stx::ArithmeticException );
+    }
+
+    void test_variables()
+    {
+	std::set<std::string> vars = stx::parseExpression("a + b * (c > 2 and not d) - f((int)x, -y, 3) + a").getVariables();
+	CPPUNIT_ASSERT( vars.size() == 6 );
+
+	const char* expected[6] = { "a", "b", "c", "d", "x", "y" };
+	CPPUNIT_ASSERT( std::equal(vars.begin(), vars.end(), expected) );
+
+	CPPUNIT_ASSERT( stx::parseExpression("5 * 3 == 15 or \"x\" != \"y\"").getVariables().empty() );
+	CPPUNIT_ASSERT( stx::parseExpression("f()").getVariables().empty() );
+
+	// string references are copied into the symbol table
+	char line[] = "abc\tlonger than the inline string buffer";
+
+	stx::AnyScalar ref;
+	stx::BasicSymbolTable bst;
+	bst.setVariable("s", ref.setAutoStringRef(line, 3));
+	bst.setVariable("l", ref.setAutoStringRef(line + 4, sizeof(line) - 5));
+
+	for(unsigned int i = 0; i < sizeof(line) - 1; ++i)
+	    line[i] = 'x';
+
+	CPPUNIT_ASSERT( stx::parseExpression("s").evaluate(bst) == "abc" );
+	CPPUNIT_ASSERT( stx::parseExpression("l").evaluate(bst) == "longer than the inline string buffer" );
+	CPPUNIT_ASSERT( !bst.lookupVariable("s").isStringRef() );
+    }
+
+    void test_functioncall()
+    {
+	std::string funcname;
+	std::vector<stx::ParseTree> params;
+
+	stx::ParseTreeList ptl = stx::parseExpressionList("sum(a * 2), count(), f(1, b), a + sum(b), c");
+	CPPUNIT_ASSERT( ptl.size() == 5 );
+
+	CPPUNIT_ASSERT( ptl[0].getFunctionCall(funcname, params) );
+	CPPUNIT_ASSERT( funcname == "sum" && params.size() == 1 );
+	CPPUNIT_ASSERT( params[0].toString() == "(a * 2)" );
+
+	stx::BasicSymbolTable bst;
+	bst.setVariable("a", 21);
+	CPPUNIT_ASSERT( params[0].evaluate(bst) == stx::AnyScalar(42) );
+
+	CPPUNIT_ASSERT( ptl[1].getFunctionCall(funcname, params) );
+	CPPUNIT_ASSERT( funcname == "count" && params.empty() );
+
+	CPPUNIT_ASSERT( ptl[2].getFunctionCall(funcname, params) );
+	CPPUNIT_ASSERT( funcname == "f" && params.size() == 2 );
+	CPPUNIT_ASSERT( params[0].toString() == "1" && params[1].toString() == "b" );
+
+	CPPUNIT_ASSERT( !ptl[3].getFunctionCall(funcname, params) );
+	CPPUNIT_ASSERT( !ptl[4].getFunctionCall(funcname, params) );
+
+	// the parameter trees keep the nodes alive
+	params.clear();
+	CPPUNIT_ASSERT( stx::parseExpression("g(x + 1)").getFunctionCall(funcname, params) );
+	bst.setVariable("x", 1);
+	CPPUNIT_ASSERT( params[0].evaluate(bst) == stx::AnyScalar(2) );
+    }
+
+    void test_conjuncts()
+    {
+	std::vector<stx::ParseTree> operands;
+	std::string varname;
+	int op;
+	stx::AnyScalar value;
+
+	stx::parseExpression("a > 5 && (\"x\" == b AND c + 1 < 2) && d").getConjuncts(operands);
+	CPPUNIT_ASSERT( operands.size() == 4 );
+
+	CPPUNIT_ASSERT( operands[0].getPredicate(varname, op, value) );
+	CPPUNIT_ASSERT( varname == "a" && op == stx::ParseProgram::OP_GREATER && value == stx::AnyScalar(5) );
+
+	CPPUNIT_ASSERT( operands[1].getPredicate(varname, op, value) );
+	CPPUNIT_ASSERT( varname == "b" && op == stx::ParseProgram::OP_EQUAL && value == stx::AnyScalar("x") );
+
+	CPPUNIT_ASSERT( !operands[2].getPredicate(varname, op, value) );
+
+	CPPUNIT_ASSERT( operands[3].getPredicate(varname, op, value) );
+	CPPUNIT_ASSERT( varname == "d" && op == stx::ParseProgram::OP_EQUAL && value == stx::AnyScalar(true) );
+
+	// the constant is moved to the right side
+	stx::parseExpression("10 <= x").getConjuncts(operands);
+	CPPUNIT_ASSERT( operands.size() == 1 );
+	CPPUNIT_ASSERT( operands[0].getPredicate(varname, op, value) );
+	CPPUNIT_ASSERT( varname == "x" && op == stx::ParseProgram::OP_GREATEREQUAL && value == stx::AnyScalar(10) );
+
+	// an or-chain is a single operand
+	stx::parseExpression("a > 5 || b < 2").getConjuncts(operands);
+	CPPUNIT_ASSERT( operands.size() == 1 );
+	CPPUNIT_ASSERT( !operands[0].getPredicate(varname, op, value) );
+
+	// the operands keep the nodes alive
+	stx::parseExpression("y == 2 * 21 and z").getConjuncts(operands);
+	CPPUNIT_ASSERT( operands.size() == 2 );
+	CPPUNIT_ASSERT( operands[0].getPredicate(varname, op, value) );
+	CPPUNIT_ASSERT( varname == "y" && value == stx::AnyScalar(42) );
+    }
+
+    void test_bulk()
+    {
+	std::vector<std::string> inputs;
+	for(unsigned int i = 0; i < 1000; ++i)
+	{
+	    std::ostringstream oss;
+	    if (i % 100 == 7)
+		oss << "a + " << i << " *";
+	    else
+		oss << "a + " << i << " * 2";
+	    inputs.push_back(oss.str());
+	}
+
+	std::vector<stx::BulkParseResult> results = stx::parseExpressionBulk(inputs, 4);
+	CPPUNIT_ASSERT( results.size() == 1000 );
+
+	stx::BasicSymbolTable bst;
+	bst.setVariable("a", 1);
+
+	for(unsigned int i = 0; i < results.size(); ++i)
+	{
+	    CPPUNIT_ASSERT( results[i].line == i );
+
+	    if (i % 100 == 7) {
+		CPPUNIT_ASSERT( results[i].isError() );
+		CPPUNIT_ASSERT( results[i].error.find("Syntax error at position") == 0 );
+	    }
+	    else {
+		CPPUNIT_ASSERT( !results[i].isError() && results[i].error.empty() );
+		CPPUNIT_ASSERT( results[i].tree.evaluate(bst) == stx::AnyScalar(static_cast<int>(1 + i * 2)) );
+	    }
+	}
+
+	// read expressions from a stream, skipping empty lines
+	std::istringstream iss("a + 1\r\n\n  \n1 / 0\nb(\n");
+	results = stx::parseExpressionBulk(iss);
+
+	CPPUNIT_ASSERT( results.size() == 3 );
+	CPPUNIT_ASSERT( results[0].line == 1 && results[0].tree.toString() == "(a + 1)" );
+	CPPUNIT_ASSERT( results[1].line == 4 && results[1].isError() );
+	CPPUNIT_ASSERT( results[2].line == 5 && results[2].isError() );
+    }
+
+    std::string optimize(const std::string &input, stx::OptimizeLog *log = NULL)
+    {
+	stx::OptimizeOptions opts;
+	opts.vartypes["i"] = stx::AnyScalar::ATTRTYPE_INTEGER;
+	opts.vartypes["l"] = stx::AnyScalar::ATTRTYPE_LONG;
+	opts.vartypes["d"] = stx::AnyScalar::ATTRTYPE_DOUBLE;
+	opts.vartypes["b"] = stx::AnyScalar::ATTRTYPE_BOOL;
+	opts.standardfunctions = true;
+
+	stx::ParseTree pt = stx::parseExpression(input);
+	stx::ParseTree opt = pt.optimize(opts, log);
+
+	// both trees must yield the same value
+	stx::BasicSymbolTable bst;
+	bst.addStandardFunctions();
+	bst.setVariable("i", 5);
+	bst.setVariable("l", static_cast<long long>(5000000000LL));
+	bst.setVariable("d", -2.5);
+	bst.setVariable("b", true);
+	bst.setVariable("x", 3);
+
+	CPPUNIT_ASSERT( pt.evaluate(bst) == opt.evaluate(bst) );
+
+	return opt.toString();
+    }
+
+    void test_optimize()
+    {
+	// identities
+	CPPUNIT_ASSERT( optimize("i * 1 + 0") == "i" );
+	CPPUNIT_ASSERT( optimize("1 * d / 1") == "d" );
+	CPPUNIT_ASSERT( optimize("i * 0 + 2") == "2" );
+	CPPUNIT_ASSERT( optimize("-(-i)") == "i" );
+	CPPUNIT_ASSERT( optimize("not (not b)") == "b" );
+	CPPUNIT_ASSERT( optimize("+x") == "x" );
+
+	// not exact for these types or unknown variables
+	CPPUNIT_ASSERT( optimize("d + 0") == "(d + 0)" );
+	CPPUNIT_ASSERT( optimize("d * 0") == "(d * 0)" );
+	CPPUNIT_ASSERT( optimize("x * 1") == "(x * 1)" );
+	CPPUNIT_ASSERT( optimize("not (not (x > 1))") == "(x > 1)" );
+
+	// redundant casts
+	CPPUNIT_ASSERT( optimize("(integer)i + (long)(i * 1.5)") == "(i + ((long)(i * 1.5)))" );
+	CPPUNIT_ASSERT( optimize("(bool)(i > 2)") == "(i > 2)" );
+
+	// strength reduction
+	CPPUNIT_ASSERT( optimize("d ^ 2") == "(d * d)" );
+	CPPUNIT_ASSERT( optimize("POW(i, 2)") == "(((double)i) * ((double)i))" );
+	CPPUNIT_ASSERT( optimize("x ^ 2") == "(x ^ 2)" );
+
+	// re-association of constants
+	CPPUNIT_ASSERT( optimize("((i + 1) + 2) - 5") == "(i - 2)" );
+	CPPUNIT_ASSERT( optimize("2 * (i * 3)") == "(i * 6)" );
+	CPPUNIT_ASSERT( optimize("(l - 1) + 3") == "(l + 2)" );
+	CPPUNIT_ASSERT( optimize("(d + 1) + 2") == "((d + 1) + 2)" );
+
+	// comparisons
+	CPPUNIT_ASSERT( optimize("i + 3 > 10") == "(i > 7)" );
+	CPPUNIT_ASSERT( optimize("10 <= i - 3 and b") == "((13 <= i) && b)" );
+	CPPUNIT_ASSERT( optimize("d + 3 > 10") == "((d + 3) > 10)" );
+
+	// the log contains each rewrite
+	stx::OptimizeLog log;
+	CPPUNIT_ASSERT( optimize("(i + 1) + 2 > 4 * 1", &log) == "(i > 1)" );
+	CPPUNIT_ASSERT( log.size() == 2 );
+	CPPUNIT_ASSERT( log[0].first == "((i + 1) + 2)" && log[0].second == "(i + 3)" );
+	CPPUNIT_ASSERT( log[1].first == "((i + 3) > 4)" && log[1].second == "(i > 1)" );
+
+	// exceptions are kept
+	stx::OptimizeOptions opts;
+	opts.vartypes["i"] = stx::AnyScalar::ATTRTYPE_INTEGER;
+
+	stx::BasicSymbolTable bst;
+	bst.setVariable("i", 5);
+
+	stx::ParseTree opt = stx::parseExpression("(i / (i - 5)) * 0").optimize(opts);
+	CPPUNIT_ASSERT( opt.toString() == "((i / (i - 5)) * 0)" );
+	CPPUNIT_ASSERT_THROW( opt.evaluate(bst), stx::ArithmeticException );
+
+	// a folded pure call deciding the result does not drop the exceptions
+	// of the left operand, but is folded after one which cannot throw.
+	bst.setFunction("SQUARE", 1, funcSQUARE, true);
+	bst.setVariable("b", true);
+
+	opts.symboltable = &bst;
+	opts.vartypes["b"] = stx::AnyScalar::ATTRTYPE_BOOL;
+
+	opt = stx::parseExpression("(i / (i - 5)) > 1 && SQUARE(2) > 5").optimize(opts);
+	CPPUNIT_ASSERT( opt.toString() == "(((i / (i - 5)) > 1) && false)" );
+	CPPUNIT_ASSERT_THROW( opt.evaluate(bst), stx::ArithmeticException );
+
+	opt = stx::parseExpression("(i / (i - 5)) > 1 || SQUARE(2) < 5").optimize(opts);
+	CPPUNIT_ASSERT( opt.toString() == "(((i / (i - 5)) > 1) || true)" );
+	CPPUNIT_ASSERT_THROW( opt.evaluate(bst), stx::ArithmeticException );
+
+	CPPUNIT_ASSERT( stx::parseExpression("i > 1 && SQUARE(2) > 5").optimize(opts).toString() == "false" );
+	CPPUNIT_ASSERT( stx::parseExpression("b || SQUARE(2) < 5").optimize(opts).toString() == "true" );
+	CPPUNIT_ASSERT( stx::parseExpression("SQUARE(2) < 5 && b").optimize(opts).toString() == "b" );
+	CPPUNIT_ASSERT( stx::parseExpression("(i / (i - 5)) > 1 && SQUARE(2) < 5").optimize(opts).toString() == "((i / (i - 5)) > 1)" );
+    }
+
+    static int calls;
+
+    static stx::AnyScalar funcSQUARE(const stx::SymbolTable::paramlist_type &paramlist)
+    {
+	++calls;
+	return paramlist[0].getInteger() * paramlist[0].getInteger();
+    }
+
+    void test_purefunctions()
+    {
+	stx::BasicSymbolTable bst;
+	bst.setFunction("SQUARE", 1, funcSQUARE, true);
+	bst.setFunction("IMPURE", 1, funcSQUARE);
+
+	stx::OptimizeOptions opts;
+	opts.symboltable = &bst;
+
+	// constant arguments are folded
+	stx::ParseTree pt = stx::parseExpression("SQUARE(3) * x + IMPURE(2) + SQRT(4) + PI() * 0");
+	stx::ParseTree opt = pt.optimize(opts);
+
+	CPPUNIT_ASSERT( opt.toString() == "((((9 * x) + IMPURE(2)) + 2) + 0)" );
+
+	// calls with variable arguments are memoized
+	opts.memoize = 2;
+	opt = stx::parseExpression("SQUARE(x) + SQUARE(x + 1) + IMPURE(x)").optimize(opts);
+
+	CPPUNIT_ASSERT( opt.toString() == "((SQUARE(x) + SQUARE((x + 1))) + IMPURE(x))" );
+
+	calls = 0;
+	for(unsigned int i = 0; i < 100; ++i)
+	{
+	    bst.setVariable("x", static_cast<int>(i % 2));
+	    CPPUNIT_ASSERT( opt.evaluate(bst) == stx::AnyScalar(static_cast<int>((i % 2) * 5 + 1)) );
+	}
+
+	// two memoized calls with two argument values each and the impure call
+	CPPUNIT_ASSERT( calls == 4 + 100 );
+
+	// compiled programs also use the cache
+	calls = 0;
+	stx::ParseProgram prog = opt.compile();
+	CPPUNIT_ASSERT( prog.evaluate(bst) == stx::AnyScalar(6) );
+	CPPUNIT_ASSERT( calls == 1 );
+    }
 };
 
+int ExpressionParserTest::calls = 0;
+
 CPPUNIT_TEST_SUITE_REGISTRATION( ExpressionParserTest );
@@ -0,0 +1,370 @@
+// $Id$
+
+/*
+ * STX Expression Parser C++ Framework v0.7
+ * Copyright (C) 2007 Timo Bingmann
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "ExpressionParser.h"
+
+#include <stdlib.h>
+
+static double hypot2(double x, double y)
+{
+    return x * x + y * y;
+}
+
+static int countchars(const std::string &str, int c)
+{
+    int n = 0;
+    for(unsigned int i = 0; i < str.size(); ++i)
+	if (str[i] == c) ++n;
+    return n;
+}
+
+static bool iseven(long long v)
+{
+    return (v % 2) == 0;
+}
+
+static unsigned int slowcalls = 0;
+
+static bool slowcheck(int v)
+{
+    ++slowcalls;
+    return v > 0;
+}
+
+class ParseProgramTest : public CPPUNIT_NS::TestFixture
+{
+    CPPUNIT_TEST_SUITE( ParseProgramTest );
+    CPPUNIT_TEST(test_compare);
+    CPPUNIT_TEST(test_exceptions);
+    CPPUNIT_TEST(test_copy);
+    CPPUNIT_TEST(test_bind);
+    CPPUNIT_TEST(test_functions);
+    CPPUNIT_TEST(test_shortcircuit);
+    CPPUNIT_TEST(test_adaptive);
+    CPPUNIT_TEST_SUITE_END();
+
+protected:
+
+    stx::BasicSymbolTable	bst;
+
+public:
+
+    void setUp()
+    {
+	bst.setVariable("a", 42);
+	bst.setVariable("b", 2.5);
+	bst.setVariable("s", "abc");
+	bst.setVariable("l", 1234567890123LL);
+	bst.setVariable("t", true);
+    }
+
+protected:
+
+    /// Evaluate the expression using both the tree and the compiled program
+    /// and check that they return exactly the same value.
+    void compare(const std::string &str)
+    {
+	stx::ParseTree pt = stx::parseExpression(str);
+	stx::ParseProgram pp = pt.compile();
+
+	stx::AnyScalar vt = pt.evaluate(bst);
+	stx::AnyScalar vp = pp.evaluate(bst);
+
+	CPPUNIT_ASSERT( vt.getType() == vp.getType() );
+	CPPUNIT_ASSERT( vt == vp );
+
+	// evaluate a second time to test reuse of the stack
+	CPPUNIT_ASSERT( pp.evaluate(bst) == vt );
+    }
+
+    void test_compare()
+    {
+	compare("5 + 4.5");
+	compare("a * 2 + 4");
+	compare("(a * 2 + 4) / 2 == 44");
+	compare("(a ^ 2 + 4) / 2 == 884");
+	compare("-a + 4.5 + (-b)");
+	compare("(integer)(a * b)");
+	compare("(short)(a) + (char)(3)");
+	compare("(string)(a) + s");
+	compare("s + \"def\" == \"abcdef\"");
+	compare("l * 2 > a");
+	compare("l / a");
+	compare("a > 10 AND b <= 42.2 OR s == \"x\"");
+	compare("!(t AND a < 0) || (not t OR a < 0)");
+	compare("(0 < a) && (4 > b) && (a = 42) && (a != 4) && (a <= 42) && (a >= 1) && (b =< 3) && (a => 1)");
+	compare("logn(exp(a)) + sqrt(pow(a,2)) == 84");
+	compare("sin(b) * cos(b) + tan(a) - abs(-a)");
+	compare("pi() * b ^ 2");
+	compare("sqrt(a*a + b*b) > 10");
+	compare("+a");
+    }
+
+    void test_exceptions()
+    {
+	stx::ParseProgram pp;
+
+	pp = stx::parseExpression("5 + xyz").compile();
+	CPPUNIT_ASSERT_THROW( pp.evaluate(bst), stx::UnknownSymbolException );
+
+	pp = stx::parseExpression("5 + FUNCXYZ(a)").compile();
+	CPPUNIT_ASSERT_THROW( pp.evaluate(bst), stx::UnknownSymbolException );
+
+	pp = stx::parseExpression("5 + COS(a,2)").compile();
+	CPPUNIT_ASSERT_THROW( pp.evaluate(bst), stx::BadFunctionCallException );
+
+	pp = stx::parseExpression("a / (a - 42)").compile();
+	CPPUNIT_ASSERT_THROW( pp.evaluate(bst), stx::ArithmeticException );
+
+	pp = stx::parseExpression("a AND t").compile();
+	CPPUNIT_ASSERT_THROW( pp.evaluate(bst), stx::BadSyntaxException );
+
+	// the program is reusable after an exception
+	pp = stx::parseExpression("a / (a - 41)").compile();
+	CPPUNIT_ASSERT( pp.evaluate(bst) == 42 );
+    }
+
+    void test_copy()
+    {
+	stx::ParseProgram pp1 = stx::parseExpression("a * 2 + b").compile();
+	stx::ParseProgram pp2 = pp1;
+
+	CPPUNIT_ASSERT( !pp2.isEmpty() );
+	CPPUNIT_ASSERT( &pp1.getCode() == &pp2.getCode() );
+	CPPUNIT_ASSERT( pp1.getCode().size() == 5 );
+	CPPUNIT_ASSERT( pp1.evaluate(bst) == pp2.evaluate(bst) );
+	CPPUNIT_ASSERT( pp1.toString() == pp2.toString() );
+    }
+
+    void test_bind()
+    {
+	stx::ParseProgram::slotmap_type schema;
+	schema["x"] = 2;
+	schema["y"] = 0;
+
+	stx::ParseProgram pp1 = stx::parseExpression("x * 2 + y + a + x").compile();
+	stx::ParseProgram pp2 = pp1;
+
+	CPPUNIT_ASSERT( pp1.bindVariables(schema) == 3 );
+
+	CPPUNIT_ASSERT( pp1.getBoundSlots().size() == 2 );
+	CPPUNIT_ASSERT( pp1.getBoundSlots()[0] == 0 );
+	CPPUNIT_ASSERT( pp1.getBoundSlots()[1] == 2 );
+
+	stx::AnyScalar slots[3];
+	slots[0] = 5;
+	slots[2] = 1.5;
+
+	// x and y from the slots, a from the symbol table
+	CPPUNIT_ASSERT( pp1.evaluate(slots, bst) == 51.5 );
+
+	// without slots all variables are looked up
+	bst.setVariable("x", 10);
+	bst.setVariable("y", 100);
+
+	CPPUNIT_ASSERT( pp1.evaluate(bst) == 172 );
+
+	// the copy was not bound
+	CPPUNIT_ASSERT( pp2.getBoundSlots().size() == 0 );
+	CPPUNIT_ASSERT( pp2.evaluate(slots, bst) == 172 );
+
+	// rebind with a different schema
+	schema.erase("x");
+	CPPUNIT_ASSERT( pp1.bindVariables(schema) == 1 );
+	CPPUNIT_ASSERT( pp1.getBoundSlots().size() == 1 );
+	CPPUNIT_ASSERT( pp1.evaluate(slots, bst) == 77 );
+
+	// variables missing in the schema and the symbol table still throw
+	pp1 = stx::parseExpression("y + z").compile();
+	pp1.bindVariables(schema);
+	CPPUNIT_ASSERT_THROW( pp1.evaluate(slots, bst), stx::UnknownSymbolException );
+    }
+
+    void test_functions()
+    {
+	bst.setFunction<double(double,double)>("HYPOT2", hypot2);
+	bst.setFunction<int(const std::string&,int)>("COUNTCHARS", countchars);
+	bst.setFunction<bool(long long)>("ISEVEN", iseven);
+
+	const char *exprs[] = {
+	    "sqrt(a*a + b*b) > 10",
+	    "hypot2(a, b) + pi() + abs(-b)",
+	    "countchars(s + \"aaa\", 97) == 4",
+	    "iseven(l) AND NOT iseven(a + 1)",
+	    "pow(2, 10) + logn(exp(1)) + sin(0) + cos(0) + tan(0)",
+	    NULL
+	};
+
+	for(unsigned int i = 0; exprs[i]; ++i)
+	{
+	    stx::ParseTree pt = stx::parseExpression(exprs[i]);
+	    stx::ParseProgram pp = pt.compile();
+
+	    pp.bindFunctions(bst);
+
+	    stx::AnyScalar vt = pt.evaluate(bst);
+	    stx::AnyScalar vp = pp.evaluate(bst);
+
+	    CPPUNIT_ASSERT( vt.getType() == vp.getType() );
+	    CPPUNIT_ASSERT( vt == vp );
+	    CPPUNIT_ASSERT( pp.evaluate(bst) == vt );
+	}
+
+	CPPUNIT_ASSERT( stx::parseExpression("hypot2(a, b)").evaluate(bst) == 1770.25 );
+
+	// all calls are bound, the typed ones are called natively
+	stx::ParseProgram pp = stx::parseExpression("sqrt(hypot2(a, b)) + abs(b)").compile();
+	CPPUNIT_ASSERT( pp.bindFunctions(bst) == 3 );
+	CPPUNIT_ASSERT( pp.getCode()[2].opcode == stx::ParseProgram::OP_CALL_NATIVE );
+	CPPUNIT_ASSERT( pp.getCode()[3].opcode == stx::ParseProgram::OP_CALL_NATIVE );
+	CPPUNIT_ASSERT( pp.getCode()[5].opcode == stx::ParseProgram::OP_CALL_FUNC );
+
+	// the number of parameters is checked at bind time
+	pp = stx::parseExpression("hypot2(a) + 1").compile();
+	CPPUNIT_ASSERT_THROW( pp.bindFunctions(bst), stx::BadFunctionCallException );
+
+	pp = stx::parseExpression("pi(a)").compile();
+	CPPUNIT_ASSERT_THROW( pp.bindFunctions(bst), stx::BadFunctionCallException );
+
+	// unknown functions are still called and fail during evaluation
+	pp = stx::parseExpression("funcxyz(a) + 1").compile();
+	CPPUNIT_ASSERT( pp.bindFunctions(bst) == 0 );
+	CPPUNIT_ASSERT_THROW( pp.evaluate(bst), stx::UnknownSymbolException );
+
+	// conversion errors of native arguments are reported as usual
+	pp = stx::parseExpression("sqrt(s)").compile();
+	pp.bindFunctions(bst);
+	CPPUNIT_ASSERT_THROW( pp.evaluate(bst), stx::ConversionException );
+    }
+
+    void test_shortcircuit()
+    {
+	// the right operand is not evaluated if the left one decides
+	const char *exprs[] = {
+	    "a < 0 AND xyz > 1",
+	    "a > 0 OR xyz > 1",
+	    "a < 0 AND 5 + s",
+	    "(a < 0 AND xyz) OR (t AND (b > 2 OR funcxyz(a)))",
+	    "a > 0 AND b > 0 AND t AND s == \"abc\"",
+	    "a < 0 OR b < 0 OR not t OR s == \"abc\"",
+	    // partially constant chains are folded to the variable operand
+	    "t OR FALSE",
+	    "not t OR FALSE",
+	    "a > 1 AND TRUE",
+	    NULL
+	};
+
+	for(unsigned int i = 0; exprs[i]; ++i)
+	    compare(exprs[i]);
+
+	CPPUNIT_ASSERT( stx::parseExpression("a > 0 OR xyz > 1").evaluate(bst) == true );
+	CPPUNIT_ASSERT( stx::parseExpression("t OR FALSE").toString() == "t" );
+	CPPUNIT_ASSERT( stx::parseExpression("a > 1 AND FALSE").toString() == "false" );
+
+	// but evaluated if required
+	stx::ParseProgram pp = stx::parseExpression("a > 0 AND xyz > 1").compile();
+	CPPUNIT_ASSERT_THROW( pp.evaluate(bst), stx::UnknownSymbolException );
+
+	pp = stx::parseExpression("a > 0 AND b").compile();
+	CPPUNIT_ASSERT_THROW( pp.evaluate(bst), stx::BadSyntaxException );
+
+	pp = stx::parseExpression("a < 0 OR s").compile();
+	CPPUNIT_ASSERT_THROW( pp.evaluate(bst), stx::BadSyntaxException );
+    }
+
+    void test_adaptive()
+    {
+	bst.setFunction<bool(int)>("SLOWCHECK", slowcheck);
+
+	stx::ParseProgram pp = stx::parseExpression("slowcheck(a) AND b > 100 AND t").compile();
+	CPPUNIT_ASSERT( pp.getChain() == stx::ParseProgram::CHAIN_AND );
+	CPPUNIT_ASSERT( !pp.isAdaptive() );
+
+	pp.setAdaptive(100);
+	CPPUNIT_ASSERT( pp.isAdaptive() );
+
+	slowcalls = 0;
+	for(unsigned int i = 0; i < 1000; ++i)
+	    CPPUNIT_ASSERT( pp.evaluate(bst) == false );
+
+	// after the first reordering b > 100 decides the chain first
+	CPPUNIT_ASSERT( slowcalls <= 100 );
+
+	std::vector<stx::ParseProgram::OperandStats> stats = pp.getChainStats();
+	CPPUNIT_ASSERT( stats.size() == 3 );
+	CPPUNIT_ASSERT( stats[0].expression == "slowcheck(a)" );
+	CPPUNIT_ASSERT( stats[0].evaluations == slowcalls );
+	CPPUNIT_ASSERT( stats[0].decisions == 0 );
+	CPPUNIT_ASSERT( stats[1].expression == "(b > 100)" );
+	CPPUNIT_ASSERT( stats[1].position == 0 );
+	CPPUNIT_ASSERT( stats[1].evaluations == 1000 );
+	CPPUNIT_ASSERT( stats[1].decisions == 1000 );
+
+	// OR chains are decided by true operands
+	pp = stx::parseExpression("a < 0 OR (b < 0 OR s == \"abc\")").compile();
+	CPPUNIT_ASSERT( pp.getChain() == stx::ParseProgram::CHAIN_OR );
+	pp.setAdaptive(100);
+
+	for(unsigned int i = 0; i < 2000; ++i)
+	    CPPUNIT_ASSERT( pp.evaluate(bst) == true );
+
+	stats = pp.getChainStats();
+	CPPUNIT_ASSERT( stats.size() == 3 );
+	CPPUNIT_ASSERT( stats[2].position == 0 );
+	CPPUNIT_ASSERT( stats[2].decisions == 2000 );
+
+	// a throwing operand is counted and not moved to the front
+	pp = stx::parseExpression("b > x OR s == 5").compile();
+	pp.setAdaptive(100);
+
+	unsigned int exceptions = 0;
+	for(unsigned int i = 0; i < 2000; ++i)
+	{
+	    bst.setVariable("x", (i % 2 == 0) ? 0 : 100);
+
+	    try {
+		CPPUNIT_ASSERT( pp.evaluate(bst) == true );
+	    }
+	    catch (stx::ExpressionParserException &) {
+		++exceptions;
+	    }
+	}
+
+	CPPUNIT_ASSERT( exceptions == 1000 );
+
+	stats = pp.getChainStats();
+	CPPUNIT_ASSERT( stats.size() == 2 );
+	CPPUNIT_ASSERT( stats[1].position == 1 );
+	CPPUNIT_ASSERT( stats[1].evaluations == 1000 );
+	CPPUNIT_ASSERT( stats[1].decisions == 0 );
+
+	// programs without root chain evaluate normally
+	pp = stx::parseExpression("a + 1").compile();
+	pp.setAdaptive(10);
+	CPPUNIT_ASSERT( !pp.isAdaptive() );
+	CPPUNIT_ASSERT( pp.evaluate(bst) == 43 );
+	CPPUNIT_ASSERT( pp.getChainStats().size() == 0 );
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION( ParseProgramTest );